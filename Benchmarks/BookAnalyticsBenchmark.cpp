@@ -0,0 +1,88 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "MarketDataSnapshot.h"
+
+#include <iomanip>
+
+/* Чтение показателей стакана(get_analytics) против их подсчёта заново по срезу, как делал бы код сигналов без них:
+ * лучшие уровни, перевес, microprice и средние цены сторон. Стакан растёт в 10 раз: от 1K до max заявок.
+ *
+ * Использование: BookAnalyticsBenchmark [максимальное количество заявок]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	template<typename FunctionT>
+	double measure_ns(size_t repetitions, FunctionT &&function)
+	{
+		auto const start = clock_type::now();
+		for (size_t repetition = 0; repetition < repetitions; ++repetition)
+			function();
+		return std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / repetitions;
+	}
+
+	// \brief Microprice и средняя цена Ask.
+	std::pair<price_t, price_t> recompute_analytics(OrderBook const &book)
+	{
+		auto const snapshot = book.get_flat_snapshot();
+		std::array<price_t, Order::Type::_EnumElementsCount> best_price{};
+		std::array<quantity_t, Order::Type::_EnumElementsCount> best_quantity{};
+		std::array<double, Order::Type::_EnumElementsCount> notional{};
+		std::array<quantity_t, Order::Type::_EnumElementsCount> total_quantity{};
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const &records = snapshot.GetOrders()[type];
+			if (records.empty())
+				continue;
+			best_price[type] = type == Order::Type::Ask ? records.front().price : records.back().price;
+			for (auto const &record : records)
+			{
+				if (record.price == best_price[type])
+					best_quantity[type] += record.quantity;
+				notional[type] += record.price * record.quantity;
+				total_quantity[type] += record.quantity;
+			}
+		}
+		auto const ask = static_cast<double>(best_quantity[Order::Type::Ask]);
+		auto const bid = static_cast<double>(best_quantity[Order::Type::Bid]);
+		return {
+			(best_price[Order::Type::Bid] * ask + best_price[Order::Type::Ask] * bid) / (ask + bid),
+			notional[Order::Type::Ask] / total_quantity[Order::Type::Ask]
+		};
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const max_orders_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+	std::cout << std::setw(10) << "orders" << std::setw(22) << "get_analytics, ns" << std::setw(22) << "from snapshot, ns" << std::endl;
+	for (size_t orders_count = 1000; orders_count <= max_orders_count; orders_count *= 10)
+	{
+		OrderBook book;
+		// Цены Ask и Bid не пересекаются, так что все заявки остаются в стакане.
+		for (size_t i = 0; i < orders_count; ++i)
+			book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 20000 : 0) + i % 10000, 1 + i % 100));
+		// IOC исполняется после всех поставленных раньше заявок: дожидаемся сведения.
+		book.execute(std::make_unique<Order>(Order::Type::Bid, 15000, 1, Order::TimeInForce::ImmediateOrCancel));
+
+		volatile price_t sink = 0;
+		auto const analytics_ns = measure_ns(1000000, [&]
+		{
+			auto const analytics = book.get_analytics();
+			sink = analytics.microprice + analytics.vwap[Order::Type::Ask];
+		});
+		auto const recomputation_ns = measure_ns((std::max)(size_t(1), 10000000 / orders_count), [&]
+		{
+			auto const analytics = recompute_analytics(book);
+			sink = analytics.first + analytics.second;
+		});
+		std::cout << std::setw(10) << orders_count << std::fixed << std::setprecision(1)
+			<< std::setw(22) << analytics_ns << std::setw(22) << recomputation_ns << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+
+#include <iomanip>
+
+/* Поток заявок, большую часть которых отменяют: на каждую заявку, которая остаётся в стакане или исполняется,
+ * приходится cancel_ratio отменённых. Меряем среднее время отмены заявки стакана в вызывающем потоке
+ * и пропускную способность всего потока, включая сведение встречных заявок.
+ *
+ * Использование: CancelHeavyBenchmark [количество заявок] [отменённых на одну оставшуюся]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const orders_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	size_t const cancel_ratio = argc > 2 ? std::stoul(argv[2]) : 19;
+	size_t const batch_size = 1000;
+
+	OrderBook book;
+	// Глубокий стакан, в котором отменяют.
+	for (size_t i = 0; i < 100000; ++i)
+		book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, i % 2 ? 100 + i % 500 : 99 - i % 500, 1 + i % 10));
+
+	clock_type::duration cancels_duration{};
+	size_t cancels_count = 0;
+	auto const start = clock_type::now();
+	std::vector<order_id_t> batch;
+	batch.reserve(batch_size);
+	for (size_t posted = 0; posted < orders_count;)
+	{
+		batch.clear();
+		for (size_t i = 0; i < batch_size; ++i, ++posted)
+		{
+			auto const type = posted % 2 ? Order::Type::Ask : Order::Type::Bid;
+			// Каждая cancel_ratio + 1 заявка пересекает лучшую цену встречной стороны и исполняется.
+			auto const is_crossing = posted % (cancel_ratio + 1) == 0;
+			auto const price = type == Order::Type::Ask ? (is_crossing ? 99 : 100 + posted % 50) : (is_crossing ? 100 : 99 - posted % 50);
+			auto const id = book.post(std::make_unique<Order>(type, price, 1));
+			if (is_crossing == false)
+				batch.emplace_back(id);
+		}
+		// IOC сводится после всех заявок до него: отменяем то, что уже в стакане.
+		book.execute(std::make_unique<Order>(Order::Type::Bid, 0.5, 1, Order::TimeInForce::ImmediateOrCancel));
+
+		auto const cancels_start = clock_type::now();
+		for (auto const &id : batch)
+			book.cancel(id);
+		cancels_duration += clock_type::now() - cancels_start;
+		cancels_count += batch.size();
+	}
+	auto const seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+	std::cout << "orders: " << orders_count << ", cancelled: " << cancels_count << std::endl;
+	std::cout << std::fixed << std::setprecision(1)
+		<< "cancel, ns:  " << std::chrono::duration<double, std::nano>(cancels_duration).count() / cancels_count << std::endl
+		<< "orders/s:    " << std::setprecision(0) << orders_count / seconds << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "MarketDataSnapshot.h"
+#include "tracing.h"
+
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+
+/* Пропускная способность и хвосты задержек операций стакана под конкуренцией потоков.
+ * Потоки четырёх ролей: постановка(post, часть заявок - IOC через execute), отмена, запрос данных заявки(get_data) и срез.
+ * Прогон повторяется с числом потоков каждой роли, умноженным на 1, 2, 4, ... до --max-scale, так что видно,
+ * как операции масштабируются и где начинают мешать друг другу блокировки.
+ * Отменяются и запрашиваются случайные id из последних поставленных: id выдаются подряд, так что общая очередь id не нужна.
+ *
+ * Использование: ConcurrencyScalingBenchmark [--опция=значение ...]
+ *	--posters, --cancellers, --lookups, --snapshotters	потоков каждой роли при масштабе 1(по умолчанию 1, 1, 1, 1)
+ *	--max-scale		наибольший множитель числа потоков(8)
+ *	--seconds		секунд на прогон(2)
+ *	--ioc-share		доля постановок, исполняемых немедленно(0.1)
+ *	--prices		распределение цен: uniform или normal(uniform)
+ *	--price-levels	ширина распределения цен в шагах по каждую сторону(100)
+ *	--policy		политика блокировок: shared_mutex или spinlock(shared_mutex)
+ *	--trace			файл, в который выгрузить трассировку сведения в формате Chrome trace. Нужна сборка с ORDER_BOOK_TRACING.
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	struct Options
+	{
+		size_t posters = 1;
+		size_t cancellers = 1;
+		size_t lookups = 1;
+		size_t snapshotters = 1;
+		size_t max_scale = 8;
+		size_t seconds = 2;
+		double ioc_share = 0.1;
+		std::string prices = "uniform";
+		size_t price_levels = 100;
+		std::string policy = "shared_mutex";
+		std::string trace;
+	};
+
+	Options parse_options(int argc, char *argv[])
+	{
+		Options options;
+		std::map<std::string, std::function<void(std::string const &)>> const setters{
+			{ "--posters", [&](std::string const &value) { options.posters = std::stoul(value); } },
+			{ "--cancellers", [&](std::string const &value) { options.cancellers = std::stoul(value); } },
+			{ "--lookups", [&](std::string const &value) { options.lookups = std::stoul(value); } },
+			{ "--snapshotters", [&](std::string const &value) { options.snapshotters = std::stoul(value); } },
+			{ "--max-scale", [&](std::string const &value) { options.max_scale = (std::max)(std::stoul(value), 1ul); } },
+			{ "--seconds", [&](std::string const &value) { options.seconds = std::stoul(value); } },
+			{ "--ioc-share", [&](std::string const &value) { options.ioc_share = std::stod(value); } },
+			{ "--prices", [&](std::string const &value) { options.prices = value; } },
+			{ "--price-levels", [&](std::string const &value) { options.price_levels = (std::max)(std::stoul(value), 1ul); } },
+			{ "--policy", [&](std::string const &value) { options.policy = value; } },
+			{ "--trace", [&](std::string const &value) { options.trace = value; } },
+		};
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string const argument = argv[i];
+			auto const separator = argument.find('=');
+			auto const setter = setters.find(argument.substr(0, separator));
+			if (separator == std::string::npos || setter == setters.end())
+				throw std::invalid_argument("Unknown option: " + argument);
+			setter->second(argument.substr(separator + 1));
+		}
+		if (options.prices != "uniform" && options.prices != "normal")
+			throw std::invalid_argument("Unknown prices distribution: " + options.prices);
+		return options;
+	}
+
+	/**
+	 * \brief Задержки операций одного потока.
+	 */
+	struct Latencies
+	{
+		std::vector<double> microseconds;
+
+		template<typename OperationT>
+		void measure(OperationT &&operation)
+		{
+			auto const start = clock_type::now();
+			operation();
+			microseconds.emplace_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+		}
+	};
+
+	/**
+	 * \brief Цены постановок: Ask выше середины, Bid ниже, так что без IOC заявки не пересекаются и остаются в стакане.
+	 */
+	class PricesGenerator
+	{
+	public:
+		PricesGenerator(Options const &options, unsigned seed)
+			: _is_normal(options.prices == "normal")
+			, _levels(options.price_levels)
+			, _random(seed)
+			, _uniform(0, options.price_levels - 1)
+			, _normal(0., options.price_levels / 3.)
+		{
+		}
+
+		price_t resting(Order::Type type)
+		{
+			auto const distance = 1 + _offset();
+			return type == Order::Type::Ask ? _middle + distance : _middle - distance;
+		}
+		// \brief Цена IOC, пересекающая всю сторону стакана.
+		price_t crossing(Order::Type type) const
+		{
+			return type == Order::Type::Ask ? _middle - _levels - 1. : _middle + _levels + 1.;
+		}
+		std::mt19937_64 &random()
+		{
+			return _random;
+		}
+
+	private:
+		price_t _offset()
+		{
+			if (_is_normal == false)
+				return static_cast<price_t>(_uniform(_random));
+			return (std::min)(std::round(std::abs(_normal(_random))), static_cast<price_t>(_levels - 1));
+		}
+
+		price_t const _middle = 100000;
+		bool const _is_normal;
+		size_t const _levels;
+		std::mt19937_64 _random;
+		std::uniform_int_distribution<size_t> _uniform;
+		std::normal_distribution<double> _normal;
+	};
+
+	double percentile(std::vector<double> const &sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0;
+		return sorted[(std::min)(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+	}
+
+	struct Role
+	{
+		char const *name;
+		size_t threads_count;
+		std::vector<Latencies> latencies;
+	};
+
+	template<typename LockPolicyT>
+	void run(Options const &options, size_t scale)
+	{
+		BasicOrderBook<LockPolicyT> book;
+		// id последней поставленной заявки, чтобы отменять и запрашивать существующие.
+		std::atomic<uint64_t> last_order_id{ 0 };
+		std::atomic<bool> is_stopped{ false };
+
+		std::array<Role, 4> roles{ {
+			{ "post", options.posters * scale, {} },
+			{ "cancel", options.cancellers * scale, {} },
+			{ "get_data", options.lookups * scale, {} },
+			{ "get_snapshot", options.snapshotters * scale, {} },
+		} };
+		for (auto &role : roles)
+			role.latencies.resize(role.threads_count);
+
+		auto const random_recent_id = [&last_order_id](std::mt19937_64 &random)
+		{
+			auto const last_id = last_order_id.load(std::memory_order_relaxed);
+			auto const window = (std::min)(last_id, uint64_t(1024));
+			return order_id_t(last_id - std::uniform_int_distribution<uint64_t>(0, window)(random));
+		};
+
+		std::vector<std::function<void()>> workers;
+		for (size_t thread = 0; thread < roles[0].threads_count; ++thread)
+			workers.emplace_back([&, thread]
+			{
+				PricesGenerator prices(options, static_cast<unsigned>(thread));
+				std::bernoulli_distribution is_ioc(options.ioc_share);
+				auto &latencies = roles[0].latencies[thread];
+				for (size_t i = 0; is_stopped == false; ++i)
+				{
+					auto const type = i % 2 ? Order::Type::Ask : Order::Type::Bid;
+					if (is_ioc(prices.random()))
+					{
+						latencies.measure([&] { book.execute(std::make_unique<Order>(type, prices.crossing(type), 1 + i % 10, Order::TimeInForce::ImmediateOrCancel)); });
+						continue;
+					}
+					latencies.measure([&]
+					{
+						auto const id = book.post(std::make_unique<Order>(type, prices.resting(type), 1 + i % 100));
+						auto const id_value = id.template convert_to<uint64_t>();
+						auto last_id = last_order_id.load(std::memory_order_relaxed);
+						while (last_id < id_value && last_order_id.compare_exchange_weak(last_id, id_value, std::memory_order_relaxed) == false);
+					});
+				}
+			});
+		for (size_t thread = 0; thread < roles[1].threads_count; ++thread)
+			workers.emplace_back([&, thread]
+			{
+				std::mt19937_64 random(1000 + thread);
+				auto &latencies = roles[1].latencies[thread];
+				while (is_stopped == false)
+				{
+					auto const id = random_recent_id(random);
+					latencies.measure([&] { book.cancel(id); });
+				}
+			});
+		for (size_t thread = 0; thread < roles[2].threads_count; ++thread)
+			workers.emplace_back([&, thread]
+			{
+				std::mt19937_64 random(2000 + thread);
+				auto &latencies = roles[2].latencies[thread];
+				while (is_stopped == false)
+				{
+					auto const id = random_recent_id(random);
+					latencies.measure([&] { try { book.get_data(id); } catch (std::logic_error const &) {} });
+				}
+			});
+		for (size_t thread = 0; thread < roles[3].threads_count; ++thread)
+			workers.emplace_back([&, thread]
+			{
+				auto &latencies = roles[3].latencies[thread];
+				while (is_stopped == false)
+					latencies.measure([&] { book.get_snapshot(); });
+			});
+
+		clock_type::duration elapsed;
+		{
+			std::vector<boost::scoped_thread<boost::join_if_joinable>> threads;
+			for (auto &worker : workers)
+				threads.emplace_back(boost::thread(worker));
+
+			auto const start = clock_type::now();
+			boost::this_thread::sleep_for(boost::chrono::seconds(options.seconds));
+			is_stopped = true;
+			threads.clear();
+			elapsed = clock_type::now() - start;
+		}
+		auto const seconds = std::chrono::duration<double>(elapsed).count();
+
+		for (auto &role : roles)
+		{
+			std::vector<double> latencies;
+			for (auto &thread_latencies : role.latencies)
+				latencies.insert(latencies.end(), thread_latencies.microseconds.begin(), thread_latencies.microseconds.end());
+			std::sort(latencies.begin(), latencies.end());
+
+			std::cout << std::setw(6) << scale << std::setw(14) << role.name << std::setw(9) << role.threads_count
+				<< std::fixed << std::setprecision(0) << std::setw(14) << latencies.size() / seconds
+				<< std::setprecision(1) << std::setw(12) << percentile(latencies, 0.5)
+				<< std::setw(12) << percentile(latencies, 0.99)
+				<< std::setw(12) << percentile(latencies, 0.999)
+				<< std::setw(12) << (latencies.empty() ? 0. : latencies.back()) << std::endl;
+		}
+	}
+
+	template<typename LockPolicyT>
+	void run_scaling(Options const &options)
+	{
+		std::cout << std::setw(6) << "scale" << std::setw(14) << "operation" << std::setw(9) << "threads"
+			<< std::setw(14) << "ops/s" << std::setw(12) << "p50, us" << std::setw(12) << "p99, us"
+			<< std::setw(12) << "p99.9, us" << std::setw(12) << "max, us" << std::endl;
+		for (size_t scale = 1; scale <= options.max_scale; scale *= 2)
+			run<LockPolicyT>(options, scale);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		auto const options = parse_options(argc, argv);
+		std::cout << "policy: " << options.policy << ", prices: " << options.prices << " over " << options.price_levels << " levels"
+			<< ", IOC share: " << options.ioc_share << ", hardware threads: " << boost::thread::hardware_concurrency() << std::endl;
+
+		if (options.policy == "shared_mutex")
+			run_scaling<lock_policy::SharedMutex>(options);
+		else if (options.policy == "spinlock")
+			run_scaling<lock_policy::SharedSpinLock>(options);
+		else
+			throw std::invalid_argument("Unknown lock policy: " + options.policy);
+
+		if (options.trace.empty() == false)
+		{
+			std::ofstream trace(options.trace);
+			tools::tracing::export_chrome_trace(trace);
+		}
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "MarketDataSnapshot.h"
+
+#include <iomanip>
+
+/* Сравнение политик блокировок стакана на нагрузке deadlock тестов:
+ * два потока ставят заявки(встречные заявки одного уровня, так что сведения много), два запрашивают данные заявки, два - срез.
+ * Для lock_policy::NullLock та же смесь операций исполняется в одном потоке: только так им и можно пользоваться.
+ *
+ * Использование: LockPolicyBenchmark [секунд на политику]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	struct Counters
+	{
+		std::atomic<size_t> posts{ 0 };
+		std::atomic<size_t> lookups{ 0 };
+		std::atomic<size_t> snapshots{ 0 };
+	};
+
+	auto constexpr max_quantity = 3000;
+
+	template<typename BookT>
+	void post_orders(BookT &book, size_t i, Counters &counters)
+	{
+		auto const quantity = i % max_quantity;
+		book.post(std::make_unique<Order>(Order::Type::Ask, 4, max_quantity - quantity));
+		book.post(std::make_unique<Order>(Order::Type::Bid, 4, quantity + 1));
+		counters.posts += 2;
+	}
+	template<typename BookT>
+	void get_data(BookT &book, Counters &counters)
+	{
+		try { book.get_data(1); }
+		catch (std::exception const &) {}
+		++counters.lookups;
+	}
+	template<typename BookT>
+	void get_snapshot(BookT &book, Counters &counters)
+	{
+		auto snapshot = book.get_snapshot();
+		++counters.snapshots;
+	}
+
+	void report(char const *policy, Counters const &counters, double seconds)
+	{
+		std::cout << std::left << std::setw(16) << policy << std::right << std::fixed << std::setprecision(0)
+			<< std::setw(16) << counters.posts / seconds
+			<< std::setw(16) << counters.lookups / seconds
+			<< std::setw(16) << counters.snapshots / seconds << std::endl;
+	}
+
+	template<typename LockPolicyT>
+	void measure_concurrent(char const *policy, std::chrono::seconds duration)
+	{
+		Counters counters;
+		clock_type::duration elapsed;
+		{
+			BasicOrderBook<LockPolicyT> book;
+			std::atomic<bool> is_stopped{ false };
+			{
+				std::vector<boost::scoped_thread<boost::join_if_joinable>> threads;
+				for (size_t poster = 0; poster < 2; ++poster)
+					threads.emplace_back(boost::thread([&] { for (size_t i = 0; is_stopped == false; ++i) post_orders(book, i, counters); }));
+				for (size_t looker = 0; looker < 2; ++looker)
+					threads.emplace_back(boost::thread([&] { while (is_stopped == false) get_data(book, counters); }));
+				for (size_t snapshotter = 0; snapshotter < 2; ++snapshotter)
+					threads.emplace_back(boost::thread([&] { while (is_stopped == false) get_snapshot(book, counters); }));
+
+				auto const start = clock_type::now();
+				boost::this_thread::sleep_for(boost::chrono::seconds(duration.count()));
+				is_stopped = true;
+				threads.clear();
+				elapsed = clock_type::now() - start;
+			}
+		}
+		report(policy, counters, std::chrono::duration<double>(elapsed).count());
+	}
+
+	void measure_thread_confined(std::chrono::seconds duration)
+	{
+		Counters counters;
+		BasicOrderBook<lock_policy::NullLock> book;
+
+		auto const start = clock_type::now();
+		auto const deadline = start + duration;
+		for (size_t i = 0; clock_type::now() < deadline; ++i)
+		{
+			post_orders(book, i, counters);
+			get_data(book, counters);
+			get_data(book, counters);
+			// Срез на порядки дороже остальных операций, так что снимаем его пореже, как и выходит у потоков выше.
+			if (i % 1024 == 0)
+				get_snapshot(book, counters);
+		}
+		report("NullLock", counters, std::chrono::duration<double>(clock_type::now() - start).count());
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	auto const duration = std::chrono::seconds(argc > 1 ? std::stoul(argv[1]) : 5);
+
+	std::cout << std::left << std::setw(16) << "ops per second"
+		<< std::right << std::setw(16) << "post" << std::setw(16) << "get_data" << std::setw(16) << "get_snapshot" << std::endl;
+
+	measure_concurrent<lock_policy::SharedMutex>("SharedMutex", duration);
+	measure_concurrent<lock_policy::SharedSpinLock>("SharedSpinLock", duration);
+	measure_thread_confined(duration);
+
+	return 0;
+}
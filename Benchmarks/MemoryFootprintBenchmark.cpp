@@ -0,0 +1,75 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+
+#include <iomanip>
+#include <thread>
+
+/* Память стакана по составляющим(memory_usage) и байт на заявку при росте стакана в 10 раз: от 1K до max заявок.
+ * Стакан однопоточный(lock_policy::NullLock): раскладка памяти та же, а заполняется он без потока сведения.
+ * Если задано расстояние заморозки, то стакан обычный, с enable_cold_tiering, и память меряется после того, как уровни
+ * дальше этого расстояния от лучшей цены заморожены.
+ * Результат печатается CSV, чтобы его можно было сохранять и сравнивать между версиями.
+ *
+ * Использование: MemoryFootprintBenchmark [максимальное количество заявок] [расстояние заморозки]
+ */
+
+namespace
+{
+	// Цены Ask и Bid не пересекаются, так что все заявки остаются в стакане.
+	template<typename BookT>
+	void fill(BookT &book, size_t orders_count)
+	{
+		for (size_t i = 0; i < orders_count; ++i)
+			book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 20000 : 0) + i % 10000, 1 + i % 100));
+	}
+
+	MemoryUsage cold_tiered_memory_usage(size_t orders_count, price_t cold_level_distance)
+	{
+		OrderBook book;
+		book.enable_cold_tiering(cold_level_distance, std::chrono::milliseconds(10));
+		fill(book, orders_count);
+		// IOC сводится после всех заявок до него, а заморозка идёт в том же потоке: ждём, пока память перестанет меняться.
+		book.execute(std::make_unique<Order>(Order::Type::Bid, 1, 1, Order::TimeInForce::ImmediateOrCancel));
+		auto usage = book.memory_usage();
+		while (true)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			auto const next_usage = book.memory_usage();
+			if (next_usage.total() == usage.total())
+				return next_usage;
+			usage = next_usage;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const max_orders_count = argc > 1 ? std::stoul(argv[1]) : 10000000;
+	boost::optional<price_t> const cold_level_distance = argc > 2 ? boost::make_optional(std::stod(argv[2])) : boost::none;
+
+	std::cout << "orders,index_buckets,index_nodes,order_payloads,pending_queue,cold_levels,total,bytes_per_order" << std::endl;
+	for (size_t orders_count = 1000; orders_count <= max_orders_count; orders_count *= 10)
+	{
+		MemoryUsage usage{};
+		if (cold_level_distance.is_initialized())
+			usage = cold_tiered_memory_usage(orders_count, *cold_level_distance);
+		else
+		{
+			BasicOrderBook<lock_policy::NullLock> book;
+			fill(book, orders_count);
+			usage = book.memory_usage();
+		}
+
+		std::cout << usage.orders_count
+			<< ',' << usage.index_buckets
+			<< ',' << usage.index_nodes
+			<< ',' << usage.order_payloads
+			<< ',' << usage.pending_queue
+			<< ',' << usage.cold_levels
+			<< ',' << usage.total()
+			<< ',' << std::fixed << std::setprecision(1) << usage.bytes_per_order() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "PriceLevel.h"
+
+#include <iomanip>
+#include <map>
+
+/* Сравнение хранения уровней цены в виде структуры массивов(PriceLevel) с текущим multi_index хранилищем стакана.
+ * Меряем то, что чаще всего делается с уровнем: подсчёт объёма уровня, исполнение уровня и агрегацию всех уровней для среза.
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	auto constexpr levels_count = 64;
+	auto constexpr orders_per_level = 4096;
+	auto constexpr repetitions = 50;
+
+	price_t level_price(size_t level)
+	{
+		return 100 + static_cast<price_t>(level);
+	}
+
+	template<typename FunctionT>
+	double measure_ns_per_order(FunctionT &&function)
+	{
+		auto const start = clock_type::now();
+		for (size_t repetition = 0; repetition < repetitions; ++repetition)
+			function();
+		auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+		return static_cast<double>(elapsed) / (repetitions * levels_count * orders_per_level);
+	}
+
+	void report(char const *operation, double multi_index_ns, double price_level_ns)
+	{
+		std::cout << std::left << std::setw(24) << operation
+			<< std::right << std::setw(14) << std::fixed << std::setprecision(3) << multi_index_ns
+			<< std::setw(14) << price_level_ns
+			<< std::setw(10) << std::setprecision(2) << multi_index_ns / price_level_ns << "x" << std::endl;
+	}
+
+	OrderBook::orders_book_t make_book()
+	{
+		OrderBook::orders_book_t book;
+		order_id_t id = 0;
+		for (size_t order = 0; order < orders_per_level; ++order)
+			for (size_t level = 0; level < levels_count; ++level)
+				book.emplace(++id, std::make_unique<Order>(Order::Type::Bid, level_price(level), 1 + (order % 100)));
+		return book;
+	}
+
+	std::vector<PriceLevel> make_levels()
+	{
+		std::vector<PriceLevel> levels(levels_count, PriceLevel(orders_per_level));
+		order_id_t id = 0;
+		PriceLevel::timestamp_t timestamp = 0;
+		for (size_t order = 0; order < orders_per_level; ++order)
+			for (size_t level = 0; level < levels_count; ++level)
+				levels[level].add(++id, 1 + (order % 100), ++timestamp);
+		return levels;
+	}
+}
+
+int main()
+{
+	std::cout << "levels: " << levels_count << ", orders per level: " << orders_per_level << std::endl;
+#if defined(__AVX2__)
+	std::cout << "simd: AVX2" << std::endl;
+#elif defined(__SSE2__) || defined(_M_X64)
+	std::cout << "simd: SSE2" << std::endl;
+#else
+	std::cout << "simd: scalar" << std::endl;
+#endif
+	std::cout << std::left << std::setw(24) << "ns per order"
+		<< std::right << std::setw(14) << "multi_index" << std::setw(14) << "PriceLevel" << std::setw(11) << "speedup" << std::endl;
+
+	auto const book = make_book();
+	auto const levels = make_levels();
+	auto const &book_by_priority = book.get<OrdersByPriority>();
+	auto const bid_level_key = [](size_t level) { return boost::make_tuple(Order::Type::Bid, OrderData::GetPriorityPrice(Order::Type::Bid, level_price(level))); };
+
+	// Объём каждого уровня.
+	volatile quantity_t sink = 0;
+	report(
+		"level totals",
+		measure_ns_per_order([&] {
+			for (size_t level = 0; level < levels_count; ++level)
+			{
+				auto const range = book_by_priority.equal_range(bid_level_key(level));
+				quantity_t total = 0;
+				for (auto iter = range.first; iter != range.second; ++iter)
+					total += iter->GetQuantity();
+				sink = sink + total;
+			}
+		}),
+		measure_ns_per_order([&] {
+			for (auto const &level : levels)
+				sink = sink + level.total_quantity();
+		})
+	);
+
+	// Агрегация всех уровней, как при построении среза.
+	report(
+		"snapshot aggregation",
+		measure_ns_per_order([&] {
+			std::map<price_t, quantity_t> aggregated;
+			for (auto const &order : book)
+				aggregated[order.GetPrice()] += order.GetQuantity();
+			sink = sink + aggregated.size();
+		}),
+		measure_ns_per_order([&] {
+			std::vector<std::pair<price_t, quantity_t>> aggregated;
+			aggregated.reserve(levels_count);
+			for (size_t level = 0; level < levels_count; ++level)
+				aggregated.emplace_back(level_price(level), levels[level].total_quantity());
+			sink = sink + aggregated.size();
+		})
+	);
+
+	// Исполнение: встречная заявка на половину объёма каждого уровня. Копии готовим вне замера.
+	std::vector<OrderBook::orders_book_t> books;
+	std::vector<std::vector<PriceLevel>> levels_copies;
+	for (size_t repetition = 0; repetition < repetitions; ++repetition)
+	{
+		books.emplace_back(book);
+		levels_copies.emplace_back(levels);
+	}
+	auto const half_of_level = levels.front().total_quantity() / 2;
+
+	size_t book_copy_index = 0;
+	size_t levels_copy_index = 0;
+	report(
+		"fill sweep",
+		measure_ns_per_order([&] {
+			auto &book_by_priority = books[book_copy_index++].get<OrdersByPriority>();
+			for (size_t level = 0; level < levels_count; ++level)
+			{
+				// Внутри уровня индекс хранит заявки в порядке поступления, как их и исполняет _merge_with_book.
+				auto range = book_by_priority.equal_range(bid_level_key(level));
+				auto quantity = half_of_level;
+				for (auto order = range.first; order != range.second && quantity != 0; ++order)
+				{
+					auto const filled = (std::min)(quantity, order->GetQuantity());
+					order->SetQuantity(order->GetQuantity() - filled);
+					quantity -= filled;
+				}
+				sink = sink + quantity;
+			}
+		}),
+		measure_ns_per_order([&] {
+			for (auto &level : levels_copies[levels_copy_index++])
+			{
+				auto quantity = half_of_level;
+				level.fill(quantity);
+				sink = sink + quantity;
+			}
+		})
+	);
+
+	return 0;
+}
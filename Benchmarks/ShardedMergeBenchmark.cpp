@@ -0,0 +1,70 @@
+﻿#include "pch.h"
+
+#include "OrderBookShards.h"
+
+#include <iomanip>
+
+/* Пропускная способность сведения стаканов, распределённых по шардам(OrderBookShards), в зависимости от числа шардов.
+ * Заявки ставят по потоку на шард, каждый - в стаканы своих инструментов, цены Ask и Bid пересекаются, так что сведение
+ * исполняет заявки, а не только кладёт их в стакан. Время - от первой постановки до сведения последней заявки во всех стаканах.
+ *
+ * Использование: ShardedMergeBenchmark [инструментов] [заявок на инструмент] [наибольшее число шардов]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	double merged_orders_per_second(size_t shards_count, size_t instruments_count, size_t orders_per_instrument)
+	{
+		OrderBookShards shards(shards_count);
+		// Ссылки на стаканы берём заранее: в цикле постановки ищется только сведение, а не стакан.
+		std::vector<std::reference_wrapper<OrderBookShards::book_t>> books;
+		for (size_t instrument = 0; instrument < instruments_count; ++instrument)
+			books.emplace_back(shards.book("instrument " + std::to_string(instrument)));
+
+		auto const start = clock_type::now();
+		{
+			std::vector<boost::scoped_thread<boost::join_if_joinable>> posters;
+			for (size_t poster = 0; poster < shards_count; ++poster)
+				posters.emplace_back(boost::thread([&, poster]
+				{
+					for (size_t order = 0; order < orders_per_instrument; ++order)
+						for (auto instrument = poster; instrument < instruments_count; instrument += shards_count)
+						{
+							auto const type = order % 2 ? Order::Type::Ask : Order::Type::Bid;
+							books[instrument].get().post(std::make_unique<Order>(type, 100 + (order * 7) % 11, 1 + order % 10));
+						}
+				}));
+		}
+		// IOC сводится после всех заявок до него, так что его исполнение означает, что стакан всё свёл.
+		for (auto &book : books)
+			book.get().execute(std::make_unique<Order>(Order::Type::Bid, 1, 1, Order::TimeInForce::ImmediateOrCancel));
+		auto const seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+		return instruments_count * orders_per_instrument / seconds;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const instruments_count = argc > 1 ? std::stoul(argv[1]) : 64;
+	size_t const orders_per_instrument = argc > 2 ? std::stoul(argv[2]) : 20000;
+	size_t const max_shards_count = argc > 3 ? std::stoul(argv[3]) : (std::max)(boost::thread::hardware_concurrency(), 1u);
+
+	std::cout << "instruments: " << instruments_count << ", orders per instrument: " << orders_per_instrument
+		<< ", hardware threads: " << boost::thread::hardware_concurrency() << std::endl;
+	std::cout << std::setw(8) << "shards" << std::setw(16) << "orders/s" << std::setw(10) << "speedup" << std::endl;
+
+	double single_shard_throughput = 0;
+	for (size_t shards_count = 1; shards_count <= max_shards_count; shards_count *= 2)
+	{
+		auto const throughput = merged_orders_per_second(shards_count, instruments_count, orders_per_instrument);
+		if (shards_count == 1)
+			single_shard_throughput = throughput;
+		std::cout << std::setw(8) << shards_count << std::setw(16) << std::fixed << std::setprecision(0) << throughput
+			<< std::setw(9) << std::setprecision(2) << throughput / single_shard_throughput << "x" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "MarketDataSnapshot.h"
+
+#include <iomanip>
+
+/* Время получения среза большого стакана разными способами.
+ * Срез строится параллельно, если заявок много, так что результат зависит от количества ядер.
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	auto constexpr repetitions = 5;
+
+	template<typename FunctionT>
+	double measure_ms(FunctionT &&function)
+	{
+		auto const start = clock_type::now();
+		for (size_t repetition = 0; repetition < repetitions; ++repetition)
+			function();
+		return std::chrono::duration<double, std::milli>(clock_type::now() - start).count() / repetitions;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const orders_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	std::cout << "orders: " << orders_count << ", hardware threads: " << boost::thread::hardware_concurrency() << std::endl;
+
+	OrderBook book;
+	// Цены Ask и Bid не пересекаются, так что все заявки остаются в стакане.
+	for (size_t i = 0; i < orders_count; ++i)
+		book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 20000 : 0) + i % 10000, 1 + i % 100));
+	// IOC исполняется после всех поставленных раньше заявок: дожидаемся сведения.
+	book.execute(std::make_unique<Order>(Order::Type::Bid, 15000, 1, Order::TimeInForce::ImmediateOrCancel));
+
+	volatile size_t sink = 0;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "get_snapshot:          " << measure_ms([&] { sink = sink + book.get_snapshot()->GetOrders()[Order::Type::Bid].size(); }) << " ms" << std::endl;
+	std::cout << "get_flat_snapshot:     " << measure_ms([&] { sink = sink + book.get_flat_snapshot().GetOrders()[Order::Type::Bid].size(); }) << " ms" << std::endl;
+	std::cout << "visit_snapshot_levels: " << measure_ms([&] { book.visit_snapshot_levels([&](PriceLevelView const &) { sink = sink + 1; }); }) << " ms" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "TickLadder.h"
+
+#include <iomanip>
+
+/* Сравнение лестницы цен(TickLadder) с multi_index хранилищем стакана для инструмента с ограниченным диапазоном цен.
+ * Уровни заняты разреженно, как у реального стакана: поиск лучшего и следующего уровня должен перескакивать пустые шаги.
+ * Меряем постановку, поиск лучшей цены, обход уровней от лучшего к худшему и исполнение встречной заявкой всей стороны.
+ * Затем то же для стакана целиком: стакан по умолчанию против стакана с итогами уровней в лестнице(enable_tick_ladder).
+ * Стаканы - без блокировок, так что заявки сводятся в вызывающем потоке и время включает сведение.
+ *
+ * Использование: TickLadderBenchmark [количество заявок]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	price_t constexpr min_price = 1000;
+	price_t constexpr max_price = 2000;
+	price_t constexpr tick_size = 0.5;
+	// Занят каждый level_stride шаг диапазона.
+	size_t constexpr level_stride = 7;
+	size_t constexpr levels_count = 2001 / level_stride;
+
+	price_t order_price(size_t order)
+	{
+		return min_price + static_cast<price_t>(order % levels_count * level_stride) * tick_size;
+	}
+
+	template<typename FunctionT>
+	double measure_ns(size_t operations_count, FunctionT &&function)
+	{
+		auto const start = clock_type::now();
+		function();
+		auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+		return static_cast<double>(elapsed) / operations_count;
+	}
+
+	using book_t = BasicOrderBook<lock_policy::NullLock>;
+
+	std::unique_ptr<book_t> make_book(bool is_tick_ladder)
+	{
+		auto book = std::make_unique<book_t>();
+		if (is_tick_ladder)
+			book->enable_tick_ladder(min_price, max_price, tick_size);
+		return book;
+	}
+
+	void report(char const *operation, double multi_index_ns, double tick_ladder_ns)
+	{
+		std::cout << std::left << std::setw(24) << operation
+			<< std::right << std::setw(14) << std::fixed << std::setprecision(3) << multi_index_ns
+			<< std::setw(14) << tick_ladder_ns
+			<< std::setw(10) << std::setprecision(2) << multi_index_ns / tick_ladder_ns << "x" << std::endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const orders_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	size_t const lookups_count = 10000000;
+
+	std::cout << "price range: [" << min_price << ", " << max_price << "] by " << tick_size
+		<< ", occupied levels: " << levels_count << ", orders: " << orders_count << std::endl;
+	std::cout << std::left << std::setw(24) << "ns per operation"
+		<< std::right << std::setw(14) << "multi_index" << std::setw(14) << "TickLadder" << std::setw(11) << "speedup" << std::endl;
+
+	// Все заявки - Bid, стакан одной стороны.
+	OrderBook::orders_book_t book;
+	TickLadder ladder(min_price, max_price, tick_size);
+	report(
+		"post",
+		measure_ns(orders_count, [&] {
+			for (size_t order = 0; order < orders_count; ++order)
+				book.emplace(order_id_t(order + 1), std::make_unique<Order>(Order::Type::Bid, order_price(order), 1 + order % 100));
+		}),
+		measure_ns(orders_count, [&] {
+			for (size_t order = 0; order < orders_count; ++order)
+				ladder.add(Order::Type::Bid, order_price(order), order_id_t(order + 1), 1 + order % 100, order);
+		})
+	);
+
+	auto const &book_by_priority = book.get<OrdersByPriority>();
+	volatile price_t price_sink = 0;
+	report(
+		"best price",
+		measure_ns(lookups_count, [&] {
+			for (size_t lookup = 0; lookup < lookups_count; ++lookup)
+				price_sink = book_by_priority.lower_bound(boost::make_tuple(Order::Type::Bid))->GetPrice();
+		}),
+		measure_ns(lookups_count, [&] {
+			for (size_t lookup = 0; lookup < lookups_count; ++lookup)
+				price_sink = *ladder.best_price(Order::Type::Bid);
+		})
+	);
+
+	// Обход уровней: в индексе следующий уровень - upper_bound по цене текущего.
+	size_t const walks_count = 1000;
+	volatile size_t levels_sink = 0;
+	report(
+		"next level",
+		measure_ns(walks_count * levels_count, [&] {
+			for (size_t walk = 0; walk < walks_count; ++walk)
+			{
+				auto const end = book_by_priority.upper_bound(boost::make_tuple(Order::Type::Bid));
+				for (auto level = book_by_priority.lower_bound(boost::make_tuple(Order::Type::Bid)); level != end;
+					level = book_by_priority.upper_bound(boost::make_tuple(Order::Type::Bid, level->GetPriorityPrice())))
+					levels_sink = levels_sink + 1;
+			}
+		}),
+		measure_ns(walks_count * levels_count, [&] {
+			for (size_t walk = 0; walk < walks_count; ++walk)
+				ladder.for_each_level(Order::Type::Bid, [&](price_t, PriceLevel const &) { levels_sink = levels_sink + 1; });
+		})
+	);
+
+	// Встречная заявка на весь объём стороны: то же, что делает _merge_with_book, и пометка исполненных.
+	volatile quantity_t quantity_sink = 0;
+	report(
+		"sweep, per order",
+		measure_ns(orders_count, [&] {
+			auto quantity = (std::numeric_limits<quantity_t>::max)();
+			std::vector<OrderData const*> satisfied;
+			for (auto order = book_by_priority.lower_bound(boost::make_tuple(Order::Type::Bid));
+				order != book_by_priority.end() && static_cast<Order::Type>(order->GetType()) == Order::Type::Bid && quantity != 0; ++order)
+			{
+				auto const filled = (std::min)(quantity, order->GetQuantity());
+				order->SetQuantity(order->GetQuantity() - filled);
+				quantity -= filled;
+				if (order->GetQuantity() == 0)
+					satisfied.push_back(&*order);
+			}
+			for (auto const order : satisfied)
+				book.erase(book.iterator_to(*order));
+			quantity_sink = quantity;
+		}),
+		measure_ns(orders_count, [&] {
+			auto quantity = (std::numeric_limits<quantity_t>::max)();
+			ladder.match(Order::Type::Ask, min_price, quantity);
+			quantity_sink = quantity;
+		})
+	);
+
+	std::cout << std::left << std::setw(24) << "book, ns per operation"
+		<< std::right << std::setw(14) << "default" << std::setw(14) << "TickLadder" << std::setw(11) << "speedup" << std::endl;
+	std::array<std::unique_ptr<book_t>, 2> books{ { make_book(false), make_book(true) } };
+	std::array<std::vector<order_id_t>, 2> ids;
+	std::array<double, 2> ns{};
+	for (size_t book = 0; book < books.size(); ++book)
+		ns[book] = measure_ns(orders_count, [&] {
+			for (size_t order = 0; order < orders_count; ++order)
+				ids[book].push_back(books[book]->post(std::make_unique<Order>(Order::Type::Bid, order_price(order), 1 + order % 100)));
+		});
+	report("book post", ns[0], ns[1]);
+
+	for (size_t book = 0; book < books.size(); ++book)
+		ns[book] = measure_ns(lookups_count, [&] {
+			for (size_t lookup = 0; lookup < lookups_count; ++lookup)
+				price_sink = books[book]->get_analytics().best_price[Order::Type::Bid];
+		});
+	report("book analytics", ns[0], ns[1]);
+
+	// Отменяем каждую вторую заявку, а остальные исполняет одна встречная заявка на весь объём стороны.
+	for (size_t book = 0; book < books.size(); ++book)
+		ns[book] = measure_ns(orders_count / 2, [&] {
+			for (size_t order = 0; order < orders_count; order += 2)
+				books[book]->cancel(ids[book][order]);
+		});
+	report("book cancel", ns[0], ns[1]);
+
+	for (size_t book = 0; book < books.size(); ++book)
+		ns[book] = measure_ns(orders_count / 2, [&] {
+			books[book]->post(std::make_unique<Order>(Order::Type::Ask, min_price, (std::numeric_limits<quantity_t>::max)()));
+		});
+	report("book sweep, per order", ns[0], ns[1]);
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+﻿#include "pch.h"
+
+#include "OrderBook.h"
+#include "MarketDataWireFormat.h"
+
+#include <iomanip>
+
+/* Скорость кодирования и размер среза в компактном двоичном представлении(MarketDataWireFormat.h)
+ * по сравнению с записями плоского среза как есть.
+ *
+ * Использование: WireFormatBenchmark [количество заявок]
+ */
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	auto constexpr repetitions = 20;
+	price_t constexpr tick_size = 0.01;
+
+	template<typename FunctionT>
+	double measure_seconds(FunctionT &&function)
+	{
+		auto const start = clock_type::now();
+		for (size_t repetition = 0; repetition < repetitions; ++repetition)
+			function();
+		return std::chrono::duration<double>(clock_type::now() - start).count() / repetitions;
+	}
+
+	void report(char const *operation, size_t records_count, size_t encoded_size, size_t raw_size, double seconds)
+	{
+		std::cout << std::left << std::setw(16) << operation << std::right << std::fixed
+			<< std::setw(14) << std::setprecision(1) << records_count / seconds / 1e6
+			<< std::setw(14) << encoded_size / seconds / (1 << 20)
+			<< std::setw(14) << encoded_size
+			<< std::setw(14) << std::setprecision(2) << static_cast<double>(raw_size) / encoded_size << std::endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t const orders_count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+	OrderBook book;
+	// Цены Ask и Bid не пересекаются, так что все заявки остаются в стакане.
+	for (size_t i = 0; i < orders_count; ++i)
+		book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 200 : 100) + (i % 5000) * tick_size, 1 + i % 1000));
+	book.execute(std::make_unique<Order>(Order::Type::Bid, 1, 1, Order::TimeInForce::ImmediateOrCancel));
+
+	auto const snapshot = book.get_flat_snapshot();
+	std::vector<PriceLevelView> levels;
+	book.copy_snapshot_levels(std::back_inserter(levels));
+
+	std::vector<uint8_t> buffer((std::max)(wire_format::max_encoded_size(snapshot), wire_format::max_encoded_levels_size(levels.size())));
+	size_t encoded_size = 0;
+
+	std::cout << "orders: " << orders_count << ", levels: " << levels.size() << std::endl;
+	std::cout << std::left << std::setw(16) << "" << std::right
+		<< std::setw(14) << "Mrecords/s" << std::setw(14) << "MiB/s" << std::setw(14) << "bytes" << std::setw(14) << "raw/encoded" << std::endl;
+
+	auto const raw_orders_size = orders_count * sizeof(FlatMarketDataSnapshot::Record);
+	auto seconds = measure_seconds([&] { encoded_size = wire_format::encode(snapshot, tick_size, buffer.data(), buffer.size()); });
+	report("encode orders", orders_count, encoded_size, raw_orders_size, seconds);
+
+	FlatMarketDataSnapshot decoded;
+	seconds = measure_seconds([&] { wire_format::decode(buffer.data(), encoded_size, tick_size, decoded); });
+	report("decode orders", orders_count, encoded_size, raw_orders_size, seconds);
+
+	auto const raw_levels_size = levels.size() * sizeof(PriceLevelView);
+	seconds = measure_seconds([&] { encoded_size = wire_format::encode_levels(levels.begin(), levels.end(), tick_size, buffer.data(), buffer.size()); });
+	report("encode levels", levels.size(), encoded_size, raw_levels_size, seconds);
+
+	std::vector<PriceLevelView> decoded_levels(levels.size());
+	seconds = measure_seconds([&] { wire_format::decode_levels(buffer.data(), encoded_size, tick_size, decoded_levels.begin()); });
+	report("decode levels", levels.size(), encoded_size, raw_levels_size, seconds);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+﻿#ifndef BENCHMARKS_PCH_H
+#define BENCHMARKS_PCH_H
+
+#include "../OrderBook/pch.h"
+
+#endif //BENCHMARKS_PCH_H
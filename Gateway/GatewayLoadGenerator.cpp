@@ -0,0 +1,157 @@
+﻿#include "pch.h"
+
+#include "GatewayProtocol.h"
+
+#include <deque>
+#include <iomanip>
+
+/* Нагрузка на шлюз заявок с замером времени от отправки запроса до получения ответа на него.
+ * Запросы отправляются окнами: окно пишется одной записью, и следующее окно отправляется, когда пришли все ответы на текущее.
+ * В потоке запросов - постановки по обе стороны стакана без пересечения, отмены ранее поставленных заявок и IOC, которые их исполняют.
+ *
+ * Использование: GatewayLoadGenerator tcp <порт> | unix <путь к сокету> [количество запросов] [размер окна]
+ */
+
+namespace
+{
+	using namespace gateway::protocol;
+	using clock_type = std::chrono::steady_clock;
+
+	size_t constexpr default_requests_count = 1000000;
+	size_t constexpr default_window_size = 64;
+
+	class RequestsGenerator
+	{
+	public:
+		Request next(uint64_t client_tag)
+		{
+			if (client_tag % 4 == 0 && _posted_orders.empty() == false)
+			{
+				auto const order_id = _posted_orders.front();
+				_posted_orders.pop_front();
+				return make_cancel(client_tag, order_id);
+			}
+			if (client_tag % 16 == 1)
+				return make_post(client_tag, Order::Type::Bid, 120, 5, Order::TimeInForce::ImmediateOrCancel);
+			if (client_tag % 2 == 0)
+				return make_post(client_tag, Order::Type::Ask, 100 + static_cast<price_t>(client_tag % 20), 10);
+			return make_post(client_tag, Order::Type::Bid, 90 - static_cast<price_t>(client_tag % 20), 10);
+		}
+		void on_accepted(order_id_pod_t const &order_id)
+		{
+			_posted_orders.emplace_back(order_id);
+		}
+
+	private:
+		std::deque<order_id_pod_t> _posted_orders;
+	};
+
+	double percentile(std::vector<double> const &sorted, double fraction)
+	{
+		return sorted[(std::min)(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+	}
+
+	template<typename SocketT>
+	void run(SocketT &socket, size_t requests_count, size_t window_size)
+	{
+		RequestsGenerator generator;
+		std::vector<Request> window;
+		std::vector<char> read_buffer(window_size * sizeof(Response));
+		std::vector<double> latencies_us;
+		latencies_us.reserve(requests_count);
+		std::array<size_t, 7> responses_by_type{};
+
+		auto const start = clock_type::now();
+		uint64_t client_tag = 0;
+		while (latencies_us.size() < requests_count)
+		{
+			window.clear();
+			for (size_t i = 0; i < window_size && latencies_us.size() + window.size() < requests_count; ++i)
+				window.emplace_back(generator.next(client_tag++));
+
+			auto const sent_at = clock_type::now();
+			boost::asio::write(socket, boost::asio::buffer(window));
+
+			size_t responses_count = 0;
+			size_t read_size = 0;
+			while (responses_count < window.size())
+			{
+				read_size += socket.read_some(boost::asio::buffer(read_buffer.data() + read_size, read_buffer.size() - read_size));
+				auto const received_at = clock_type::now();
+				auto const decoded_size = decode<Response>(
+					read_buffer.data(), read_size,
+					[&](Response const &response)
+					{
+						++responses_by_type[static_cast<size_t>(response.type) % responses_by_type.size()];
+						// Исполнения и снятия по сроку принятых заявок - не ответы на запросы окна.
+						if (response.type == ResponseType::Filled || response.type == ResponseType::Expired)
+							return;
+						latencies_us.emplace_back(std::chrono::duration<double, std::micro>(received_at - sent_at).count());
+						if (response.type == ResponseType::Accepted)
+							generator.on_accepted(response.order_id);
+						++responses_count;
+					}
+				);
+				std::memmove(read_buffer.data(), read_buffer.data() + decoded_size, read_size - decoded_size);
+				read_size -= decoded_size;
+			}
+		}
+		auto const elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+
+		std::sort(latencies_us.begin(), latencies_us.end());
+		std::cout << "requests: " << latencies_us.size() << ", window: " << window_size << std::endl
+			<< "responses: accepted " << responses_by_type[static_cast<size_t>(ResponseType::Accepted)]
+			<< ", executed " << responses_by_type[static_cast<size_t>(ResponseType::Executed)]
+			<< ", cancelled " << responses_by_type[static_cast<size_t>(ResponseType::Cancelled)]
+			<< ", rejected " << responses_by_type[static_cast<size_t>(ResponseType::Rejected)]
+			<< "; fills of accepted " << responses_by_type[static_cast<size_t>(ResponseType::Filled)] << std::endl
+			<< std::fixed << std::setprecision(0) << "throughput: " << latencies_us.size() / elapsed << " requests/s" << std::endl
+			<< std::setprecision(1) << "round trip, us: p50 " << percentile(latencies_us, 0.5)
+			<< ", p99 " << percentile(latencies_us, 0.99)
+			<< ", p99.9 " << percentile(latencies_us, 0.999)
+			<< ", max " << latencies_us.back() << std::endl;
+	}
+
+	int usage()
+	{
+		std::cerr << "usage: GatewayLoadGenerator tcp <port> | unix <socket path> [requests count] [window size]" << std::endl;
+		return 1;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+		return usage();
+	std::string const transport = argv[1];
+	auto const requests_count = argc > 3 ? std::stoul(argv[3]) : default_requests_count;
+	auto const window_size = argc > 4 ? (std::max)(std::stoul(argv[4]), 1ul) : default_window_size;
+
+	boost::asio::io_service service;
+	try
+	{
+		if (transport == "tcp")
+		{
+			boost::asio::ip::tcp::socket socket(service);
+			socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(std::stoul(argv[2]))));
+			socket.set_option(boost::asio::ip::tcp::no_delay(true));
+			run(socket, requests_count, window_size);
+		}
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		else if (transport == "unix")
+		{
+			boost::asio::local::stream_protocol::socket socket(service);
+			socket.connect(boost::asio::local::stream_protocol::endpoint(argv[2]));
+			run(socket, requests_count, window_size);
+		}
+#endif
+		else
+			return usage();
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
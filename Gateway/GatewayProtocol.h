@@ -0,0 +1,122 @@
+﻿#ifndef GATEWAY_PROTOCOL_H
+#define GATEWAY_PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "Order.h"
+
+/* Бинарный протокол шлюза заявок.
+ * Запросы и ответы - структуры фиксированного размера, которые передаются как есть, без разметки и префиксов длины.
+ * Порядок байт и представление цены - как у машины, поэтому шлюз слушает только локальные сокеты.
+ */
+namespace gateway
+{
+	namespace protocol
+	{
+		enum class RequestType : uint8_t
+		{
+			Post = 1,
+			Cancel = 2
+		};
+
+		enum class ResponseType : uint8_t
+		{
+			// \brief Заявка принята в стакан. Исполнения по ней приходят отдельными ответами Filled, снятие по сроку - ответом Expired.
+			Accepted = 1,
+			// \brief IOC/FOK заявка исполнена. quantity - исполненное количество.
+			//	Приходит, когда заявка сведена, и может обогнать ответы на запросы, отправленные после неё.
+			Executed = 2,
+			// \brief Заявка отменена. quantity - отменённый остаток.
+			Cancelled = 3,
+			// \brief Запрос отклонён: некорректный запрос или отмена неизвестной либо чужой заявки.
+			Rejected = 4,
+			// \brief Не ответ на запрос: принятая заявка исполнена на quantity. client_tag - метка запроса, которым она поставлена.
+			//	Приходит на каждое исполнение, пока заявка не исполнена целиком.
+			Filled = 5,
+			// \brief Не ответ на запрос: срок принятой GTD заявки истёк. quantity - снятый остаток.
+			Expired = 6
+		};
+
+		struct Request
+		{
+			RequestType type;
+			Order::Type order_type;
+			Order::TimeInForce time_in_force;
+			uint8_t reserved[5];
+			// \brief Метка клиента, возвращается в ответе как есть.
+			uint64_t client_tag;
+			price_t price;
+			uint64_t quantity;
+			// \brief Срок GTD заявки: наносекунды от эпохи system_clock.
+			int64_t expire_at;
+			// \brief id отменяемой заявки.
+			order_id_pod_t order_id;
+		};
+		static_assert(sizeof(Request) == 72, "Размер запроса - часть протокола");
+		static_assert(std::is_trivially_copyable<Request>::value, "Запрос передаётся как есть");
+
+		struct Response
+		{
+			ResponseType type;
+			uint8_t reserved[7];
+			uint64_t client_tag;
+			uint64_t quantity;
+			order_id_pod_t order_id;
+		};
+		static_assert(sizeof(Response) == 56, "Размер ответа - часть протокола");
+		static_assert(std::is_trivially_copyable<Response>::value, "Ответ передаётся как есть");
+
+		inline Request make_post(uint64_t client_tag, Order::Type order_type, price_t price, quantity_t quantity,
+			Order::TimeInForce time_in_force = Order::TimeInForce::GoodTillCancel)
+		{
+			Request request{};
+			request.type = RequestType::Post;
+			request.order_type = order_type;
+			request.time_in_force = time_in_force;
+			request.client_tag = client_tag;
+			request.price = price;
+			request.quantity = quantity;
+			return request;
+		}
+		inline Request make_cancel(uint64_t client_tag, order_id_pod_t const &order_id)
+		{
+			Request request{};
+			request.type = RequestType::Cancel;
+			request.client_tag = client_tag;
+			request.order_id = order_id;
+			return request;
+		}
+		inline Response make_response(ResponseType type, uint64_t client_tag, quantity_t quantity = 0, order_id_pod_t const &order_id = {})
+		{
+			Response response{};
+			response.type = type;
+			response.client_tag = client_tag;
+			response.quantity = quantity;
+			response.order_id = order_id;
+			return response;
+		}
+
+		/**
+		 * \brief Разобрать все целые сообщения из начала буфера.
+		 * \param on_message Вызывается для каждого сообщения по порядку.
+		 * \return Сколько байт разобрано. Хвост - начало ещё не дочитанного сообщения.
+		 */
+		template<typename MessageT, typename OnMessageT>
+		size_t decode(char const *data, size_t size, OnMessageT &&on_message)
+		{
+			size_t decoded = 0;
+			for (; decoded + sizeof(MessageT) <= size; decoded += sizeof(MessageT))
+			{
+				// Буфер сокета не выровнен под сообщение, поэтому копируем.
+				MessageT message;
+				std::memcpy(&message, data + decoded, sizeof(MessageT));
+				on_message(message);
+			}
+			return decoded;
+		}
+	}
+}
+
+#endif
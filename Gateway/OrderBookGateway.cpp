@@ -0,0 +1,89 @@
+﻿#include "pch.h"
+
+#include "OrderBookGateway.h"
+
+#include <boost/filesystem.hpp>
+
+/* Шлюз заявок: принимает запросы бинарного протокола(GatewayProtocol.h) по локальному TCP или Unix сокету.
+ * Всё, что пришло за одно чтение, разбирается целиком: подряд идущие постановки ставятся в стакан одной пачкой(post_batch),
+ * а ответы на запросы одного чтения копятся в одну пачку. Пачки, накопившиеся за время записи, уходят одной gather-записью.
+ * IOC/FOK заявки сводятся асинхронно: ответ на них приходит, когда поток сведения их исполнил.
+ * Владельцу принятой заявки приходят её исполнения и снятие по сроку.
+ *
+ * Использование: OrderBookGateway tcp <порт> | unix <путь к сокету>
+ */
+
+namespace
+{
+	using namespace gateway;
+
+	/**
+	 * \brief Удалить сокет, оставшийся от прошлого запуска.
+	 * \return false, если по пути лежит не сокет: его не трогаем.
+	 */
+	bool remove_socket_file(std::string const &path)
+	{
+		boost::system::error_code error;
+		auto const status = boost::filesystem::symlink_status(path, error);
+		if (status.type() == boost::filesystem::file_not_found)
+			return true;
+		if (status.type() != boost::filesystem::socket_file)
+			return false;
+		return boost::filesystem::remove(path, error);
+	}
+
+	int usage()
+	{
+		std::cerr << "usage: OrderBookGateway tcp <port> | unix <socket path>" << std::endl;
+		return 1;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+		return usage();
+	std::string const transport = argv[1];
+
+	// Стакан разрушается до сервиса: его потоки останавливаются, пока исполнители обработчиков асинхронных операций ещё живы.
+	// Обработчики сервиса после его остановки не вызываются, так что сессии стакан уже не трогают.
+	boost::asio::io_service service;
+	OrderBook book;
+	OrderOwners owners(service, book);
+
+	boost::asio::signal_set stop_signals(service, SIGINT, SIGTERM);
+	stop_signals.async_wait([&service](boost::system::error_code const &, int) { service.stop(); });
+
+	try
+	{
+		if (transport == "tcp")
+		{
+			boost::asio::ip::tcp::endpoint const endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(std::stoul(argv[2])));
+			Server<boost::asio::ip::tcp> server(service, endpoint, book, owners);
+			std::cout << "listening on " << endpoint << std::endl;
+			service.run();
+		}
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		else if (transport == "unix")
+		{
+			if (remove_socket_file(argv[2]) == false)
+			{
+				std::cerr << argv[2] << " exists and is not a socket" << std::endl;
+				return 1;
+			}
+			Server<boost::asio::local::stream_protocol> server(service, boost::asio::local::stream_protocol::endpoint(argv[2]), book, owners);
+			std::cout << "listening on " << argv[2] << std::endl;
+			service.run();
+			remove_socket_file(argv[2]);
+		}
+#endif
+		else
+			return usage();
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
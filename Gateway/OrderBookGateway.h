@@ -0,0 +1,426 @@
+﻿#pragma once
+
+#ifndef ORDER_BOOK_GATEWAY_H
+#define ORDER_BOOK_GATEWAY_H
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "OrderBook.h"
+#include "GatewayProtocol.h"
+
+/* Сессии и сервер шлюза заявок(OrderBookGateway.cpp): всё, что исполняется в потоке сервиса.
+ */
+namespace gateway
+{
+	using namespace protocol;
+
+	// \brief Размер буфера чтения, а значит и наибольшей пачки запросов.
+	constexpr size_t read_buffer_size = 64 * 1024;
+	// \brief Сколько неотправленных пачек ответов допускаем, прежде чем перестать читать запросы от клиента.
+	constexpr size_t max_pending_response_batches = 64;
+
+	inline bool is_valid(Request const &request)
+	{
+		switch (request.type)
+		{
+		case RequestType::Post:
+			return request.order_type < Order::Type::_EnumElementsCount
+				&& request.time_in_force <= Order::TimeInForce::GoodTillDate
+				&& request.quantity != 0
+				&& std::isfinite(request.price);
+		case RequestType::Cancel:
+			return true;
+		}
+		return false;
+	}
+
+	inline std::unique_ptr<Order> make_order(Request const &request)
+	{
+		if (request.time_in_force == Order::TimeInForce::GoodTillDate)
+		{
+			auto const expire_at = std::chrono::system_clock::time_point(
+				std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(request.expire_at))
+			);
+			return std::make_unique<Order>(request.order_type, request.price, request.quantity, expire_at);
+		}
+		return std::make_unique<Order>(request.order_type, request.price, request.quantity, request.time_in_force);
+	}
+
+	/**
+	 * \brief Получатель ответов, которые приходят не на запрос.
+	 */
+	class Subscriber
+	{
+	public:
+		virtual ~Subscriber() = default;
+		virtual void notify(Response const &response) = 0;
+	};
+
+	/**
+	 * \brief Владельцы принятых заявок: кому сообщать об исполнении и снятии по сроку.
+	 * \details События стакана приходят под его блокировкой из потока сведения и передаются в поток сервиса,
+	 *		где и живёт реестр. Заявку регистрируют в потоке сервиса сразу после постановки,
+	 *		так что регистрация всегда раньше, чем событие о ней.
+	 */
+	class OrderOwners
+	{
+	public:
+		OrderOwners(boost::asio::io_service &service, OrderBook &book)
+			: _service(service)
+			, _book(book)
+		{
+			_executions_subscription = _book.subscribe_to_executions([this](ExecutionReport const &execution)
+			{
+				boost::asio::post(_service, [this, execution] { _on_filled(execution.order_id, execution.quantity); });
+			});
+			// Снятия заявок видны только в потоке изменений для реплик.
+			_removals_subscription = _book.subscribe_to_replication([this](ReplicationEvent const &event)
+			{
+				if (event.kind == ReplicationEvent::Kind::Remove)
+					boost::asio::post(_service, [this, order_id = event.order_id] { _on_removed(order_id); });
+			});
+		}
+		~OrderOwners()
+		{
+			_book.unsubscribe_from_replication(_removals_subscription);
+			_book.unsubscribe_from_executions(_executions_subscription);
+		}
+
+		void add(order_id_t const &order_id, std::weak_ptr<Subscriber> subscriber, uint64_t client_tag, quantity_t quantity)
+		{
+			_owners.emplace(order_id, Owner{ std::move(subscriber), client_tag, quantity });
+		}
+		/**
+		 * \brief Владеет ли заявкой эта сессия. Отменить заявку может только её владелец.
+		 */
+		bool owns(order_id_t const &order_id, Subscriber const &subscriber) const
+		{
+			auto const owner = _owners.find(order_id);
+			return owner != _owners.end() && owner->second.subscriber.lock().get() == &subscriber;
+		}
+		/**
+		 * \brief Заявку отменил запросом её владелец: об отмене он узнает из ответа.
+		 */
+		void remove(order_id_t const &order_id)
+		{
+			_owners.erase(order_id);
+		}
+
+	private:
+		struct Owner
+		{
+			std::weak_ptr<Subscriber> subscriber;
+			uint64_t client_tag;
+			quantity_t remaining;
+		};
+
+		void _on_filled(order_id_t const &order_id, quantity_t quantity)
+		{
+			// IOC/FOK заявок в реестре нет: их исполнение - ответ на запрос.
+			auto const owner = _owners.find(order_id);
+			if (owner == _owners.end())
+				return;
+			owner->second.remaining -= quantity;
+			if (auto const subscriber = owner->second.subscriber.lock())
+				subscriber->notify(make_response(ResponseType::Filled, owner->second.client_tag, quantity, to_pod(order_id)));
+			if (owner->second.remaining == 0)
+				_owners.erase(owner);
+		}
+		void _on_removed(order_id_t const &order_id)
+		{
+			// Исполненные целиком и отменённые запросом уже удалены, так что осталось снятие по сроку.
+			auto const owner = _owners.find(order_id);
+			if (owner == _owners.end())
+				return;
+			if (auto const subscriber = owner->second.subscriber.lock())
+				subscriber->notify(make_response(ResponseType::Expired, owner->second.client_tag, owner->second.remaining, to_pod(order_id)));
+			_owners.erase(owner);
+		}
+
+		boost::asio::io_service &_service;
+		OrderBook &_book;
+		size_t _executions_subscription;
+		size_t _removals_subscription;
+		std::unordered_map<order_id_t, Owner, boost::hash<order_id_t>> _owners;
+	};
+
+	/**
+	 * \brief Соединение с клиентом.
+	 * \warning Исполняется в потоке сервиса. Ни один запрос не ждёт сведения: IOC/FOK заявки завершаются обработчиком в этом же потоке.
+	 */
+	template<typename ProtocolT>
+	class Session
+		: public Subscriber
+		, public std::enable_shared_from_this<Session<ProtocolT>>
+	{
+	public:
+		Session(typename ProtocolT::socket socket, OrderBook &book, OrderOwners &owners)
+			: _socket(std::move(socket))
+			, _book(book)
+			, _owners(owners)
+			, _read_buffer(read_buffer_size)
+		{
+		}
+
+		void start()
+		{
+			_read();
+		}
+
+		void notify(Response const &response) override
+		{
+			_push(response);
+		}
+
+	private:
+		void _read()
+		{
+			auto self = this->shared_from_this();
+			_socket.async_read_some(
+				boost::asio::buffer(_read_buffer.data() + _read_size, _read_buffer.size() - _read_size),
+				[this, self](boost::system::error_code const &error, size_t bytes_read)
+				{
+					// Клиент отключился. Сессию разрушит последний обработчик, который её держит.
+					if (error)
+						return;
+
+					_read_size += bytes_read;
+					_process_requests();
+
+					if (_pending_batches.size() < max_pending_response_batches)
+						_read();
+					else
+						_is_reading_paused = true;
+				}
+			);
+		}
+
+		void _process_requests()
+		{
+			std::vector<Response> responses;
+			auto const decoded_size = decode<Request>(
+				_read_buffer.data(), _read_size,
+				[this, &responses](Request const &request) { _process(request, responses); }
+			);
+			_post_accumulated(responses);
+
+			// Недочитанное сообщение переносим в начало буфера.
+			std::memmove(_read_buffer.data(), _read_buffer.data() + decoded_size, _read_size - decoded_size);
+			_read_size -= decoded_size;
+
+			if (responses.empty())
+				return;
+			_pending_batches.emplace_back(std::move(responses));
+			if (_is_writing == false)
+				_write();
+		}
+
+		/**
+		 * \brief Отправить ответ, пришедший не при разборе запросов: он добавляется к последней ждущей записи пачке.
+		 */
+		void _push(Response const &response)
+		{
+			if (_pending_batches.empty())
+				_pending_batches.emplace_back();
+			_pending_batches.back().emplace_back(response);
+			if (_is_writing == false)
+				_write();
+		}
+
+		void _process(Request const &request, std::vector<Response> &responses)
+		{
+			if (is_valid(request) == false)
+			{
+				_post_accumulated(responses);
+				responses.emplace_back(make_response(ResponseType::Rejected, request.client_tag));
+				return;
+			}
+
+			if (request.type == RequestType::Post
+				&& request.time_in_force != Order::TimeInForce::ImmediateOrCancel
+				&& request.time_in_force != Order::TimeInForce::FillOrKill)
+			{
+				_accumulated_orders.emplace_back(make_order(request));
+				_accumulated_tags.emplace_back(request.client_tag);
+				return;
+			}
+
+			// Чтобы не нарушить порядок запросов, до остальных запросов ставим накопленные.
+			_post_accumulated(responses);
+			try
+			{
+				if (request.type == RequestType::Post)
+					_execute(request);
+				// Чужую заявку, как и неизвестную, не отменяем: иначе её владелец не узнал бы об отмене.
+				else if (_owners.owns(from_pod(request.order_id), *this) == false)
+					responses.emplace_back(make_response(ResponseType::Rejected, request.client_tag, 0, request.order_id));
+				else if (auto const cancelled = _book.cancel(from_pod(request.order_id)))
+				{
+					_owners.remove(cancelled->order_id);
+					responses.emplace_back(make_response(ResponseType::Cancelled, request.client_tag, cancelled->GetQuantity(), request.order_id));
+				}
+				else
+					responses.emplace_back(make_response(ResponseType::Rejected, request.client_tag, 0, request.order_id));
+			}
+			catch (std::exception const &)
+			{
+				// Например, стакан останавливается и сведение прервано.
+				responses.emplace_back(make_response(ResponseType::Rejected, request.client_tag, 0, request.order_id));
+			}
+		}
+
+		/**
+		 * \brief Поставить IOC/FOK заявку на сведение. Ответ отправит обработчик, когда заявка будет исполнена.
+		 */
+		void _execute(Request const &request)
+		{
+			auto self = this->shared_from_this();
+			_book.async_execute(
+				make_order(request),
+				boost::asio::bind_executor(
+					_socket.get_executor(),
+					[this, self, client_tag = request.client_tag, quantity = request.quantity](std::exception_ptr error, OrderData executed)
+					{
+						// Например, стакан останавливается и сведение прервано.
+						if (error)
+							_push(make_response(ResponseType::Rejected, client_tag));
+						else
+							_push(make_response(ResponseType::Executed, client_tag, quantity - executed.GetQuantity(), to_pod(executed.order_id)));
+					}
+				)
+			);
+		}
+
+		/**
+		 * \brief Поставить накопленные заявки одной пачкой и зарегистрировать их владельцем эту сессию.
+		 */
+		void _post_accumulated(std::vector<Response> &responses)
+		{
+			if (_accumulated_orders.empty())
+				return;
+
+			std::vector<quantity_t> quantities;
+			quantities.reserve(_accumulated_orders.size());
+			for (auto const &order : _accumulated_orders)
+				quantities.emplace_back(order->quantity);
+
+			auto const orders_ids = _book.post_batch(std::move(_accumulated_orders));
+			std::weak_ptr<Subscriber> const self = this->shared_from_this();
+			for (size_t i = 0; i < orders_ids.size(); ++i)
+			{
+				_owners.add(orders_ids[i], self, _accumulated_tags[i], quantities[i]);
+				responses.emplace_back(make_response(ResponseType::Accepted, _accumulated_tags[i], 0, to_pod(orders_ids[i])));
+			}
+
+			_accumulated_orders.clear();
+			_accumulated_tags.clear();
+		}
+
+		/**
+		 * \brief Отправить все накопившиеся пачки ответов одной gather-записью.
+		 */
+		void _write()
+		{
+			_writing_batches.swap(_pending_batches);
+			_write_buffers.clear();
+			for (auto const &batch : _writing_batches)
+				_write_buffers.emplace_back(boost::asio::buffer(batch));
+
+			_is_writing = true;
+			auto self = this->shared_from_this();
+			boost::asio::async_write(
+				_socket, _write_buffers,
+				[this, self](boost::system::error_code const &error, size_t)
+				{
+					_is_writing = false;
+					if (error)
+						return;
+
+					_writing_batches.clear();
+					if (_pending_batches.empty() == false)
+						_write();
+					if (_is_reading_paused)
+					{
+						_is_reading_paused = false;
+						_read();
+					}
+				}
+			);
+		}
+
+		typename ProtocolT::socket _socket;
+		OrderBook &_book;
+		OrderOwners &_owners;
+
+		std::vector<char> _read_buffer;
+		size_t _read_size = 0;
+		bool _is_reading_paused = false;
+
+		// \brief Постановки, накопленные для пачки, и метки их запросов.
+		std::vector<std::unique_ptr<Order>> _accumulated_orders;
+		std::vector<uint64_t> _accumulated_tags;
+
+		// \brief Пачки ответов, ждущие записи, и пачки, которые пишутся сейчас.
+		std::vector<std::vector<Response>> _pending_batches;
+		std::vector<std::vector<Response>> _writing_batches;
+		std::vector<boost::asio::const_buffer> _write_buffers;
+		bool _is_writing = false;
+	};
+
+	template<typename ProtocolT>
+	class Server
+	{
+	public:
+		Server(boost::asio::io_service &service, typename ProtocolT::endpoint const &endpoint, OrderBook &book, OrderOwners &owners)
+			: _acceptor(service, endpoint)
+			, _socket(service)
+			, _book(book)
+			, _owners(owners)
+		{
+			_accept();
+		}
+
+	private:
+		void _accept()
+		{
+			_acceptor.async_accept(
+				_socket,
+				[this](boost::system::error_code const &error)
+				{
+					if (error == boost::asio::error::operation_aborted)
+						return;
+					if (!error)
+					{
+						_configure(_socket);
+						std::make_shared<Session<ProtocolT>>(std::move(_socket), _book, _owners)->start();
+					}
+					_accept();
+				}
+			);
+		}
+
+		template<typename SocketT>
+		static void _configure(SocketT &)
+		{
+		}
+		static void _configure(boost::asio::ip::tcp::socket &socket)
+		{
+			// Ответы уже собраны в пачки, ждать Нейгла незачем.
+			socket.set_option(boost::asio::ip::tcp::no_delay(true));
+		}
+
+		typename ProtocolT::acceptor _acceptor;
+		typename ProtocolT::socket _socket;
+		OrderBook &_book;
+		OrderOwners &_owners;
+	};
+}
+
+#endif
@@ -0,0 +1,8 @@
+﻿#ifndef GATEWAY_PCH_H
+#define GATEWAY_PCH_H
+
+#include "../OrderBook/pch.h"
+
+#include <cmath>
+
+#endif //GATEWAY_PCH_H
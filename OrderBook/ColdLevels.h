@@ -0,0 +1,297 @@
+﻿#pragma once
+
+#ifndef COLD_LEVELS_H
+#define COLD_LEVELS_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "Order.h"
+
+/**
+ * \brief Заявки уровней, далёких от лучшей цены, в плотном замороженном виде.
+ * \details Заявки стороны лежат в параллельных массивах в порядке приоритета: уровни от лучшей цены к худшей,
+ *		внутри уровня - по возрастанию id. Вместо узла индекса, отдельно выделенной Order и 256-битного id
+ *		на заявку приходятся 64-битные id и количество, запись поиска по id и доля записи уровня.
+ *		Поиск по id - двоичный, по массиву (id, позиция), отсортированному по id.
+ *		Отменённая заявка помечается нулевым количеством и вычищается при следующей перестройке стороны.
+ *		Перестраивается сторона при заморозке и разморозке, то есть пачками, в фоне.
+ * \warning Не потокобезопасно.
+ */
+class ColdLevels
+{
+public:
+	using narrow_id_t = uint64_t;
+
+	struct ColdOrder
+	{
+		Order::Type type;
+		price_t price;
+		narrow_id_t id;
+		quantity_t quantity;
+	};
+
+	/**
+	 * \brief Влезает ли id в 64 бита. Заявки с более длинными id не замораживаются.
+	 */
+	static bool can_be_frozen(order_id_t const &id)
+	{
+		return id <= (std::numeric_limits<narrow_id_t>::max)();
+	}
+	/**
+	 * \brief Цена в порядке приоритета стороны: меньше - ближе к лучшей цене.
+	 */
+	static price_t priority_price(Order::Type type, price_t price)
+	{
+		return type == Order::Type::Bid ? -price : price;
+	}
+
+	/**
+	 * \brief Заморозить заявки.
+	 * \details Сторона перестраивается, если в неё добавились заявки или в ней есть отменённые, так что заморозка заодно вычищает их.
+	 */
+	void freeze(std::vector<ColdOrder> const &orders)
+	{
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto side_orders = _alive_orders(static_cast<Order::Type>(type));
+			auto const alive_count = side_orders.size();
+			for (auto const &order : orders)
+				if (order.type == type)
+					side_orders.emplace_back(order);
+			// Сравнивать размеры с ids нельзя: новых заявок может оказаться ровно столько же, сколько отменённых.
+			if (side_orders.size() != alive_count || alive_count != _sides[type].ids.size())
+				_rebuild(static_cast<Order::Type>(type), std::move(side_orders));
+		}
+	}
+	/**
+	 * \brief Разморозить уровни стороны, приоритетная цена которых не больше priority_bound.
+	 * \return Живые заявки этих уровней.
+	 */
+	std::vector<ColdOrder> thaw(Order::Type type, price_t priority_bound)
+	{
+		auto side_orders = _alive_orders(type);
+		auto const thawed_end = std::partition_point(side_orders.begin(), side_orders.end(),
+			[type, priority_bound](ColdOrder const &order) { return priority_price(type, order.price) <= priority_bound; }
+		);
+		std::vector<ColdOrder> thawed(side_orders.begin(), thawed_end);
+		side_orders.erase(side_orders.begin(), thawed_end);
+		_rebuild(type, std::move(side_orders));
+		return thawed;
+	}
+	/**
+	 * \brief Приоритетная цена самого близкого к лучшей цене замороженного уровня стороны.
+	 */
+	boost::optional<price_t> best_priority_price(Order::Type type) const
+	{
+		auto const &side = _sides[type];
+		if (side.level_prices.empty())
+			return boost::none;
+		return priority_price(type, side.level_prices.front());
+	}
+
+	boost::optional<ColdOrder> find(order_id_t const &id) const
+	{
+		Order::Type type;
+		size_t position;
+		if (_find(id, type, position) == false)
+			return boost::none;
+		return _order_at(type, position);
+	}
+	/**
+	 * \return Отменённая заявка или boost::none, если такой нет.
+	 */
+	boost::optional<ColdOrder> cancel(order_id_t const &id)
+	{
+		Order::Type type;
+		size_t position;
+		if (_find(id, type, position) == false)
+			return boost::none;
+		auto const order = _order_at(type, position);
+		_sides[type].quantities[position] = 0;
+		--_sides[type].alive_count;
+		return order;
+	}
+
+	/**
+	 * \brief Суммарное количество и число живых заявок уровня.
+	 */
+	std::pair<quantity_t, size_t> level_totals(Order::Type type, price_t price) const
+	{
+		auto const &side = _sides[type];
+		auto const level = std::lower_bound(side.level_prices.begin(), side.level_prices.end(), price,
+			[type](price_t lhs, price_t rhs) { return priority_price(type, lhs) < priority_price(type, rhs); }
+		);
+		std::pair<quantity_t, size_t> totals{ 0, 0 };
+		if (level == side.level_prices.end() || *level != price)
+			return totals;
+
+		auto const index = static_cast<size_t>(level - side.level_prices.begin());
+		for (auto position = _level_begin(side, index); position != side.level_ends[index]; ++position)
+			if (side.quantities[position] != 0)
+			{
+				totals.first += side.quantities[position];
+				++totals.second;
+			}
+		return totals;
+	}
+	/**
+	 * \brief Обойти живые заявки: visitor(ColdOrder const &). Сторона за стороной, в порядке приоритета.
+	 */
+	template<typename VisitorT>
+	void for_each(VisitorT &&visitor) const
+	{
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			for (size_t position = 0; position < _sides[type].ids.size(); ++position)
+				if (_sides[type].quantities[position] != 0)
+					visitor(_order_at(static_cast<Order::Type>(type), position));
+	}
+	/**
+	 * \brief Обойти непустые уровни: visitor(тип, цена, количество, число заявок).
+	 */
+	template<typename VisitorT>
+	void for_each_level(VisitorT &&visitor) const
+	{
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const &side = _sides[type];
+			for (size_t level = 0; level < side.level_prices.size(); ++level)
+			{
+				quantity_t quantity = 0;
+				size_t orders_count = 0;
+				for (auto position = _level_begin(side, level); position != side.level_ends[level]; ++position)
+					if (side.quantities[position] != 0)
+					{
+						quantity += side.quantities[position];
+						++orders_count;
+					}
+				if (orders_count != 0)
+					visitor(static_cast<Order::Type>(type), side.level_prices[level], quantity, orders_count);
+			}
+		}
+	}
+
+	size_t size() const
+	{
+		return _sides[Order::Type::Ask].alive_count + _sides[Order::Type::Bid].alive_count;
+	}
+	bool empty() const
+	{
+		return size() == 0;
+	}
+	/**
+	 * \brief Память массивов, в байтах.
+	 */
+	size_t memory_usage() const
+	{
+		size_t usage = 0;
+		for (auto const &side : _sides)
+			usage += side.level_prices.capacity() * sizeof(price_t)
+				+ side.level_ends.capacity() * sizeof(uint32_t)
+				+ side.ids.capacity() * sizeof(narrow_id_t)
+				+ side.quantities.capacity() * sizeof(quantity_t)
+				+ side.positions_by_id.capacity() * sizeof(IdPosition);
+		return usage;
+	}
+
+private:
+	struct IdPosition
+	{
+		narrow_id_t id;
+		uint32_t position;
+	};
+	struct Side
+	{
+		// \brief Цены уровней от лучшей к худшей и конец заявок каждого уровня в массивах заявок.
+		std::vector<price_t> level_prices;
+		std::vector<uint32_t> level_ends;
+		std::vector<narrow_id_t> ids;
+		std::vector<quantity_t> quantities;
+		std::vector<IdPosition> positions_by_id;
+		size_t alive_count = 0;
+	};
+
+	static uint32_t _level_begin(Side const &side, size_t level)
+	{
+		return level == 0 ? 0 : side.level_ends[level - 1];
+	}
+	ColdOrder _order_at(Order::Type type, size_t position) const
+	{
+		auto const &side = _sides[type];
+		auto const level = std::upper_bound(side.level_ends.begin(), side.level_ends.end(), static_cast<uint32_t>(position));
+		return ColdOrder{ type, side.level_prices[static_cast<size_t>(level - side.level_ends.begin())], side.ids[position], side.quantities[position] };
+	}
+	bool _find(order_id_t const &id, Order::Type &type, size_t &position) const
+	{
+		if (can_be_frozen(id) == false)
+			return false;
+		auto const narrow_id = id.convert_to<narrow_id_t>();
+		for (size_t side_type = 0; side_type < Order::Type::_EnumElementsCount; ++side_type)
+		{
+			auto const &side = _sides[side_type];
+			auto const found = std::lower_bound(side.positions_by_id.begin(), side.positions_by_id.end(), narrow_id,
+				[](IdPosition const &lhs, narrow_id_t rhs) { return lhs.id < rhs; }
+			);
+			if (found != side.positions_by_id.end() && found->id == narrow_id && side.quantities[found->position] != 0)
+			{
+				type = static_cast<Order::Type>(side_type);
+				position = found->position;
+				return true;
+			}
+		}
+		return false;
+	}
+	std::vector<ColdOrder> _alive_orders(Order::Type type) const
+	{
+		std::vector<ColdOrder> orders;
+		orders.reserve(_sides[type].alive_count);
+		for (size_t position = 0; position < _sides[type].ids.size(); ++position)
+			if (_sides[type].quantities[position] != 0)
+				orders.emplace_back(_order_at(type, position));
+		return orders;
+	}
+	void _rebuild(Order::Type type, std::vector<ColdOrder> orders)
+	{
+		std::sort(orders.begin(), orders.end(),
+			[type](ColdOrder const &lhs, ColdOrder const &rhs)
+			{
+				return std::make_tuple(priority_price(type, lhs.price), lhs.id) < std::make_tuple(priority_price(type, rhs.price), rhs.id);
+			}
+		);
+
+		// Собираем в новую сторону, чтобы память массивов ужималась вместе с числом заявок.
+		Side side;
+		side.ids.reserve(orders.size());
+		side.quantities.reserve(orders.size());
+		side.positions_by_id.reserve(orders.size());
+		for (auto const &order : orders)
+		{
+			if (side.level_prices.empty() || side.level_prices.back() != order.price)
+			{
+				side.level_prices.emplace_back(order.price);
+				side.level_ends.emplace_back(static_cast<uint32_t>(side.ids.size()));
+			}
+			side.positions_by_id.emplace_back(IdPosition{ order.id, static_cast<uint32_t>(side.ids.size()) });
+			side.ids.emplace_back(order.id);
+			side.quantities.emplace_back(order.quantity);
+			++side.level_ends.back();
+		}
+		side.level_prices.shrink_to_fit();
+		side.level_ends.shrink_to_fit();
+		std::sort(side.positions_by_id.begin(), side.positions_by_id.end(),
+			[](IdPosition const &lhs, IdPosition const &rhs) { return lhs.id < rhs.id; }
+		);
+		side.alive_count = orders.size();
+		_sides[type] = std::move(side);
+	}
+
+	std::array<Side, Order::Type::_EnumElementsCount> _sides;
+};
+
+#endif
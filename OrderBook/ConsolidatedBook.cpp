@@ -0,0 +1,116 @@
+﻿#include "pch.h"
+
+#include <queue>
+
+#include "ConsolidatedBook.h"
+
+namespace
+{
+	/**
+	 * \brief Слить уровни площадок от лучшего к худшему, складывая уровни с одной ценой, пока не наберётся depth цен.
+	 * \param cursors Непустые диапазоны уровней площадок, каждый от лучшего уровня к худшему.
+	 */
+	template<typename IteratorT, typename IsBetterT>
+	void merge_best_levels(std::vector<std::pair<IteratorT, IteratorT>> cursors, IsBetterT const &is_better, size_t depth, std::vector<PriceLevelView> &top)
+	{
+		using cursor_t = std::pair<IteratorT, IteratorT>;
+		auto const is_worse = [&is_better](cursor_t const &lhs, cursor_t const &rhs) { return is_better(rhs.first->first, lhs.first->first); };
+		std::priority_queue<cursor_t, std::vector<cursor_t>, decltype(is_worse)> heap(is_worse, std::move(cursors));
+
+		top.clear();
+		while (heap.empty() == false)
+		{
+			auto cursor = heap.top();
+			heap.pop();
+
+			auto const &level = cursor.first->second;
+			if (top.empty() == false && top.back().price == level.price)
+			{
+				top.back().quantity += level.quantity;
+				top.back().orders_count += level.orders_count;
+			}
+			else if (top.size() == depth)
+				break;
+			else
+				top.emplace_back(level);
+
+			if (++cursor.first != cursor.second)
+				heap.push(cursor);
+		}
+	}
+}
+
+ConsolidatedBook::ConsolidatedBook(size_t depth)
+	: _depth(depth)
+{
+}
+
+ConsolidatedBook::~ConsolidatedBook()
+{
+	// Слушатели берут блокировку сводного стакана, поэтому отписываемся без неё.
+	decltype(_unsubscribers) unsubscribers;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		unsubscribers.swap(_unsubscribers);
+	}
+	for (auto const &unsubscribe : unsubscribers)
+		unsubscribe();
+}
+
+std::vector<PriceLevelView> ConsolidatedBook::top(Order::Type type) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _top[type];
+}
+
+uint64_t ConsolidatedBook::version() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _version;
+}
+
+void ConsolidatedBook::_on_level_changed(size_t venue, PriceLevelView const &level)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto &levels = _venues[venue].levels[level.type];
+	if (level.orders_count == 0)
+		levels.erase(level.price);
+	else
+		levels[level.price] = level;
+
+	if (_can_affect_top(level.type, level.price) == false)
+		return;
+	_rebuild_top(level.type);
+	++_version;
+}
+
+bool ConsolidatedBook::_can_affect_top(Order::Type type, price_t price) const
+{
+	auto const &top = _top[type];
+	if (top.size() < _depth)
+		return true;
+	return type == Order::Type::Ask
+		? price <= top.back().price
+		: price >= top.back().price;
+}
+
+void ConsolidatedBook::_rebuild_top(Order::Type type)
+{
+	if (type == Order::Type::Ask)
+	{
+		std::vector<std::pair<venue_levels_t::const_iterator, venue_levels_t::const_iterator>> cursors;
+		for (auto const &venue : _venues)
+			if (venue.levels[type].empty() == false)
+				cursors.emplace_back(venue.levels[type].cbegin(), venue.levels[type].cend());
+		merge_best_levels(std::move(cursors), std::less<price_t>(), _depth, _top[type]);
+	}
+	else
+	{
+		std::vector<std::pair<venue_levels_t::const_reverse_iterator, venue_levels_t::const_reverse_iterator>> cursors;
+		for (auto const &venue : _venues)
+			if (venue.levels[type].empty() == false)
+				cursors.emplace_back(venue.levels[type].crbegin(), venue.levels[type].crend());
+		merge_best_levels(std::move(cursors), std::greater<price_t>(), _depth, _top[type]);
+	}
+}
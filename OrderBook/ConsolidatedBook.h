@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#ifndef CONSOLIDATED_BOOK_H
+#define CONSOLIDATED_BOOK_H
+
+#include <array>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "OrderBook.h"
+
+/**
+ * \brief Сводный стакан одного инструмента по нескольким площадкам, по стакану на площадку.
+ * \details Держит N лучших уровней цены каждой стороны, сложенных по всем площадкам.
+ *		Уровни площадок приходят через подписку на изменения уровней, так что полные срезы стаканов не строятся.
+ *		Лучшие уровни пересобираются k-путевым слиянием по куче из лучших уровней площадок, и только если изменился уровень,
+ *		который в них попадает или может попасть.
+ * \warning Стаканы площадок должны жить дольше сводного стакана.
+ */
+class ConsolidatedBook
+	: private boost::noncopyable
+{
+public:
+	explicit ConsolidatedBook(size_t depth);
+	/**
+	 * \brief Отписывается от стаканов площадок.
+	 */
+	~ConsolidatedBook();
+
+	/**
+	 * \brief Добавить площадку.
+	 * \return Номер площадки.
+	 */
+	template<typename BookT>
+	size_t add_venue(BookT &book)
+	{
+		size_t venue;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			venue = _venues.size();
+			_venues.emplace_back();
+		}
+
+		// Подписываемся без блокировки: слушатель сразу получит уровни стакана и возьмёт её сам.
+		auto const subscription_id = book.subscribe_to_level_changes(
+			[this, venue](PriceLevelView const &level) { _on_level_changed(venue, level); }
+		);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_unsubscribers.emplace_back([&book, subscription_id] { book.unsubscribe_from_level_changes(subscription_id); });
+		return venue;
+	}
+
+	/**
+	 * \brief Лучшие уровни стороны, от лучшего к худшему: Ask по возрастанию цены, Bid по убыванию.
+	 */
+	std::vector<PriceLevelView> top(Order::Type type) const;
+	/**
+	 * \brief Номер версии лучших уровней, растёт с каждым их изменением.
+	 */
+	uint64_t version() const;
+
+private:
+	void _on_level_changed(size_t venue, PriceLevelView const &level);
+	/**
+	 * \brief Может ли уровень с такой ценой быть среди лучших уровней стороны.
+	 */
+	bool _can_affect_top(Order::Type type, price_t price) const;
+	/**
+	 * \brief Пересобрать лучшие уровни стороны слиянием лучших уровней площадок.
+	 */
+	void _rebuild_top(Order::Type type);
+
+	// \brief Уровни стороны площадки по возрастанию цены.
+	using venue_levels_t = std::map<price_t, PriceLevelView>;
+	struct Venue
+	{
+		std::array<venue_levels_t, Order::Type::_EnumElementsCount> levels;
+	};
+
+	size_t const _depth;
+
+	std::mutex mutable _mutex;
+	std::vector<Venue> _venues;
+	std::array<std::vector<PriceLevelView>, Order::Type::_EnumElementsCount> _top;
+	uint64_t _version = 0;
+	std::vector<std::function<void()>> _unsubscribers;
+};
+
+#endif
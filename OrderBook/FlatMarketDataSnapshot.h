@@ -0,0 +1,122 @@
+﻿#pragma once
+
+#ifndef FLAT_MARKET_DATA_SNAPSHOT_H
+#define FLAT_MARKET_DATA_SNAPSHOT_H
+
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+#include "Order.h"
+
+/**
+ * \brief Срез в виде двух непрерывных массивов POD записей, по массиву на тип заявки.
+ * \details Записи добавляются в произвольном порядке в заранее выделенные массивы и сортируются по цене один раз, в \ref{sort}.
+ *		Массивы можно обходить, копировать memcpy-ем и сериализовывать как есть.
+ */
+struct FlatMarketDataSnapshot
+{
+	/**
+	 * \brief Заявка среза.
+	 */
+	struct Record
+	{
+		price_t price;
+		quantity_t quantity;
+		order_id_pod_t order_id;
+	};
+	static_assert(std::is_trivially_copyable<Record>::value, "Записи среза должны копироваться memcpy-ем");
+
+	using records_t = std::vector<Record>;
+
+	FlatMarketDataSnapshot() = default;
+
+	/**
+	 * \brief Выделить память под записи заранее, чтобы добавление не перевыделяло массивы.
+	 */
+	void reserve(Order::Type type, size_t records_count)
+	{
+		_orders[type].reserve(records_count);
+	}
+	void add(Order::Type type, price_t price, quantity_t quantity, order_id_t const &order_id)
+	{
+		_orders[type].emplace_back(Record{ price, quantity, to_pod(order_id) });
+	}
+	void add(Order::Type type, price_t price, quantity_t quantity, order_id_pod_t const &order_id)
+	{
+		_orders[type].emplace_back(Record{ price, quantity, order_id });
+	}
+	/**
+	 * \brief Удалить записи, сохранив выделенную под них память, чтобы срез можно было заполнить заново без выделений.
+	 */
+	void clear()
+	{
+		for (auto &records : _orders)
+			records.clear();
+	}
+	/**
+	 * \brief Порядок записей в срезе: по возрастанию цены, а при равной цене раньше идёт заявка, поставленная раньше.
+	 */
+	static bool precedes(Record const &lhs, Record const &rhs)
+	{
+		if (lhs.price != rhs.price)
+			return lhs.price < rhs.price;
+		// id сравниваем со старшего слова.
+		return std::lexicographical_compare(
+			lhs.order_id.rbegin(), lhs.order_id.rend(),
+			rhs.order_id.rbegin(), rhs.order_id.rend()
+		);
+	}
+	/**
+	 * \brief Отсортировать записи в порядке \ref{precedes}.
+	 */
+	void sort()
+	{
+		for (auto &records : _orders)
+			std::sort(records.begin(), records.end(), &precedes);
+	}
+	/**
+	 * \brief Слить уже отсортированные части среза в один срез k-путевым слиянием.
+	 */
+	static FlatMarketDataSnapshot merge(std::vector<FlatMarketDataSnapshot> const &sorted_parts)
+	{
+		FlatMarketDataSnapshot merged;
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			using cursor_t = std::pair<Record const*, Record const*>;
+			auto const cursor_is_after = [](cursor_t const &lhs, cursor_t const &rhs) { return precedes(*rhs.first, *lhs.first); };
+			std::priority_queue<cursor_t, std::vector<cursor_t>, decltype(cursor_is_after)> cursors(cursor_is_after);
+
+			size_t records_count = 0;
+			for (auto const &part : sorted_parts)
+			{
+				auto const &records = part._orders[type];
+				records_count += records.size();
+				if (records.empty() == false)
+					cursors.emplace(records.data(), records.data() + records.size());
+			}
+
+			auto &merged_records = merged._orders[type];
+			merged_records.reserve(records_count);
+			while (cursors.empty() == false)
+			{
+				auto cursor = cursors.top();
+				cursors.pop();
+				merged_records.emplace_back(*cursor.first);
+				if (++cursor.first != cursor.second)
+					cursors.emplace(cursor);
+			}
+		}
+		return merged;
+	}
+
+private:
+	std::array<records_t, Order::Type::_EnumElementsCount> _orders{};
+public:
+	decltype(_orders) const& GetOrders() const
+	{
+		return _orders;
+	}
+};
+
+#endif
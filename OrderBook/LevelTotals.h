@@ -0,0 +1,186 @@
+﻿#pragma once
+
+#ifndef LEVEL_TOTALS_H
+#define LEVEL_TOTALS_H
+
+#include <array>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/optional.hpp>
+
+#include "Order.h"
+#include "TickLadder.h"
+
+/**
+ * \brief Объём и число заявок уровня цены.
+ */
+struct LevelTotal
+{
+	// \brief Цена первой заявки уровня. В лестнице цен это и есть цена уровня: цена шага, вычисленная как min + tick * шаг,
+	//	может отличаться от цены заявок в последних разрядах.
+	price_t price = 0;
+	quantity_t quantity = 0;
+	size_t orders_count = 0;
+
+	bool empty() const
+	{
+		return orders_count == 0;
+	}
+};
+
+/**
+ * \brief Объёмы и числа заявок непустых уровней обеих сторон стакана, от лучшего уровня к худшему.
+ * \details По умолчанию уровни лежат в std::map по цене в порядке приоритета стороны: изменение - O(log уровней) и узел на уровень.
+ *		Для инструмента с известным диапазоном цен и шагом(\ref{use_tick_ladder}) - в \ref{BasicTickLadder}:
+ *		изменение - индекс в массиве, лучший уровень и обход - по битовой карте занятости, без узлов и аллокаций.
+ * \warning Не потокобезопасно.
+ */
+class LevelTotals
+{
+public:
+	/**
+	 * \brief Хранить уровни в лестнице цен.
+	 * \throw std::logic_error если уровни уже есть.
+	 * \throw std::invalid_argument если шаг не положителен или диапазон пуст.
+	 */
+	void use_tick_ladder(price_t min_price, price_t max_price, price_t tick_size)
+	{
+		if (empty(Order::Type::Ask) == false || empty(Order::Type::Bid) == false)
+			throw std::logic_error("Price levels can be moved to a tick ladder only while there are none");
+		_ladder = std::make_unique<BasicTickLadder<LevelTotal>>(min_price, max_price, tick_size);
+	}
+	bool is_tick_ladder() const
+	{
+		return _ladder != nullptr;
+	}
+	/**
+	 * \brief Проверить, что уровень с такой ценой можно завести.
+	 * \throw std::out_of_range если цена вне диапазона лестницы.
+	 * \throw std::invalid_argument если цена не кратна шагу лестницы.
+	 */
+	void validate_price(price_t price) const
+	{
+		if (_ladder)
+			_ladder->to_tick(price);
+	}
+
+	void add(Order::Type type, price_t price, quantity_t quantity)
+	{
+		_modify(type, price, [quantity](LevelTotal &level)
+		{
+			level.quantity += quantity;
+			++level.orders_count;
+		});
+	}
+	/**
+	 * \param removed_count 1, если заявка из уровня ушла, иначе 0. Уровень без заявок удаляется.
+	 */
+	void subtract(Order::Type type, price_t price, quantity_t quantity, size_t removed_count)
+	{
+		_modify(type, price, [quantity, removed_count](LevelTotal &level)
+		{
+			level.quantity -= quantity;
+			level.orders_count -= removed_count;
+		});
+	}
+
+	/**
+	 * \brief Цена уровня, на который встанет заявка с такой ценой: у непустого уровня лестницы - \ref{LevelTotal::price}.
+	 * \details Так сравнения и уведомления по цене заявки видят ту же цену, что публикуется для уровня.
+	 */
+	price_t level_price(Order::Type type, price_t price) const
+	{
+		if (_ladder == nullptr)
+			return price;
+		auto const &level = _ladder->level(type, price);
+		return level.empty() ? price : level.price;
+	}
+	/**
+	 * \brief Итоги уровня. У уровня без заявок orders_count - 0.
+	 */
+	LevelTotal find(Order::Type type, price_t price) const
+	{
+		if (_ladder)
+			return _ladder->level(type, price);
+		auto const &levels = _levels[type];
+		auto const level = levels.find(_priority_price(type, price));
+		return level != levels.end() ? level->second : LevelTotal{};
+	}
+	/**
+	 * \brief Цена и итоги лучшего уровня стороны, или boost::none, если сторона пуста.
+	 */
+	boost::optional<std::pair<price_t, LevelTotal>> best(Order::Type type) const
+	{
+		boost::optional<std::pair<price_t, LevelTotal>> best_level;
+		for_each_level(type, 1, [&best_level](price_t price, LevelTotal const &level) { best_level.emplace(price, level); });
+		return best_level;
+	}
+	bool empty(Order::Type type) const
+	{
+		return best(type).is_initialized() == false;
+	}
+	/**
+	 * \brief Обойти не больше max_levels лучших уровней стороны: visitor(цена, LevelTotal const &).
+	 */
+	template<typename VisitorT>
+	void for_each_level(Order::Type type, size_t max_levels, VisitorT &&visitor) const
+	{
+		if (_ladder)
+			return _ladder->for_each_level(type, max_levels, [&visitor](price_t, LevelTotal const &level) { visitor(level.price, level); });
+		auto const &levels = _levels[type];
+		for (auto level = levels.begin(); level != levels.end() && max_levels != 0; ++level, --max_levels)
+			visitor(_priority_price(type, level->first), level->second);
+	}
+
+	/**
+	 * \brief Память уровней: узлы std::map(значение, три указателя и цвет) или массивы лестницы.
+	 */
+	size_t memory_usage() const
+	{
+		if (_ladder)
+			return _ladder->memory_usage();
+		size_t usage = 0;
+		for (auto const &levels : _levels)
+			usage += levels.size() * (sizeof(levels_t::value_type) + 4 * sizeof(void*));
+		return usage;
+	}
+
+private:
+	using levels_t = std::map<price_t, LevelTotal>;
+
+	template<typename ModifierT>
+	void _modify(Order::Type type, price_t price, ModifierT &&modifier)
+	{
+		if (_ladder)
+			return _ladder->modify(type, price, [price, &modifier](LevelTotal &level)
+			{
+				if (level.empty())
+					level.price = price;
+				modifier(level);
+			});
+		auto &levels = _levels[type];
+		auto const priority_price = _priority_price(type, price);
+		auto level = levels.lower_bound(priority_price);
+		if (level == levels.end() || level->first != priority_price)
+			level = levels.emplace_hint(level, priority_price, LevelTotal{ price });
+		modifier(level->second);
+		if (level->second.empty())
+			levels.erase(level);
+	}
+	/**
+	 * \brief Цена в порядке приоритета стороны: меньше - ближе к лучшей цене. Преобразование обратно - то же.
+	 */
+	static price_t _priority_price(Order::Type type, price_t price)
+	{
+		return type == Order::Type::Bid ? -price : price;
+	}
+
+	// \brief Уровни сторон по приоритетной цене, пока нет лестницы.
+	std::array<levels_t, Order::Type::_EnumElementsCount> _levels;
+	std::unique_ptr<BasicTickLadder<LevelTotal>> _ladder;
+};
+
+#endif
@@ -4,10 +4,16 @@
 #define MARKET_DATA_SNAPSHOT_H
 
 #include "OrderBook.h"
+#include "FlatMarketDataSnapshot.h"
 
 struct MarketDataSnapshot
 {
 	MarketDataSnapshot() = default;
+	/**
+	 * \brief Построить срез из плоского среза, для кода, которому нужен \ref{GetOrders}.
+	 * \details Записи плоского среза уже отсортированы, так что каждая вставляется в конец за амортизированное O(1).
+	 */
+	explicit MarketDataSnapshot(FlatMarketDataSnapshot const &flat_snapshot);
 
 	template<typename OrdersContainerT>
 	void add_orders(OrdersContainerT const &orders);
@@ -37,9 +43,26 @@ inline void MarketDataSnapshot::add_orders(OrdersContainerT const &orders_contai
 {
 	for (auto const &order : orders_container)
 	{
+		// Отменённая заявка, узел которой стакан ещё не удалил.
+		if (order.GetQuantity() == 0)
+			continue;
 		auto order_copy = order;
 		_orders[order.GetType()].emplace(std::move(order_copy));
 	}
 }
 
+inline MarketDataSnapshot::MarketDataSnapshot(FlatMarketDataSnapshot const &flat_snapshot)
+{
+	for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+	{
+		auto &orders = _orders[type];
+		for (auto const &record : flat_snapshot.GetOrders()[type])
+			orders.emplace_hint(
+				orders.end(),
+				from_pod(record.order_id),
+				std::make_unique<Order>(static_cast<Order::Type>(type), record.price, record.quantity)
+			);
+	}
+}
+
 #endif
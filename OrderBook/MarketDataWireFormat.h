@@ -0,0 +1,364 @@
+﻿#pragma once
+
+#ifndef MARKET_DATA_WIRE_FORMAT_H
+#define MARKET_DATA_WIRE_FORMAT_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "FlatMarketDataSnapshot.h"
+#include "OrderBook.h"
+
+/* Компактное двоичное представление рыночных данных для рассылки.
+ * Цены передаются в шагах цены разностью с предыдущей ценой, а все целые - varint-ами(по 7 бит в байте, младшие байты вперёд),
+ * так что запись заявки обычно занимает несколько байт вместо 56 байт \ref{FlatMarketDataSnapshot::Record}.
+ * Кодирование пишет в буфер вызывающего, а декодирование - в его срез или выходной итератор, так что ничего не выделяется.
+ *
+ * Формат:
+ *	Заявки среза:	Content::Orders, затем для Ask и Bid: число заявок, и на каждую заявку
+ *					разность цены в шагах(zigzag), количество, число значащих 64-битных слов id и сами слова, с младшего.
+ *	Уровни цены:	Content::Levels, число уровней, и на каждый уровень
+ *					(разность цены в шагах(zigzag) << 1 | тип заявки), количество, число заявок уровня. id уровней не нужны.
+ *					Так передаются и агрегированный срез, и изменения уровней: уровень с нулём заявок из стакана ушёл.
+ *	Событие реплики: Content::Replication, вид события, id, количество, контрольная сумма, а для Rest ещё
+ *					(тип заявки << 2 | время действия), цена - битами double, чтобы реплика восстановила её точно, и срок(zigzag).
+ * Разность первой цены считается от нуля. Шаг цены в поток не пишется: передающая и принимающая стороны знают его заранее.
+ */
+namespace wire_format
+{
+	enum class Content : uint8_t
+	{
+		Orders = 1,
+		Levels = 2,
+		Replication = 3
+	};
+
+	namespace details
+	{
+		size_t constexpr max_varint_size = 10;
+		size_t constexpr max_order_id_size = 1 + std::tuple_size<order_id_pod_t>::value * max_varint_size;
+
+		inline uint64_t zigzag(int64_t value)
+		{
+			return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+		}
+		inline int64_t unzigzag(uint64_t value)
+		{
+			return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+		}
+
+		inline uint64_t price_bits(price_t price)
+		{
+			static_assert(sizeof(price_t) == sizeof(uint64_t), "Prices are sent as 64-bit patterns");
+			uint64_t bits;
+			std::memcpy(&bits, &price, sizeof(bits));
+			return bits;
+		}
+		inline price_t price_from_bits(uint64_t bits)
+		{
+			price_t price;
+			std::memcpy(&price, &bits, sizeof(price));
+			return price;
+		}
+
+		/**
+		 * \brief Цена в шагах цены.
+		 * \throw std::invalid_argument если цена не кратна шагу.
+		 */
+		inline int64_t to_ticks(price_t price, price_t tick_size)
+		{
+			auto const ticks = std::llround(price / tick_size);
+			if (std::abs(static_cast<price_t>(ticks) * tick_size - price) > tick_size * 1e-6)
+				throw std::invalid_argument("The price is not a multiple of the tick size");
+			return ticks;
+		}
+
+		class Writer
+		{
+		public:
+			Writer(uint8_t *buffer, size_t buffer_size)
+				: _begin(buffer)
+				, _current(buffer)
+				, _end(buffer + buffer_size)
+			{
+			}
+
+			/**
+			 * \throw std::length_error если в буфере не хватает места.
+			 */
+			void varint(uint64_t value)
+			{
+				// Место проверяем раз на число, а не на каждый байт.
+				if (static_cast<size_t>(_end - _current) < max_varint_size && static_cast<size_t>(_end - _current) < _varint_size(value))
+					throw std::length_error("The buffer is too small for the encoded market data");
+				while (value >= 0x80)
+				{
+					*_current++ = static_cast<uint8_t>(value | 0x80);
+					value >>= 7;
+				}
+				*_current++ = static_cast<uint8_t>(value);
+			}
+			void order_id(order_id_pod_t const &id)
+			{
+				size_t words_count = id.size();
+				while (words_count != 0 && id[words_count - 1] == 0)
+					--words_count;
+				varint(words_count);
+				for (size_t word = 0; word < words_count; ++word)
+					varint(id[word]);
+			}
+
+			size_t size() const
+			{
+				return static_cast<size_t>(_current - _begin);
+			}
+
+		private:
+			static size_t _varint_size(uint64_t value)
+			{
+				size_t size = 1;
+				for (; value >= 0x80; value >>= 7)
+					++size;
+				return size;
+			}
+
+			uint8_t *const _begin;
+			uint8_t *_current;
+			uint8_t *const _end;
+		};
+
+		class Reader
+		{
+		public:
+			Reader(uint8_t const *data, size_t data_size)
+				: _begin(data)
+				, _current(data)
+				, _end(data + data_size)
+			{
+			}
+
+			/**
+			 * \throw std::invalid_argument если данные оборваны или число длиннее 64 бит.
+			 */
+			uint64_t varint()
+			{
+				uint64_t value = 0;
+				for (unsigned shift = 0; shift < 64; shift += 7)
+				{
+					if (_current == _end)
+						throw std::invalid_argument("The encoded market data are truncated");
+					auto const byte = *_current++;
+					value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+					if ((byte & 0x80) == 0)
+						return value;
+				}
+				throw std::invalid_argument("The encoded market data contain a malformed varint");
+			}
+			order_id_pod_t order_id()
+			{
+				auto const words_count = varint();
+				if (words_count > std::tuple_size<order_id_pod_t>::value)
+					throw std::invalid_argument("The encoded market data contain a malformed order id");
+				order_id_pod_t id{};
+				for (size_t word = 0; word < words_count; ++word)
+					id[word] = varint();
+				return id;
+			}
+			void content(Content expected)
+			{
+				if (varint() != static_cast<uint64_t>(expected))
+					throw std::invalid_argument("The encoded market data have unexpected content");
+			}
+
+			size_t size() const
+			{
+				return static_cast<size_t>(_current - _begin);
+			}
+
+		private:
+			uint8_t const *const _begin;
+			uint8_t const *_current;
+			uint8_t const *const _end;
+		};
+	}
+
+	/**
+	 * \brief Размер буфера, которого точно хватит для заявок среза.
+	 */
+	inline size_t max_encoded_size(FlatMarketDataSnapshot const &snapshot)
+	{
+		size_t size = 1;
+		for (auto const &records : snapshot.GetOrders())
+			size += details::max_varint_size + records.size() * (2 * details::max_varint_size + details::max_order_id_size);
+		return size;
+	}
+	/**
+	 * \brief Размер буфера, которого точно хватит для levels_count уровней цены.
+	 */
+	inline size_t max_encoded_levels_size(size_t levels_count)
+	{
+		return 1 + details::max_varint_size + levels_count * 3 * details::max_varint_size;
+	}
+
+	/**
+	 * \brief Закодировать заявки среза.
+	 * \throw std::length_error если в буфере не хватает места. Хватит \ref{max_encoded_size}.
+	 * \throw std::invalid_argument если цена заявки не кратна tick_size.
+	 * \return Число записанных байт.
+	 */
+	inline size_t encode(FlatMarketDataSnapshot const &snapshot, price_t tick_size, uint8_t *buffer, size_t buffer_size)
+	{
+		details::Writer writer(buffer, buffer_size);
+		writer.varint(static_cast<uint64_t>(Content::Orders));
+		int64_t previous_ticks = 0;
+		for (auto const &records : snapshot.GetOrders())
+		{
+			writer.varint(records.size());
+			for (auto const &record : records)
+			{
+				auto const ticks = details::to_ticks(record.price, tick_size);
+				writer.varint(details::zigzag(ticks - previous_ticks));
+				previous_ticks = ticks;
+				writer.varint(record.quantity);
+				writer.order_id(record.order_id);
+			}
+		}
+		return writer.size();
+	}
+	/**
+	 * \brief Декодировать заявки среза в snapshot, заменив его записи.
+	 * \details Память под записи снимка переиспользуется, так что повторное декодирование в тот же срез не выделяет память.
+	 * \throw std::invalid_argument если данные повреждены или оборваны.
+	 * \return Число прочитанных байт.
+	 */
+	inline size_t decode(uint8_t const *data, size_t data_size, price_t tick_size, FlatMarketDataSnapshot &snapshot)
+	{
+		details::Reader reader(data, data_size);
+		reader.content(Content::Orders);
+		snapshot.clear();
+		int64_t ticks = 0;
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const records_count = reader.varint();
+			// Заявок не может быть больше, чем байт в данных: так повреждённое число не выделит лишней памяти.
+			if (records_count > data_size)
+				throw std::invalid_argument("The encoded market data contain a malformed orders count");
+			snapshot.reserve(static_cast<Order::Type>(type), records_count);
+			for (size_t record = 0; record < records_count; ++record)
+			{
+				ticks += details::unzigzag(reader.varint());
+				auto const quantity = reader.varint();
+				snapshot.add(static_cast<Order::Type>(type), static_cast<price_t>(ticks) * tick_size, quantity, reader.order_id());
+			}
+		}
+		return reader.size();
+	}
+
+	/**
+	 * \brief Закодировать уровни цены, например из \ref{BasicOrderBook::copy_snapshot_levels} или подписки на изменения уровней.
+	 * \throw std::length_error если в буфере не хватает места. Хватит \ref{max_encoded_levels_size}.
+	 * \throw std::invalid_argument если цена уровня не кратна tick_size.
+	 * \return Число записанных байт.
+	 */
+	template<typename ForwardIteratorT>
+	size_t encode_levels(ForwardIteratorT first, ForwardIteratorT last, price_t tick_size, uint8_t *buffer, size_t buffer_size)
+	{
+		details::Writer writer(buffer, buffer_size);
+		writer.varint(static_cast<uint64_t>(Content::Levels));
+		writer.varint(static_cast<uint64_t>(std::distance(first, last)));
+		int64_t previous_ticks = 0;
+		for (; first != last; ++first)
+		{
+			PriceLevelView const &level = *first;
+			auto const ticks = details::to_ticks(level.price, tick_size);
+			writer.varint(details::zigzag(ticks - previous_ticks) << 1 | level.type);
+			previous_ticks = ticks;
+			writer.varint(level.quantity);
+			writer.varint(level.orders_count);
+		}
+		return writer.size();
+	}
+	/**
+	 * \brief Декодировать уровни цены в выходной итератор.
+	 * \throw std::invalid_argument если данные повреждены или оборваны.
+	 * \return Число прочитанных байт.
+	 */
+	template<typename OutputIteratorT>
+	size_t decode_levels(uint8_t const *data, size_t data_size, price_t tick_size, OutputIteratorT out)
+	{
+		details::Reader reader(data, data_size);
+		reader.content(Content::Levels);
+		auto const levels_count = reader.varint();
+		int64_t ticks = 0;
+		for (uint64_t level = 0; level < levels_count; ++level)
+		{
+			auto const price_and_type = reader.varint();
+			ticks += details::unzigzag(price_and_type >> 1);
+			PriceLevelView decoded{};
+			decoded.type = static_cast<Order::Type>(price_and_type & 1);
+			decoded.price = static_cast<price_t>(ticks) * tick_size;
+			decoded.quantity = reader.varint();
+			decoded.orders_count = reader.varint();
+			*out++ = decoded;
+		}
+		return reader.size();
+	}
+
+	size_t constexpr max_encoded_replication_event_size = 1 + 2 * details::max_varint_size + details::max_order_id_size + 4 * details::max_varint_size;
+
+	/**
+	 * \brief Закодировать событие реплики, см. \ref{BasicOrderBook::subscribe_to_replication}.
+	 * \details Поток событий можно передавать реплике в другом процессе через любой упорядоченный канал, например локальный сокет.
+	 * \throw std::length_error если в буфере не хватает места. Хватит \ref{max_encoded_replication_event_size}.
+	 * \return Число записанных байт.
+	 */
+	inline size_t encode_replication_event(ReplicationEvent const &event, uint8_t *buffer, size_t buffer_size)
+	{
+		details::Writer writer(buffer, buffer_size);
+		writer.varint(static_cast<uint64_t>(Content::Replication));
+		writer.varint(static_cast<uint64_t>(event.kind));
+		writer.order_id(to_pod(event.order_id));
+		writer.varint(event.quantity);
+		writer.varint(event.checksum);
+		if (event.kind == ReplicationEvent::Kind::Rest)
+		{
+			writer.varint(static_cast<uint64_t>(event.type) << 2 | event.time_in_force);
+			writer.varint(details::price_bits(event.price));
+			writer.varint(details::zigzag(event.expire_at.time_since_epoch().count()));
+		}
+		return writer.size();
+	}
+	/**
+	 * \brief Декодировать событие реплики.
+	 * \throw std::invalid_argument если данные повреждены или оборваны.
+	 * \return Число прочитанных байт.
+	 */
+	inline size_t decode_replication_event(uint8_t const *data, size_t data_size, ReplicationEvent &event)
+	{
+		details::Reader reader(data, data_size);
+		reader.content(Content::Replication);
+		auto const kind = reader.varint();
+		if (kind > static_cast<uint64_t>(ReplicationEvent::Kind::IdAdvance))
+			throw std::invalid_argument("The encoded replication event has unknown kind");
+		event = ReplicationEvent{};
+		event.kind = static_cast<ReplicationEvent::Kind>(kind);
+		event.order_id = from_pod(reader.order_id());
+		event.quantity = reader.varint();
+		event.checksum = reader.varint();
+		if (event.kind == ReplicationEvent::Kind::Rest)
+		{
+			auto const type_and_time_in_force = reader.varint();
+			if ((type_and_time_in_force >> 2) >= Order::Type::_EnumElementsCount)
+				throw std::invalid_argument("The encoded replication event has unknown order type");
+			event.type = static_cast<Order::Type>(type_and_time_in_force >> 2);
+			event.time_in_force = static_cast<Order::TimeInForce>(type_and_time_in_force & 3);
+			event.price = details::price_from_bits(reader.varint());
+			event.expire_at = expiration_time_t(expiration_time_t::duration(details::unzigzag(reader.varint())));
+		}
+		return reader.size();
+	}
+}
+
+#endif
@@ -3,11 +3,30 @@
 #ifndef ORDER_H
 #define ORDER_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
 
 using order_id_t = boost::multiprecision::uint256_t;
 using price_t = double;
 using quantity_t = size_t;
+using expiration_time_t = std::chrono::system_clock::time_point;
+// \brief id заявки в виде POD: 64-битные слова, начиная с младшего. Для плоских структур и сериализации.
+using order_id_pod_t = std::array<uint64_t, 4>;
+
+inline order_id_pod_t to_pod(order_id_t const &id)
+{
+	order_id_pod_t pod{};
+	boost::multiprecision::export_bits(id, pod.begin(), 64, false);
+	return pod;
+}
+inline order_id_t from_pod(order_id_pod_t const &pod)
+{
+	order_id_t id;
+	boost::multiprecision::import_bits(id, pod.begin(), pod.end(), 64, false);
+	return id;
+}
 
 struct Order
 {
@@ -17,15 +36,51 @@ struct Order
 		Bid = 1,
 		_EnumElementsCount
 	};
+	/**
+	 * \brief Срок действия заявки.
+	 */
+	enum TimeInForce : uint8_t
+	{
+		// Действует до отмены: неисполненный остаток помещается в стакан.
+		GoodTillCancel = 0,
+		// Исполнить немедленно то, что можно, а неисполненный остаток отменить.
+		ImmediateOrCancel = 1,
+		// Исполнить немедленно и полностью, иначе не исполнять вовсе.
+		FillOrKill = 2,
+		// Действует до указанного момента: неисполненный остаток помещается в стакан и снимается по истечении срока.
+		GoodTillDate = 3
+	};
 	
 	Type type;
 	price_t price;
-	quantity_t quantity;
+	// \brief Неисполненный остаток. Остаток заявки стакана отмена обнуляет без блокировки стакана, поэтому он атомарный.
+	std::atomic<quantity_t> quantity;
+	TimeInForce time_in_force;
+	// \brief Момент истечения срока заявки. Имеет смысл только для GoodTillDate.
+	expiration_time_t expire_at;
 
-	Order(Type type, price_t price, quantity_t quantity) noexcept
+	Order(Type type, price_t price, quantity_t quantity, TimeInForce time_in_force = TimeInForce::GoodTillCancel) noexcept
+		: type(type)
+		, price(price)
+		, quantity(quantity)
+		, time_in_force(time_in_force)
+		, expire_at((expiration_time_t::max)())
+	{
+	}
+	Order(Type type, price_t price, quantity_t quantity, expiration_time_t expire_at) noexcept
 		: type(type)
 		, price(price)
 		, quantity(quantity)
+		, time_in_force(TimeInForce::GoodTillDate)
+		, expire_at(expire_at)
+	{
+	}
+	Order(Order const &other) noexcept
+		: type(other.type)
+		, price(other.price)
+		, quantity(other.quantity.load(std::memory_order_relaxed))
+		, time_in_force(other.time_in_force)
+		, expire_at(other.expire_at)
 	{
 	}
 };
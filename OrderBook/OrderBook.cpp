@@ -1,34 +1,56 @@
 ﻿#include "pch.h"
 
+#include <deque>
+#include <map>
+
+#include <boost/thread/latch.hpp>
+
 #include "OrderBook.h"
+#include "ColdLevels.h"
+#include "LevelTotals.h"
 #include "MarketDataSnapshot.h"
+#include "seqlock.h"
+#include "striped_hash_map.h"
+#include "timer_wheel.h"
+#include "tracing.h"
+#include "SharedMemoryBookView.h"
 
 namespace details
 {
 	namespace
 	{
-		template<typename OrdersMultiIndexContainerT>
-		boost::optional<OrderData> cancel(order_id_t const &id, boost::shared_mutex &container_mutex, OrdersMultiIndexContainerT &container)
+		/**
+		 * \param on_cancelled Вызывается с отменённой заявкой, пока write lock ещё взят.
+		 */
+		template<typename OrdersMultiIndexContainerT, typename MutexT, typename OnCancelledT>
+		boost::optional<OrderData> cancel(order_id_t const &id, MutexT &container_mutex, OrdersMultiIndexContainerT &container, OnCancelledT &&on_cancelled)
 		{
-			boost::optional<OrderData> ret_val = boost::none;
-			boost::upgrade_lock<boost::shared_mutex> read_lock(container_mutex);
-
 			auto& orders_by_id = container.template get<OrdersById>();
-			auto const order_iter = orders_by_id.find(id);
-			if (order_iter != orders_by_id.end())
+			/* Отменяют обычно то, что есть, но стакан и буфер проверяются по очереди, так что промах тоже частый.
+			 * Поэтому ищем под read lock-ом, а write lock берём, только если нашли. Апгрейд блокировки дороже повторного поиска.
+			 */
 			{
-				boost::upgrade_to_unique_lock<boost::shared_mutex> write_lock(read_lock);
-				ret_val = std::move(order_iter.get_node()->value());
-				orders_by_id.erase(order_iter);
+				boost::shared_lock<MutexT> read_lock(container_mutex);
+				if (orders_by_id.find(id) == orders_by_id.end())
+					return boost::none;
 			}
 
+			boost::unique_lock<MutexT> write_lock(container_mutex);
+			auto const order_iter = orders_by_id.find(id);
+			// Пока блокировка была снята, заявку могли отменить, свести или снять по сроку.
+			if (order_iter == orders_by_id.end())
+				return boost::none;
+
+			boost::optional<OrderData> ret_val = std::move(order_iter.get_node()->value());
+			orders_by_id.erase(order_iter);
+			on_cancelled(*ret_val);
 			return std::move(ret_val);
 		}
 
-		template<typename OrdersMultiIndexContainerT>
-		boost::optional<OrderData> get_data(order_id_t const &id, boost::shared_mutex &container_mutex, OrdersMultiIndexContainerT &container)
+		template<typename OrdersMultiIndexContainerT, typename MutexT>
+		boost::optional<OrderData> get_data(order_id_t const &id, MutexT &container_mutex, OrdersMultiIndexContainerT &container)
 		{
-			boost::shared_lock<boost::shared_mutex> read_lock(container_mutex);
+			boost::shared_lock<MutexT> read_lock(container_mutex);
 			auto& orders_by_id = container.template get<OrdersById>();
 			auto const order_iter = orders_by_id.find(id);
 			if (order_iter != orders_by_id.end())
@@ -40,6 +62,84 @@ namespace details
 			return boost::none;
 		}
 
+		/**
+		 * \brief Потоки параллельных фаз построения срезов, общие для всех стаканов процесса.
+		 * \details Запускаются при первом параллельном срезе и работают до конца процесса,
+		 *		так что срез, копируемый под блокировками, не ждёт запуска и завершения потоков.
+		 */
+		class ParallelWorkers
+			: private boost::noncopyable
+		{
+		public:
+			static ParallelWorkers &instance()
+			{
+				static ParallelWorkers workers;
+				return workers;
+			}
+
+			size_t size() const
+			{
+				return _workers.size();
+			}
+			void post(size_t worker, std::function<void()> task)
+			{
+				_workers[worker % _workers.size()].GetService().post(std::move(task));
+			}
+
+		private:
+			// Один поток из hardware_concurrency - вызывающий.
+			ParallelWorkers()
+				: _workers((std::max)(1u, boost::thread::hardware_concurrency()) - 1)
+			{
+				for (auto &worker : _workers)
+					worker.StartTasksExecution();
+			}
+			~ParallelWorkers()
+			{
+				for (auto &worker : _workers)
+					worker.StopTasksExecution();
+			}
+
+			std::vector<tools::async::TasksExecutor> _workers;
+		};
+
+		/**
+		 * \brief Исполнить function(0) .. function(tasks_count - 1) параллельно, в потоках \ref{ParallelWorkers}.
+		 * \details Нулевая задача исполняется в вызывающем потоке. Исключение из задачи пробрасывается после завершения всех задач.
+		 */
+		template<typename FunctionT>
+		void parallel_for(size_t tasks_count, FunctionT const &function)
+		{
+			std::vector<std::exception_ptr> errors(tasks_count);
+			auto const run = [&function, &errors](size_t task)
+			{
+				try { function(task); }
+				catch (...) { errors[task] = std::current_exception(); }
+			};
+
+			auto &workers = ParallelWorkers::instance();
+			if (workers.size() == 0)
+			{
+				for (size_t task = 0; task < tasks_count; ++task)
+					run(task);
+			}
+			else
+			{
+				boost::latch done(tasks_count - 1);
+				for (size_t task = 1; task < tasks_count; ++task)
+					workers.post(task - 1, [&run, &done, task]
+					{
+						run(task);
+						done.count_down();
+					});
+				run(0);
+				done.wait();
+			}
+			for (auto const &error : errors)
+				if (error)
+					std::rethrow_exception(error);
+		}
+
 		template<typename ContainerT, typename MutexT>
 		struct ContainerWithSynchronization
 		{
@@ -50,44 +150,151 @@ namespace details
 	}
 }
 
-class OrderBook::Impl
+template<typename LockPolicyT>
+class BasicOrderBook<LockPolicyT>::Impl
 {
+	using mutex_t = typename LockPolicyT::mutex_t;
+	static constexpr bool _is_thread_confined = LockPolicyT::is_thread_confined;
+
 public:
-	Impl()
+	/**
+	 * \param shared_orders_merger Исполнитель сведения, общий с другими стаканами, или nullptr, чтобы завести свой.
+	 */
+	explicit Impl(tools::async::TasksExecutor *shared_orders_merger)
+		: _orders_merger(shared_orders_merger != nullptr ? *shared_orders_merger : _own_orders_merger)
+		, _is_orders_merger_shared(shared_orders_merger != nullptr)
 	{
-		_orders_merger.StartTasksExecution();
+		_publish_analytics();
+		// Стаканом пользуется один поток, он же и сводит заявки.
+		if (_is_thread_confined)
+		{
+			if (_is_orders_merger_shared)
+				throw std::logic_error("A thread-confined book merges orders in the caller thread and can't use a shared merger");
+			return;
+		}
+
+		if (_is_orders_merger_shared == false)
+			_orders_merger.StartTasksExecution();
 	}
 	~Impl()
 	{
-		_orders_merger.StopTasksExecution();
+		stop_async_operations();
+		// Общий исполнитель останавливает его владелец, до разрушения стакана.
+		if (_is_orders_merger_shared == false)
+			_orders_merger.StopTasksExecution();
+	}
+
+	void queue_async_operation(std::function<void()> operation)
+	{
+		if (_is_thread_confined)
+			throw std::logic_error("Asynchronous operations are not available for a thread-confined book");
+
+		std::call_once(_async_operations_started, [this] { _async_operations.StartTasksExecution(); });
+		_async_operations.GetService().post(std::move(operation));
+	}
+	/**
+	 * \brief Остановить поток асинхронных операций. Неисполненные операции отбрасываются.
+	 * \details Операции обращаются к стакану через его публичный интерфейс, поэтому останавливать их надо раньше всего остального.
+	 */
+	void stop_async_operations()
+	{
+		_async_operations.StopTasksExecution();
 	}
 
 	order_id_t post(std::unique_ptr<Order> order)
 	{
-		boost::unique_lock<boost::shared_mutex> merging_orders_read_lock(_merging.mutex);
+		_throw_if_replica();
+		if (_can_rest_in_book(order->time_in_force) == false)
+			return execute(std::move(order)).order_id;
+
+		boost::unique_lock<mutex_t> merging_orders_read_lock(_merging.mutex);
+		_level_totals.validate_price(order->price);
 		/* \warning Не будем лочить \ref{_id_counter} отдельно, ибо здесь всёравно гуляет не больше 1 потока, поскольку это контекст write lock-a.
 		 *		И \ref{_id_counter} изменяется только здесь. В связи со всем этим дополнительной синхронизации не надо.
 		 */
 		auto order_id = ++_id_counter;
 
-		auto& merging_orders_by_id = _merging.container.get<OrdersById>();
+		auto& merging_orders_by_id = _merging.container.template get<OrdersById>();
 		auto merging_order_iter = merging_orders_by_id.find(order_id);
 		assert(merging_order_iter == merging_orders_by_id.end());
 
 		merging_order_iter = merging_orders_by_id.emplace_hint(merging_order_iter, OrderData(order_id, std::move(order)));
 		assert(merging_order_iter != _merging.container.end());
 
-		_orders_merger.GetService().post([this, order_id]() mutable { _merge(std::move(order_id)); return true; });
+		_schedule_merging();
+		merging_orders_read_lock.unlock();
+		_merge_in_caller_thread_if_confined();
 		
 		return order_id;
 	}
+
+	std::vector<order_id_t> post_batch(std::vector<std::unique_ptr<Order>> orders)
+	{
+		_throw_if_replica();
+		auto const is_immediate = [](std::unique_ptr<Order> const &order) { return _can_rest_in_book(order->time_in_force) == false; };
+		if (std::any_of(orders.begin(), orders.end(), is_immediate))
+			throw std::invalid_argument("Immediate-or-cancel and fill-or-kill orders can't be posted in a batch");
+
+		std::vector<order_id_t> orders_ids;
+		if (orders.empty())
+			return orders_ids;
+		orders_ids.reserve(orders.size());
+
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex);
+		for (auto const &order : orders)
+			_level_totals.validate_price(order->price);
+		auto& merging_orders_by_id = _merging.container.template get<OrdersById>();
+		for (auto &order : orders)
+		{
+			orders_ids.emplace_back(++_id_counter);
+			merging_orders_by_id.emplace(OrderData(orders_ids.back(), std::move(order)));
+		}
+
+		_schedule_merging();
+		merging_orders_write_lock.unlock();
+		_merge_in_caller_thread_if_confined();
+
+		return orders_ids;
+	}
+
+	OrderData execute(std::unique_ptr<Order> order)
+	{
+		// Если сведение прервут, то обещание разрушится не исполненным и ожидающий получит broken_promise.
+		auto result = std::make_shared<boost::promise<OrderData>>();
+		auto execution_result = result->get_future();
+		execute(std::move(order), [result](OrderData executed) { result->set_value(std::move(executed)); });
+		return execution_result.get();
+	}
+	/**
+	 * \brief Поставить заявку IOC или FOK на сведение.
+	 * \param on_executed Вызывается в потоке сведения, под его блокировками, с данными заявки после исполнения.
+	 */
+	void execute(std::unique_ptr<Order> order, std::function<void(OrderData)> on_executed)
+	{
+		_throw_if_replica();
+		if (_can_rest_in_book(order->time_in_force))
+			throw std::invalid_argument("Only immediate-or-cancel and fill-or-kill orders can be executed immediately");
+
+		{
+			boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex);
+			// В буфер, видимый срезам, заявка не попадает, но ждёт сведения в общей очереди, чтобы свестись в порядке поступления.
+			_pending_executions.emplace_back(PendingExecution{ OrderData(++_id_counter, std::move(order)), std::move(on_executed) });
+			_schedule_merging();
+		}
+		_merge_in_caller_thread_if_confined();
+	}
 	
 	boost::optional<OrderData> cancel(order_id_t const &id)
 	{
-		if (auto book_order = details::cancel(id, _book.mutex, _book.container))
+		_throw_if_replica();
+		if (auto book_order = _cancel_book_order(id))
+		{
+			if (book_order->GetTimeInForce() == Order::TimeInForce::GoodTillDate)
+				_in_merger_thread([this, id] { _expirations.cancel(id); });
 			return std::move(book_order);
+		}
 
-		if (auto merging_order = details::cancel(id, _merging.mutex, _merging.container))
+		if (auto merging_order = details::cancel(id, _merging.mutex, _merging.container, [](OrderData const &) {}))
 			return std::move(merging_order);
 
 		return boost::none;
@@ -95,9 +302,13 @@ public:
 
 	OrderData get_data(order_id_t const &id) const
 	{
-		if (auto const book_order = details::get_data(id, _book.mutex, _book.container))
-			if (_is_order_satisfied(*book_order) == false)
-				return std::move(*book_order);
+		// Заявки стакана ищем по каталогу: под блокировкой одной его полосы, а не всего стакана.
+		boost::optional<OrderData> book_order;
+		_book_directory.visit(id, [&book_order](OrderData const *order) { book_order.emplace(*order); });
+		if (book_order.is_initialized() && _is_order_satisfied(*book_order) == false)
+			return std::move(*book_order);
+		if (auto cold_tiered_order = _find_book_order_if_cold_tiered(id))
+			return std::move(*cold_tiered_order);
 
 		if (auto const merging_order = details::get_data(id, _merging.mutex, _merging.container))
 			if (_is_order_satisfied(*merging_order) == false)
@@ -108,186 +319,1869 @@ public:
 	
 	std::unique_ptr<MarketDataSnapshot> get_snapshot() const
 	{
-		auto snapshot = std::make_unique<MarketDataSnapshot>();
-		boost::shared_lock<boost::shared_mutex> book_read_lock(_book.mutex, boost::defer_lock);
-		boost::shared_lock<boost::shared_mutex> merging_orders_read_lock(_merging.mutex, boost::defer_lock);
-		std::lock(book_read_lock, merging_orders_read_lock);
-		
-		snapshot->add_orders(_book.container);
-		snapshot->add_orders(_merging.container);
+		std::vector<FlatMarketDataSnapshot> parts;
+		{
+			boost::shared_lock<mutex_t> book_read_lock(_book.mutex, boost::defer_lock);
+			boost::shared_lock<mutex_t> merging_orders_read_lock(_merging.mutex, boost::defer_lock);
+			std::lock(book_read_lock, merging_orders_read_lock);
+
+			// Небольшой стакан быстрее сразу сложить в срез, чем делать это в два прохода. Замороженные заявки - не узлы, их добавляет только копирование в части.
+			if (_get_snapshot_workers_count() == 1 && _cold_levels.empty())
+			{
+				auto snapshot = std::make_unique<MarketDataSnapshot>();
+				snapshot->add_orders(_book.container);
+				snapshot->add_orders(_merging.container);
+				return std::move(snapshot);
+			}
+
+			// Большой же под блокировками только копируем в части плоского среза, а дерево строим уже после их снятия.
+			parts = _copy_to_snapshot_parts();
+		}
 
-		return std::move(snapshot);
+		return std::make_unique<MarketDataSnapshot>(_sort_snapshot_parts(std::move(parts)));
 	}
-private:
-	/**
-	 * \brief Сведение заявок.
-	 */
-	void _merge(order_id_t id)
+
+	FlatMarketDataSnapshot get_flat_snapshot() const
 	{
-		// Сначала получим заявку, которую будем мёржить.
-		OrderData new_order;
+		std::vector<FlatMarketDataSnapshot> parts;
 		{
-			boost::upgrade_lock<boost::shared_mutex> merging_orders_read_lock(_merging.mutex);
+			boost::shared_lock<mutex_t> book_read_lock(_book.mutex, boost::defer_lock);
+			boost::shared_lock<mutex_t> merging_orders_read_lock(_merging.mutex, boost::defer_lock);
+			std::lock(book_read_lock, merging_orders_read_lock);
 
-			auto &merging_orders_by_id = _merging.container.get<OrdersById>();
-			auto new_order_iter = merging_orders_by_id.find(id);
-			if (new_order_iter == merging_orders_by_id.end())
+			parts = _copy_to_snapshot_parts();
+		}
+
+		return _sort_snapshot_parts(std::move(parts));
+	}
+
+	MemoryUsage memory_usage() const
+	{
+		MemoryUsage usage{};
+		{
+			boost::shared_lock<mutex_t> book_read_lock(_book.mutex);
+			auto const &book = _book.container;
+			usage.index_nodes = book.size() * sizeof(typename orders_book_t::final_node_type);
+			usage.order_payloads = book.size() * sizeof(Order);
+			usage.cold_levels = _cold_levels.memory_usage();
+			usage.orders_count = book.size() - _tombstones.size() - _cancelled_orders_count() + _cold_levels.size();
+			usage.index_nodes += _level_totals.memory_usage();
+		}
+		// Узел unordered_map - значение, указатель на следующий узел и сохранённый хеш.
+		_book_directory.for_each_stripe([&usage](typename decltype(_book_directory)::map_t const &stripe)
+		{
+			usage.index_buckets += stripe.bucket_count() * sizeof(void*);
+			usage.index_nodes += stripe.size() * (sizeof(typename decltype(_book_directory)::map_t::value_type) + sizeof(void*) + sizeof(size_t));
+		});
+		{
+			boost::shared_lock<mutex_t> merging_orders_read_lock(_merging.mutex);
+			auto const &merging = _merging.container;
+			usage.pending_queue = _buckets_memory_usage(merging.template get<OrdersById>())
+				+ merging.size() * (sizeof(typename buffered_orders_t::final_node_type) + sizeof(Order))
+				+ _pending_executions.size() * (sizeof(PendingExecution) + sizeof(Order));
+			usage.orders_count += merging.size() + _pending_executions.size();
+		}
+		return usage;
+	}
+
+	BookAnalytics get_analytics() const
+	{
+		return _analytics.load();
+	}
+
+	void publish_to_shared_memory(std::string segment_name, size_t depth, std::chrono::milliseconds period)
+	{
+		if (_is_thread_confined)
+			throw std::logic_error("Publishing to shared memory is not available for a thread-confined book");
+		if (_shared_memory_writer)
+			throw std::logic_error("The book is already published to shared memory");
+
+		_shared_memory_writer = std::make_unique<shared_memory_book::Writer>(std::move(segment_name), depth);
+		{
+			// Пока ничего не опубликовано, публикацию меняет любой уровень.
+			boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+			_published_worst_priority_prices.fill(std::numeric_limits<price_t>::infinity());
+			_is_published_top_changed.store(true, std::memory_order_relaxed);
+		}
+		_orders_merger.ExecutePeriodically(period, [this] { _publish_to_shared_memory(); });
+	}
+
+	void enable_cold_tiering(price_t distance, std::chrono::milliseconds period)
+	{
+		if (_is_thread_confined)
+			throw std::logic_error("Cold tiering is not available for a thread-confined book");
+		if (distance < 0)
+			throw std::invalid_argument("The cold level distance can't be negative");
+		if (_is_cold_tiering_enabled.exchange(true))
+			throw std::logic_error("Cold tiering is already enabled");
+
+		_cold_level_distance = distance;
+		_orders_merger.ExecutePeriodically(period, [this] { _freeze_cold_levels(); });
+	}
+
+	void enable_tick_ladder(price_t min_price, price_t max_price, price_t tick_size)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex, boost::defer_lock);
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex, boost::defer_lock);
+		std::lock(book_write_lock, merging_orders_write_lock);
+		if (_level_totals.is_tick_ladder())
+			throw std::logic_error("The tick ladder is already enabled");
+		// Цены ждущих сведения заявок не проверены, а заявки стакана уже на уровнях.
+		if (_merging.container.empty() == false)
+			throw std::logic_error("The tick ladder can be enabled only for an empty book");
+		_level_totals.use_tick_ladder(min_price, max_price, tick_size);
+	}
+
+	void begin_auction()
+	{
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex);
+		if (_is_auction)
+			throw std::logic_error("The auction has already begun");
+		_is_auction = true;
+	}
+
+	void wait_for_merging()
+	{
+		if (_is_thread_confined)
+			return;
+
+		order_id_t last_posted_id;
+		{
+			boost::unique_lock<mutex_t> merging_orders_read_lock(_merging.mutex);
+			last_posted_id = _id_counter;
+		}
+		// Задача сведения, запланированная до вызова, могла оставить остаток следующей задаче, поэтому досводим сами.
+		boost::promise<void> merged;
+		auto merging = merged.get_future();
+		_orders_merger.GetService().post([this, &merged, last_posted_id]
+		{
+			try
 			{
-				// добавление заявки отменили.
-				return;
+				while (_last_merged_id < last_posted_id)
+					_merge_pending_orders();
+				merged.set_value();
 			}
-			
-			boost::upgrade_to_unique_lock<boost::shared_mutex> merging_orders_write_lock(merging_orders_read_lock);
-			
-			new_order = std::move(new_order_iter.get_node()->value());
-			merging_orders_by_id.erase(new_order_iter);
+			catch (boost::thread_interrupted const &)
+			{
+				merged.set_exception(boost::current_exception());
+				throw;
+			}
+			catch (...) { merged.set_exception(boost::current_exception()); }
+		});
+		merging.get();
+	}
+
+	boost::optional<AuctionResult> uncross()
+	{
+		if (_is_thread_confined)
+			return _uncross();
+
+		// Сведением и колесом таймеров владеет поток сведения, поэтому аукцион проводится там же.
+		boost::promise<boost::optional<AuctionResult>> result;
+		auto auction = result.get_future();
+		_orders_merger.GetService().post([this, &result]
+		{
+			try { result.set_value(_uncross()); }
+			catch (boost::thread_interrupted const &)
+			{
+				result.set_exception(boost::current_exception());
+				throw;
+			}
+			catch (...) { result.set_exception(boost::current_exception()); }
+		});
+		return auction.get();
+	}
+
+	size_t subscribe_to_replication(replication_listener_t listener)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex, boost::defer_lock);
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex, boost::defer_lock);
+		std::lock(book_write_lock, merging_orders_write_lock);
+
+		// Заявки стакана отдаём под той же блокировкой, чтобы между ними и первым изменением ничего не потерялось.
+		auto const directory_write_locks = _lock_out_cancels();
+		uint64_t checksum = 0;
+		for (auto const &order : _book.container.template get<OrdersByPriority>())
+		{
+			if (_is_order_satisfied(order))
+				continue;
+			checksum += _checksum_of(order);
+			listener(_make_replication_event(ReplicationEvent::Kind::Rest, order, order.GetQuantity(), checksum));
 		}
+		_cold_levels.for_each([&listener, &checksum](ColdLevels::ColdOrder const &cold_order)
+		{
+			auto const order = _to_order_data(cold_order);
+			checksum += _checksum_of(order);
+			listener(_make_replication_event(ReplicationEvent::Kind::Rest, order, order.GetQuantity(), checksum));
+		});
+		assert(checksum == _state_checksum.load(std::memory_order_relaxed));
+		if (_id_counter != 0)
+			listener(_make_id_advance_event());
+
+		_replication_listeners.emplace_back(++_last_subscription_id, std::move(listener));
+		return _last_subscription_id;
+	}
+
+	void unsubscribe_from_replication(size_t subscription_id)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		_replication_listeners.erase(
+			std::remove_if(_replication_listeners.begin(), _replication_listeners.end(),
+				[subscription_id](std::pair<size_t, replication_listener_t> const &listener) { return listener.first == subscription_id; }
+			),
+			_replication_listeners.end()
+		);
+	}
 
-		// Мержим заявки из стакана с новоприбывшей.
+	void apply_replication_event(ReplicationEvent const &event)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex, boost::defer_lock);
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex, boost::defer_lock);
+		std::lock(book_write_lock, merging_orders_write_lock);
+		if (_is_replica == false)
 		{
-			boost::upgrade_lock<boost::shared_mutex> orders_read_lock(_book.mutex);
+			_apply_cancels();
+			_erase_tombstones(_tombstones.size());
+			if (_book.container.empty() == false || _cold_levels.empty() == false
+				|| _merging.container.empty() == false || _pending_executions.empty() == false)
+				throw std::logic_error("Only an empty book can become a replica");
+			_is_replica = true;
+		}
 
-			auto& orders_by_price_and_type = _book.container.get<OrdersByPriceAndType>();
-			// Мержить можем если пришедшая заявка - ask, тогда будем мёржить bid-ы, и наоборот.
-			auto const order_type_that_can_be_merged = _get_order_type_for_merge_with((Order::Type)new_order.GetType());
-			auto const key_of_merging_orders = boost::make_tuple(new_order.GetPrice(), order_type_that_can_be_merged);
+		if (event.kind == ReplicationEvent::Kind::IdAdvance)
+		{
+			if (_state_checksum.load(std::memory_order_relaxed) != event.checksum)
+				throw std::runtime_error("The replica has diverged from the leader: state checksum mismatch");
+			if (_id_counter < event.order_id)
+				_last_merged_id = _id_counter = event.order_id;
+			_replicate_id_advance();
+			return;
+		}
 
-			// Сначала получим все зявки, которые можно слить с новоприбывшей ..
-			auto orders_for_merge_iters_pair = orders_by_price_and_type.equal_range(key_of_merging_orders);
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		auto const book_order = _find_book_order(event.order_id);
+		if ((event.kind == ReplicationEvent::Kind::Rest) != (book_order == nullptr))
+			throw std::runtime_error("The replica has diverged from the leader: unexpected order id");
+		auto order_iter = book_order != nullptr ? orders_by_priority.iterator_to(*book_order) : orders_by_priority.end();
 
-			std::list<order_id_t> satisfied_orders_from_book;
-			auto update_book_orders_after_merge = [&book_orders = _book.container, &new_order, &satisfied_orders_from_book, &orders_read_lock]
+		switch (event.kind)
+		{
+		case ReplicationEvent::Kind::Rest:
+		{
+			_level_totals.validate_price(event.price);
+			auto order = event.time_in_force == Order::TimeInForce::GoodTillDate
+				? std::make_unique<Order>(event.type, event.price, event.quantity, event.expire_at)
+				: std::make_unique<Order>(event.type, event.price, event.quantity, event.time_in_force);
+			order_iter = orders_by_priority.emplace(OrderData(event.order_id, std::move(order))).first;
+			_book_directory.insert(order_iter->order_id, &*order_iter);
+			_mark_level_changed(*order_iter);
+			_on_order_rested(*order_iter);
+			if (event.time_in_force == Order::TimeInForce::GoodTillDate)
+				_in_merger_thread([this, id = event.order_id, expire_at = event.expire_at] { _schedule_expiration(id, expire_at); });
+			// После promote стакан продолжит выдавать id с того места, где остановился лидер.
+			if (_id_counter < event.order_id)
+				_last_merged_id = _id_counter = event.order_id;
+			break;
+		}
+		case ReplicationEvent::Kind::Fill:
+		{
+			auto const quantity = order_iter->GetQuantity();
+			if (quantity < event.quantity)
+				throw std::runtime_error("The replica has diverged from the leader: overfilled order");
 			{
-				auto &orders_by_id = book_orders.get<OrdersById>();
+				auto const directory_write_lock = _book_directory.lock_exclusive(order_iter->order_id);
+				order_iter->SetQuantity(quantity - event.quantity);
+			}
+			_mark_level_changed(*order_iter);
+			_on_order_filled(*order_iter, event.quantity, quantity - event.quantity);
+			if (quantity == event.quantity)
+				_erase_replicated_order(order_iter);
+			break;
+		}
+		case ReplicationEvent::Kind::Remove:
+			_mark_level_changed(*order_iter);
+			_on_order_removed(*order_iter);
+			_erase_replicated_order(order_iter);
+			break;
+		}
+		_notify_level_changes();
 
-				// Если в стакане после мёржа есть удовлетворённые заявки ..
-				if (satisfied_orders_from_book.empty() == false)
-				{
-					// .. то удалим их из стакана ..
-					boost::upgrade_to_unique_lock<boost::shared_mutex> book_write_lock(orders_read_lock);
-					for (auto satisfied_order_id : satisfied_orders_from_book)
-					{
-						boost::this_thread::interruption_point();
-						orders_by_id.erase(satisfied_order_id);
-					}
-				}
+		if (_state_checksum.load(std::memory_order_relaxed) != event.checksum)
+			throw std::runtime_error("The replica has diverged from the leader: state checksum mismatch");
+	}
 
-				// Если заявку надо добавить в стакан(она не удовлетворена после мёржа) ..
-				if (new_order.GetQuantity() != 0)
-				{
-					auto new_order_in_book_iter = orders_by_id.find(new_order.order_id);
-					assert(new_order_in_book_iter == orders_by_id.end());
+	void promote()
+	{
+		{
+			boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex);
+			_is_replica = false;
+		}
+		// Колесо реплики не продвигалось: истёкшее снимется сразу, а дальше тики пойдут сами.
+		_in_merger_thread([this] { _remove_expired_orders(); });
+	}
 
-					boost::upgrade_to_unique_lock<boost::shared_mutex> book_write_lock(orders_read_lock);
-					
-					new_order_in_book_iter = orders_by_id.emplace_hint(new_order_in_book_iter, std::move(new_order));
-					assert(new_order_in_book_iter != orders_by_id.end());
-				}
-			};
-			// .. если есть с кем сливать ..
-			if (orders_for_merge_iters_pair.first != orders_for_merge_iters_pair.second)
+	uint64_t state_checksum() const
+	{
+		return _state_checksum.load(std::memory_order_relaxed);
+	}
+
+	size_t subscribe_to_level_changes(level_listener_t listener)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+
+		// Текущие уровни отдаём под той же блокировкой, чтобы между ними и первым изменением ничего не потерялось.
+		std::vector<PriceLevelView> levels;
+		_collect_book_levels(levels);
+		_visit_aggregated_levels(levels, listener);
+
+		_level_listeners.emplace_back(++_last_subscription_id, std::move(listener));
+		return _last_subscription_id;
+	}
+
+	void unsubscribe_from_level_changes(size_t subscription_id)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		_level_listeners.erase(
+			std::remove_if(_level_listeners.begin(), _level_listeners.end(),
+				[subscription_id](std::pair<size_t, level_listener_t> const &listener) { return listener.first == subscription_id; }
+			),
+			_level_listeners.end()
+		);
+	}
+
+	size_t subscribe_to_executions(execution_listener_t listener)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		_execution_listeners.emplace_back(++_last_subscription_id, std::move(listener));
+		return _last_subscription_id;
+	}
+
+	void unsubscribe_from_executions(size_t subscription_id)
+	{
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		_execution_listeners.erase(
+			std::remove_if(_execution_listeners.begin(), _execution_listeners.end(),
+				[subscription_id](std::pair<size_t, execution_listener_t> const &listener) { return listener.first == subscription_id; }
+			),
+			_execution_listeners.end()
+		);
+	}
+
+	void visit_snapshot(std::function<void(OrderView const &)> const &visitor) const
+	{
+		boost::shared_lock<mutex_t> book_read_lock(_book.mutex, boost::defer_lock);
+		boost::shared_lock<mutex_t> merging_orders_read_lock(_merging.mutex, boost::defer_lock);
+		std::lock(book_read_lock, merging_orders_read_lock);
+
+		auto const visit = [&visitor](OrderData const &order)
+		{
+			if (_is_order_satisfied(order) == false)
+				visitor(OrderView{ order.order_id, static_cast<Order::Type>(order.GetType()), order.GetPrice(), order.GetQuantity() });
+		};
+		std::for_each(_book.container.begin(), _book.container.end(), visit);
+		_cold_levels.for_each([&visitor](ColdLevels::ColdOrder const &order)
+		{
+			order_id_t const order_id = order.id;
+			visitor(OrderView{ order_id, order.type, order.price, order.quantity });
+		});
+		std::for_each(_merging.container.begin(), _merging.container.end(), visit);
+	}
+
+	void visit_snapshot_levels(std::function<void(PriceLevelView const &)> const &visitor) const
+	{
+		std::vector<PriceLevelView> levels;
+		{
+			boost::shared_lock<mutex_t> book_read_lock(_book.mutex, boost::defer_lock);
+			boost::shared_lock<mutex_t> merging_orders_read_lock(_merging.mutex, boost::defer_lock);
+			std::lock(book_read_lock, merging_orders_read_lock);
+
+			_collect_book_levels(levels);
+			// Заявки, ждущие сведения, добавляем как отдельные уровни: ниже они сольются с уровнями стакана.
+			for (auto const &order : _merging.container)
+				levels.emplace_back(PriceLevelView{ static_cast<Order::Type>(order.GetType()), order.GetPrice(), order.GetQuantity(), 1 });
+		}
+
+		_visit_aggregated_levels(levels, visitor);
+	}
+private:
+	/**
+	 * \brief Добавить уровни стакана к \ref{levels}.
+	 * \details В индексе приоритета заявки одного уровня лежат подряд, так что горячие уровни собираются за один проход.
+	 *		Замороженные добавляются отдельно, и уровень, на который после заморозки встали новые заявки, встретится дважды.
+	 * \warning Вызывать под lock-ом \ref{_book}.
+	 */
+	void _collect_book_levels(std::vector<PriceLevelView> &levels) const
+	{
+		auto const &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		auto const hot_levels_begin = levels.size();
+		for (auto const &order : orders_by_priority)
+		{
+			if (_is_order_satisfied(order))
+				continue;
+			auto const type = static_cast<Order::Type>(order.GetType());
+			if (levels.size() == hot_levels_begin || levels.back().type != type || levels.back().price != order.GetPrice())
+				levels.emplace_back(PriceLevelView{ type, order.GetPrice(), 0, 0 });
+			levels.back().quantity += order.GetQuantity();
+			++levels.back().orders_count;
+		}
+		_cold_levels.for_each_level([&levels](Order::Type type, price_t price, quantity_t quantity, size_t orders_count)
+		{
+			levels.emplace_back(PriceLevelView{ type, price, quantity, orders_count });
+		});
+	}
+	/**
+	 * \brief Отсортировать уровни по типу и цене и вызвать visitor для каждого, сложив повторы одного уровня.
+	 */
+	template<typename VisitorT>
+	static void _visit_aggregated_levels(std::vector<PriceLevelView> &levels, VisitorT const &visitor)
+	{
+		std::sort(levels.begin(), levels.end(),
+			[](PriceLevelView const &lhs, PriceLevelView const &rhs)
 			{
-				// .. то сливаем.
-				while (true)
-				{
-					boost::this_thread::interruption_point();
-					// Если сливаемая заявка удовлетворена ..
-					if (new_order.GetQuantity() == 0)
-						// .. то сливать больше нечего.
-						break;
-
-					boost::upgrade_to_unique_lock<boost::shared_mutex> orders_write_lock(orders_read_lock);
-					// Первой сливается заявка, которая была зарегистрирована раньше других.
-					// При этом, если слияние займёт больше 1й итерации, то учтём, что мы можем встретить уже удовлетворённые заявки.
-					// Уже удовлетворённые не удаляем здесь по одной, а удалим после мёржа все сразу.
-					auto iter_to_merging_order_with_top_prioroty = std::min_element(
-						orders_for_merge_iters_pair.first,
-						orders_for_merge_iters_pair.second,
-						[](decltype(*orders_for_merge_iters_pair.first) lhs, decltype(*orders_for_merge_iters_pair.first) rhs)
-						{
-							return lhs.order_id < rhs.order_id
-								&& _is_order_satisfied(lhs) == false;
-						}
-					);
-					// Если заявка для слияния найдена ..
-					if (iter_to_merging_order_with_top_prioroty != orders_for_merge_iters_pair.second
-						// .. и она не удовлетворена ..
-						&& _is_order_satisfied(*iter_to_merging_order_with_top_prioroty) == false
-					) {
-						auto &new_order_quantity = new_order.GetQuantity();
-						auto &merging_order_with_top_prioroty_quantity = iter_to_merging_order_with_top_prioroty->GetQuantity();
-						// .. сливаем её.
-						auto const quantity = (std::min)(new_order_quantity, merging_order_with_top_prioroty_quantity);
-						new_order_quantity -= quantity;
-						merging_order_with_top_prioroty_quantity -= quantity;
-						// Если после мёржа заявка из стакана удовлетворена ..
-						if (_is_order_satisfied(*iter_to_merging_order_with_top_prioroty))
-							// .. отметим, что её надо удалить.
-							satisfied_orders_from_book.emplace_back(iter_to_merging_order_with_top_prioroty->order_id);
-					}
-					else // Иначе заявок для слияния больше нет.
-						break;
-				}
+				return std::tie(lhs.type, lhs.price) < std::tie(rhs.type, rhs.price);
+			}
+		);
+		for (auto level = levels.begin(); level != levels.end();)
+		{
+			auto aggregated_level = *level;
+			while (++level != levels.end() && level->type == aggregated_level.type && level->price == aggregated_level.price)
+			{
+				aggregated_level.quantity += level->quantity;
+				aggregated_level.orders_count += level->orders_count;
 			}
-			update_book_orders_after_merge();
+			visitor(aggregated_level);
 		}
 	}
 	/**
-	 * \brief Удавлетворена ли заявка.
+	 * \brief Отменить заявку, если она в стакане.
+	 * \details Горячую заявку отмена обнуляет(надгробие) и удаляет из каталога под блокировкой одной его полосы,
+	 *		не беря блокировку стакана и не дожидаясь пачки сведения. Сведение меняет количество заявки под той же блокировкой
+	 *		полосы, так что заявка достаётся либо отмене, либо исполнению. Итоги уровня, показатели, контрольную сумму и событие
+	 *		реплики отмена оставляет потоку сведения в \ref{_cancelled}, а он же удаляет узлы надгробий пачками,
+	 *		см. \ref{_schedule_cancels_processing}. До того сведение, срезы и уровни пропускают надгробия по нулевому количеству.
+	 *		Замороженных заявок в каталоге нет, поэтому с заморозкой промах проверяется ещё и под блокировкой стакана на чтение,
+	 *		а замороженная заявка отменяется под его write lock-ом.
 	 */
-	static bool _is_order_satisfied(OrderData const &order)
+	boost::optional<OrderData> _cancel_book_order(order_id_t const &id)
 	{
-		return order.GetQuantity() == 0;
+		auto cancelled_order = _cancel_hot_book_order(id);
+		if (cancelled_order.is_initialized() == false)
+		{
+			if (_find_book_order_if_cold_tiered(id).is_initialized() == false)
+				return boost::none;
+
+			boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+			// Пока блокировка стакана не была взята, заявку могли разморозить, свести или снять по сроку.
+			cancelled_order = _cancel_hot_book_order(id);
+			if (cancelled_order.is_initialized() == false)
+			{
+				auto const cold_order = _cold_levels.cancel(id);
+				if (cold_order.is_initialized() == false)
+					return boost::none;
+				cancelled_order.emplace(_to_order_data(*cold_order));
+				_mark_level_changed(*cancelled_order);
+				_on_order_removed(*cancelled_order);
+			}
+		}
+		_schedule_cancels_processing();
+		return cancelled_order;
 	}
 	/**
-	 * \brief Получить тип заявки, с которой можно провести слияние.
-	 * \param merge_with_me Тип заявки, которая будет сливаться.
-	 * \return Тип заявки, с которой можно провести слияние.
+	 * \brief Сделать горячую заявку стакана надгробием и передать её потоку сведения, см. \ref{_cancel_book_order}.
 	 */
-	static Order::Type _get_order_type_for_merge_with(Order::Type merge_with_me)
+	boost::optional<OrderData> _cancel_hot_book_order(order_id_t const &id)
 	{
-		BOOST_STATIC_ASSERT_MSG((size_t)Order::Type::_EnumElementsCount == 2, "На данный момент учитываются только Ask и Bid. При добавлении новых типов заявок, получение типа для мёржа надо переписать.");
-		// Отталкиваемся от знания того, что типа сейчас всего два и один из Ask или Bid равен нулю, а второй не равен нулю.
-		return (Order::Type)!merge_with_me;
+		boost::optional<OrderData> cancelled_order;
+		_book_directory.erase_if(id, [this, &cancelled_order](OrderData const *order)
+		{
+			// Исполненную целиком заявку из каталога удалит сведение.
+			if (_is_order_satisfied(*order))
+				return false;
+			cancelled_order.emplace(*order);
+			order->SetQuantity(0);
+			boost::unique_lock<mutex_t> cancelled_orders_write_lock(_cancelled.mutex);
+			_cancelled.container.emplace_back(CancelledOrder{ order, cancelled_order->GetQuantity() });
+			_has_tombstones.store(true, std::memory_order_relaxed);
+			return true;
+		});
+		return cancelled_order;
 	}
+	/**
+	 * \brief Скопировать заявки в неотсортированные части среза.
+	 * \details Большой стакан копируется параллельно: полосы каталога делятся поровну между потоками,
+	 *		и каждый поток пишет в свою часть. Надгробий в каталоге нет, а удовлетворённые заявки удаляются из него в той же пачке сведения.
+	 *		Маленький стакан копируется в одну часть в вызывающем потоке.
+	 * \warning Вызывать под read lock-ами \ref{_book} и \ref{_merging}.
+	 */
+	std::vector<FlatMarketDataSnapshot> _copy_to_snapshot_parts() const
+	{
+		auto const orders_count = _book.container.size() + _merging.container.size();
+		auto const workers_count = _get_snapshot_workers_count();
 
-	using buffered_orders_t = boost::multi_index::multi_index_container<
-		OrderData,
-		boost::multi_index::indexed_by<orders_by_id_hashed_unique_index_t>
-	>;
+		auto const stripes_count = decltype(_book_directory)::stripes_count;
 
-	// \brief Исполнитель, который, по велению стакана, занимается сведением заявок в отдельном потоке.
-	tools::async::TasksExecutor _orders_merger;
+		std::vector<FlatMarketDataSnapshot> parts(workers_count);
+		details::parallel_for(workers_count, [&](size_t worker)
+		{
+			auto &part = parts[worker];
+			/* Сколько заявок каждого типа, не известно без лишнего прохода под блокировками. Поэтому каждой стороне выделяем
+			 * память на все заявки части: страницы, в которые так и не запишут, в резидентную память не попадут.
+			 */
+			for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+				part.reserve(static_cast<Order::Type>(type), orders_count / workers_count + orders_count % workers_count);
 
-	details::ContainerWithSynchronization<orders_book_t, boost::shared_mutex> _book{};
-	details::ContainerWithSynchronization<buffered_orders_t, boost::shared_mutex> _merging{};
-	
-	// \warning Изменять только в контексте write lock-a.
-	order_id_t _id_counter = 0;
-};
+			auto const add = [&part](OrderData const &order)
+			{
+				if (_is_order_satisfied(order) == false)
+					part.add(static_cast<Order::Type>(order.GetType()), order.GetPrice(), order.GetQuantity(), order.order_id);
+			};
+			auto const first_stripe = stripes_count * worker / workers_count;
+			auto const last_stripe = stripes_count * (worker + 1) / workers_count;
+			for (auto stripe = first_stripe; stripe != last_stripe; ++stripe)
+				_book_directory.visit_stripe(stripe, [&add](typename decltype(_book_directory)::map_t const &orders)
+				{
+					for (auto const &order : orders)
+						add(*order.second);
+				});
 
-OrderBook::~OrderBook() = default;
-OrderBook::OrderBook()
-	: _impl(std::make_unique<Impl>())
-{
-}
+			// Заявок, ждущих сведения, немного, их копирует один поток. Он же копирует замороженные: они лежат подряд.
+			if (worker == 0)
+			{
+				std::for_each(_merging.container.begin(), _merging.container.end(), add);
+				_cold_levels.for_each([&part](ColdLevels::ColdOrder const &order)
+				{
+					part.add(order.type, order.price, order.quantity, order_id_t(order.id));
+				});
+			}
+		});
+		return parts;
+	}
+	/**
+	 * \brief Отсортировать части среза, каждую в своём потоке, и слить их в один срез.
+	 */
+	static FlatMarketDataSnapshot _sort_snapshot_parts(std::vector<FlatMarketDataSnapshot> parts)
+	{
+		if (parts.size() == 1)
+		{
+			parts.front().sort();
+			return std::move(parts.front());
+		}
 
-order_id_t OrderBook::post(std::unique_ptr<Order> order)
-{
+		details::parallel_for(parts.size(), [&parts](size_t part) { parts[part].sort(); });
+		return FlatMarketDataSnapshot::merge(parts);
+	}
+	/**
+	 * \brief Сколько потоков будут строить срез.
+	 * \warning Вызывать под read lock-ами \ref{_book} и \ref{_merging}.
+	 */
+	size_t _get_snapshot_workers_count() const
+	{
+		auto const orders_count = _book.container.size() + _merging.container.size();
+		return orders_count < _parallel_snapshot_min_orders_count
+			? size_t(1)
+			: (std::max)(size_t(1), size_t(boost::thread::hardware_concurrency()));
+	}
+	/**
+	 * \brief Запланировать сведение ожидающих заявок, если оно ещё не запланировано.
+	 * \warning Вызывать в контексте write lock-a \ref{_merging}.
+	 */
+	void _schedule_merging()
+	{
+		// Без потока сведения заявки сведёт сам вызывающий, в \ref{_merge_in_caller_thread_if_confined}.
+		if (_is_merging_scheduled || _is_thread_confined)
+			return;
+		_is_merging_scheduled = true;
+		auto const scheduled_at = ORDER_BOOK_TRACE_TIMESTAMP();
+		_orders_merger.GetService().post([this, scheduled_at]
+		{
+			ORDER_BOOK_TRACE_SPAN("merge dispatch", scheduled_at);
+			_merge_pending_orders();
+		});
+	}
+	/**
+	 * \brief Если потока сведения нет, то свести ожидающие заявки в вызывающем потоке.
+	 * \details Заодно снимаются заявки с истёкшим сроком: больше этого делать некому.
+	 * \warning Вызывать вне блокировок.
+	 */
+	void _merge_in_caller_thread_if_confined()
+	{
+		if (_is_thread_confined == false)
+			return;
+
+		_remove_expired_orders();
+		_compact_tombstones();
+		while (_last_merged_id != _id_counter)
+			_merge_pending_orders();
+	}
+	/**
+	 * \brief Сведение ожидающих сведения заявок пачкой.
+	 * \details Заявки сводятся в порядке id, то есть в порядке поступления, под одним захватом write lock-ов буфера и стакана.
+	 *		Так при всплеске заявок блокировки берутся раз на пачку, а не на каждую заявку.
+	 *		Заявка остаётся в буфере, пока не сведена, так что get_data и срезы видят её всё время.
+	 *		Чтобы не задерживать постановку и чтение надолго, пачка ограничена \ref{_max_merging_batch_size}, а остаток сводит следующая задача.
+	 */
+	void _merge_pending_orders()
+	{
+		ORDER_BOOK_TRACE_SCOPE("merge batch");
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex, boost::defer_lock);
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex, boost::defer_lock);
+		{
+			ORDER_BOOK_TRACE_SCOPE("merge lock wait");
+			std::lock(book_write_lock, merging_orders_write_lock);
+		}
+
+		_apply_cancels();
+		auto &merging_orders_by_id = _merging.container.template get<OrdersById>();
+		auto const now = std::chrono::system_clock::now();
+		auto execution = _pending_executions.begin();
+		// id выдаются подряд, поэтому ожидающие заявки - это id после последней сведённой. Отменённых среди них просто нет в буфере.
+		for (size_t merged_count = 0; _last_merged_id != _id_counter && merged_count != _max_merging_batch_size; ++merged_count)
+		{
+			boost::this_thread::interruption_point();
+			++_last_merged_id;
+
+			if (execution != _pending_executions.end() && execution->order.order_id == _last_merged_id)
+			{
+				_merge_with_book(execution->order);
+				// Ждущий исполнения должен застать и уведомления об уровнях по всем заявкам до неё.
+				_notify_level_changes();
+				execution->on_executed(std::move(execution->order));
+				++execution;
+				continue;
+			}
+
+			auto const new_order_iter = merging_orders_by_id.find(_last_merged_id);
+			// Добавление заявки отменили.
+			if (new_order_iter == merging_orders_by_id.end())
+				continue;
+
+			auto new_order = std::move(new_order_iter.get_node()->value());
+			merging_orders_by_id.erase(new_order_iter);
+			// Заявка, срок которой истёк, пока она ждала сведения, уже не исполняется.
+			if (_is_order_expired(new_order, now) == false)
+				_merge_with_book(new_order);
+		}
+		_pending_executions.erase(_pending_executions.begin(), execution);
+		_notify_level_changes();
+		_replicate_id_advance();
+
+		_is_merging_scheduled = false;
+		if (_last_merged_id != _id_counter)
+			_schedule_merging();
+	}
+	/**
+	 * \brief Сведение новоприбывшей заявки с заявками из стакана.
+	 * \details Заявка сводится со встречной стороной от лучшей цены к худшей, пока цена встречной заявки не хуже её собственной,
+	 *		а внутри уровня - в порядке поступления. Индекс \ref{OrdersByPriority} хранит сторону ровно в этом порядке,
+	 *		так что следующая заявка и следующий уровень находятся за амортизированное O(1).
+	 *		Неисполненный остаток заявки, действующей до отмены, помещается в стакан.
+	 *		Заявки IOC и FOK в стакан не помещаются никогда, и после сведения в \ref{new_order} остаётся неисполненный остаток.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _merge_with_book(OrderData &new_order)
+	{
+		auto const &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		// Мержить можем если пришедшая заявка - ask, тогда будем мёржить bid-ы, и наоборот.
+		auto const order_type_that_can_be_merged = _get_order_type_for_merge_with((Order::Type)new_order.GetType());
+		// Замороженные уровни, с которыми заявка может исполниться, возвращаем в стакан.
+		if (_is_auction == false)
+			_thaw_cold_levels(order_type_that_can_be_merged, OrderData::GetPriorityPrice(order_type_that_can_be_merged, new_order.GetPrice()));
+
+		// Сначала получим все зявки, которые можно слить с новоприбывшей: встречные по её цене или лучше ..
+		auto const orders_for_merge_begin = orders_by_priority.lower_bound(boost::make_tuple(order_type_that_can_be_merged));
+		auto const orders_for_merge_end = orders_by_priority.upper_bound(boost::make_tuple(
+			order_type_that_can_be_merged,
+			OrderData::GetPriorityPrice(order_type_that_can_be_merged, new_order.GetPrice())
+		));
+
+		// .. если не идёт аукцион, во время которого заявки только копятся, и есть с кем сливать ..
+		if (_is_auction == false && orders_for_merge_begin != orders_for_merge_end)
+		{
+			// .. то сливаем, пока сливаемая заявка не удовлетворена.
+			ORDER_BOOK_TRACE_SCOPE("match levels");
+			_fill_from_book(new_order, orders_for_merge_begin, orders_for_merge_end);
+			for (auto const &fill : _fills)
+			{
+				// Объём уровня встречной заявки изменился.
+				_mark_level_changed(*fill.order);
+				_on_order_filled(*fill.order, fill.quantity, fill.remaining);
+				_report_execution(fill.order->order_id, fill.order->GetPrice(), fill.quantity);
+				_report_execution(new_order.order_id, fill.order->GetPrice(), fill.quantity);
+				// Удовлетворённые заявки из стакана не удаляем здесь по одной, а удалим после мёржа все сразу.
+				if (fill.remaining == 0)
+					_satisfied_orders_from_book.emplace_back(fill.order);
+			}
+			_fills.clear();
+		}
+
+		// Если в стакане после мёржа есть удовлетворённые заявки, то удалим их из стакана.
+		_erase_satisfied_orders_from_book();
+
+		// Если заявку надо добавить в стакан(она не удовлетворена после мёржа и может ждать в стакане) ..
+		if (new_order.GetQuantity() != 0
+			&& _can_rest_in_book(new_order.GetTimeInForce()))
+		{
+			assert(_book_directory.contains(new_order.order_id) == false);
+
+			if (new_order.GetTimeInForce() == Order::TimeInForce::GoodTillDate)
+				_schedule_expiration(new_order.order_id, new_order.GetExpirationTime());
+
+			_mark_level_changed(static_cast<Order::Type>(new_order.GetType()), new_order.GetPrice());
+			auto const new_order_in_book_iter = _book.container.template get<OrdersByPriority>().emplace(std::move(new_order)).first;
+			_book_directory.insert(new_order_in_book_iter->order_id, &*new_order_in_book_iter);
+			_on_order_rested(*new_order_in_book_iter);
+		}
+	}
+	/**
+	 * \brief Исполнить заявку о встречные заявки стакана из [begin, end), записав исполнения в \ref{_fills}.
+	 * \details Количество встречной заявки проверяется и уменьшается под блокировкой её полосы каталога, под которой отмена
+	 *		делает заявку надгробием, так что отменённую только что заявку сведение пропускает. FOK заявку проверяют и исполняют
+	 *		под блокировками всех полос, чтобы отмены не уменьшили проверенный объём. Об исполнениях уведомляют уже вне блокировок
+	 *		полос: подписчики могут читать стакан по каталогу.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	template<typename OrdersIterT>
+	void _fill_from_book(OrderData &new_order, OrdersIterT begin, OrdersIterT end)
+	{
+		auto const is_fill_or_kill = new_order.GetTimeInForce() == Order::TimeInForce::FillOrKill;
+		typename decltype(_book_directory)::exclusive_locks_t directory_write_locks;
+		if (is_fill_or_kill)
+		{
+			directory_write_locks = _book_directory.lock_all_exclusive();
+			if (_can_be_merged_entirely_if_required(new_order, begin, end) == false)
+				return;
+		}
+
+		auto new_order_quantity = new_order.GetQuantity();
+		for (auto merging_order = begin; merging_order != end && new_order_quantity != 0; ++merging_order)
+		{
+			boost::unique_lock<mutex_t> directory_write_lock;
+			if (is_fill_or_kill == false)
+				directory_write_lock = _book_directory.lock_exclusive(merging_order->order_id);
+			auto const merging_order_quantity = merging_order->GetQuantity();
+			// Надгробие отменённой заявки.
+			if (merging_order_quantity == 0)
+				continue;
+			auto const quantity = (std::min)(new_order_quantity, merging_order_quantity);
+			new_order_quantity -= quantity;
+			merging_order->SetQuantity(merging_order_quantity - quantity);
+			_fills.emplace_back(Fill{ &*merging_order, quantity, merging_order_quantity - quantity });
+		}
+		new_order.SetQuantity(new_order_quantity);
+	}
+	/**
+	 * \brief Удалить из стакана заявки, удовлетворённые при сведении, из \ref{_satisfied_orders_from_book}.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}, в потоке сведения.
+	 */
+	void _erase_satisfied_orders_from_book()
+	{
+		if (_satisfied_orders_from_book.empty())
+			return;
+		ORDER_BOOK_TRACE_SCOPE("erase satisfied");
+
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		for (auto const satisfied_order : _satisfied_orders_from_book)
+		{
+			boost::this_thread::interruption_point();
+			auto const satisfied_order_id = satisfied_order->order_id;
+			_book_directory.erase(satisfied_order_id);
+			orders_by_priority.erase(orders_by_priority.iterator_to(*satisfied_order));
+			// Удовлетворённой заявке истечение срока уже не грозит.
+			if (_expirations.empty() == false)
+				_expirations.cancel(satisfied_order_id);
+		}
+		_satisfied_orders_from_book.clear();
+	}
+	/**
+	 * \brief Провести аукцион, см. \ref{uncross}.
+	 * \details Исполняется в потоке сведения.
+	 */
+	boost::optional<AuctionResult> _uncross()
+	{
+		ORDER_BOOK_TRACE_SCOPE("uncross");
+
+		// Сначала кладём в стакан всё, что поставлено до вызова. Во время аукциона это быстро: сведения нет.
+		boost::optional<order_id_t> last_auction_order_id;
+		while (true)
+		{
+			{
+				boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex);
+				if (_is_auction == false)
+					throw std::logic_error("There is no auction to uncross");
+				if (last_auction_order_id.is_initialized() == false)
+					last_auction_order_id = _id_counter;
+				if (_last_merged_id >= *last_auction_order_id)
+					break;
+			}
+			_merge_pending_orders();
+		}
+
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex, boost::defer_lock);
+		boost::unique_lock<mutex_t> merging_orders_write_lock(_merging.mutex, boost::defer_lock);
+		std::lock(book_write_lock, merging_orders_write_lock);
+		_is_auction = false;
+		// Равновесие ищется по всем уровням, так что размораживаем все.
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			_thaw_cold_levels(static_cast<Order::Type>(type), std::numeric_limits<price_t>::infinity());
+
+		boost::optional<AuctionResult> auction;
+		{
+			// Объём ищется по итогам уровней, так что в них должны быть учтены все отмены, а новые не должны его уменьшить.
+			auto const directory_write_locks = _lock_out_cancels();
+			auction = _find_auction_equilibrium();
+			if (auction.is_initialized())
+				_execute_auction(*auction);
+		}
+		for (auto const &fill : _fills)
+		{
+			_mark_level_changed(*fill.order);
+			_on_order_filled(*fill.order, fill.quantity, fill.remaining);
+			_report_execution(fill.order->order_id, auction->price, fill.quantity);
+			if (fill.remaining == 0)
+				_satisfied_orders_from_book.emplace_back(fill.order);
+		}
+		_fills.clear();
+		_erase_satisfied_orders_from_book();
+
+		_notify_level_changes();
+		return auction;
+	}
+	/**
+	 * \brief Найти цену равновесия аукциона по суммарным объёмам уровней из \ref{_level_totals}.
+	 * \details Заявки не перебираются: уровни сторон сливаются по возрастанию цены, как слияние двух отсортированных списков.
+	 * \warning Вызывать в контексте lock-a \ref{_book}, когда все отмены учтены.
+	 */
+	boost::optional<AuctionResult> _find_auction_equilibrium() const
+	{
+		// Цены и объёмы уровней каждой стороны по возрастанию цены.
+		std::array<std::vector<std::pair<price_t, quantity_t>>, Order::Type::_EnumElementsCount> levels;
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			_level_totals.for_each_level(static_cast<Order::Type>(type), (std::numeric_limits<size_t>::max)(),
+				[&side_levels = levels[type]](price_t price, LevelTotal const &level) { side_levels.emplace_back(price, level.quantity); }
+			);
+		// Уровни Bid обходятся от лучшей, то есть наибольшей, цены.
+		std::reverse(levels[Order::Type::Bid].begin(), levels[Order::Type::Bid].end());
+		auto const &asks = levels[Order::Type::Ask];
+		auto const &bids = levels[Order::Type::Bid];
+
+		// Спрос по цене - объём Bid по ней и выше: все Bid без тех, что дешевле.
+		quantity_t bids_volume = 0;
+		for (auto const &bid : bids)
+			bids_volume += bid.second;
+
+		// Предложение по цене - объём Ask по ней и ниже. Цены перебираем по возрастанию, так что при равенстве остаётся наименьшая.
+		boost::optional<AuctionResult> best;
+		quantity_t best_surplus = 0;
+		quantity_t asks_volume = 0;
+		auto ask = asks.cbegin();
+		auto bid = bids.cbegin();
+		while (ask != asks.cend() || bid != bids.cend())
+		{
+			auto const price = bid == bids.cend() || (ask != asks.cend() && ask->first < bid->first) ? ask->first : bid->first;
+			if (ask != asks.cend() && ask->first == price)
+				asks_volume += (ask++)->second;
+			auto const volume = (std::min)(asks_volume, bids_volume);
+			auto const surplus = (std::max)(asks_volume, bids_volume) - volume;
+			if (volume != 0
+				&& (best.is_initialized() == false || volume > best->volume || (volume == best->volume && surplus < best_surplus))
+			) {
+				best = AuctionResult{ price, volume };
+				best_surplus = surplus;
+			}
+			if (bid != bids.cend() && bid->first == price)
+				bids_volume -= (bid++)->second;
+		}
+		return best;
+	}
+	/**
+	 * \brief Исполнить объём аукциона по его цене, записав исполнения в \ref{_fills}.
+	 * \details Каждая сторона исполняется от начала в \ref{OrdersByPriority}: от лучшей цены к цене аукциона,
+	 *		а внутри уровня - в порядке поступления. Без копирования и сортировки заявок.
+	 * \warning Вызывать в контексте write lock-a \ref{_book} и блокировок всех полос каталога, в потоке сведения.
+	 */
+	void _execute_auction(AuctionResult const &auction)
+	{
+		auto const &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		for (size_t side = 0; side < Order::Type::_EnumElementsCount; ++side)
+		{
+			auto const type = static_cast<Order::Type>(side);
+			auto const end = orders_by_priority.upper_bound(boost::make_tuple(type, OrderData::GetPriorityPrice(type, auction.price)));
+			auto remaining_volume = auction.volume;
+			for (auto order = orders_by_priority.lower_bound(boost::make_tuple(type)); order != end && remaining_volume != 0; ++order)
+			{
+				auto const quantity = order->GetQuantity();
+				// Надгробие отменённой заявки.
+				if (quantity == 0)
+					continue;
+				auto const filled = (std::min)(quantity, remaining_volume);
+				order->SetQuantity(quantity - filled);
+				remaining_volume -= filled;
+				_fills.emplace_back(Fill{ &*order, filled, quantity - filled });
+			}
+		}
+	}
+	/**
+	 * \brief Можно ли слить заявку, учитывая, что FOK заявку надо исполнить целиком либо не исполнять вовсе.
+	 * \param begin, end Заявки из стакана, с которыми можно провести слияние.
+	 */
+	template<typename OrdersIterT>
+	static bool _can_be_merged_entirely_if_required(OrderData const &new_order, OrdersIterT begin, OrdersIterT end)
+	{
+		if (new_order.GetTimeInForce() != Order::TimeInForce::FillOrKill)
+			return true;
+
+		quantity_t available_quantity = 0;
+		for (; begin != end && available_quantity < new_order.GetQuantity(); ++begin)
+			available_quantity += begin->GetQuantity();
+
+		return available_quantity >= new_order.GetQuantity();
+	}
+	/**
+	 * \brief Поставить таймер заявки GTD и, если надо, завести тик, на котором он истечёт.
+	 * \warning Вызывать в потоке сведения.
+	 */
+	void _schedule_expiration(order_id_t const &id, expiration_time_t expire_at)
+	{
+		// Пустое колесо никто не продвигает: догоняем текущий момент, чтобы новый таймер встал в слот по своей удалённости.
+		if (_expirations.empty())
+			_expirations.advance(std::chrono::system_clock::now(), [](order_id_t const &) {});
+		_expirations.schedule(id, expire_at);
+		_arm_expiration_tick();
+	}
+	/**
+	 * \brief Завести тик снятия истёкших заявок на момент, когда колесо в следующий раз может что-то снять.
+	 * \details Пока заявок GTD нет, поток сведения ради них не просыпается. Тик, заведённый на более ранний момент, не переставляется.
+	 * \warning Вызывать в потоке сведения.
+	 */
+	void _arm_expiration_tick()
+	{
+		// Без потока сведения истёкшие снимаются при постановке заявок, а заявки реплики снимает лидер.
+		if (_is_thread_confined || _is_replica)
+			return;
+		auto const tick_at = _expirations.next_advance_time();
+		if (tick_at.is_initialized() == false || (_expiration_tick_at.is_initialized() && *_expiration_tick_at <= *tick_at))
+			return;
+
+		_expiration_tick_at = tick_at;
+		auto const delay = (std::max)(*tick_at - std::chrono::system_clock::now(), std::chrono::system_clock::duration::zero());
+		_orders_merger.ExecuteAfter(std::chrono::duration_cast<boost::asio::steady_timer::duration>(delay), [this, tick_at = *tick_at]
+		{
+			if (_expiration_tick_at == tick_at)
+				_expiration_tick_at = boost::none;
+			_remove_expired_orders();
+		});
+	}
+	/**
+	 * \brief Снять из стакана заявки, срок которых истёк.
+	 * \details Исполняется в потоке сведения. Все истёкшие за тик заявки удаляются под одним write lock-ом.
+	 *		Затем заводится следующий тик, если заявки GTD ещё есть.
+	 */
+	void _remove_expired_orders()
+	{
+		// Заявки реплики снимает лидер. Колесо не продвигается, так что после promote истёкшее снимется сразу.
+		if (_is_replica)
+			return;
+		ORDER_BOOK_TRACE_SCOPE("remove expired");
+		_expired_orders.clear();
+		_expirations.advance(
+			std::chrono::system_clock::now(),
+			[&expired_orders = _expired_orders](order_id_t const &id) { expired_orders.emplace_back(id); }
+		);
+		_arm_expiration_tick();
+		if (_expired_orders.empty())
+			return;
+
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		for (auto const &expired_order_id : _expired_orders)
+		{
+			// Отмена делает заявку надгробием без блокировки стакана: снимаем заявку, только если она ещё в каталоге.
+			OrderData const *expired_order = nullptr;
+			_book_directory.erase_if(expired_order_id, [&expired_order](OrderData const *order)
+			{
+				if (_is_order_satisfied(*order))
+					return false;
+				expired_order = order;
+				return true;
+			});
+			if (expired_order == nullptr)
+				continue;
+			_mark_level_changed(*expired_order);
+			_on_order_removed(*expired_order);
+			orders_by_priority.erase(orders_by_priority.iterator_to(*expired_order));
+		}
+		_notify_level_changes();
+	}
+	/**
+	 * \brief Учесть отмены и удалить из стакана узлы отменённых заявок, см. \ref{_cancel_book_order}.
+	 * \details Обычно это делает задача \ref{_schedule_cancels_processing}, а здесь - со всеми оставшимися сразу:
+	 *		перед заморозкой уровней и, у стакана без блокировок, перед сведением в вызывающем потоке.
+	 *		Узлы удаляются пачками по \ref{_max_merging_batch_size} под одним захватом write lock-a.
+	 */
+	void _compact_tombstones()
+	{
+		while (_has_tombstones.load(std::memory_order_relaxed))
+		{
+			ORDER_BOOK_TRACE_SCOPE("compact tombstones");
+			boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+			_apply_cancels();
+			_erase_tombstones(_max_merging_batch_size);
+		}
+	}
+	/**
+	 * \brief Удалить до \ref{max_count} надгробий, отмены которых уже учтены.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _erase_tombstones(size_t max_count)
+	{
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		for (size_t erased_count = 0; erased_count != max_count && _tombstones.empty() == false; ++erased_count)
+		{
+			// Узел надгробия жив, пока его не удалили здесь: исполнение, снятие по сроку и заморозка надгробия пропускают.
+			orders_by_priority.erase(orders_by_priority.iterator_to(*_tombstones.back()));
+			_tombstones.pop_back();
+		}
+		if (_tombstones.empty() == false)
+			return;
+		// Отмена, которая ещё не учтена, выставит признак снова под блокировкой \ref{_cancelled}.
+		boost::shared_lock<mutex_t> cancelled_orders_read_lock(_cancelled.mutex);
+		_has_tombstones.store(_cancelled.container.empty() == false, std::memory_order_relaxed);
+	}
+	/**
+	 * \brief Учесть отмены из \ref{_cancelled}: итоги уровней и сторон, контрольную сумму и события реплик.
+	 *		Их узлы переходят в \ref{_tombstones}.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _apply_cancels()
+	{
+		{
+			boost::unique_lock<mutex_t> cancelled_orders_write_lock(_cancelled.mutex);
+			if (_cancelled.container.empty())
+				return;
+			_applied_cancels.swap(_cancelled.container);
+		}
+		for (auto const &cancelled_order : _applied_cancels)
+		{
+			_mark_level_changed(*cancelled_order.order);
+			_on_order_removed(*cancelled_order.order, cancelled_order.quantity);
+			_tombstones.emplace_back(cancelled_order.order);
+		}
+		_applied_cancels.clear();
+	}
+	/**
+	 * \brief Учесть все отмены и взять блокировки всех полос каталога, чтобы новых не было.
+	 * \details Для того, кому заявки стакана нужны согласованными с итогами и контрольной суммой: отмена не берёт
+	 *		блокировку стакана, так что одной её для этого мало. Отмены учитываются вне блокировок полос, а если за это время
+	 *		пришли новые - ещё раз.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}. Под возвращёнными блокировками не обращаться к каталогу.
+	 */
+	typename tools::StripedHashMap<order_id_t, OrderData const*, mutex_t>::exclusive_locks_t _lock_out_cancels()
+	{
+		while (true)
+		{
+			_apply_cancels();
+			auto directory_write_locks = _book_directory.lock_all_exclusive();
+			if (_cancelled_orders_count() == 0)
+				return directory_write_locks;
+		}
+	}
+	size_t _cancelled_orders_count() const
+	{
+		boost::shared_lock<mutex_t> cancelled_orders_read_lock(_cancelled.mutex);
+		return _cancelled.container.size();
+	}
+	/**
+	 * \brief Заморозить уровни дальше \ref{_cold_level_distance} от лучшей цены стороны и разморозить те, что ближе.
+	 * \details Исполняется в потоке сведения, под write lock-ом стакана. Лучшая цена стороны - лучшая из горячих и замороженных.
+	 *		Заявки, состояние и контрольная сумма стакана не меняются, меняется только их хранение, так что событий нет.
+	 */
+	void _freeze_cold_levels()
+	{
+		// Реплика хранит заявки так, как их присылает лидер.
+		if (_is_replica)
+			return;
+		ORDER_BOOK_TRACE_SCOPE("freeze cold levels");
+		_compact_tombstones();
+
+		boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		std::vector<ColdLevels::ColdOrder> frozen_orders;
+		for (size_t side = 0; side < Order::Type::_EnumElementsCount; ++side)
+		{
+			auto const type = static_cast<Order::Type>(side);
+			auto const best_priority_price = _best_priority_price(type);
+			if (best_priority_price.is_initialized() == false)
+				continue;
+
+			auto const cold_priority_price = *best_priority_price + _cold_level_distance;
+			_thaw_cold_levels(type, cold_priority_price);
+
+			auto const side_end = orders_by_priority.upper_bound(boost::make_tuple(type));
+			for (auto order = orders_by_priority.upper_bound(boost::make_tuple(type, cold_priority_price)); order != side_end;)
+			{
+				// Отмена делает заявку надгробием без блокировки стакана: замораживаем заявку, только если она ещё в каталоге.
+				if (order->GetTimeInForce() != Order::TimeInForce::GoodTillCancel || ColdLevels::can_be_frozen(order->order_id) == false
+					|| _book_directory.erase_if(order->order_id, [](OrderData const *order) { return _is_order_satisfied(*order) == false; }) == false)
+				{
+					++order;
+					continue;
+				}
+				frozen_orders.emplace_back(ColdLevels::ColdOrder{
+					type, order->GetPrice(), order->order_id.template convert_to<ColdLevels::narrow_id_t>(), order->GetQuantity()
+				});
+				order = orders_by_priority.erase(order);
+			}
+		}
+		_cold_levels.freeze(frozen_orders);
+	}
+	/**
+	 * \brief Вернуть в стакан замороженные уровни стороны, приоритетная цена которых не больше \ref{priority_price}.
+	 * \details Заявки возвращаются со своими id, так что приоритет внутри уровня сохраняется.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _thaw_cold_levels(Order::Type type, price_t priority_price)
+	{
+		auto const cold_best_priority_price = _cold_levels.best_priority_price(type);
+		if (cold_best_priority_price.is_initialized() == false || *cold_best_priority_price > priority_price)
+			return;
+		ORDER_BOOK_TRACE_SCOPE("thaw cold levels");
+
+		auto &orders_by_priority = _book.container.template get<OrdersByPriority>();
+		for (auto const &cold_order : _cold_levels.thaw(type, priority_price))
+		{
+			auto const order_iter = orders_by_priority.emplace(_to_order_data(cold_order)).first;
+			_book_directory.insert(order_iter->order_id, &*order_iter);
+		}
+	}
+	/**
+	 * \brief Найти заявку стакана под его блокировкой на чтение, если включена заморозка, иначе boost::none.
+	 * \details Заморозка и разморозка переносят заявку между каталогом и \ref{_cold_levels}, так что промах по каталогу
+	 *		ещё не значит, что заявки в стакане нет. Под блокировкой стакана оба хранилища согласованы.
+	 */
+	boost::optional<OrderData> _find_book_order_if_cold_tiered(order_id_t const &id) const
+	{
+		if (_is_cold_tiering_enabled == false)
+			return boost::none;
+
+		boost::shared_lock<mutex_t> book_read_lock(_book.mutex);
+		auto const book_order = _find_book_order(id);
+		if (book_order != nullptr && _is_order_satisfied(*book_order) == false)
+			return *book_order;
+		if (auto const cold_order = _cold_levels.find(id))
+			return _to_order_data(*cold_order);
+		return boost::none;
+	}
+	/**
+	 * \brief Узел горячей заявки стакана по id. Каталог и есть индекс стакана по id.
+	 * \return nullptr, если такой заявки среди горячих нет или она отменена.
+	 * \warning Вызывать под lock-ом \ref{_book}, чтобы узел не удалили.
+	 */
+	OrderData const* _find_book_order(order_id_t const &id) const
+	{
+		OrderData const *book_order = nullptr;
+		_book_directory.visit(id, [&book_order](OrderData const *order) { book_order = order; });
+		return book_order;
+	}
+	static OrderData _to_order_data(ColdLevels::ColdOrder const &order)
+	{
+		return OrderData(order.id, std::make_unique<Order>(order.type, order.price, order.quantity));
+	}
+	/**
+	 * \brief Хеш заявки в \ref{_state_checksum}. У исполненной заявки - 0: её в стакане уже нет.
+	 */
+	static uint64_t _checksum_of(OrderData const &order, quantity_t quantity)
+	{
+		if (quantity == 0)
+			return 0;
+		size_t seed = boost::hash<order_id_t>{}(order.order_id);
+		boost::hash_combine(seed, order.GetType());
+		boost::hash_combine(seed, order.GetPrice());
+		boost::hash_combine(seed, quantity);
+		return static_cast<uint64_t>(seed);
+	}
+	static uint64_t _checksum_of(OrderData const &order)
+	{
+		return _checksum_of(order, order.GetQuantity());
+	}
+	static ReplicationEvent _make_replication_event(ReplicationEvent::Kind kind, OrderData const &order, quantity_t quantity, uint64_t checksum)
+	{
+		return ReplicationEvent{
+			kind, order.order_id, static_cast<Order::Type>(order.GetType()), order.GetPrice(),
+			order.GetTimeInForce(), order.GetExpirationTime(), quantity, checksum
+		};
+	}
+	void _replicate(ReplicationEvent::Kind kind, OrderData const &order, quantity_t quantity)
+	{
+		if (_replication_listeners.empty())
+			return;
+		auto const event = _make_replication_event(kind, order, quantity, _state_checksum.load(std::memory_order_relaxed));
+		for (auto const &listener : _replication_listeners)
+			listener.second(event);
+	}
+	ReplicationEvent _make_id_advance_event() const
+	{
+		ReplicationEvent event{};
+		event.kind = ReplicationEvent::Kind::IdAdvance;
+		event.order_id = _id_counter;
+		event.checksum = _state_checksum.load(std::memory_order_relaxed);
+		return event;
+	}
+	/**
+	 * \brief Разослать репликам id, выданный последним, если он вырос с прошлой рассылки.
+	 * \details Id, выданные после последней пачки сведения, реплика не узнает, но и заявок с ними в её состоянии нет.
+	 * \warning Вызывать в контексте write lock-ов \ref{_book} и \ref{_merging}.
+	 */
+	void _replicate_id_advance()
+	{
+		if (_replication_listeners.empty() || _replicated_id_counter == _id_counter)
+			return;
+		_replicated_id_counter = _id_counter;
+		auto const event = _make_id_advance_event();
+		for (auto const &listener : _replication_listeners)
+			listener.second(event);
+	}
+	/* Обновить контрольную сумму и объёмы сторон и разослать событие реплики.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}: заявка уже в стакане, количество уже изменено, а удаляемая ещё в нём.
+	 */
+	void _on_order_rested(OrderData const &order)
+	{
+		_add_to_side_totals(order, order.GetQuantity());
+		_level_totals.add(static_cast<Order::Type>(order.GetType()), order.GetPrice(), order.GetQuantity());
+		_state_checksum.store(_state_checksum.load(std::memory_order_relaxed) + _checksum_of(order), std::memory_order_relaxed);
+		_replicate(ReplicationEvent::Kind::Rest, order, order.GetQuantity());
+	}
+	/**
+	 * \param remaining Остаток после исполнения: отмена может обнулить количество заявки, пока о её исполнении сообщают.
+	 */
+	void _on_order_filled(OrderData const &order, quantity_t filled, quantity_t remaining)
+	{
+		_subtract_from_side_totals(order, filled);
+		_level_totals.subtract(static_cast<Order::Type>(order.GetType()), order.GetPrice(), filled, remaining == 0 ? 1 : 0);
+		auto const checksum_before = _checksum_of(order, remaining + filled);
+		_state_checksum.store(_state_checksum.load(std::memory_order_relaxed) - checksum_before + _checksum_of(order, remaining), std::memory_order_relaxed);
+		_replicate(ReplicationEvent::Kind::Fill, order, filled);
+	}
+	void _report_execution(order_id_t const &order_id, price_t price, quantity_t quantity) const
+	{
+		for (auto const &listener : _execution_listeners)
+			listener.second(ExecutionReport{ order_id, price, quantity });
+	}
+	/**
+	 * \param quantity Снятый остаток: у надгробия количество уже обнулено.
+	 */
+	void _on_order_removed(OrderData const &order, quantity_t quantity)
+	{
+		_subtract_from_side_totals(order, quantity);
+		_level_totals.subtract(static_cast<Order::Type>(order.GetType()), order.GetPrice(), quantity, 1);
+		_state_checksum.store(_state_checksum.load(std::memory_order_relaxed) - _checksum_of(order, quantity), std::memory_order_relaxed);
+		_replicate(ReplicationEvent::Kind::Remove, order, 0);
+	}
+	void _on_order_removed(OrderData const &order)
+	{
+		_on_order_removed(order, order.GetQuantity());
+	}
+	/**
+	 * \brief Удалить из реплики заявку, которую исполнил или снял лидер.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	template<typename OrderIterT>
+	void _erase_replicated_order(OrderIterT order_iter)
+	{
+		if (order_iter->GetTimeInForce() == Order::TimeInForce::GoodTillDate)
+			_in_merger_thread([this, id = order_iter->order_id] { _expirations.cancel(id); });
+		_book_directory.erase(order_iter->order_id);
+		_book.container.template get<OrdersByPriority>().erase(order_iter);
+	}
+	/**
+	 * \brief Исполнить задачу в потоке сведения, например обратиться к колесу таймеров, которым он владеет.
+	 * \details Без потока сведения задача исполняется сразу.
+	 */
+	template<typename TaskT>
+	void _in_merger_thread(TaskT task)
+	{
+		if (_is_thread_confined)
+			task();
+		else
+			_orders_merger.GetService().post(std::move(task));
+	}
+	void _throw_if_replica() const
+	{
+		if (_is_replica)
+			throw std::logic_error("Orders of a replica are posted and cancelled only by its leader");
+	}
+	/**
+	 * \brief Запомнить уровень заявки как изменившийся, если на изменения уровней кто-то подписан.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _mark_level_changed(Order::Type type, price_t price)
+	{
+		price = _level_totals.level_price(type, price);
+		if (_level_listeners.empty() == false)
+			_changed_levels.emplace_back(type, price);
+		// Уровень хуже опубликованных в разделяемую память лучших публикацию не меняет.
+		if (OrderData::GetPriorityPrice(type, price) <= _published_worst_priority_prices[type])
+			_is_published_top_changed.store(true, std::memory_order_relaxed);
+	}
+	void _mark_level_changed(OrderData const &order)
+	{
+		_mark_level_changed(static_cast<Order::Type>(order.GetType()), order.GetPrice());
+	}
+	/**
+	 * \brief Доделать отмену в потоке сведения, а не в вызывающем: учесть её в итогах, сообщить об изменившихся уровнях,
+	 *		опубликовать показатели и удалить узлы надгробий.
+	 * \details Отмена только передаёт заявку в \ref{_cancelled}. Всё, что накопили несколько отмен подряд, делает одна
+	 *		задача, поставленная первой из них. Надгробия она удаляет пачками по \ref{_max_merging_batch_size} под одним захватом
+	 *		write lock-a, а если они остались - ставится снова, чтобы не задерживать постановку, отмену и чтение надолго.
+	 *		Стакан без блокировок учитывает отмену и уведомляет сразу, а надгробия удаляет при следующей постановке.
+	 */
+	void _schedule_cancels_processing()
+	{
+		if (_is_thread_confined)
+		{
+			_apply_cancels();
+			_notify_level_changes();
+			return;
+		}
+		{
+			boost::unique_lock<mutex_t> cancelled_orders_write_lock(_cancelled.mutex);
+			if (_is_cancels_processing_scheduled)
+				return;
+			_is_cancels_processing_scheduled = true;
+		}
+		_orders_merger.GetService().post([this]
+		{
+			ORDER_BOOK_TRACE_SCOPE("process cancels");
+			boost::unique_lock<mutex_t> book_write_lock(_book.mutex);
+			{
+				boost::unique_lock<mutex_t> cancelled_orders_write_lock(_cancelled.mutex);
+				_is_cancels_processing_scheduled = false;
+			}
+			_apply_cancels();
+			_notify_level_changes();
+			_erase_tombstones(_max_merging_batch_size);
+			if (_tombstones.empty() == false)
+				_schedule_cancels_processing();
+		});
+	}
+	/**
+	 * \brief Сообщить подписчикам новые объёмы изменившихся уровней и опубликовать показатели стакана.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _notify_level_changes()
+	{
+		_publish_analytics();
+		if (_changed_levels.empty())
+			return;
+		ORDER_BOOK_TRACE_SCOPE("notify levels");
+
+		std::sort(_changed_levels.begin(), _changed_levels.end());
+		_changed_levels.erase(std::unique(_changed_levels.begin(), _changed_levels.end()), _changed_levels.end());
+
+		for (auto const &changed_level : _changed_levels)
+		{
+			auto const level = _level_of(changed_level.first, changed_level.second);
+			for (auto const &listener : _level_listeners)
+				listener.second(level);
+		}
+		_changed_levels.clear();
+	}
+	/**
+	 * \brief Уровень стакана, горячие и замороженные заявки вместе, по \ref{_level_totals}. У уровня без заявок orders_count - 0.
+	 * \warning Вызывать под lock-ом \ref{_book}.
+	 */
+	PriceLevelView _level_of(Order::Type type, price_t price) const
+	{
+		auto const totals = _level_totals.find(type, price);
+		return PriceLevelView{ type, price, totals.quantity, totals.orders_count };
+	}
+	/**
+	 * \brief Приоритетная цена лучшего уровня стороны, горячего или замороженного, или boost::none, если сторона пуста.
+	 * \warning Вызывать под lock-ом \ref{_book}.
+	 */
+	boost::optional<price_t> _best_priority_price(Order::Type type) const
+	{
+		auto const best_level = _level_totals.best(type);
+		if (best_level.is_initialized() == false)
+			return boost::none;
+		return OrderData::GetPriorityPrice(type, best_level->first);
+	}
+	/**
+	 * \brief Учесть изменение заявки стакана в объёмах сторон для \ref{BookAnalytics}.
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _add_to_side_totals(OrderData const &order, quantity_t quantity)
+	{
+		_side_quantities[order.GetType()] += quantity;
+		_side_notionals[order.GetType()] += order.GetPrice() * quantity;
+		_is_analytics_changed = true;
+	}
+	void _subtract_from_side_totals(OrderData const &order, quantity_t quantity)
+	{
+		auto const type = order.GetType();
+		_side_quantities[type] -= quantity;
+		// Погрешность сложений и вычитаний не копится дольше, чем сторона не пустеет.
+		_side_notionals[type] = _side_quantities[type] == 0 ? 0. : _side_notionals[type] - order.GetPrice() * quantity;
+		_is_analytics_changed = true;
+	}
+	/**
+	 * \brief Опубликовать показатели стакана, если с прошлой публикации он изменился.
+	 * \details Объёмы сторон и уровней уже посчитаны по ходу изменений, так что публикация - O(1).
+	 * \warning Вызывать в контексте write lock-a \ref{_book}.
+	 */
+	void _publish_analytics()
+	{
+		if (_is_analytics_changed == false)
+			return;
+		_is_analytics_changed = false;
+
+		auto const nan = std::numeric_limits<double>::quiet_NaN();
+		BookAnalytics analytics{};
+		for (size_t side = 0; side < Order::Type::_EnumElementsCount; ++side)
+		{
+			auto const type = static_cast<Order::Type>(side);
+			auto const best_level = _level_totals.best(type);
+			if (best_level.is_initialized())
+			{
+				analytics.best_price[type] = best_level->first;
+				analytics.best_quantity[type] = best_level->second.quantity;
+			}
+			else
+				analytics.best_price[type] = nan;
+			analytics.total_quantity[type] = _side_quantities[type];
+			analytics.vwap[type] = _side_quantities[type] != 0 ? _side_notionals[type] / _side_quantities[type] : nan;
+		}
+
+		auto const imbalance = [nan](std::array<quantity_t, Order::Type::_EnumElementsCount> const &quantities)
+		{
+			auto const total = static_cast<double>(quantities[Order::Type::Bid]) + quantities[Order::Type::Ask];
+			return total == 0 ? nan : (static_cast<double>(quantities[Order::Type::Bid]) - quantities[Order::Type::Ask]) / total;
+		};
+		analytics.imbalance = imbalance(analytics.best_quantity);
+		analytics.depth_imbalance = imbalance(analytics.total_quantity);
+
+		auto const ask_quantity = static_cast<double>(analytics.best_quantity[Order::Type::Ask]);
+		auto const bid_quantity = static_cast<double>(analytics.best_quantity[Order::Type::Bid]);
+		analytics.microprice = ask_quantity == 0 || bid_quantity == 0
+			? nan
+			: (analytics.best_price[Order::Type::Bid] * ask_quantity + analytics.best_price[Order::Type::Ask] * bid_quantity) / (ask_quantity + bid_quantity);
+
+		analytics.version = ++_analytics_version;
+		_analytics.store(analytics);
+	}
+	/**
+	 * \brief Опубликовать лучшие уровни стакана в разделяемую память, если с прошлой публикации какой-то из них изменился.
+	 * \details Исполняется в потоке сведения. Изменения отмечает \ref{_mark_level_changed}, а уровни берутся готовыми
+	 *		из \ref{_level_totals}, так что публикация - O(глубины) под read lock-ом стакана, а не обход всех заявок.
+	 */
+	void _publish_to_shared_memory()
+	{
+		{
+			boost::shared_lock<mutex_t> book_read_lock(_book.mutex);
+			if (_is_published_top_changed.exchange(false, std::memory_order_relaxed) == false)
+				return;
+
+			auto const depth = _shared_memory_writer->depth();
+			for (size_t side = 0; side < Order::Type::_EnumElementsCount; ++side)
+			{
+				auto const type = static_cast<Order::Type>(side);
+				auto &published_levels = _published_levels[type];
+				published_levels.clear();
+				_level_totals.for_each_level(type, depth, [&published_levels](price_t price, LevelTotal const &level)
+				{
+					published_levels.emplace_back(shared_memory_book::Level{ price, level.quantity, level.orders_count });
+				});
+				_published_worst_priority_prices[type] = published_levels.size() == depth
+					? OrderData::GetPriorityPrice(type, published_levels.back().price)
+					: std::numeric_limits<price_t>::infinity();
+			}
+		}
+		_shared_memory_writer->publish(_published_levels[Order::Type::Ask], _published_levels[Order::Type::Bid]);
+	}
+	/**
+	 * \brief Может ли заявка с таким сроком действия ждать исполнения в стакане.
+	 */
+	static bool _can_rest_in_book(Order::TimeInForce time_in_force)
+	{
+		return time_in_force == Order::TimeInForce::GoodTillCancel
+			|| time_in_force == Order::TimeInForce::GoodTillDate;
+	}
+	/**
+	 * \brief Истёк ли срок заявки к моменту \ref{now}.
+	 */
+	static bool _is_order_expired(OrderData const &order, expiration_time_t now)
+	{
+		return order.GetTimeInForce() == Order::TimeInForce::GoodTillDate
+			&& order.GetExpirationTime() <= now;
+	}
+	/**
+	 * \brief Удавлетворена ли заявка.
+	 * \details Заявка стакана с нулевым количеством - исполненная или отменённая(надгробие), которую ещё не удалили из индексов.
+	 */
+	static bool _is_order_satisfied(OrderData const &order)
+	{
+		return order.GetQuantity() == 0;
+	}
+	/**
+	 * \brief Получить тип заявки, с которой можно провести слияние.
+	 * \param merge_with_me Тип заявки, которая будет сливаться.
+	 * \return Тип заявки, с которой можно провести слияние.
+	 */
+	static Order::Type _get_order_type_for_merge_with(Order::Type merge_with_me)
+	{
+		BOOST_STATIC_ASSERT_MSG((size_t)Order::Type::_EnumElementsCount == 2, "На данный момент учитываются только Ask и Bid. При добавлении новых типов заявок, получение типа для мёржа надо переписать.");
+		// Отталкиваемся от знания того, что типа сейчас всего два и один из Ask или Bid равен нулю, а второй не равен нулю.
+		return (Order::Type)!merge_with_me;
+	}
+
+	/**
+	 * \brief Память массива корзин хеш-индекса: указатель на корзину и ещё один на конец.
+	 */
+	template<typename HashedIndexT>
+	static size_t _buckets_memory_usage(HashedIndexT const &index)
+	{
+		return (index.bucket_count() + 1) * sizeof(void*);
+	}
+
+	using buffered_orders_t = boost::multi_index::multi_index_container<
+		OrderData,
+		boost::multi_index::indexed_by<orders_by_id_hashed_unique_index_t>
+	>;
+
+	// \brief Сколько заявок сводится под одним захватом блокировок.
+	static constexpr size_t _max_merging_batch_size = 1024;
+	// \brief Начиная с такого количества заявок срез копируется параллельно.
+	static constexpr size_t _parallel_snapshot_min_orders_count = 1 << 16;
+	// \brief Точность, с которой снимаются заявки с истёкшим сроком.
+	static constexpr std::chrono::milliseconds _expiration_resolution{1};
+
+	tools::async::TasksExecutor _own_orders_merger;
+	// \brief Исполнитель, который, по велению стакана, занимается сведением заявок в отдельном потоке: свой или общий с другими стаканами.
+	tools::async::TasksExecutor &_orders_merger;
+	bool const _is_orders_merger_shared;
+	// \brief Исполнитель асинхронных операций. Запускается при первой из них.
+	tools::async::TasksExecutor _async_operations;
+	std::once_flag _async_operations_started;
+
+	// \warning Изменять только в потоке сведения.
+	tools::TimerWheel<order_id_t> _expirations{_expiration_resolution, std::chrono::system_clock::now()};
+	// \brief Буфер истёкших за тик заявок, чтобы не аллоцировать его каждый тик. Только для потока сведения.
+	std::vector<order_id_t> _expired_orders;
+	// \brief На какой момент заведён самый ранний тик колеса. Только для потока сведения.
+	boost::optional<expiration_time_t> _expiration_tick_at;
+
+	// \warning Публикация в разделяемую память. Изменять только в потоке сведения.
+	std::unique_ptr<shared_memory_book::Writer> _shared_memory_writer;
+	std::array<std::vector<shared_memory_book::Level>, Order::Type::_EnumElementsCount> _published_levels{};
+	// \brief Приоритетная цена худшего из опубликованных уровней стороны: бесконечность, если их меньше глубины,
+	//	и минус бесконечность, пока публикация не включена.
+	// \warning Изменять только в контексте write lock-a \ref{_book} или в потоке сведения под его read lock-ом.
+	std::array<price_t, Order::Type::_EnumElementsCount> _published_worst_priority_prices{
+		-std::numeric_limits<price_t>::infinity(), -std::numeric_limits<price_t>::infinity()
+	};
+	// \brief С прошлой публикации изменился уровень не хуже \ref{_published_worst_priority_prices}.
+	std::atomic<bool> _is_published_top_changed{ false };
+
+	details::ContainerWithSynchronization<orders_book_t, mutex_t> _book{};
+	/**
+	 * \brief Каталог заявок стакана: id - узел \ref{_book}, в полосах под своими блокировками.
+	 * \details Единственный индекс стакана по id. По нему get_data и промахи cancel не берут блокировку стакана и не ждут сведения.
+	 *		Узел удаляется из каталога раньше, чем из стакана, а количество заявки стакана меняется под блокировкой её полосы,
+	 *		так что под блокировкой полосы узел жив и согласован.
+	 * \warning Изменять только в контексте write lock-a \ref{_book}. Без него заявку удаляет из каталога только отмена.
+	 */
+	tools::StripedHashMap<order_id_t, OrderData const*, mutex_t> _book_directory;
+	/**
+	 * \brief Заявка стакана, отменённая без блокировки стакана, и её снятый остаток.
+	 */
+	struct CancelledOrder
+	{
+		OrderData const *order;
+		quantity_t quantity;
+	};
+	/**
+	 * \brief Отмены, которые поток сведения ещё не учёл, см. \ref{_apply_cancels}. Их узлы - уже надгробия, в каталоге их нет.
+	 * \warning Изменять только в контексте write lock-a \ref{_cancelled}: отмена берёт его под блокировкой полосы каталога.
+	 */
+	details::ContainerWithSynchronization<std::vector<CancelledOrder>, mutex_t> _cancelled{};
+	// \brief Буфер учитываемых отмен, чтобы не аллоцировать его на каждую задачу. Только в контексте write lock-a \ref{_book}.
+	std::vector<CancelledOrder> _applied_cancels;
+	/**
+	 * \brief Узлы учтённых отмен, которые ещё не удалены из индексов. Их количество - 0, в каталоге их нет.
+	 * \warning Изменять только в контексте write lock-a \ref{_book}.
+	 */
+	std::vector<OrderData const*> _tombstones;
+	// \brief Есть ли надгробия или неучтённые отмены: чтобы поток сведения не брал блокировку стакана впустую.
+	std::atomic<bool> _has_tombstones{ false };
+	/**
+	 * \brief Замороженные уровни стакана, см. \ref{enable_cold_tiering}. Их заявок нет ни в \ref{_book}, ни в каталоге.
+	 * \warning Изменять только в контексте write lock-a \ref{_book}.
+	 */
+	ColdLevels _cold_levels;
+	// \brief Расстояние от лучшей цены стороны, дальше которого уровни замораживаются. Задаётся до запуска заморозки.
+	price_t _cold_level_distance = 0;
+	std::atomic<bool> _is_cold_tiering_enabled{ false };
+	details::ContainerWithSynchronization<buffered_orders_t, mutex_t> _merging{};
+	
+	// \warning Изменять только в контексте write lock-a.
+	order_id_t _id_counter = 0;
+
+	/**
+	 * \brief Заявка IOC или FOK, ждущая сведения, и кому отдать результат её исполнения.
+	 */
+	struct PendingExecution
+	{
+		OrderData order;
+		std::function<void(OrderData)> on_executed;
+	};
+	// \warning Изменять только в контексте write lock-a \ref{_merging}.
+	std::deque<PendingExecution> _pending_executions;
+	bool _is_merging_scheduled = false;
+	// \brief Идёт аукцион: заявки копятся в стакане без сведения.
+	// \warning Изменять только в контексте write lock-a \ref{_merging}, а при сведении - ещё и \ref{_book}.
+	bool _is_auction = false;
+	// \brief id последней сведённой(или отменённой до сведения) заявки.
+	// \warning Изменять только в контексте write lock-a \ref{_merging}.
+	order_id_t _last_merged_id = 0;
+
+	// \brief Буфер удовлетворённых при сведении заявок, чтобы не аллоцировать его на каждую заявку. Только для потока сведения.
+	std::vector<OrderData const*> _satisfied_orders_from_book;
+	/**
+	 * \brief Исполнение заявки стакана: на сколько и какой остался остаток.
+	 */
+	struct Fill
+	{
+		OrderData const *order;
+		quantity_t quantity;
+		quantity_t remaining;
+	};
+	// \brief Исполнения заявок стакана, о которых ещё не сообщили, см. \ref{_fill_from_book}. Только для потока сведения.
+	std::vector<Fill> _fills;
+
+	// \brief Подписчики на изменения уровней и уровни, изменившиеся с последнего оповещения.
+	// \warning Изменять только в контексте write lock-a \ref{_book}.
+	std::vector<std::pair<size_t, level_listener_t>> _level_listeners;
+	size_t _last_subscription_id = 0;
+	std::vector<std::pair<Order::Type, price_t>> _changed_levels;
+
+	// \brief Подписчики на поток изменений для реплик.
+	// \warning Изменять только в контексте write lock-a \ref{_book}.
+	std::vector<std::pair<size_t, replication_listener_t>> _replication_listeners;
+	// \brief \ref{_id_counter}, разосланный репликам последним.
+	// \warning Изменять только в контексте write lock-ов \ref{_book} и \ref{_merging}.
+	order_id_t _replicated_id_counter = 0;
+	// \brief Подписчики на исполнения заявок.
+	// \warning Изменять только в контексте write lock-a \ref{_book}.
+	std::vector<std::pair<size_t, execution_listener_t>> _execution_listeners;
+	// \brief Сумма \ref{_checksum_of} заявок стакана.
+	// \warning Изменять только в контексте write lock-a \ref{_book}. Читать можно без блокировок.
+	std::atomic<uint64_t> _state_checksum{ 0 };
+	// \brief Стакан - реплика: заявки в нём меняет только \ref{apply_replication_event}.
+	// \warning Изменять только в контексте write lock-a \ref{_merging}.
+	std::atomic<bool> _is_replica{ false };
+
+	// \brief Объём и сумма цена*объём заявок каждой стороны стакана для \ref{BookAnalytics}.
+	// \warning Изменять только в контексте write lock-a \ref{_book}.
+	std::array<quantity_t, Order::Type::_EnumElementsCount> _side_quantities{};
+	std::array<double, Order::Type::_EnumElementsCount> _side_notionals{};
+	bool _is_analytics_changed = true;
+	uint64_t _analytics_version = 0;
+	// \brief Объём и число заявок каждого уровня стороны, горячих и замороженных вместе. Заморозка и разморозка их не меняют.
+	// \warning Изменять только в контексте write lock-a \ref{_book}, а хранилище менять - ещё и \ref{_merging}.
+	LevelTotals _level_totals;
+	// \brief Задача потока сведения, которая доделает отмены, уже поставлена.
+	// \warning Изменять только в контексте write lock-a \ref{_cancelled}.
+	bool _is_cancels_processing_scheduled = false;
+	// \brief Опубликованные показатели. Пишутся под write lock-ом \ref{_book}, читаются без блокировок.
+	tools::SeqLock<BookAnalytics> _analytics;
+};
+
+template<typename LockPolicyT>
+constexpr std::chrono::milliseconds BasicOrderBook<LockPolicyT>::Impl::_expiration_resolution;
+
+template<typename LockPolicyT>
+BasicOrderBook<LockPolicyT>::~BasicOrderBook()
+{
+	_impl->stop_async_operations();
+}
+template<typename LockPolicyT>
+BasicOrderBook<LockPolicyT>::BasicOrderBook()
+	: _impl(std::make_unique<Impl>(nullptr))
+{
+}
+template<typename LockPolicyT>
+BasicOrderBook<LockPolicyT>::BasicOrderBook(tools::async::TasksExecutor &shared_orders_merger)
+	: _impl(std::make_unique<Impl>(&shared_orders_merger))
+{
+}
+
+template<typename LockPolicyT>
+order_id_t BasicOrderBook<LockPolicyT>::post(std::unique_ptr<Order> order)
+{
 	return _impl->post(std::move(order));
 }
 
-boost::optional<OrderData> OrderBook::cancel(order_id_t const &id)
+template<typename LockPolicyT>
+std::vector<order_id_t> BasicOrderBook<LockPolicyT>::post_batch(std::vector<std::unique_ptr<Order>> orders)
+{
+	return _impl->post_batch(std::move(orders));
+}
+
+template<typename LockPolicyT>
+OrderData BasicOrderBook<LockPolicyT>::execute(std::unique_ptr<Order> order)
+{
+	return _impl->execute(std::move(order));
+}
+
+template<typename LockPolicyT>
+boost::optional<OrderData> BasicOrderBook<LockPolicyT>::cancel(order_id_t const &id)
 {
 	return _impl->cancel(id);
 }
 
-OrderData OrderBook::get_data(order_id_t const &id) const
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::wait_for_merging()
+{
+	_impl->wait_for_merging();
+}
+
+template<typename LockPolicyT>
+OrderData BasicOrderBook<LockPolicyT>::get_data(order_id_t const &id) const
 {
 	return _impl->get_data(id);
 }
 
-std::unique_ptr<MarketDataSnapshot> OrderBook::get_snapshot() const
+template<typename LockPolicyT>
+std::unique_ptr<MarketDataSnapshot> BasicOrderBook<LockPolicyT>::get_snapshot() const
 {
 	return _impl->get_snapshot();
-}
\ No newline at end of file
+}
+
+template<typename LockPolicyT>
+FlatMarketDataSnapshot BasicOrderBook<LockPolicyT>::get_flat_snapshot() const
+{
+	return _impl->get_flat_snapshot();
+}
+
+template<typename LockPolicyT>
+MemoryUsage BasicOrderBook<LockPolicyT>::memory_usage() const
+{
+	return _impl->memory_usage();
+}
+
+template<typename LockPolicyT>
+BookAnalytics BasicOrderBook<LockPolicyT>::get_analytics() const
+{
+	return _impl->get_analytics();
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::_queue_async_operation(std::function<void()> operation)
+{
+	_impl->queue_async_operation(std::move(operation));
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::_execute_deferred(std::unique_ptr<Order> order, std::function<void(OrderData)> on_executed)
+{
+	_impl->execute(std::move(order), std::move(on_executed));
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::enable_tick_ladder(price_t min_price, price_t max_price, price_t tick_size)
+{
+	_impl->enable_tick_ladder(min_price, max_price, tick_size);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::publish_to_shared_memory(std::string segment_name, size_t depth, std::chrono::milliseconds period)
+{
+	_impl->publish_to_shared_memory(std::move(segment_name), depth, period);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::enable_cold_tiering(price_t distance, std::chrono::milliseconds period)
+{
+	_impl->enable_cold_tiering(distance, period);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::begin_auction()
+{
+	_impl->begin_auction();
+}
+
+template<typename LockPolicyT>
+boost::optional<AuctionResult> BasicOrderBook<LockPolicyT>::uncross()
+{
+	return _impl->uncross();
+}
+
+template<typename LockPolicyT>
+size_t BasicOrderBook<LockPolicyT>::subscribe_to_level_changes(level_listener_t listener)
+{
+	return _impl->subscribe_to_level_changes(std::move(listener));
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::unsubscribe_from_level_changes(size_t subscription_id)
+{
+	_impl->unsubscribe_from_level_changes(subscription_id);
+}
+
+template<typename LockPolicyT>
+size_t BasicOrderBook<LockPolicyT>::subscribe_to_executions(execution_listener_t listener)
+{
+	return _impl->subscribe_to_executions(std::move(listener));
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::unsubscribe_from_executions(size_t subscription_id)
+{
+	_impl->unsubscribe_from_executions(subscription_id);
+}
+
+template<typename LockPolicyT>
+size_t BasicOrderBook<LockPolicyT>::subscribe_to_replication(replication_listener_t listener)
+{
+	return _impl->subscribe_to_replication(std::move(listener));
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::unsubscribe_from_replication(size_t subscription_id)
+{
+	_impl->unsubscribe_from_replication(subscription_id);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::apply_replication_event(ReplicationEvent const &event)
+{
+	_impl->apply_replication_event(event);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::promote()
+{
+	_impl->promote();
+}
+
+template<typename LockPolicyT>
+uint64_t BasicOrderBook<LockPolicyT>::state_checksum() const
+{
+	return _impl->state_checksum();
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::visit_snapshot(std::function<void(OrderView const &)> const &visitor) const
+{
+	_impl->visit_snapshot(visitor);
+}
+
+template<typename LockPolicyT>
+void BasicOrderBook<LockPolicyT>::visit_snapshot_levels(std::function<void(PriceLevelView const &)> const &visitor) const
+{
+	_impl->visit_snapshot_levels(visitor);
+}
+
+template class BasicOrderBook<lock_policy::SharedMutex>;
+template class BasicOrderBook<lock_policy::SharedSpinLock>;
+template class BasicOrderBook<lock_policy::NullLock>;
@@ -3,10 +3,22 @@
 #ifndef ORDER_BOOK_H
 #define ORDER_BOOK_H
 
+#include <exception>
+#include <functional>
+#include <memory>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/thread/exceptions.hpp>
+
 #include "async_tasks_executor.h"
+#include "lock_policy.h"
 #include "Order.h"
 
 struct MarketDataSnapshot;
+struct FlatMarketDataSnapshot;
 
 struct OrderData
 {
@@ -19,10 +31,10 @@ struct OrderData
 
 	OrderData(OrderData const& other)
 		noexcept(noexcept(
-			std::make_unique<Order>(std::declval<Order::Type>(), std::declval<price_t>(), std::declval<quantity_t>())
+			std::make_unique<Order>(std::declval<Order const&>())
 			))
 		: order_id(other.order_id)
-		, _order(std::make_unique<Order>(other._order->type, other._order->price, other._order->quantity))
+		, _order(std::make_unique<Order>(*other._order))
 	{
 	}
 	
@@ -53,9 +65,39 @@ struct OrderData
 		return static_cast<typename std::underlying_type<decltype(Order::type)>::type>(_order->type);
 	}
 
-	quantity_t &GetQuantity() const
+	/**
+	 * \brief Цена в порядке приоритета стороны: у Ask - сама цена, у Bid - с обратным знаком.
+	 * \details Так лучшая цена любой стороны - наименьшая, и индекс по ней обходит сторону от лучшей цены к худшей.
+	 */
+	static price_t GetPriorityPrice(Order::Type type, price_t price)
 	{
-		return _order->quantity;
+		return type == Order::Type::Bid ? -price : price;
+	}
+	price_t GetPriorityPrice() const
+	{
+		return GetPriorityPrice(static_cast<Order::Type>(GetType()), GetPrice());
+	}
+
+	/**
+	 * \brief Неисполненный остаток.
+	 * \details Остаток заявки стакана меняют под блокировкой полосы каталога, а читают и под блокировкой стакана,
+	 *		поэтому обращения к нему атомарные. Порядок им не нужен: его дают блокировки.
+	 */
+	quantity_t GetQuantity() const
+	{
+		return _order->quantity.load(std::memory_order_relaxed);
+	}
+	void SetQuantity(quantity_t quantity) const
+	{
+		_order->quantity.store(quantity, std::memory_order_relaxed);
+	}
+	Order::TimeInForce GetTimeInForce() const
+	{
+		return _order->time_in_force;
+	}
+	expiration_time_t GetExpirationTime() const
+	{
+		return _order->expire_at;
 	}
 	
 	order_id_t order_id;
@@ -64,27 +106,172 @@ private:
 	std::unique_ptr<Order> _order;
 };
 
+/**
+ * \brief Заявка среза, отдаваемая визитору без копирования.
+ * \warning Действительна только во время вызова визитора.
+ */
+struct OrderView
+{
+	order_id_t const &order_id;
+	Order::Type type;
+	price_t price;
+	quantity_t quantity;
+};
+
+/**
+ * \brief Агрегированный уровень цены среза.
+ */
+struct PriceLevelView
+{
+	Order::Type type;
+	price_t price;
+	// \brief Суммарное количество заявок уровня.
+	quantity_t quantity;
+	size_t orders_count;
+};
+
+/**
+ * \brief Итог аукциона.
+ */
+struct AuctionResult
+{
+	// \brief Цена, по которой исполнены все сделки аукциона.
+	price_t price;
+	// \brief Исполненный объём, одинаковый для Ask и Bid.
+	quantity_t volume;
+};
+
+/**
+ * \brief Показатели стакана, которые поток сведения поддерживает по ходу изменений, см. \ref{BasicOrderBook::get_analytics}.
+ * \details Считаются по заявкам стакана, без ждущих сведения, как и уровни. Массивы - по Order::Type.
+ *		У пустой стороны цены - NaN, объёмы - 0. Microprice без одной из сторон и перевес пустого стакана - тоже NaN.
+ */
+struct BookAnalytics
+{
+	// \brief Лучшая цена стороны и объём её уровня.
+	std::array<price_t, Order::Type::_EnumElementsCount> best_price;
+	std::array<quantity_t, Order::Type::_EnumElementsCount> best_quantity;
+	// \brief Объём всех заявок стороны и их средняя цена, взвешенная по объёму.
+	std::array<quantity_t, Order::Type::_EnumElementsCount> total_quantity;
+	std::array<price_t, Order::Type::_EnumElementsCount> vwap;
+	// \brief Перевес лучших уровней: (Bid - Ask) / (Bid + Ask), от -1 до 1.
+	double imbalance;
+	// \brief То же по объёмам сторон целиком.
+	double depth_imbalance;
+	// \brief Лучшие цены, взвешенные по объёму противоположного лучшего уровня: ближе к той, у которой объём меньше.
+	price_t microprice;
+	// \brief Растёт с каждым обновлением показателей.
+	uint64_t version;
+};
+
+/**
+ * \brief Изменение состояния стакана для реплики.
+ * \details Поток событий стакана-лидера, применённый по порядку к пустому стакану, воспроизводит в нём те же заявки с теми же id.
+ *		Заявки, ждущие сведения, в состояние не входят: в поток они попадают, когда встают в стакан.
+ */
+struct ReplicationEvent
+{
+	enum class Kind : uint8_t
+	{
+		// Заявка встала в стакан с неисполненным остатком quantity.
+		Rest = 0,
+		// Заявка стакана исполнена на quantity. Исполненная полностью из стакана уходит.
+		Fill = 1,
+		// Заявка снята из стакана: отменена или истёк её срок.
+		Remove = 2,
+		// Лидер выдал id до order_id включительно. Состояние не меняется, но после promote реплика не выдаст эти id снова,
+		// хотя заявки IOC/FOK и исполненные сразу при постановке в Rest не попадают.
+		IdAdvance = 3
+	};
+
+	Kind kind;
+	order_id_t order_id;
+	// \brief Заявка целиком - только для Rest.
+	Order::Type type;
+	price_t price;
+	Order::TimeInForce time_in_force;
+	expiration_time_t expire_at;
+	// \brief Для Rest - остаток заявки, для Fill - исполненное количество.
+	quantity_t quantity;
+	// \brief Контрольная сумма состояния лидера после события, см. \ref{BasicOrderBook::state_checksum}.
+	uint64_t checksum;
+};
+
+/**
+ * \brief Исполнение заявки при сведении или на аукционе.
+ * \details При сведении о сделке приходят два исполнения: заявки из стакана и встречной ей новой заявки, оба по цене заявки из стакана.
+ */
+struct ExecutionReport
+{
+	order_id_t order_id;
+	price_t price;
+	quantity_t quantity;
+};
+
+/**
+ * \brief Память, занятая заявками стакана, по составляющим.
+ * \details Считается по размерам структур, без накладных расходов аллокатора на каждое выделение.
+ */
+struct MemoryUsage
+{
+	// \brief Массивы корзин каталога стакана по id.
+	size_t index_buckets;
+	// \brief Узлы контейнера стакана: OrderData(id и указатель на заявку) вместе с указателями индексов, и узлы каталога по id.
+	size_t index_nodes;
+	// \brief Заявки Order в куче, на которые указывают OrderData стакана.
+	size_t order_payloads;
+	// \brief Заявки, ждущие сведения: буфер сведения целиком и очередь IOC/FOK.
+	size_t pending_queue;
+	// \brief Массивы замороженных уровней, см. \ref{BasicOrderBook::enable_cold_tiering}.
+	size_t cold_levels;
+	// \brief Заявки в стакане, в том числе замороженные, и ждущие сведения.
+	size_t orders_count;
+
+	size_t total() const
+	{
+		return index_buckets + index_nodes + order_payloads + pending_queue + cold_levels;
+	}
+	double bytes_per_order() const
+	{
+		return orders_count == 0 ? 0. : static_cast<double>(total()) / orders_count;
+	}
+};
+
 /**
  * \brief Стакан заявок.
- * \warning Сведение заявок происходит в отдельном потоке.
+ * \tparam LockPolicyT Политика блокировок из lock_policy.h.
+ * \warning Сведение заявок происходит в отдельном потоке, если политика не lock_policy::NullLock.
+ *		С lock_policy::NullLock заявки сводятся в вызывающем потоке, а стаканом можно пользоваться только из одного потока.
+ *		Тогда же заявки с истёкшим сроком снимаются только при постановке заявок,
+ *		а публикация в разделяемую память, заморозка уровней и асинхронные операции недоступны.
  */
-class OrderBook : boost::noncopyable
+template<typename LockPolicyT = lock_policy::SharedMutex>
+class BasicOrderBook : boost::noncopyable
 {
 public:
+	using lock_policy_t = LockPolicyT;
+
 	using orders_by_id_hashed_unique_index_t = boost::multi_index::hashed_unique<
 		boost::multi_index::tag<struct OrdersById>,
 		boost::multi_index::member<OrderData, decltype(OrderData::order_id), &OrderData::order_id>
 	>;
+	/**
+	 * \brief Хранилище заявок стакана.
+	 * \details Индекса по id здесь нет: по id заявки стакана находятся через каталог(StripedHashMap id - узел),
+	 *		который нужен и без того, чтобы get_data и промахи cancel не брали блокировку стакана. Так на заявку приходится
+	 *		один хеш-узел, а не два.
+	 */
 	using orders_book_t = boost::multi_index::multi_index_container<
 		OrderData,
 		boost::multi_index::indexed_by<
-			orders_by_id_hashed_unique_index_t,
-			boost::multi_index::hashed_non_unique<
-				boost::multi_index::tag<struct OrdersByPriceAndType>,
+			// Сторона, уровни от лучшей цены к худшей, а внутри уровня - в порядке поступления: в таком порядке заявки и сводятся.
+			boost::multi_index::ordered_non_unique<
+				boost::multi_index::tag<struct OrdersByPriority>,
 			    boost::multi_index::composite_key<
 					OrderData,
-					boost::multi_index::const_mem_fun<OrderData, price_t, &OrderData::GetPrice>,
-					boost::multi_index::const_mem_fun<OrderData, decltype(std::declval<OrderData>().GetType()), &OrderData::GetType>
+					boost::multi_index::const_mem_fun<OrderData, decltype(std::declval<OrderData>().GetType()), &OrderData::GetType>,
+					boost::multi_index::const_mem_fun<OrderData, price_t, &OrderData::GetPriorityPrice>,
+					boost::multi_index::member<OrderData, decltype(OrderData::order_id), &OrderData::order_id>
 				>
 			>
 		>
@@ -92,14 +279,41 @@ public:
 	
 	/**
 	 * \brief Постановка заявок
+	 * \details Заявки IOC и FOK в стакан не попадают, а исполняются немедленно, как в \ref{execute}.
+	 *		Заявки GTD снимаются из стакана по истечении срока.
 	 * \return id заявки
+	 * \throw std::out_of_range, std::invalid_argument если включена \ref{enable_tick_ladder}, а цена заявки GTC или GTD
+	 *		вне диапазона лестницы или не кратна её шагу.
 	 */
 	order_id_t post(std::unique_ptr<Order>);
+	/**
+	 * \brief Постановка пачки заявок за один захват блокировки буфера сведения.
+	 * \details Заявки получают идущие подряд id в порядке пачки и сводятся одной задачей в том же порядке.
+	 * \return id заявок в порядке пачки
+	 * \throw std::invalid_argument если в пачке есть заявка IOC или FOK: такие исполняются через \ref{execute}.
+	 * \throw std::out_of_range, std::invalid_argument если цена заявки не на лестнице цен, как у \ref{post}. Тогда не ставится ни одна.
+	 */
+	std::vector<order_id_t> post_batch(std::vector<std::unique_ptr<Order>> orders);
+	/**
+	 * \brief Немедленное исполнение заявки IOC или FOK.
+	 * \details Заявка сводится в потоке сведения за один проход, минуя буфер ожидающих сведения заявок, и в стакан не помещается.
+	 * \return Данные заявки после исполнения. Количество в них - неисполненный(отменённый) остаток.
+	 * \throw std::invalid_argument если заявка помещается в стакан(GTC или GTD).
+	 */
+	OrderData execute(std::unique_ptr<Order>);
 	/**
 	 * \brief Отмена заявки
+	 * \details Заявку стакана отмена снимает под блокировкой полосы каталога, не беря блокировку стакана и не дожидаясь сведения.
+	 *		Итоги уровней, подписчики и реплики узнают об отмене из потока сведения, чуть позже.
 	 * \return Данные отменённой заявки. Если такой заявки не было(либо уже нет, то есть её отменили), то boost::none.
 	 */
 	boost::optional<OrderData> cancel(order_id_t const &);
+	/**
+	 * \brief Дождаться сведения всех заявок, поставленных до вызова.
+	 * \details В отличие от заявки IOC, которой можно дождаться того же, ничего не меняет: ни id, ни исполнений, ни реплик.
+	 *		Без потока сведения заявки уже сведены вызывающим, так что ждать нечего.
+	 */
+	void wait_for_merging();
 	/**
 	 * \brief Получение данных заявки
 	 * \return Данные заявки
@@ -110,12 +324,337 @@ public:
 	 * \return Срез.
 	 */
 	std::unique_ptr<MarketDataSnapshot> get_snapshot() const;
+	/**
+	 * \brief Получить срез в виде плоских массивов POD записей, отсортированных по возрастанию цены.
+	 * \details Под блокировками записи только копируются в заранее выделенные массивы, сортировка идёт уже после их снятия.
+	 *		Если нужен \ref{MarketDataSnapshot}, то его можно построить из плоского среза.
+	 */
+	FlatMarketDataSnapshot get_flat_snapshot() const;
+	/**
+	 * \brief Оценить память, занятую заявками, по составляющим.
+	 * \details Стакан и буфер сведения оцениваются под своими блокировками по очереди, так что вместе они могут не совпадать по времени.
+	 *		Таймеры заявок GTD принадлежат потоку сведения и не учитываются.
+	 */
+	MemoryUsage memory_usage() const;
+	/**
+	 * \brief Показатели стакана: лучшие уровни, перевес, microprice и средние цены сторон.
+	 * \details Поток сведения поддерживает их по ходу изменений: объёмы сторон за O(1), а объёмы уровней - за O(log уровней)
+	 *		на изменение заявки. Публикует он их раз на пачку сведения или снятия по сроку, а отмены, пришедшие между пачками,
+	 *		публикует одной своей задачей. Читаются показатели за O(1) без блокировок, не мешая сведению.
+	 *		Опубликованные показатели согласованы между собой и соответствуют стакану после последней публикации.
+	 *		Исполнение IOC и FOK возвращается уже после публикации показателей по всем заявкам до него.
+	 */
+	BookAnalytics get_analytics() const;
+	/**
+	 * \brief Обойти заявки, которые есть в стакане на момент вызова, не копируя их.
+	 * \details Визитор вызывается под теми же блокировками, что и при получении среза, поэтому видит согласованное состояние.
+	 *		Порядок заявок не определён.
+	 * \warning Визитор не должен обращаться к стакану.
+	 */
+	void visit_snapshot(std::function<void(OrderView const &)> const &visitor) const;
+	/**
+	 * \brief Обойти агрегированные уровни цены, которые есть в стакане на момент вызова.
+	 * \details Сначала все уровни Ask, потом Bid, каждая сторона по возрастанию цены, как и в срезе.
+	 *		Промежуточно хранятся только уровни, а не заявки. Визитор вызывается уже после снятия блокировок.
+	 */
+	void visit_snapshot_levels(std::function<void(PriceLevelView const &)> const &visitor) const;
+	/**
+	 * \brief Записать агрегированные уровни цены в выходной итератор.
+	 * \return Итератор за последним записанным уровнем.
+	 */
+	template<typename OutputIteratorT>
+	OutputIteratorT copy_snapshot_levels(OutputIteratorT out) const
+	{
+		visit_snapshot_levels([&out](PriceLevelView const &level) { *out++ = level; });
+		return out;
+	}
+	/**
+	 * \brief Публиковать агрегированные уровни стакана в разделяемую память для читателей из других процессов.
+	 * \details Поток сведения раз в \ref{period} публикует до \ref{depth} лучших уровней каждой стороны, если какой-то из них изменился.
+	 *		Уровни - те же, что в \ref{subscribe_to_level_changes}: заявки, ждущие сведения, в них не входят.
+	 *		Публикация стоит O(depth): объёмы уровней поддерживаются по ходу изменений, а не собираются из заявок.
+	 *		Читать опубликованное - через shared_memory_book::Reader. Сегмент удаляется при разрушении стакана.
+	 * \throw std::logic_error если публикация уже включена.
+	 * \throw boost::interprocess::interprocess_exception если сегмент создать не удалось.
+	 */
+	void publish_to_shared_memory(std::string segment_name, size_t depth, std::chrono::milliseconds period = std::chrono::milliseconds(1));
+	/**
+	 * \brief Замораживать уровни, далёкие от лучшей цены.
+	 * \details Поток сведения раз в \ref{period} переносит заявки GTC с уровней дальше \ref{distance} от лучшей цены своей стороны
+	 *		из узлов стакана в плотные массивы \ref{ColdLevels}, а уровни, к которым цена приблизилась, возвращает обратно.
+	 *		Заявку, которая может исполниться с замороженными уровнями, сведение размораживает их перед исполнением,
+	 *		так что исполнение, срезы, уровни, get_data, cancel и реплики видят стакан тем же, с тем же приоритетом заявок.
+	 *		Заявки GTD и заявки, id которых не влезает в 64 бита, не замораживаются.
+	 *		Промах get_data и cancel по каталогу стакана проверяет замороженные заявки под блокировкой стакана на чтение.
+	 * \param distance Расстояние по цене от лучшей цены стороны, не отрицательное.
+	 * \throw std::logic_error если заморозка уже включена или стакан - lock_policy::NullLock.
+	 * \throw std::invalid_argument если расстояние отрицательно.
+	 */
+	void enable_cold_tiering(price_t distance, std::chrono::milliseconds period = std::chrono::milliseconds(100));
+	/**
+	 * \brief Хранить итоги уровней в лестнице цен(\ref{BasicTickLadder}) для инструмента с известным диапазоном цен и шагом.
+	 * \details Вместо узла std::map на уровень - массив по шагам цены и битовая карта занятости: учёт заявки в уровне -
+	 *		индекс в массиве, а лучший уровень для показателей, уровней и публикации в разделяемую память - поиск по битовой карте.
+	 *		Заявки, которые могут встать в стакан, после этого принимаются только с ценой на лестнице.
+	 *		Память - по итогам уровня на каждый шаг диапазона с каждой стороны.
+	 * \throw std::logic_error если лестница уже включена или в стакане либо в буфере сведения есть заявки.
+	 * \throw std::invalid_argument если шаг не положителен или диапазон пуст.
+	 */
+	void enable_tick_ladder(price_t min_price, price_t max_price, price_t tick_size);
+
+	/**
+	 * \brief Начать аукцион: заявки больше не сводятся при поступлении, а копятся в стакане до \ref{uncross}.
+	 * \details Заявки, которые к этому моменту ещё не сведены, тоже копятся.
+	 *		Заявки IOC и FOK во время аукциона не исполняются и возвращаются с неисполненным количеством.
+	 * \throw std::logic_error если аукцион уже идёт.
+	 */
+	void begin_auction();
+	/**
+	 * \brief Провести аукцион и вернуться к непрерывному сведению.
+	 * \details Цена равновесия ищется по суммарным объёмам уровней: та, при которой исполняется наибольший объём,
+	 *		из таких - с наименьшим перевесом спроса или предложения, из таких - наименьшая.
+	 *		Bid по этой цене и выше и Ask по этой цене и ниже исполняются по ней за один проход,
+	 *		лучшие по цене раньше, а при равной цене - в порядке поступления. Участвуют все заявки, поставленные до вызова.
+	 * \throw std::logic_error если аукцион не идёт.
+	 * \return Итог аукциона или boost::none, если Ask и Bid не пересеклись.
+	 */
+	boost::optional<AuctionResult> uncross();
+
+	using replication_listener_t = std::function<void(ReplicationEvent const &)>;
+	/**
+	 * \brief Подписаться на поток изменений состояния стакана для реплики.
+	 * \details Сначала слушатель получает Rest на каждую заявку стакана, затем - каждое изменение в том порядке, в котором
+	 *		оно произошло. id, выданный последним, приходит в IdAdvance при подписке и после каждой пачки сведения, в которой он вырос.
+	 *		Другой стакан, применяя события по порядку через \ref{apply_replication_event}, становится копией этого.
+	 *		Для передачи между процессами события кодируются в wire_format::encode_replication_event.
+	 * \warning Слушатель вызывается под блокировкой стакана, в потоке сведения: туда же приходят и отмены.
+	 *		Обращаться к этому стакану из слушателя нельзя, а применять событие к реплике - можно.
+	 * \return id подписки
+	 */
+	size_t subscribe_to_replication(replication_listener_t listener);
+	/**
+	 * \brief Отписаться от потока изменений состояния.
+	 * \details После возврата слушатель больше не вызывается.
+	 */
+	void unsubscribe_from_replication(size_t subscription_id);
+	/**
+	 * \brief Применить событие лидера.
+	 * \details С первым событием стакан становится репликой: заявки в него ставит и снимает только лидер,
+	 *		а post, post_batch, execute и cancel бросают std::logic_error. Срок заявок GTD реплики не истекает сам по себе:
+	 *		их снимает лидер. Реплика сама рассылает применённые события своим подписчикам, так что реплики можно сцеплять.
+	 * \throw std::logic_error если стакан, ещё не ставший репликой, не пуст.
+	 * \throw std::runtime_error если реплика разошлась с лидером: контрольная сумма после события не совпала с лидерской
+	 *		или событие ссылается на заявку, которой в реплике нет.
+	 */
+	void apply_replication_event(ReplicationEvent const &event);
+	/**
+	 * \brief Сделать реплику самостоятельным стаканом, например когда лидер упал.
+	 * \details id новых заявок продолжают id лидера, а заявки GTD, срок которых истёк, снимаются.
+	 */
+	void promote();
+	/**
+	 * \brief Контрольная сумма заявок стакана: сумма по модулю 2^64 хешей id, типа, цены и остатка каждой заявки.
+	 * \details Обновляется при каждом изменении стакана за O(1) и читается без блокировок,
+	 *		так что расхождение реплики с лидером видно по одному сравнению, без сравнения срезов.
+	 *		Заявки, ждущие сведения, в сумму не входят.
+	 */
+	uint64_t state_checksum() const;
+
+	using level_listener_t = std::function<void(PriceLevelView const &)>;
+	/**
+	 * \brief Подписаться на изменения уровней цены стакана.
+	 * \details Сначала слушатель получает все уровни, которые есть в стакане, затем - каждый изменившийся уровень с новыми
+	 *		количеством и числом заявок. Уровень с нулём заявок из стакана ушёл. Заявки, ждущие сведения, в уровни не входят.
+	 *		Изменения от отмен приходят не из отменившего потока, а из потока сведения: после пачки сведения или его задачей.
+	 * \warning Слушатель вызывается под блокировкой стакана, в потоке сведения(у стакана без блокировок - в вызывающем потоке).
+	 *		Обращаться к стакану из слушателя нельзя.
+	 * \return id подписки
+	 */
+	size_t subscribe_to_level_changes(level_listener_t listener);
+	/**
+	 * \brief Отписаться от изменений уровней цены.
+	 * \details После возврата слушатель больше не вызывается.
+	 */
+	void unsubscribe_from_level_changes(size_t subscription_id);
+
+	using execution_listener_t = std::function<void(ExecutionReport const &)>;
+	/**
+	 * \brief Подписаться на исполнения заявок: и поставленных в стакан, и IOC/FOK, и исполненных сразу при постановке.
+	 * \details Реплика исполнений не рассылает: заявки в ней исполняет лидер.
+	 * \warning Слушатель вызывается под блокировкой стакана, в потоке сведения. Обращаться к стакану из слушателя нельзя.
+	 * \return id подписки
+	 */
+	size_t subscribe_to_executions(execution_listener_t listener);
+	/**
+	 * \brief Отписаться от исполнений заявок.
+	 * \details После возврата слушатель больше не вызывается.
+	 */
+	void unsubscribe_from_executions(size_t subscription_id);
 
-	OrderBook();
-	~OrderBook();
+	/* Асинхронные варианты операций.
+	 * Операция ставится в очередь и исполняется в отдельном потоке стакана, так что вызывающий поток не ждёт блокировок.
+	 * Исключение - async_execute, см. его описание.
+	 * Операции исполняются по одной в порядке постановки в очередь.
+	 * Заявку IOC или FOK поток операций только ставит на сведение, а завершает операцию поток сведения, когда исполнит её,
+	 * так что остальные операции исполнения не ждут.
+	 * Завершение - по соглашениям Asio: обработчик с сигнатурой void(std::exception_ptr, результат), либо boost::asio::use_future.
+	 * Обработчик вызывается через post на связанном с ним исполнителе(boost::asio::bind_executor),
+	 * так что, привязав обработчик к своему io_context или strand, вызывающий получит завершение в своём потоке.
+	 * Пока операция не завершена, исполнитель обработчика считается занятым работой.
+	 * Если стакан разрушен раньше, чем операция исполнена, обработчик разрушается не вызванным.
+	 */
+	template<typename CompletionTokenT>
+	auto async_post(std::unique_ptr<Order> order, CompletionTokenT &&token)
+	{
+		// std::function требует копируемости, поэтому заявку держим через shared_ptr.
+		std::shared_ptr<Order> shared_order(std::move(order));
+		return _initiate_async<order_id_t>(
+			std::forward<CompletionTokenT>(token),
+			[this, shared_order](auto const &complete)
+			{
+				if (_is_immediate(*shared_order))
+					_execute_deferred(std::make_unique<Order>(std::move(*shared_order)), [complete](OrderData executed) { complete(nullptr, executed.order_id); });
+				else
+					complete(nullptr, post(std::make_unique<Order>(std::move(*shared_order))));
+			}
+		);
+	}
+	/**
+	 * \brief Асинхронное немедленное исполнение заявки IOC или FOK, см. \ref{execute}.
+	 * \details В отличие от остальных асинхронных операций, заявка ставится на сведение сразу, в вызывающем потоке, минуя очередь:
+	 *		как и post, вызов ждёт только блокировку буфера сведения. Так заявки потока сводятся в том порядке,
+	 *		в котором он вызывал post, post_batch и async_execute.
+	 */
+	template<typename CompletionTokenT>
+	auto async_execute(std::unique_ptr<Order> order, CompletionTokenT &&token)
+	{
+		std::shared_ptr<Order> shared_order(std::move(order));
+		return _initiate_async<OrderData>(
+			std::forward<CompletionTokenT>(token),
+			[this, shared_order](auto const &complete)
+			{
+				_execute_deferred(std::make_unique<Order>(std::move(*shared_order)), [complete](OrderData executed) { complete(nullptr, std::move(executed)); });
+			},
+			false
+		);
+	}
+	template<typename CompletionTokenT>
+	auto async_cancel(order_id_t id, CompletionTokenT &&token)
+	{
+		return _initiate_async<boost::optional<OrderData>>(
+			std::forward<CompletionTokenT>(token),
+			[this, id = std::move(id)](auto const &complete) { complete(nullptr, cancel(id)); }
+		);
+	}
+	template<typename CompletionTokenT>
+	auto async_get_data(order_id_t id, CompletionTokenT &&token)
+	{
+		return _initiate_async<OrderData>(
+			std::forward<CompletionTokenT>(token),
+			[this, id = std::move(id)](auto const &complete) { complete(nullptr, get_data(id)); }
+		);
+	}
+	template<typename CompletionTokenT>
+	auto async_get_snapshot(CompletionTokenT &&token)
+	{
+		return _initiate_async<std::unique_ptr<MarketDataSnapshot>>(
+			std::forward<CompletionTokenT>(token),
+			[this](auto const &complete) { complete(nullptr, get_snapshot()); }
+		);
+	}
+
+	BasicOrderBook();
+	/**
+	 * \brief Стакан, который сводит заявки в потоке исполнителя, общего с другими стаканами.
+	 * \details Так несколько стаканов делят между собой N потоков сведения, см. \ref{BasicOrderBookShards}.
+	 * \warning Исполнитель должен быть уже запущен, а остановлен - до разрушения стакана: его задачи ссылаются на стакан.
+	 * \throw std::logic_error для lock_policy::NullLock: такой стакан сводит заявки в вызывающем потоке.
+	 */
+	explicit BasicOrderBook(tools::async::TasksExecutor &shared_orders_merger);
+	~BasicOrderBook();
 private:
+	/**
+	 * \param operation Вызывается с complete(std::exception_ptr, ResultT), которую надо вызвать ровно один раз:
+	 *		сразу или позже, из другого потока. Исключение из operation завершает операцию с ним.
+	 * \param is_queued Вызвать operation в потоке асинхронных операций или сразу, в вызывающем потоке.
+	 */
+	template<typename ResultT, typename CompletionTokenT, typename OperationT>
+	auto _initiate_async(CompletionTokenT &&token, OperationT operation, bool is_queued = true)
+	{
+		return boost::asio::async_initiate<CompletionTokenT, void(std::exception_ptr, ResultT)>(
+			[this, is_queued](auto handler, OperationT operation)
+			{
+				using handler_t = decltype(handler);
+				using work_t = decltype(boost::asio::make_work_guard(boost::asio::get_associated_executor(handler)));
+
+				struct PendingOperation
+				{
+					handler_t handler;
+					work_t work;
+					OperationT operation;
+				};
+				auto work = boost::asio::make_work_guard(boost::asio::get_associated_executor(handler));
+				auto pending = std::make_shared<PendingOperation>(PendingOperation{ std::move(handler), std::move(work), std::move(operation) });
+
+				auto run = [pending]
+				{
+					auto const complete = [pending](std::exception_ptr error, ResultT result)
+					{
+						auto const executor = pending->work.get_executor();
+						auto completion = std::make_shared<std::pair<std::exception_ptr, ResultT>>(error, std::move(result));
+						boost::asio::post(executor, [pending, completion]
+						{
+							pending->handler(completion->first, std::move(completion->second));
+						});
+						pending->work.reset();
+					};
+					try
+					{
+						pending->operation(complete);
+					}
+					catch (boost::thread_interrupted const &)
+					{
+						// Стакан разрушается: обработчик не вызываем.
+						throw;
+					}
+					catch (...)
+					{
+						complete(std::current_exception(), ResultT{});
+					}
+				};
+				if (is_queued)
+					_queue_async_operation(std::move(run));
+				else
+					run();
+			},
+			token, std::move(operation)
+		);
+	}
+	/**
+	 * \brief Поставить операцию в очередь потока асинхронных операций. Поток запускается при первой операции.
+	 */
+	void _queue_async_operation(std::function<void()> operation);
+	/**
+	 * \brief Поставить заявку IOC или FOK на сведение, не дожидаясь исполнения, как \ref{execute}.
+	 * \param on_executed Вызывается в потоке сведения с данными заявки после исполнения.
+	 *		Если стакан разрушен раньше, чем заявка исполнена, то разрушается не вызванным.
+	 */
+	void _execute_deferred(std::unique_ptr<Order> order, std::function<void(OrderData)> on_executed);
+	static bool _is_immediate(Order const &order)
+	{
+		return order.time_in_force == Order::TimeInForce::ImmediateOrCancel
+			|| order.time_in_force == Order::TimeInForce::FillOrKill;
+	}
+
 	class Impl;
 	std::unique_ptr<Impl> _impl;
 };
 
+// Определены и инстанцированы в OrderBook.cpp.
+extern template class BasicOrderBook<lock_policy::SharedMutex>;
+extern template class BasicOrderBook<lock_policy::SharedSpinLock>;
+extern template class BasicOrderBook<lock_policy::NullLock>;
+
+using OrderBook = BasicOrderBook<>;
+
 #endif
\ No newline at end of file
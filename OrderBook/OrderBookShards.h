@@ -0,0 +1,98 @@
+﻿#pragma once
+
+#ifndef ORDER_BOOK_SHARDS_H
+#define ORDER_BOOK_SHARDS_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "OrderBook.h"
+
+/**
+ * \brief Стаканы инструментов, распределённые по N потокам сведения.
+ * \details Инструмент хешируется в шард, и все стаканы шарда сводят заявки в его потоке, каждый - в порядке поступления своих заявок.
+ *		Заявки разных инструментов друг с другом не сводятся, так что сведение масштабируется по ядрам,
+ *		когда поток заявок распределён по инструментам, а число потоков не растёт с числом инструментов.
+ *		Сведение одного стакана шарды не ускоряют: заявка проходит встречную сторону по приоритету цены и времени,
+ *		и каждая следующая зависит от того, что оставила предыдущая, так что стакан сводит один поток.
+ *		Для одного инструмента параллельны только постановка, поиск и срезы, как и у отдельного стакана.
+ *		Простаивающий стакан потоки шарда не будит: таймеры заводятся, только пока есть заявки GTD.
+ * \tparam LockPolicyT Политика блокировок стаканов. lock_policy::NullLock не подходит: такой стакан сводит заявки сам.
+ */
+template<typename LockPolicyT = lock_policy::SharedMutex>
+class BasicOrderBookShards
+	: private boost::noncopyable
+{
+	static_assert(LockPolicyT::is_thread_confined == false, "Thread-confined books merge orders in the caller thread and can't be sharded");
+
+public:
+	using book_t = BasicOrderBook<LockPolicyT>;
+
+	/**
+	 * \param shards_count Число потоков сведения, по умолчанию - по числу аппаратных потоков.
+	 */
+	explicit BasicOrderBookShards(size_t shards_count = boost::thread::hardware_concurrency())
+		: _shards((std::max)(shards_count, size_t(1)))
+	{
+		for (auto &shard : _shards)
+			shard.orders_merger.StartTasksExecution();
+	}
+	/**
+	 * \brief Останавливает потоки сведения, затем разрушает стаканы. Несведённые заявки отбрасываются.
+	 */
+	~BasicOrderBookShards()
+	{
+		for (auto &shard : _shards)
+			shard.orders_merger.StopTasksExecution();
+		for (auto &shard : _shards)
+			shard.books.clear();
+	}
+
+	/**
+	 * \brief Стакан инструмента. Создаётся при первом обращении.
+	 * \details Ссылка стабильна, пока живут шарды: её получают один раз и дальше обращаются к стакану напрямую.
+	 *		Сам вызов ищет стакан под блокировкой только шарда инструмента, так что поиски в разных шардах друг друга не ждут.
+	 */
+	book_t& book(std::string const &instrument)
+	{
+		auto &shard = _shards[shard_of(instrument)];
+		std::lock_guard<std::mutex> lock(shard.books_mutex);
+		auto &book = shard.books[instrument];
+		if (!book)
+			book = std::make_unique<book_t>(shard.orders_merger);
+		return *book;
+	}
+	/**
+	 * \brief Номер шарда, который сводит заявки инструмента.
+	 */
+	size_t shard_of(std::string const &instrument) const
+	{
+		return std::hash<std::string>{}(instrument) % _shards.size();
+	}
+	size_t shards_count() const
+	{
+		return _shards.size();
+	}
+
+private:
+	struct Shard
+	{
+		tools::async::TasksExecutor orders_merger;
+		std::mutex books_mutex;
+		// \warning Разрушать только после остановки \ref{orders_merger}.
+		std::unordered_map<std::string, std::unique_ptr<book_t>> books;
+	};
+	// \brief Шарды не перемещаются: их число задаётся в конструкторе.
+	std::vector<Shard> _shards;
+};
+
+using OrderBookShards = BasicOrderBookShards<>;
+
+#endif
@@ -0,0 +1,255 @@
+﻿#pragma once
+
+#ifndef PRICE_LEVEL_H
+#define PRICE_LEVEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <immintrin.h>
+#endif
+
+#include "Order.h"
+
+namespace simd
+{
+	/**
+	 * \brief Сумма количеств.
+	 * \details AVX2 или SSE2, если они доступны при сборке, иначе скалярный цикл.
+	 */
+	inline quantity_t sum(quantity_t const *quantities, size_t count)
+	{
+		size_t i = 0;
+		quantity_t result = 0;
+#if defined(__AVX2__)
+		if (sizeof(quantity_t) == sizeof(uint64_t))
+		{
+			auto accumulator = _mm256_setzero_si256();
+			for (; i + 4 <= count; i += 4)
+				accumulator = _mm256_add_epi64(accumulator, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(quantities + i)));
+
+			alignas(32) uint64_t lanes[4];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), accumulator);
+			result = static_cast<quantity_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+		}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		if (sizeof(quantity_t) == sizeof(uint64_t))
+		{
+			auto accumulator = _mm_setzero_si128();
+			for (; i + 2 <= count; i += 2)
+				accumulator = _mm_add_epi64(accumulator, _mm_loadu_si128(reinterpret_cast<__m128i const*>(quantities + i)));
+
+			alignas(16) uint64_t lanes[2];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), accumulator);
+			result = static_cast<quantity_t>(lanes[0] + lanes[1]);
+		}
+#endif
+		for (; i < count; ++i)
+			result += quantities[i];
+		return result;
+	}
+
+	/**
+	 * \brief Ширина блока, которым \ref{fill} пропускает полностью исполняемые заявки.
+	 */
+#if defined(__AVX2__)
+	constexpr size_t fill_block_size = 4;
+#else
+	constexpr size_t fill_block_size = 2;
+#endif
+
+	/**
+	 * \brief Исполнить заявки по порядку, пока не наберётся \ref{quantity}.
+	 * \details Объём блоков суммируется векторно, и блок, который исполняется целиком, списывается разом.
+	 *		Поэлементно сравнивается с остатком только блок, в котором исполнение заканчивается.
+	 * \param on_fill Вызывается для каждой затронутой заявки: (индекс, исполненное количество).
+	 * \return Индекс первой заявки, которая исполнена не полностью(или count, если исполнены все).
+	 */
+	template<typename OnFillT>
+	size_t fill(quantity_t *quantities, size_t count, quantity_t &quantity, OnFillT &&on_fill)
+	{
+		size_t i = 0;
+		while (quantity != 0 && i + fill_block_size <= count)
+		{
+			auto const block_quantity = sum(quantities + i, fill_block_size);
+			if (block_quantity > quantity)
+				break;
+
+			for (size_t j = i; j < i + fill_block_size; ++j)
+			{
+				auto const filled = quantities[j];
+				quantities[j] = 0;
+				if (filled != 0)
+					on_fill(j, filled);
+			}
+			quantity -= block_quantity;
+			i += fill_block_size;
+		}
+		for (; quantity != 0 && i < count; ++i)
+		{
+			if (quantities[i] == 0)
+				continue;
+
+			auto const filled = (std::min)(quantity, quantities[i]);
+			quantities[i] -= filled;
+			quantity -= filled;
+			on_fill(i, filled);
+			if (quantities[i] != 0)
+				return i;
+		}
+		// Пропустим уже исполненные заявки, чтобы индекс указывал на первую живую.
+		while (i < count && quantities[i] == 0)
+			++i;
+		return i;
+	}
+}
+
+/**
+ * \brief Уровень цены, хранящий заявки одной стороны в виде структуры массивов.
+ * \details Идентификаторы, количества и метки времени лежат в отдельных непрерывных массивах в порядке поступления,
+ *		так что подсчёт объёма уровня и исполнение проходят по плотному массиву количеств без разыменования узлов.
+ *		Исполненные и отменённые заявки помечаются нулевым количеством и вычищаются пачкой в \ref{compact}.
+ * \warning Не потокобезопасно.
+ */
+class PriceLevel
+{
+public:
+	using timestamp_t = uint64_t;
+
+	PriceLevel() = default;
+	explicit PriceLevel(size_t capacity)
+	{
+		_ids.reserve(capacity);
+		_quantities.reserve(capacity);
+		_timestamps.reserve(capacity);
+	}
+
+	/**
+	 * \brief Добавить заявку в конец очереди уровня.
+	 */
+	void add(order_id_t id, quantity_t quantity, timestamp_t timestamp)
+	{
+		_ids.emplace_back(std::move(id));
+		_quantities.emplace_back(quantity);
+		_timestamps.emplace_back(timestamp);
+		if (quantity != 0)
+			++_alive_count;
+	}
+	/**
+	 * \brief Отменить заявку.
+	 * \return Неисполненное количество отменённой заявки. 0, если на уровне такой заявки нет.
+	 */
+	quantity_t cancel(order_id_t const &id)
+	{
+		for (auto i = _front; i < _ids.size(); ++i)
+		{
+			if (_ids[i] != id || _quantities[i] == 0)
+				continue;
+
+			auto const quantity = _quantities[i];
+			_quantities[i] = 0;
+			--_alive_count;
+			_compact_if_sparse();
+			return quantity;
+		}
+		return 0;
+	}
+	/**
+	 * \brief Исполнить заявки уровня в порядке поступления.
+	 * \param quantity Количество, которое надо исполнить. После вызова - неисполненный остаток.
+	 * \param on_fill Вызывается для каждой затронутой заявки: (id, исполненное количество, осталось ли что-то у заявки).
+	 */
+	template<typename OnFillT>
+	void fill(quantity_t &quantity, OnFillT &&on_fill)
+	{
+		_front = _front + simd::fill(
+			_quantities.data() + _front, _quantities.size() - _front, quantity,
+			[this, &on_fill](size_t index, quantity_t filled)
+			{
+				index += _front;
+				auto const is_satisfied = _quantities[index] == 0;
+				if (is_satisfied)
+					--_alive_count;
+				on_fill(static_cast<order_id_t const&>(_ids[index]), filled, is_satisfied == false);
+			}
+		);
+		_compact_if_sparse();
+	}
+	void fill(quantity_t &quantity)
+	{
+		fill(quantity, [](order_id_t const&, quantity_t, bool) {});
+	}
+	/**
+	 * \brief Суммарное неисполненное количество на уровне.
+	 */
+	quantity_t total_quantity() const
+	{
+		return simd::sum(_quantities.data() + _front, _quantities.size() - _front);
+	}
+	/**
+	 * \brief Обойти живые заявки уровня в порядке поступления.
+	 * \param visitor (id, количество, метка времени).
+	 */
+	template<typename VisitorT>
+	void for_each(VisitorT &&visitor) const
+	{
+		for (auto i = _front; i < _ids.size(); ++i)
+			if (_quantities[i] != 0)
+				visitor(_ids[i], _quantities[i], _timestamps[i]);
+	}
+
+	size_t size() const
+	{
+		return _alive_count;
+	}
+	bool empty() const
+	{
+		return _alive_count == 0;
+	}
+	/**
+	 * \brief Убрать из массивов исполненные и отменённые заявки, сохранив порядок остальных.
+	 */
+	void compact()
+	{
+		size_t alive = 0;
+		for (auto i = _front; i < _ids.size(); ++i)
+		{
+			if (_quantities[i] == 0)
+				continue;
+			if (alive != i)
+			{
+				_ids[alive] = std::move(_ids[i]);
+				_quantities[alive] = _quantities[i];
+				_timestamps[alive] = _timestamps[i];
+			}
+			++alive;
+		}
+		_ids.resize(alive);
+		_quantities.resize(alive);
+		_timestamps.resize(alive);
+		_front = 0;
+	}
+
+private:
+	/**
+	 * \brief Вычищаем мёртвые заявки, когда их становится больше живых, чтобы амортизированно это было O(1) на заявку.
+	 */
+	void _compact_if_sparse()
+	{
+		if (_ids.size() > 2 * _alive_count + _min_compaction_size)
+			compact();
+	}
+
+	static constexpr size_t _min_compaction_size = 16;
+
+	std::vector<order_id_t> _ids;
+	std::vector<quantity_t> _quantities;
+	std::vector<timestamp_t> _timestamps;
+	// \brief Индекс первой неисполненной заявки. Всё, что до него, исполнено.
+	size_t _front = 0;
+	size_t _alive_count = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+﻿#include "pch.h"
+
+#include "SharedMemoryBookView.h"
+
+namespace shared_memory_book
+{
+	Writer::Writer(std::string segment_name, size_t depth)
+		: _segment_name(std::move(segment_name))
+		, _depth(depth)
+	{
+		boost::interprocess::shared_memory_object::remove(_segment_name.c_str());
+		_segment = boost::interprocess::shared_memory_object(
+			boost::interprocess::create_only, _segment_name.c_str(), boost::interprocess::read_write
+		);
+		_segment.truncate(static_cast<boost::interprocess::offset_t>(segment_size(_depth)));
+		_region = boost::interprocess::mapped_region(_segment, boost::interprocess::read_write);
+
+		// Сегмент только что создан и заполнен нулями, так что размещаем заголовок и уровни на месте.
+		_header = new (_region.get_address()) Header{};
+		_header->depth.store(_depth, std::memory_order_relaxed);
+		_levels = reinterpret_cast<SharedLevel*>(static_cast<char*>(_region.get_address()) + sizeof(Header));
+		for (size_t level = 0; level < _depth * Order::Type::_EnumElementsCount; ++level)
+			new (_levels + level) SharedLevel{};
+	}
+
+	Writer::~Writer()
+	{
+		boost::interprocess::shared_memory_object::remove(_segment_name.c_str());
+	}
+
+	void Writer::publish(std::vector<Level> const &asks, std::vector<Level> const &bids)
+	{
+		auto const sequence = _header->sequence.load(std::memory_order_relaxed);
+		// Нечётный счётчик - идёт запись.
+		_header->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::array<std::vector<Level> const*, Order::Type::_EnumElementsCount> sides{};
+		sides[Order::Type::Ask] = &asks;
+		sides[Order::Type::Bid] = &bids;
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const levels_count = (std::min)(sides[type]->size(), _depth);
+			for (size_t level = 0; level < levels_count; ++level)
+				_levels[type * _depth + level].store((*sides[type])[level]);
+			_header->levels_count[type].store(levels_count, std::memory_order_relaxed);
+		}
+		_header->version.store(_header->version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		_header->sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	Reader::Reader(std::string const &segment_name)
+		: _segment(boost::interprocess::open_only, segment_name.c_str(), boost::interprocess::read_only)
+		, _region(_segment, boost::interprocess::read_only)
+		, _header(static_cast<Header const*>(_region.get_address()))
+		, _levels(reinterpret_cast<SharedLevel const*>(static_cast<char const*>(_region.get_address()) + sizeof(Header)))
+		, _max_depth((_region.get_size() - sizeof(Header)) / (sizeof(SharedLevel) * Order::Type::_EnumElementsCount))
+	{
+	}
+
+	void Reader::read(View &view) const
+	{
+		_read_consistently([this, &view]
+		{
+			view.version = _header->version.load(std::memory_order_relaxed);
+			for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			{
+				// Во время параллельной записи количество может быть любым, так что не даём ему выйти за сегмент.
+				auto const depth = (std::min)(_header->depth.load(std::memory_order_relaxed), _max_depth);
+				auto const levels_count = (std::min)(_header->levels_count[type].load(std::memory_order_relaxed), depth);
+				auto const side_levels = _levels + type * depth;
+				view.levels[type].resize(levels_count);
+				for (size_t level = 0; level < levels_count; ++level)
+					view.levels[type][level] = side_levels[level].load();
+			}
+		});
+	}
+
+	TopOfBook Reader::read_top_of_book() const
+	{
+		TopOfBook top_of_book;
+		_read_consistently([this, &top_of_book]
+		{
+			top_of_book.version = _header->version.load(std::memory_order_relaxed);
+			for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			{
+				auto const depth = (std::min)(_header->depth.load(std::memory_order_relaxed), _max_depth);
+				top_of_book.has_level[type] = _header->levels_count[type].load(std::memory_order_relaxed) != 0 && depth != 0;
+				if (top_of_book.has_level[type])
+					top_of_book.level[type] = _levels[type * depth].load();
+			}
+		});
+		return top_of_book;
+	}
+}
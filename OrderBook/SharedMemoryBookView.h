@@ -0,0 +1,202 @@
+﻿#pragma once
+
+#ifndef SHARED_MEMORY_BOOK_VIEW_H
+#define SHARED_MEMORY_BOOK_VIEW_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "Order.h"
+
+/* Агрегированный стакан в разделяемой памяти, для читателей из других процессов на той же машине.
+ * Писатель один(поток сведения стакана), читателей сколько угодно. Согласованность обеспечивается seqlock-ом:
+ * писатель делает счётчик нечётным на время записи, а читатель повторяет чтение, если счётчик был нечётным
+ * или изменился за время чтения. Читатель не делает системных вызовов и ничего не блокирует.
+ * Как и в tools::SeqLock, данные сегмента лежат атомарными словами, так что повторяемое чтение не образует гонки данных.
+ * Сам tools::SeqLock не подходит: число опубликованных уровней переменное, а счётчик должен быть один на весь сегмент.
+ */
+namespace shared_memory_book
+{
+	/**
+	 * \brief Уровень цены в разделяемой памяти. Раскладка фиксирована, чтобы её одинаково видели все процессы.
+	 */
+	struct Level
+	{
+		price_t price;
+		uint64_t quantity;
+		uint64_t orders_count;
+	};
+	static_assert(std::is_trivially_copyable<Level>::value && sizeof(Level) % sizeof(uint64_t) == 0,
+		"Уровень копируется в сегмент словами по 8 байт");
+
+	/**
+	 * \brief Уровень в сегменте: те же байты, что у \ref{Level}, но атомарными словами, которые читатель читает во время записи.
+	 */
+	struct SharedLevel
+	{
+		std::array<std::atomic<uint64_t>, sizeof(Level) / sizeof(uint64_t)> words;
+
+		void store(Level const &level)
+		{
+			std::array<uint64_t, sizeof(Level) / sizeof(uint64_t)> level_words;
+			std::memcpy(level_words.data(), &level, sizeof(Level));
+			for (size_t word = 0; word < words.size(); ++word)
+				words[word].store(level_words[word], std::memory_order_relaxed);
+		}
+		Level load() const
+		{
+			std::array<uint64_t, sizeof(Level) / sizeof(uint64_t)> level_words;
+			for (size_t word = 0; word < words.size(); ++word)
+				level_words[word] = words[word].load(std::memory_order_relaxed);
+			Level level;
+			std::memcpy(&level, level_words.data(), sizeof(Level));
+			return level;
+		}
+	};
+
+	/**
+	 * \brief Заголовок сегмента. За ним лежат уровни: depth уровней Ask, потом depth уровней Bid.
+	 */
+	struct Header
+	{
+		std::atomic<uint64_t> sequence;
+		// \brief Сколько уровней каждой стороны помещается в сегмент.
+		std::atomic<uint64_t> depth;
+		// \brief Сколько уровней каждой стороны сейчас опубликовано.
+		std::atomic<uint64_t> levels_count[Order::Type::_EnumElementsCount];
+		// \brief Номер публикации, растёт с каждой публикацией.
+		std::atomic<uint64_t> version;
+	};
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Слова сегмента в разделяемой памяти должны быть lock-free");
+	static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && sizeof(SharedLevel) == sizeof(Level),
+		"Раскладка сегмента должна совпадать у всех процессов");
+
+	/**
+	 * \brief Размер сегмента для стакана глубины \ref{depth}.
+	 */
+	inline size_t segment_size(size_t depth)
+	{
+		return sizeof(Header) + sizeof(SharedLevel) * depth * Order::Type::_EnumElementsCount;
+	}
+
+	/**
+	 * \brief Согласованная копия опубликованного стакана.
+	 * \details Уровни каждой стороны идут от лучшего к худшему: Ask по возрастанию цены, Bid по убыванию.
+	 */
+	struct View
+	{
+		uint64_t version = 0;
+		std::array<std::vector<Level>, Order::Type::_EnumElementsCount> levels{};
+	};
+
+	/**
+	 * \brief Лучшие уровни обеих сторон.
+	 */
+	struct TopOfBook
+	{
+		uint64_t version = 0;
+		// \brief Есть ли уровни у стороны. Если нет, то соответствующий уровень не заполнен.
+		std::array<bool, Order::Type::_EnumElementsCount> has_level{};
+		std::array<Level, Order::Type::_EnumElementsCount> level{};
+	};
+
+	/**
+	 * \brief Писатель: создаёт сегмент и публикует в него стакан.
+	 * \warning Публиковать можно только из одного потока.
+	 */
+	class Writer
+		: private boost::noncopyable
+	{
+	public:
+		/**
+		 * \brief Создать сегмент. Сегмент с таким же именем, если он остался от прошлого запуска, пересоздаётся.
+		 */
+		Writer(std::string segment_name, size_t depth);
+		/**
+		 * \brief Удаляет сегмент. Уже открытые читателями отображения остаются действительными.
+		 */
+		~Writer();
+
+		/**
+		 * \brief Опубликовать уровни. Каждая сторона - от лучшего уровня к худшему, лишние уровни отбрасываются.
+		 */
+		void publish(std::vector<Level> const &asks, std::vector<Level> const &bids);
+
+		size_t depth() const
+		{
+			return _depth;
+		}
+
+	private:
+		std::string _segment_name;
+		size_t _depth;
+		boost::interprocess::shared_memory_object _segment;
+		boost::interprocess::mapped_region _region;
+		Header *_header;
+		SharedLevel *_levels;
+	};
+
+	/**
+	 * \brief Читатель: открывает уже созданный писателем сегмент только на чтение.
+	 */
+	class Reader
+		: private boost::noncopyable
+	{
+	public:
+		/**
+		 * \throw boost::interprocess::interprocess_exception если сегмента нет.
+		 */
+		explicit Reader(std::string const &segment_name);
+
+		/**
+		 * \brief Прочитать опубликованный стакан.
+		 * \details Память под уровни в \ref{view} переиспользуется, так что при повторных чтениях в тот же view аллокаций нет.
+		 */
+		void read(View &view) const;
+		/**
+		 * \brief Прочитать только лучшие уровни.
+		 */
+		TopOfBook read_top_of_book() const;
+
+	private:
+		/**
+		 * \brief Повторять чтение, пока оно не пройдёт без параллельной записи.
+		 * \param reader Читает данные сегмента только атомарными загрузками. Может быть вызван несколько раз,
+		 *		результат берётся из последнего вызова.
+		 */
+		template<typename ReaderT>
+		uint64_t _read_consistently(ReaderT &&reader) const
+		{
+			while (true)
+			{
+				auto const sequence_before = _header->sequence.load(std::memory_order_acquire);
+				if (sequence_before % 2 != 0)
+					continue;
+
+				reader();
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (_header->sequence.load(std::memory_order_relaxed) == sequence_before)
+					return sequence_before;
+			}
+		}
+
+		boost::interprocess::shared_memory_object _segment;
+		boost::interprocess::mapped_region _region;
+		Header const *_header;
+		SharedLevel const *_levels;
+		// \brief Сколько уровней стороны помещается в отображённый регион. Глубине из заголовка не доверяем больше этого.
+		uint64_t _max_depth;
+	};
+}
+
+#endif
@@ -0,0 +1,364 @@
+﻿#pragma once
+
+#ifndef TICK_LADDER_H
+#define TICK_LADDER_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+#include "Order.h"
+#include "PriceLevel.h"
+
+namespace bits
+{
+	/**
+	 * \brief Номер младшего установленного бита. word != 0.
+	 */
+	inline size_t count_trailing_zeros(uint64_t word)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return index;
+#else
+		return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+	}
+	/**
+	 * \brief Номер старшего установленного бита. word != 0.
+	 */
+	inline size_t highest_bit(uint64_t word)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, word);
+		return index;
+#else
+		return 63 - static_cast<size_t>(__builtin_clzll(word));
+#endif
+	}
+
+	// \brief Нет занятого элемента.
+	constexpr size_t npos = (std::numeric_limits<size_t>::max)();
+
+	/**
+	 * \brief Двухуровневая битовая карта занятости.
+	 * \details Бит нижнего уровня - занят ли элемент, бит верхнего уровня - есть ли занятые в слове нижнего уровня.
+	 *		Поиск ближайшего занятого пропускает пустые слова по верхнему уровню, а внутри слова находится одной инструкцией ctz/clz.
+	 */
+	class OccupancyBitmap
+	{
+	public:
+		explicit OccupancyBitmap(size_t size = 0)
+			: _words((size + 63) / 64, 0)
+			, _summary((_words.size() + 63) / 64, 0)
+		{
+		}
+
+		bool test(size_t index) const
+		{
+			return (_words[index / 64] >> (index % 64)) & 1;
+		}
+		void set(size_t index)
+		{
+			auto const word = index / 64;
+			_words[word] |= uint64_t(1) << (index % 64);
+			_summary[word / 64] |= uint64_t(1) << (word % 64);
+		}
+		void reset(size_t index)
+		{
+			auto const word = index / 64;
+			_words[word] &= ~(uint64_t(1) << (index % 64));
+			if (_words[word] == 0)
+				_summary[word / 64] &= ~(uint64_t(1) << (word % 64));
+		}
+
+		/**
+		 * \brief Первый занятый элемент с индексом не меньше from, или npos.
+		 */
+		size_t find_next(size_t from) const
+		{
+			auto word = from / 64;
+			if (word >= _words.size())
+				return npos;
+			auto const bits = _words[word] & (~uint64_t(0) << (from % 64));
+			if (bits != 0)
+				return word * 64 + count_trailing_zeros(bits);
+
+			word = _find_next_word(word + 1);
+			return word == npos ? npos : word * 64 + count_trailing_zeros(_words[word]);
+		}
+		/**
+		 * \brief Последний занятый элемент с индексом не больше from, или npos.
+		 */
+		size_t find_previous(size_t from) const
+		{
+			if (_words.empty())
+				return npos;
+			if (from / 64 >= _words.size())
+				from = _words.size() * 64 - 1;
+			auto word = from / 64;
+			auto const bits = _words[word] & (~uint64_t(0) >> (63 - from % 64));
+			if (bits != 0)
+				return word * 64 + highest_bit(bits);
+
+			if (word == 0)
+				return npos;
+			word = _find_previous_word(word - 1);
+			return word == npos ? npos : word * 64 + highest_bit(_words[word]);
+		}
+
+		size_t memory_usage() const
+		{
+			return (_words.capacity() + _summary.capacity()) * sizeof(uint64_t);
+		}
+
+	private:
+		size_t _find_next_word(size_t from) const
+		{
+			for (auto summary = from / 64; summary < _summary.size(); ++summary)
+			{
+				auto const bits = summary == from / 64 ? _summary[summary] & (~uint64_t(0) << (from % 64)) : _summary[summary];
+				if (bits != 0)
+					return summary * 64 + count_trailing_zeros(bits);
+			}
+			return npos;
+		}
+		size_t _find_previous_word(size_t from) const
+		{
+			for (auto summary = from / 64 + 1; summary-- != 0;)
+			{
+				auto const bits = summary == from / 64 ? _summary[summary] & (~uint64_t(0) >> (63 - from % 64)) : _summary[summary];
+				if (bits != 0)
+					return summary * 64 + highest_bit(bits);
+			}
+			return npos;
+		}
+
+		std::vector<uint64_t> _words;
+		std::vector<uint64_t> _summary;
+	};
+}
+
+/**
+ * \brief Уровни цен инструмента, торгующегося в известном диапазоне цен с известным шагом.
+ * \details Вместо поиска уровня по ключу (тип, цена) в индексе уровни лежат в плоском массиве по номеру шага цены,
+ *		а лучший и следующий непустой уровень находятся по двухуровневой битовой карте занятости.
+ *		Память - по LevelT на каждый шаг диапазона с каждой стороны, так что подходит для ограниченных диапазонов:
+ *		десятки и сотни тысяч шагов, а не миллионы.
+ * \tparam LevelT Уровень: конструируется пустым и сообщает empty(). Очередь заявок(\ref{PriceLevel}) для \ref{add},
+ *		\ref{cancel} и \ref{match}, или, например, только итоги уровня, изменяемые через \ref{modify}.
+ * \warning Не потокобезопасно.
+ */
+template<typename LevelT>
+class BasicTickLadder
+{
+public:
+	using timestamp_t = PriceLevel::timestamp_t;
+
+	/**
+	 * \throw std::invalid_argument Если шаг не положителен или диапазон пуст.
+	 */
+	BasicTickLadder(price_t min_price, price_t max_price, price_t tick_size)
+		: _min_price(min_price)
+		, _tick_size(tick_size)
+		, _ticks_count(_count_ticks(min_price, max_price, tick_size))
+		, _levels{ { std::vector<LevelT>(_ticks_count), std::vector<LevelT>(_ticks_count) } }
+		, _occupied{ { bits::OccupancyBitmap(_ticks_count), bits::OccupancyBitmap(_ticks_count) } }
+	{
+	}
+
+	size_t ticks_count() const
+	{
+		return _ticks_count;
+	}
+	/**
+	 * \brief Номер шага цены.
+	 * \throw std::out_of_range Если цена вне диапазона.
+	 * \throw std::invalid_argument Если цена не кратна шагу.
+	 */
+	size_t to_tick(price_t price) const
+	{
+		auto const ticks = (price - _min_price) / _tick_size;
+		auto const tick = std::round(ticks);
+		if (std::abs(ticks - tick) > _tick_epsilon)
+			throw std::invalid_argument("Price is not a multiple of the tick size");
+		if (tick < 0 || tick >= static_cast<price_t>(_ticks_count))
+			throw std::out_of_range("Price is out of the ladder range");
+		return static_cast<size_t>(tick);
+	}
+	price_t to_price(size_t tick) const
+	{
+		return _min_price + static_cast<price_t>(tick) * _tick_size;
+	}
+
+	/**
+	 * \brief Поставить заявку в конец очереди её уровня.
+	 */
+	void add(Order::Type type, price_t price, order_id_t id, quantity_t quantity, timestamp_t timestamp)
+	{
+		auto const tick = to_tick(price);
+		_levels[_side(type)][tick].add(std::move(id), quantity, timestamp);
+		if (quantity != 0)
+			_occupied[_side(type)].set(tick);
+	}
+	/**
+	 * \brief Отменить заявку.
+	 * \return Неисполненное количество отменённой заявки. 0, если на уровне такой заявки нет.
+	 */
+	quantity_t cancel(Order::Type type, price_t price, order_id_t const &id)
+	{
+		auto const tick = to_tick(price);
+		auto &level = _levels[_side(type)][tick];
+		auto const quantity = level.cancel(id);
+		if (level.empty())
+			_occupied[_side(type)].reset(tick);
+		return quantity;
+	}
+	/**
+	 * \brief Изменить уровень цены: modifier(LevelT &). Занят ли уровень, определяется после изменения по его empty().
+	 */
+	template<typename ModifierT>
+	void modify(Order::Type type, price_t price, ModifierT &&modifier)
+	{
+		auto const tick = to_tick(price);
+		auto &level = _levels[_side(type)][tick];
+		modifier(level);
+		if (level.empty())
+			_occupied[_side(type)].reset(tick);
+		else
+			_occupied[_side(type)].set(tick);
+	}
+
+	/**
+	 * \brief Лучшая цена стороны: наибольшая у Bid, наименьшая у Ask.
+	 */
+	boost::optional<price_t> best_price(Order::Type type) const
+	{
+		auto const tick = _best_tick(type);
+		if (tick == bits::npos)
+			return boost::none;
+		return to_price(tick);
+	}
+	/**
+	 * \brief Уровень цены. Для пустого уровня - пустой LevelT.
+	 */
+	LevelT const& level(Order::Type type, price_t price) const
+	{
+		return _levels[_side(type)][to_tick(price)];
+	}
+
+	/**
+	 * \brief Обойти непустые уровни стороны от лучшей цены к худшей.
+	 * \param visitor (цена, уровень).
+	 */
+	template<typename VisitorT>
+	void for_each_level(Order::Type type, VisitorT &&visitor) const
+	{
+		for_each_level(type, bits::npos, std::forward<VisitorT>(visitor));
+	}
+	/**
+	 * \brief Обойти не больше max_levels лучших непустых уровней стороны.
+	 */
+	template<typename VisitorT>
+	void for_each_level(Order::Type type, size_t max_levels, VisitorT &&visitor) const
+	{
+		for (auto tick = _best_tick(type); tick != bits::npos && max_levels != 0; tick = _next_tick(type, tick), --max_levels)
+			visitor(to_price(tick), _levels[_side(type)][tick]);
+	}
+
+	/**
+	 * \brief Память массивов уровней и битовых карт.
+	 */
+	size_t memory_usage() const
+	{
+		size_t usage = 0;
+		for (size_t side = 0; side < 2; ++side)
+			usage += _levels[side].capacity() * sizeof(LevelT) + _occupied[side].memory_usage();
+		return usage;
+	}
+
+	/**
+	 * \brief Свести встречную заявку со стороной, противоположной incoming_type, от лучшей цены до limit_price.
+	 * \details Цена лимита может быть вне диапазона: лимит, пересекающий весь диапазон, исполняется по всем уровням.
+	 * \param quantity Количество встречной заявки. После вызова - неисполненный остаток.
+	 * \param on_fill (цена, id, исполненное количество, осталось ли что-то у заявки).
+	 */
+	template<typename OnFillT>
+	void match(Order::Type incoming_type, price_t limit_price, quantity_t &quantity, OnFillT &&on_fill)
+	{
+		auto const type = incoming_type == Order::Type::Bid ? Order::Type::Ask : Order::Type::Bid;
+		auto &levels = _levels[_side(type)];
+		auto &occupied = _occupied[_side(type)];
+		// Лимит в шагах: Bid покупает не дороже лимита, Ask продаёт не дешевле.
+		auto const limit_ticks = (limit_price - _min_price) / _tick_size;
+		auto const is_crossing = [&](size_t tick)
+		{
+			return type == Order::Type::Ask
+				? static_cast<price_t>(tick) <= limit_ticks + _tick_epsilon
+				: static_cast<price_t>(tick) >= limit_ticks - _tick_epsilon;
+		};
+
+		for (auto tick = _best_tick(type); quantity != 0 && tick != bits::npos && is_crossing(tick); tick = _next_tick(type, tick))
+		{
+			auto const price = to_price(tick);
+			auto &level = levels[tick];
+			level.fill(quantity, [&](order_id_t const &id, quantity_t filled, bool is_partial) { on_fill(price, id, filled, is_partial); });
+			if (level.empty())
+				occupied.reset(tick);
+		}
+	}
+	void match(Order::Type incoming_type, price_t limit_price, quantity_t &quantity)
+	{
+		match(incoming_type, limit_price, quantity, [](price_t, order_id_t const&, quantity_t, bool) {});
+	}
+
+private:
+	static size_t _count_ticks(price_t min_price, price_t max_price, price_t tick_size)
+	{
+		if (!(tick_size > 0) || !(max_price >= min_price))
+			throw std::invalid_argument("Tick ladder needs a positive tick size and max price not less than min price");
+		return static_cast<size_t>(std::floor((max_price - min_price) / tick_size + _tick_epsilon)) + 1;
+	}
+	static size_t _side(Order::Type type)
+	{
+		return type == Order::Type::Bid ? 0 : 1;
+	}
+	size_t _best_tick(Order::Type type) const
+	{
+		auto const &occupied = _occupied[_side(type)];
+		return type == Order::Type::Bid ? occupied.find_previous(_ticks_count - 1) : occupied.find_next(0);
+	}
+	// \brief Следующий по убыванию привлекательности непустой уровень.
+	size_t _next_tick(Order::Type type, size_t tick) const
+	{
+		auto const &occupied = _occupied[_side(type)];
+		if (type == Order::Type::Bid)
+			return tick == 0 ? bits::npos : occupied.find_previous(tick - 1);
+		return occupied.find_next(tick + 1);
+	}
+
+	// \brief Допуск при переводе цены в шаги: цены - double, и кратная шагу цена может отличаться от него в последних разрядах.
+	static constexpr price_t _tick_epsilon = 1e-6;
+
+	price_t const _min_price;
+	price_t const _tick_size;
+	size_t const _ticks_count;
+	std::array<std::vector<LevelT>, 2> _levels;
+	std::array<bits::OccupancyBitmap, 2> _occupied;
+};
+
+using TickLadder = BasicTickLadder<PriceLevel>;
+
+#endif
@@ -36,10 +36,64 @@ namespace tools
 			_service->stop();
 			// ждём когда поток исполнит текущую задачу и вернёт управлние из сервисного run
 			_execution_thread = decltype(_execution_thread){};
+			// поток остановлен, так что таймеры можно разрушать
+			_periodic_tasks_timers.clear();
+			{
+				std::lock_guard<decltype(_deferred_tasks_timers_mutex)> deferred_tasks_timers_lock{_deferred_tasks_timers_mutex};
+				_deferred_tasks_timers.clear();
+			}
 			// удаляем все неисполненные задачи
 			_service.reset();
 		}
 
+		void TasksExecutor::ExecutePeriodically(boost::asio::steady_timer::duration period, std::function<void()> task)
+		{
+			std::unique_lock<decltype(_executor_state)> executor_state_lock{_executor_state};
+			if (!_service)
+				return;
+
+			_periodic_tasks_timers.emplace_back(std::make_unique<boost::asio::steady_timer>(*_service, period));
+			auto &timer = *_periodic_tasks_timers.back();
+
+			// Обработчик перезаводит таймер от предыдущего срока, чтобы период не уплывал.
+			auto handler = std::make_shared<std::function<void(boost::system::error_code const&)>>();
+			*handler = [&timer, period, task = std::move(task), weak_handler = std::weak_ptr<decltype(handler)::element_type>(handler)]
+				(boost::system::error_code const &error)
+				{
+					if (error == boost::asio::error::operation_aborted)
+						return;
+
+					task();
+
+					if (auto const handler = weak_handler.lock())
+					{
+						timer.expires_at(timer.expiry() + period);
+						timer.async_wait([handler](boost::system::error_code const &error) { (*handler)(error); });
+					}
+				};
+			timer.async_wait([handler](boost::system::error_code const &error) { (*handler)(error); });
+		}
+
+		void TasksExecutor::ExecuteAfter(boost::asio::steady_timer::duration delay, std::function<void()> task)
+		{
+			std::list<boost::asio::steady_timer>::iterator timer;
+			{
+				std::lock_guard<decltype(_deferred_tasks_timers_mutex)> deferred_tasks_timers_lock{_deferred_tasks_timers_mutex};
+				timer = _deferred_tasks_timers.emplace(_deferred_tasks_timers.end(), *_service, delay);
+			}
+			timer->async_wait([this, timer, task = std::move(task)](boost::system::error_code const &error)
+			{
+				if (error == boost::asio::error::operation_aborted)
+					return;
+				{
+					// Обработчик исполняется в потоке исполнения, так что таймер ещё не разрушен остановкой.
+					std::lock_guard<decltype(_deferred_tasks_timers_mutex)> deferred_tasks_timers_lock{_deferred_tasks_timers_mutex};
+					_deferred_tasks_timers.erase(timer);
+				}
+				task();
+			});
+		}
+
 		auto TasksExecutor::GetService() const
 			-> decltype(*_service)
 		{
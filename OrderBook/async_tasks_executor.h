@@ -5,7 +5,10 @@
 #pragma once
 #endif
 
+#include <functional>
+#include <list>
 #include <mutex>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
@@ -23,6 +26,11 @@ namespace tools
 
 			std::unique_ptr<boost::asio::io_service> _service;
 			std::unique_ptr<boost::asio::io_service::work> _work;
+			// \warning Таймеры периодических задач должны быть разрушены до сервиса, но после остановки потока исполнения.
+			std::vector<std::unique_ptr<boost::asio::steady_timer>> _periodic_tasks_timers;
+			// \brief Таймеры отложенных задач, ещё не исполненных. Исполненная задача удаляет свой таймер сама.
+			std::mutex _deferred_tasks_timers_mutex;
+			std::list<boost::asio::steady_timer> _deferred_tasks_timers;
 			boost::scoped_thread<boost::interrupt_and_join_if_joinable> _execution_thread;
 
 		public:
@@ -31,6 +39,18 @@ namespace tools
 
 			void StartTasksExecution();
 			void StopTasksExecution();
+			/**
+			 * \brief Исполнять задачу в потоке исполнителя периодически, пока исполнение не будет остановлено.
+			 * \warning Нельзя вызывать из самого потока исполнения.
+			 */
+			void ExecutePeriodically(boost::asio::steady_timer::duration period, std::function<void()> task);
+			/**
+			 * \brief Исполнить задачу в потоке исполнителя один раз, через \ref{delay}.
+			 * \details В отличие от \ref{ExecutePeriodically}, можно вызывать и из самого потока исполнения: так задача заводит себя снова,
+			 *		только пока ей есть что делать.
+			 * \warning Исполнение должно быть запущено, как и для \ref{GetService}.
+			 */
+			void ExecuteAfter(boost::asio::steady_timer::duration delay, std::function<void()> task);
 
 			decltype(*_service) GetService() const;
 		};
@@ -0,0 +1,149 @@
+﻿#pragma once
+
+#ifndef LOCK_POLICY_H
+#define LOCK_POLICY_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <immintrin.h>
+#endif
+
+namespace tools
+{
+	/**
+	 * \brief Спинлок читателей-писателей для коротких критических секций.
+	 * \details Писатель, который ждёт, не пускает новых читателей, так что поток читателей не может его голодом заморить.
+	 *		После нескольких десятков неудачных попыток ожидающий отдаёт квант времени, чтобы не мешать владельцу на занятых ядрах.
+	 *		Удовлетворяет SharedLockable, так что подходит для boost::unique_lock, boost::shared_lock и std::lock.
+	 * \warning Не рекурсивный, ожидание не прерывается boost::thread::interrupt.
+	 */
+	class SharedSpinLock
+	{
+	public:
+		SharedSpinLock() = default;
+		SharedSpinLock(SharedSpinLock const &) = delete;
+		SharedSpinLock& operator=(SharedSpinLock const &) = delete;
+
+		void lock()
+		{
+			for (unsigned attempt = 0;; ++attempt)
+			{
+				auto state = _state.load(std::memory_order_relaxed);
+				if ((state & (_writer | _readers_mask)) == 0)
+				{
+					// Захват снимает и флаг ожидания: другие ожидающие писатели выставят его снова.
+					if (_state.compare_exchange_weak(state, _writer, std::memory_order_acquire, std::memory_order_relaxed))
+						return;
+					continue;
+				}
+				if ((state & _writer_waiting) == 0)
+					_state.fetch_or(_writer_waiting, std::memory_order_relaxed);
+				_backoff(attempt);
+			}
+		}
+		bool try_lock()
+		{
+			auto state = _state.load(std::memory_order_relaxed);
+			return (state & (_writer | _readers_mask)) == 0
+				&& _state.compare_exchange_strong(state, _writer, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+		void unlock()
+		{
+			_state.fetch_and(~_writer, std::memory_order_release);
+		}
+
+		void lock_shared()
+		{
+			for (unsigned attempt = 0; try_lock_shared() == false; ++attempt)
+				_backoff(attempt);
+		}
+		bool try_lock_shared()
+		{
+			auto state = _state.load(std::memory_order_relaxed);
+			return (state & (_writer | _writer_waiting)) == 0
+				&& _state.compare_exchange_strong(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+		void unlock_shared()
+		{
+			_state.fetch_sub(1, std::memory_order_release);
+		}
+
+	private:
+		static void _backoff(unsigned attempt)
+		{
+			if (attempt < _spins_before_yield)
+			{
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+				_mm_pause();
+#endif
+			}
+			else
+				std::this_thread::yield();
+		}
+
+		static constexpr uint32_t _writer = 1u << 31;
+		static constexpr uint32_t _writer_waiting = 1u << 30;
+		static constexpr uint32_t _readers_mask = _writer_waiting - 1;
+		static constexpr unsigned _spins_before_yield = 64;
+
+		// \brief Флаги писателя и число читателей.
+		std::atomic<uint32_t> _state{ 0 };
+	};
+
+	/**
+	 * \brief Мьютекс, который ничего не делает. Для данных, к которым обращается только один поток.
+	 */
+	class NullSharedMutex
+	{
+	public:
+		void lock() {}
+		bool try_lock() { return true; }
+		void unlock() {}
+
+		void lock_shared() {}
+		bool try_lock_shared() { return true; }
+		void unlock_shared() {}
+	};
+}
+
+/* Политики блокировок стакана.
+ * mutex_t - мьютекс, которым защищены стакан и буфер сведения. Нужен SharedLockable.
+ * is_thread_confined - стаканом пользуется один поток. Тогда отдельного потока сведения нет:
+ *		заявки сводятся прямо в вызывающем потоке, и блокировки не нужны вовсе.
+ */
+namespace lock_policy
+{
+	/**
+	 * \brief Мьютекс читателей-писателей boost. Читатели и писатели, которые ждут долго, засыпают.
+	 */
+	struct SharedMutex
+	{
+		using mutex_t = boost::shared_mutex;
+		static constexpr bool is_thread_confined = false;
+	};
+
+	/**
+	 * \brief Спинлок читателей-писателей: дешевле на коротких критических секциях, но ожидание занимает ядро.
+	 */
+	struct SharedSpinLock
+	{
+		using mutex_t = tools::SharedSpinLock;
+		static constexpr bool is_thread_confined = false;
+	};
+
+	/**
+	 * \brief Без блокировок и без потока сведения. Стаканом должен пользоваться только один поток.
+	 */
+	struct NullLock
+	{
+		using mutex_t = tools::NullSharedMutex;
+		static constexpr bool is_thread_confined = true;
+	};
+}
+
+#endif
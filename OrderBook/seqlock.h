@@ -0,0 +1,79 @@
+﻿#ifndef TOOLS_SEQLOCK_H
+#define TOOLS_SEQLOCK_H
+
+#if defined _MSC_VER && _MSC_VER >= 1020u
+#pragma once
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <boost/noncopyable.hpp>
+
+namespace tools
+{
+	/**
+	 * \brief Значение, которое читают без блокировок, пока его пишут.
+	 * \details Писатель делает счётчик нечётным на время записи, а читатель повторяет чтение, если счётчик был нечётным
+	 *		или изменился за время чтения. Значение хранится атомарными словами, так что гонки данных нет и у повторяемого чтения.
+	 *		Читатель никого не ждёт, кроме писателя посреди записи, и ничего не пишет, так что читатели друг другу не мешают.
+	 * \warning Писать из одного потока за раз: писатели должны быть упорядочены внешней блокировкой.
+	 */
+	template<typename ValueT>
+	class SeqLock
+		: private boost::noncopyable
+	{
+		static_assert(std::is_trivially_copyable<ValueT>::value, "SeqLock copies the value word by word");
+		static constexpr size_t _words_count = (sizeof(ValueT) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+		using words_t = std::array<uint64_t, _words_count>;
+
+	public:
+		explicit SeqLock(ValueT const &value = ValueT{})
+		{
+			store(value);
+		}
+
+		void store(ValueT const &value)
+		{
+			words_t words{};
+			std::memcpy(words.data(), &value, sizeof(ValueT));
+
+			auto const sequence = _sequence.load(std::memory_order_relaxed);
+			_sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t word = 0; word < _words_count; ++word)
+				_words[word].store(words[word], std::memory_order_relaxed);
+			_sequence.store(sequence + 2, std::memory_order_release);
+		}
+		ValueT load() const
+		{
+			words_t words;
+			while (true)
+			{
+				auto const sequence_before = _sequence.load(std::memory_order_acquire);
+				if (sequence_before % 2 != 0)
+					continue;
+
+				for (size_t word = 0; word < _words_count; ++word)
+					words[word] = _words[word].load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (_sequence.load(std::memory_order_relaxed) == sequence_before)
+					break;
+			}
+
+			ValueT value;
+			std::memcpy(&value, words.data(), sizeof(ValueT));
+			return value;
+		}
+
+	private:
+		std::atomic<uint64_t> _sequence{ 0 };
+		std::array<std::atomic<uint64_t>, _words_count> _words{};
+	};
+}
+
+#endif
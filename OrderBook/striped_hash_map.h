@@ -0,0 +1,143 @@
+﻿#ifndef TOOLS_STRIPED_HASH_MAP_H
+#define TOOLS_STRIPED_HASH_MAP_H
+
+#if defined _MSC_VER && _MSC_VER >= 1020u
+#pragma once
+#endif
+
+#include <array>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/lock_types.hpp>
+
+namespace tools
+{
+	/**
+	 * \brief Хеш-таблица, разбитая на полосы, каждая под своей блокировкой.
+	 * \details Полоса ключа выбирается по его хешу, так что операции с разными ключами почти всегда берут разные блокировки
+	 *		и друг друга не ждут. Между полосами - кэш-линия отступа, чтобы блокировки соседних полос не делили одну линию.
+	 * \tparam MutexT SharedLockable: поиск берёт блокировку полосы на чтение, изменения - на запись.
+	 */
+	template<typename KeyT, typename ValueT, typename MutexT, size_t StripesCount = 64, typename HashT = boost::hash<KeyT>>
+	class StripedHashMap
+		: private boost::noncopyable
+	{
+		struct Stripe
+		{
+			MutexT mutable mutex;
+			std::unordered_map<KeyT, ValueT, HashT> map;
+			char padding[64];
+		};
+
+	public:
+		using map_t = std::unordered_map<KeyT, ValueT, HashT>;
+		using exclusive_locks_t = std::array<boost::unique_lock<MutexT>, StripesCount>;
+
+		void insert(KeyT const &key, ValueT value)
+		{
+			auto &stripe = _stripe(key);
+			boost::unique_lock<MutexT> write_lock(stripe.mutex);
+			stripe.map[key] = std::move(value);
+		}
+		/**
+		 * \return Был ли такой ключ.
+		 */
+		bool erase(KeyT const &key)
+		{
+			auto &stripe = _stripe(key);
+			boost::unique_lock<MutexT> write_lock(stripe.mutex);
+			return stripe.map.erase(key) != 0;
+		}
+		/**
+		 * \brief Удалить ключ, если predicate(значение) вернёт true. predicate вызывается под блокировкой полосы на запись.
+		 * \return Удалён ли ключ.
+		 */
+		template<typename PredicateT>
+		bool erase_if(KeyT const &key, PredicateT &&predicate)
+		{
+			auto &stripe = _stripe(key);
+			boost::unique_lock<MutexT> write_lock(stripe.mutex);
+			auto const value = stripe.map.find(key);
+			if (value == stripe.map.end() || predicate(value->second) == false)
+				return false;
+			stripe.map.erase(value);
+			return true;
+		}
+		/**
+		 * \brief Вызвать visitor(значение) под блокировкой полосы на чтение, если ключ есть.
+		 * \return Был ли такой ключ.
+		 */
+		template<typename VisitorT>
+		bool visit(KeyT const &key, VisitorT &&visitor) const
+		{
+			auto const &stripe = _stripe(key);
+			boost::shared_lock<MutexT> read_lock(stripe.mutex);
+			auto const value = stripe.map.find(key);
+			if (value == stripe.map.end())
+				return false;
+			visitor(value->second);
+			return true;
+		}
+		bool contains(KeyT const &key) const
+		{
+			return visit(key, [](ValueT const &) {});
+		}
+		/**
+		 * \brief Взять блокировку полосы ключа на запись.
+		 * \details Для изменения того, на что указывает значение, так, чтобы \ref{visit} видел его согласованным.
+		 */
+		boost::unique_lock<MutexT> lock_exclusive(KeyT const &key) const
+		{
+			return boost::unique_lock<MutexT>(_stripe(key).mutex);
+		}
+		/**
+		 * \brief Взять блокировки всех полос на запись, по порядку полос.
+		 * \details Чтобы значения не менялись, пока проверяется и меняется то, на что указывают несколько из них.
+		 */
+		exclusive_locks_t lock_all_exclusive() const
+		{
+			exclusive_locks_t locks;
+			for (size_t stripe = 0; stripe != StripesCount; ++stripe)
+				locks[stripe] = boost::unique_lock<MutexT>(_stripes[stripe].mutex);
+			return locks;
+		}
+
+		/**
+		 * \brief Обойти полосы, каждую под её блокировкой на чтение: visitor(map_t const &).
+		 */
+		template<typename VisitorT>
+		void for_each_stripe(VisitorT &&visitor) const
+		{
+			for (size_t stripe = 0; stripe != StripesCount; ++stripe)
+				visit_stripe(stripe, visitor);
+		}
+		/**
+		 * \brief Обойти одну полосу под её блокировкой на чтение: visitor(map_t const &).
+		 * \details Чтобы несколько потоков обходили таблицу, поделив полосы между собой.
+		 */
+		template<typename VisitorT>
+		void visit_stripe(size_t stripe, VisitorT &&visitor) const
+		{
+			boost::shared_lock<MutexT> read_lock(_stripes[stripe].mutex);
+			visitor(_stripes[stripe].map);
+		}
+
+		static constexpr size_t stripes_count = StripesCount;
+
+	private:
+		Stripe& _stripe(KeyT const &key)
+		{
+			return _stripes[HashT{}(key) % StripesCount];
+		}
+		Stripe const& _stripe(KeyT const &key) const
+		{
+			return _stripes[HashT{}(key) % StripesCount];
+		}
+
+		std::array<Stripe, StripesCount> _stripes;
+	};
+}
+
+#endif
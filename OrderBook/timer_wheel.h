@@ -0,0 +1,241 @@
+﻿#ifndef TOOLS_TIMER_WHEEL_H
+#define TOOLS_TIMER_WHEEL_H
+
+#if defined _MSC_VER && _MSC_VER >= 1020u
+#pragma once
+#endif
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/optional.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace tools
+{
+	/**
+	 * \brief Иерархическое колесо таймеров.
+	 * \details Постановка и отмена таймера за O(1). Таймеры раскладываются по уровням колеса в зависимости от того,
+	 *		насколько далеко их срок: ближние попадают в слоты нижнего уровня, дальние - в слоты верхних уровней
+	 *		и спускаются вниз по мере приближения срока.
+	 * \warning Не потокобезопасно. Колесом должен владеть один поток.
+	 */
+	template<typename KeyT, typename ClockT = std::chrono::system_clock, typename HashT = boost::hash<KeyT>>
+	class TimerWheel
+		: private boost::noncopyable
+	{
+	public:
+		using time_point_t = typename ClockT::time_point;
+		using duration_t = typename ClockT::duration;
+
+		TimerWheel(duration_t resolution, time_point_t now)
+			: _resolution(resolution)
+			, _current_tick(_floor_tick(now))
+		{
+		}
+
+		/**
+		 * \brief Поставить таймер. Если таймер с таким ключом уже есть, то он будет переставлен.
+		 */
+		void schedule(KeyT const &key, time_point_t expire_at)
+		{
+			cancel(key);
+			// Просроченные таймеры истекут на ближайшем тике.
+			auto const expire_tick = (std::max)(_ceil_tick(expire_at), _current_tick + 1);
+			auto &timer = _timers.emplace(
+				std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(key, expire_tick)
+			).first->second;
+			_link(timer);
+		}
+		/**
+		 * \brief Отменить таймер.
+		 * \return Был ли такой таймер.
+		 */
+		bool cancel(KeyT const &key)
+		{
+			// Узел сам отвязывается от слота при разрушении.
+			return _timers.erase(key) != 0;
+		}
+		/**
+		 * \brief Продвинуть колесо до момента \ref{now}.
+		 * \param on_expired Вызывается для ключа каждого истёкшего таймера. Истёкшие таймеры из колеса удаляются.
+		 */
+		template<typename OnExpiredT>
+		void advance(time_point_t now, OnExpiredT &&on_expired)
+		{
+			auto const target_tick = _floor_tick(now);
+			while (_current_tick < target_tick)
+			{
+				if (_timers.empty())
+				{
+					// Не тратим время на пустые тики.
+					_current_tick = target_tick;
+					break;
+				}
+
+				// Пока нижние уровни пусты, ничего не истечёт до следующего спуска с первого занятого уровня.
+				auto const next_tick = _next_significant_tick();
+				if (next_tick > target_tick)
+				{
+					_current_tick = target_tick;
+					break;
+				}
+
+				_current_tick = next_tick;
+				_cascade();
+
+				auto const slot_index = _slot_index(_current_tick, 0);
+				auto &slot = _wheel[0][slot_index];
+				while (slot.empty() == false)
+				{
+					auto const expired_key = slot.front().key;
+					slot.pop_front();
+					_timers.erase(expired_key);
+					on_expired(expired_key);
+				}
+				_occupied[0].reset(slot_index);
+			}
+		}
+
+		/**
+		 * \brief Когда колесо продвинуть в следующий раз: ближайший тик, на котором что-то может истечь или спуститься с верхнего уровня.
+		 * \details Раньше этого момента \ref{advance} ничего не сделает, так что тикать каждый тик не нужно.
+		 * \return boost::none, если таймеров нет.
+		 */
+		boost::optional<time_point_t> next_advance_time() const
+		{
+			if (_timers.empty())
+				return boost::none;
+			return time_point_t(_resolution * static_cast<typename duration_t::rep>(_next_significant_tick()));
+		}
+
+		size_t size() const
+		{
+			return _timers.size();
+		}
+		bool empty() const
+		{
+			return _timers.empty();
+		}
+
+	private:
+		static auto constexpr _slot_bits = 8u;
+		static auto constexpr _slots_count = size_t(1) << _slot_bits;
+		static auto constexpr _slot_mask = _slots_count - 1;
+		static auto constexpr _levels_count = 4u;
+		// Максимальное удаление срока, которое помещается в колесо. Более дальние таймеры ждут на верхнем уровне.
+		static auto constexpr _max_delta = (uint64_t(1) << (_slot_bits * _levels_count)) - 1;
+
+		using link_hook_t = boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+		struct Timer
+		{
+			Timer(KeyT key, uint64_t expire_tick)
+				: key(std::move(key))
+				, expire_tick(expire_tick)
+			{
+			}
+
+			KeyT key;
+			uint64_t expire_tick;
+			link_hook_t hook;
+		};
+
+		using slot_t = boost::intrusive::list<
+			Timer,
+			boost::intrusive::member_hook<Timer, link_hook_t, &Timer::hook>,
+			boost::intrusive::constant_time_size<false>
+		>;
+
+		uint64_t _floor_tick(time_point_t time) const
+		{
+			return static_cast<uint64_t>(time.time_since_epoch() / _resolution);
+		}
+		uint64_t _ceil_tick(time_point_t time) const
+		{
+			auto const tick = _floor_tick(time);
+			return _resolution * tick < time.time_since_epoch() ? tick + 1 : tick;
+		}
+		static size_t _slot_index(uint64_t tick, unsigned level)
+		{
+			return static_cast<size_t>(tick >> (_slot_bits * level)) & _slot_mask;
+		}
+		/**
+		 * \brief Ближайший тик, на котором что-то может истечь или спуститься с верхнего уровня.
+		 * \details Отметки занятости слотов консервативны: отменённые таймеры их не снимают, так что пропустить занятый слот нельзя.
+		 */
+		uint64_t _next_significant_tick() const
+		{
+			// Спуск с верхних уровней - на границе первого занятого из них.
+			unsigned level = 1;
+			while (level + 1 < _levels_count && _occupied[level].none())
+				++level;
+			auto const level_shift = _slot_bits * level;
+			auto next_tick = _occupied[level].any() ? ((_current_tick >> level_shift) + 1) << level_shift : (std::numeric_limits<uint64_t>::max)();
+
+			// На нижнем уровне таймеры ближе оборота колеса, так что следующий занятый слот - это и следующий тик, на котором они истекут.
+			auto const current_slot = _slot_index(_current_tick, 0);
+			for (uint64_t delta = 1; delta < _slots_count && _current_tick + delta < next_tick; ++delta)
+				if (_occupied[0].test((current_slot + delta) & _slot_mask))
+					return _current_tick + delta;
+			return next_tick;
+		}
+
+		/**
+		 * \brief Привязать таймер к слоту, соответствующему удалённости его срока от текущего тика.
+		 */
+		void _link(Timer &timer)
+		{
+			// При спуске с верхних уровней срок может совпасть с текущим тиком: тогда таймер истечёт на нём же.
+			auto const delta = timer.expire_tick - _current_tick < _max_delta ? timer.expire_tick - _current_tick : _max_delta;
+			auto const slot_tick = _current_tick + delta;
+
+			unsigned level = 0;
+			while (level + 1 < _levels_count && (delta >> (_slot_bits * (level + 1))) != 0)
+				++level;
+
+			auto const slot_index = _slot_index(slot_tick, level);
+			_wheel[level][slot_index].push_back(timer);
+			_occupied[level].set(slot_index);
+		}
+		/**
+		 * \brief Спустить таймеры верхних уровней, чей срок подошёл, на нижние уровни.
+		 */
+		void _cascade()
+		{
+			unsigned top_level = 0;
+			while (top_level + 1 < _levels_count
+				&& ((_current_tick >> (_slot_bits * (top_level + 1))) << (_slot_bits * (top_level + 1))) == _current_tick)
+				++top_level;
+
+			for (auto level = top_level; level > 0; --level)
+			{
+				auto const slot_index = _slot_index(_current_tick, level);
+				slot_t cascading;
+				cascading.splice(cascading.end(), _wheel[level][slot_index]);
+				_occupied[level].reset(slot_index);
+				while (cascading.empty() == false)
+				{
+					auto &timer = cascading.front();
+					cascading.pop_front();
+					_link(timer);
+				}
+			}
+		}
+
+		duration_t _resolution;
+		uint64_t _current_tick;
+		std::array<std::array<slot_t, _slots_count>, _levels_count> _wheel{};
+		// \brief Отметки слотов, в которых могут быть таймеры.
+		std::array<std::bitset<_slots_count>, _levels_count> _occupied{};
+		std::unordered_map<KeyT, Timer, HashT> _timers;
+	};
+}
+
+#endif
@@ -0,0 +1,92 @@
+﻿#include "pch.h"
+
+#include <mutex>
+
+#include "tracing.h"
+
+namespace tools
+{
+	namespace tracing
+	{
+		namespace
+		{
+			/**
+			 * \brief Буферы всех потоков, писавших интервалы, и точка отсчёта времени.
+			 */
+			struct Registry
+			{
+				std::mutex mutex;
+				std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+				uint64_t const start_timestamp = timestamp();
+				std::chrono::steady_clock::time_point const start_time = std::chrono::steady_clock::now();
+			};
+
+			Registry& registry()
+			{
+				// Буферы не удаляются до конца процесса: интервалы завершившихся потоков тоже выгружаются.
+				static Registry instance;
+				return instance;
+			}
+
+			ThreadBuffer& register_thread()
+			{
+				auto &instance = registry();
+				std::lock_guard<std::mutex> lock(instance.mutex);
+				instance.buffers.emplace_back(std::make_unique<ThreadBuffer>(instance.buffers.size() + 1));
+				return *instance.buffers.back();
+			}
+
+			thread_local ThreadBuffer *thread_buffer = nullptr;
+
+			void write_json_string(std::ostream &out, char const *string)
+			{
+				out << '"';
+				for (; *string != '\0'; ++string)
+				{
+					if (*string == '"' || *string == '\\')
+						out << '\\';
+					out << *string;
+				}
+				out << '"';
+			}
+		}
+
+		constexpr size_t ThreadBuffer::capacity;
+
+		void record(char const *name, uint64_t begin, uint64_t end)
+		{
+			if (thread_buffer == nullptr)
+				thread_buffer = &register_thread();
+			thread_buffer->record(name, begin, end);
+		}
+
+		void export_chrome_trace(std::ostream &out)
+		{
+			auto &instance = registry();
+			std::lock_guard<std::mutex> lock(instance.mutex);
+
+			// Частоту TSC узнаём по тому, сколько тактов прошло с начала трассировки за известное время.
+			auto const elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - instance.start_time).count();
+			auto const elapsed_ticks = static_cast<double>(timestamp() - instance.start_timestamp);
+			auto const ticks_per_us = elapsed_us > 0 && elapsed_ticks > 0 ? elapsed_ticks / elapsed_us : 1.;
+
+			auto const flags = out.flags();
+			out << std::fixed;
+			out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+			bool is_first = true;
+			for (auto const &buffer : instance.buffers)
+				buffer->visit([&](char const *name, uint64_t begin, uint64_t end)
+				{
+					out << (is_first ? "" : ",") << "{\"name\":";
+					write_json_string(out, name);
+					out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_index
+						<< ",\"ts\":" << static_cast<double>(static_cast<int64_t>(begin - instance.start_timestamp)) / ticks_per_us
+						<< ",\"dur\":" << static_cast<double>(end - begin) / ticks_per_us << '}';
+					is_first = false;
+				});
+			out << "]}";
+			out.flags(flags);
+		}
+	}
+}
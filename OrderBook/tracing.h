@@ -0,0 +1,172 @@
+﻿#ifndef TOOLS_TRACING_H
+#define TOOLS_TRACING_H
+
+#if defined _MSC_VER && _MSC_VER >= 1020u
+#pragma once
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define TOOLS_TRACING_HAS_TSC
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#else
+		#include <x86intrin.h>
+	#endif
+#endif
+
+/* Трассировка интервалов выполнения для поиска причин всплесков задержки.
+ * Интервал - имя и метки времени начала и конца. Каждый поток пишет свои интервалы в собственный кольцевой буфер без блокировок,
+ * старые интервалы затираются новыми. \ref{export_chrome_trace} выгружает буферы всех потоков в JSON формата Chrome trace,
+ * который открывают chrome://tracing и Perfetto.
+ *
+ * Точки трассировки в коде ставятся макросами ниже. Без ORDER_BOOK_TRACING(опция CMake) макросы раскрываются в пустоту,
+ * так что выключенная трассировка ничего не стоит.
+ */
+namespace tools
+{
+	namespace tracing
+	{
+		/**
+		 * \brief Метка времени: счётчик тактов процессора(TSC), где он есть, иначе steady_clock в наносекундах.
+		 */
+		inline uint64_t timestamp()
+		{
+#ifdef TOOLS_TRACING_HAS_TSC
+			return __rdtsc();
+#else
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+		}
+
+		/**
+		 * \brief Кольцевой буфер интервалов одного потока.
+		 * \details Пишет только поток-владелец, читать можно из любого потока одновременно с записью:
+		 *		интервалы, затёртые во время чтения, отбрасываются.
+		 */
+		class ThreadBuffer
+			: private boost::noncopyable
+		{
+		public:
+			static constexpr size_t capacity = size_t(1) << 16;
+
+			explicit ThreadBuffer(size_t thread_index)
+				: thread_index(thread_index)
+			{
+			}
+
+			void record(char const *name, uint64_t begin, uint64_t end)
+			{
+				auto const written = _written.load(std::memory_order_relaxed);
+				auto &slot = _slots[written & (capacity - 1)];
+				slot.name.store(name, std::memory_order_relaxed);
+				slot.begin.store(begin, std::memory_order_relaxed);
+				slot.end.store(end, std::memory_order_relaxed);
+				_written.store(written + 1, std::memory_order_release);
+			}
+
+			/**
+			 * \brief Обойти записанные интервалы от старых к новым.
+			 */
+			template<typename VisitorT>
+			void visit(VisitorT &&visitor) const
+			{
+				struct Span { char const *name; uint64_t begin; uint64_t end; };
+				std::vector<Span> spans;
+
+				auto const written = _written.load(std::memory_order_acquire);
+				auto const first = written > capacity ? written - capacity : 0;
+				spans.reserve(static_cast<size_t>(written - first));
+				for (auto index = first; index != written; ++index)
+				{
+					auto const &slot = _slots[index & (capacity - 1)];
+					spans.push_back(Span{ slot.name.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed) });
+				}
+
+				// Всё, что владелец успел дописать за время копирования, могло затереть начало скопированного.
+				std::atomic_thread_fence(std::memory_order_acquire);
+				auto const written_after_copy = _written.load(std::memory_order_relaxed);
+				auto const first_intact = written_after_copy > capacity ? written_after_copy - capacity : 0;
+				for (auto index = (std::max)(first, first_intact); index < written; ++index)
+				{
+					auto const &span = spans[static_cast<size_t>(index - first)];
+					visitor(span.name, span.begin, span.end);
+				}
+			}
+
+			size_t const thread_index;
+
+		private:
+			struct Slot
+			{
+				std::atomic<char const*> name{ nullptr };
+				std::atomic<uint64_t> begin{ 0 };
+				std::atomic<uint64_t> end{ 0 };
+			};
+
+			std::array<Slot, capacity> _slots{};
+			std::atomic<uint64_t> _written{ 0 };
+		};
+
+		/**
+		 * \brief Записать интервал в буфер текущего потока. Буфер создаётся при первой записи потока.
+		 * \param name Строка, которая живёт до выгрузки, обычно литерал.
+		 */
+		void record(char const *name, uint64_t begin, uint64_t end);
+
+		/**
+		 * \brief Выгрузить интервалы всех потоков в JSON формата Chrome trace.
+		 * \details Буферы потоков, которые уже завершились, тоже выгружаются.
+		 */
+		void export_chrome_trace(std::ostream &out);
+
+		/**
+		 * \brief Интервал от создания до разрушения объекта.
+		 */
+		class Scope
+			: private boost::noncopyable
+		{
+		public:
+			explicit Scope(char const *name)
+				: _name(name)
+				, _begin(timestamp())
+			{
+			}
+			~Scope()
+			{
+				record(_name, _begin, timestamp());
+			}
+
+		private:
+			char const *const _name;
+			uint64_t const _begin;
+		};
+	}
+}
+
+#define TOOLS_TRACING_CONCATENATE_IMPL(lhs, rhs) lhs##rhs
+#define TOOLS_TRACING_CONCATENATE(lhs, rhs) TOOLS_TRACING_CONCATENATE_IMPL(lhs, rhs)
+
+#ifdef ORDER_BOOK_TRACING
+	// \brief Интервал до конца текущей области видимости.
+	#define ORDER_BOOK_TRACE_SCOPE(name) ::tools::tracing::Scope TOOLS_TRACING_CONCATENATE(trace_scope_, __LINE__)(name)
+	// \brief Метка времени начала интервала, который закончится в другом месте, например в другом потоке.
+	#define ORDER_BOOK_TRACE_TIMESTAMP() ::tools::tracing::timestamp()
+	// \brief Интервал от метки begin до текущего момента.
+	#define ORDER_BOOK_TRACE_SPAN(name, begin) ::tools::tracing::record(name, begin, ::tools::tracing::timestamp())
+#else
+	#define ORDER_BOOK_TRACE_SCOPE(name) ((void)0)
+	#define ORDER_BOOK_TRACE_TIMESTAMP() uint64_t(0)
+	#define ORDER_BOOK_TRACE_SPAN(name, begin) ((void)(begin))
+#endif
+
+#endif
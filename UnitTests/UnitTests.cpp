@@ -1,14 +1,35 @@
 ﻿#include "pch.h"
 
 #define BOOST_TEST_MODULE OrderBookTests
+#include <random>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/use_future.hpp>
 #include <boost/chrono/ceil.hpp>
+#include <boost/filesystem.hpp>
+
+#include <boost/mpl/list.hpp>
 #include <boost/test/included/unit_test.hpp>
 #include <boost/thread/future.hpp>
 
 #define IS_CI_BUILD // TODO: дефайнить это должна билд машина
 
+#include "ColdLevels.h"
+#include "ConsolidatedBook.h"
 #include "OrderBook.h"
+#include "OrderBookShards.h"
 #include "MarketDataSnapshot.h"
+#include "MarketDataWireFormat.h"
+#include "OrderBookGateway.h"
+
+#include "PriceLevel.h"
+#include "SharedMemoryBookView.h"
+#include "seqlock.h"
+#include "striped_hash_map.h"
+#include "TickLadder.h"
+#include "timer_wheel.h"
+#include "tracing.h"
 
 class OrderBookTestWrapper : boost::noncopyable
 {
@@ -48,6 +69,43 @@ public:
 	{
 		return _book.get_snapshot();
 	}
+	/**
+	 * \brief Получить плоский срез
+	 */
+	FlatMarketDataSnapshot get_flat_snapshot() const
+	{
+		return _book.get_flat_snapshot();
+	}
+	/**
+	 * \brief Публиковать стакан в разделяемую память
+	 */
+	void publish_to_shared_memory(std::string segment_name, size_t depth)
+	{
+		_book.publish_to_shared_memory(std::move(segment_name), depth);
+	}
+	/**
+	 * \brief Обойти заявки среза
+	 */
+	void visit_snapshot(std::function<void(OrderView const &)> const &visitor) const
+	{
+		_book.visit_snapshot(visitor);
+	}
+	/**
+	 * \brief Записать уровни среза в выходной итератор
+	 */
+	template<typename OutputIteratorT>
+	OutputIteratorT copy_snapshot_levels(OutputIteratorT out) const
+	{
+		return _book.copy_snapshot_levels(out);
+	}
+	/**
+	 * \brief Немедленное исполнение заявки IOC или FOK
+	 * \return Данные заявки после исполнения
+	 */
+	OrderData execute(std::unique_ptr<Order> order)
+	{
+		return _book.execute(std::move(order));
+	}
 
 	OrderBookTestWrapper() = default;
 	~OrderBookTestWrapper() = default;
@@ -55,8 +113,37 @@ private:
 	OrderBook _book;
 };
 
+namespace
+{
+	/**
+	 * \brief Дождаться сведения всех поставленных в стакан заявок.
+	 * \details Ничего не меняет в стакане, так что id, исполнения и события репликации у проверок - только свои.
+	 */
+	template<typename BookT>
+	void wait_for_merging(BookT &book)
+	{
+		book.wait_for_merging();
+	}
+
+}
+
 BOOST_AUTO_TEST_SUITE(OrderBookSpecialCases)
 
+BOOST_AUTO_TEST_CASE(WaitingForMergingChangesNothing)
+{
+	OrderBook book;
+	size_t executions_count = 0;
+	book.subscribe_to_executions([&executions_count](ExecutionReport const &) { ++executions_count; });
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 0.5, 1));
+	book.wait_for_merging();
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 1);
+
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 0.5, 1));
+	book.wait_for_merging();
+	BOOST_TEST(bid_id == ask_id + 1);
+	BOOST_TEST(executions_count == 2);
+}
+
 BOOST_AUTO_TEST_CASE(EmptyBookSnapshotGetting)
 {
 	OrderBook book;
@@ -307,6 +394,113 @@ BOOST_AUTO_TEST_CASE(SnapshotDataAreInAscPriceOrder, *boost::unit_test::timeout(
 	);
 }
 
+BOOST_AUTO_TEST_CASE(BatchPosting, *boost::unit_test::timeout(2))
+{
+	OrderBook book;
+
+	std::vector<std::unique_ptr<Order>> batch;
+	batch.emplace_back(std::make_unique<Order>(Order::Type::Ask, 5, 300));
+	batch.emplace_back(std::make_unique<Order>(Order::Type::Bid, 5, 100));
+	batch.emplace_back(std::make_unique<Order>(Order::Type::Bid, 4, 50));
+	auto const ids = book.post_batch(std::move(batch));
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_TEST(ids.size() == 3);
+	BOOST_TEST(ids[1] == ids[0] + 1);
+	BOOST_TEST(ids[2] == ids[1] + 1);
+
+	// Немедленное исполнение дожидается сведения всей пачки.
+	wait_for_merging(book);
+	BOOST_TEST(book.get_data(ids[0]).GetQuantity() == 200);
+	BOOST_TEST(book.get_data(ids[2]).GetQuantity() == 50);
+
+	BOOST_TEST(book.post_batch({}).empty());
+
+	std::vector<std::unique_ptr<Order>> immediate_batch;
+	immediate_batch.emplace_back(std::make_unique<Order>(Order::Type::Ask, 5, 300, Order::TimeInForce::FillOrKill));
+	BOOST_CHECK_THROW(book.post_batch(std::move(immediate_batch)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(BurstOfOrdersIsMergedInArrivalOrder, *boost::unit_test::timeout(5))
+{
+	OrderBook book;
+
+	std::vector<order_id_t> asks_ids;
+	for (size_t i = 0; i < 1000; ++i)
+		asks_ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Ask, 5, 1)));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 500));
+	wait_for_merging(book);
+	BOOST_TEST_PASSPOINT();
+
+	// Сведение пачкой не меняет приоритета: исполнены ровно первые поступившие заявки.
+	for (size_t i = 0; i < asks_ids.size(); ++i)
+	{
+		if (i < 500)
+			BOOST_CHECK_THROW(book.get_data(asks_ids[i]), std::logic_error);
+		else
+			BOOST_TEST(book.get_data(asks_ids[i]).GetQuantity() == 1);
+	}
+
+	// Оставшиеся заявки исполняет немедленная заявка, а её неисполненный остаток отменяется.
+	auto const execution = book.execute(std::make_unique<Order>(Order::Type::Bid, 5, 600, Order::TimeInForce::ImmediateOrCancel));
+	BOOST_TEST(execution.GetQuantity() == 100);
+}
+
+BOOST_AUTO_TEST_CASE(CrossingOrderSweepsLevelsFromBestPrice, *boost::unit_test::timeout(5))
+{
+	OrderBook book;
+
+	auto const best_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	auto const first_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 101, 3));
+	auto const second_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 101, 4));
+	auto const worst_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 102, 5));
+	// Bid выше лучшего Ask исполняется по уровням 100 и 101, а до 102 не доходит.
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 101, 10));
+	wait_for_merging(book);
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_CHECK_THROW(book.get_data(best_ask_id), std::logic_error);
+	BOOST_CHECK_THROW(book.get_data(first_ask_id), std::logic_error);
+	BOOST_TEST(book.get_data(second_ask_id).GetQuantity() == 2);
+	BOOST_TEST(book.get_data(worst_ask_id).GetQuantity() == 5);
+	BOOST_CHECK_THROW(book.get_data(bid_id), std::logic_error);
+
+	// Ask сводится с Bid от наибольшей цены к наименьшей.
+	auto const lower_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 97, 5));
+	auto const higher_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 98, 5));
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 97, 7));
+	wait_for_merging(book);
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_CHECK_THROW(book.get_data(higher_bid_id), std::logic_error);
+	BOOST_TEST(book.get_data(lower_bid_id).GetQuantity() == 3);
+	BOOST_CHECK_THROW(book.get_data(ask_id), std::logic_error);
+
+	// Пересечённых заявок в стакане не остаётся.
+	std::vector<PriceLevelView> levels;
+	book.copy_snapshot_levels(std::back_inserter(levels));
+	auto const best_ask = std::find_if(levels.begin(), levels.end(), [](PriceLevelView const &level) { return level.type == Order::Type::Ask; });
+	BOOST_TEST_REQUIRE((best_ask != levels.end()));
+	BOOST_TEST(levels.back().type == Order::Type::Bid);
+	BOOST_TEST(levels.back().price < best_ask->price);
+}
+
+BOOST_AUTO_TEST_CASE(ImmediateOrdersSweepLevels, *boost::unit_test::timeout(5))
+{
+	OrderBook book;
+
+	book.post(std::make_unique<Order>(Order::Type::Ask, 101, 2));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 102, 5));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 103, 5));
+
+	// По цене 102 и лучше есть только 7, так что FOK на 8 не исполняется вовсе ..
+	BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Bid, 102, 8, Order::TimeInForce::FillOrKill)).GetQuantity() == 8);
+	// .. а IOC исполняет 7 и отменяет остаток.
+	BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Bid, 102, 8, Order::TimeInForce::ImmediateOrCancel)).GetQuantity() == 1);
+	BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Bid, 110, 5, Order::TimeInForce::FillOrKill)).GetQuantity() == 0);
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Ask].empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(OperationsOnSatisfactedOrders)
@@ -356,6 +550,2133 @@ BOOST_AUTO_TEST_CASE(LookupDataOfSatisfactedOrderInSnapsot, *boost::unit_test::t
 
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_SUITE(ImmediateOrders)
+
+BOOST_AUTO_TEST_CASE(ImmediateOrCancelOrderPartialExecution, *boost::unit_test::timeout(1))
+{
+	OrderBookTestWrapper book;
+
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 100));
+	BOOST_TEST_PASSPOINT();
+
+	auto const execution_result = book.execute(std::make_unique<Order>(Order::Type::Bid, 4, 300, Order::TimeInForce::ImmediateOrCancel));
+	// неисполненный остаток отменён ..
+	BOOST_TEST(execution_result.GetQuantity() == 200);
+	// .. и в стакан не попал
+	BOOST_CHECK_THROW(book.get_data(execution_result.order_id), std::exception);
+	BOOST_CHECK_THROW(book.get_data(ask_id), std::exception);
+
+	auto const &snapshot = book.get_snapshot();
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Ask].empty());
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Bid].empty());
+}
+
+BOOST_AUTO_TEST_CASE(ImmediateOrCancelOrderWithoutCounterpartyIsNotRested, *boost::unit_test::timeout(1))
+{
+	OrderBookTestWrapper book;
+
+	auto const execution_result = book.execute(std::make_unique<Order>(Order::Type::Bid, 4, 300, Order::TimeInForce::ImmediateOrCancel));
+	BOOST_TEST(execution_result.GetQuantity() == 300);
+
+	auto const &snapshot = book.get_snapshot();
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Bid].empty());
+}
+
+BOOST_AUTO_TEST_CASE(FillOrKillOrderIsNotExecutedPartially, *boost::unit_test::timeout(1))
+{
+	OrderBookTestWrapper book;
+
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 100));
+	BOOST_TEST_PASSPOINT();
+
+	auto const execution_result = book.execute(std::make_unique<Order>(Order::Type::Bid, 4, 300, Order::TimeInForce::FillOrKill));
+	BOOST_TEST(execution_result.GetQuantity() == 300);
+	// заявка из стакана не тронута
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 100);
+}
+
+BOOST_AUTO_TEST_CASE(FillOrKillOrderFullExecution, *boost::unit_test::timeout(1))
+{
+	OrderBookTestWrapper book;
+
+	auto const first_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 100));
+	auto const second_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 300));
+	BOOST_TEST_PASSPOINT();
+
+	auto const execution_result = book.execute(std::make_unique<Order>(Order::Type::Bid, 4, 300, Order::TimeInForce::FillOrKill));
+	BOOST_TEST(execution_result.GetQuantity() == 0);
+	BOOST_CHECK_THROW(book.get_data(first_ask_id), std::exception);
+	BOOST_TEST(book.get_data(second_ask_id).GetQuantity() == 100);
+}
+
+BOOST_AUTO_TEST_CASE(ExecutionsOfBothSidesAreReported, *boost::unit_test::timeout(1))
+{
+	OrderBook book;
+	std::vector<ExecutionReport> executions;
+	auto const subscription_id = book.subscribe_to_executions([&executions](ExecutionReport const &execution) { executions.emplace_back(execution); });
+
+	auto const first_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 100));
+	auto const second_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 5, 100));
+	auto const execution_result = book.execute(std::make_unique<Order>(Order::Type::Bid, 5, 150, Order::TimeInForce::ImmediateOrCancel));
+
+	// Каждая сделка - исполнение заявки из стакана и встречной, по цене заявки из стакана.
+	BOOST_TEST_REQUIRE(executions.size() == 4);
+	BOOST_TEST((executions[0].order_id == first_ask_id && executions[0].price == 4 && executions[0].quantity == 100));
+	BOOST_TEST((executions[1].order_id == execution_result.order_id && executions[1].price == 4 && executions[1].quantity == 100));
+	BOOST_TEST((executions[2].order_id == second_ask_id && executions[2].price == 5 && executions[2].quantity == 50));
+	BOOST_TEST((executions[3].order_id == execution_result.order_id && executions[3].price == 5 && executions[3].quantity == 50));
+
+	book.unsubscribe_from_executions(subscription_id);
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 50));
+	wait_for_merging(book);
+	BOOST_TEST(executions.size() == 4);
+}
+
+BOOST_AUTO_TEST_CASE(GoodTillCancelOrderCanNotBeExecuted)
+{
+	OrderBook book;
+	BOOST_CHECK_THROW(book.execute(std::make_unique<Order>(Order::Type::Bid, 4, 300)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(ExpiringOrders)
+
+BOOST_AUTO_TEST_CASE(GoodTillDateOrderIsRemovedWhenExpired, *boost::unit_test::timeout(2))
+{
+	OrderBookTestWrapper book;
+
+	auto const order_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 300, std::chrono::system_clock::now() + std::chrono::milliseconds(400)));
+	BOOST_TEST_PASSPOINT();
+	// срок ещё не истёк
+	BOOST_TEST(book.get_data(order_id).GetQuantity() == 300);
+
+	boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
+	BOOST_CHECK_THROW(book.get_data(order_id), std::exception);
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Ask].empty());
+}
+
+BOOST_AUTO_TEST_CASE(ExpiredGoodTillDateOrderIsNotMerged, *boost::unit_test::timeout(1))
+{
+	OrderBookTestWrapper book;
+
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 4, 300));
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 300, std::chrono::system_clock::now() - std::chrono::seconds(1)));
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_CHECK_THROW(book.get_data(ask_id), std::exception);
+	BOOST_TEST(book.get_data(bid_id).GetQuantity() == 300);
+}
+
+BOOST_AUTO_TEST_CASE(GoodTillDateOrderCancelling, *boost::unit_test::timeout(2))
+{
+	OrderBookTestWrapper book;
+
+	auto const order_id = book.post(std::make_unique<Order>(Order::Type::Ask, 4, 300, std::chrono::system_clock::now() + std::chrono::milliseconds(300)));
+	BOOST_TEST_PASSPOINT();
+
+	auto const cancelled_order = book.cancel(order_id);
+	BOOST_TEST(cancelled_order.is_initialized());
+	BOOST_TEST((cancelled_order->GetTimeInForce() == Order::TimeInForce::GoodTillDate));
+
+	boost::this_thread::sleep_for(boost::chrono::milliseconds(400));
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Ask].empty());
+}
+
+BOOST_AUTO_TEST_CASE(TimerWheelExpiresTimersInTime)
+{
+	using clock_t = std::chrono::steady_clock;
+	auto const start = clock_t::time_point{};
+	tools::TimerWheel<size_t, clock_t> wheel(std::chrono::milliseconds(1), start);
+
+	// Сроки на разных уровнях колеса, в том числе дальше, чем помещается в колесо.
+	std::vector<size_t> const delays_ms{ 0, 1, 255, 256, 257, 1000, 65535, 65536, 70000, 16777216, 20000000, 5000000000 };
+	for (size_t i = 0; i < delays_ms.size(); ++i)
+		wheel.schedule(i, start + std::chrono::milliseconds(delays_ms[i]));
+	// Отменённый таймер не истекает.
+	wheel.schedule(delays_ms.size(), start + std::chrono::milliseconds(10));
+	BOOST_TEST(wheel.cancel(delays_ms.size()));
+	BOOST_TEST(wheel.size() == delays_ms.size());
+
+	// Продвигаем колесо к каждому сроку, останавливаясь за тик до него, и запоминаем, когда истёк каждый таймер.
+	std::map<size_t, clock_t::time_point> expired_at;
+	for (auto const delay_ms : delays_ms)
+	{
+		auto const expiry = start + std::chrono::milliseconds((std::max)(delay_ms, size_t(1)));
+		for (auto const now : { expiry - std::chrono::milliseconds(1), expiry })
+			wheel.advance(now, [&expired_at, now](size_t key) { BOOST_TEST(expired_at.emplace(key, now).second); });
+	}
+	BOOST_TEST(wheel.empty());
+
+	// Каждый таймер истёк ровно в срок: не раньше и не позже.
+	BOOST_TEST(expired_at.size() == delays_ms.size());
+	for (size_t i = 0; i < delays_ms.size(); ++i)
+		BOOST_TEST((expired_at[i] == start + std::chrono::milliseconds((std::max)(delays_ms[i], size_t(1)))));
+}
+
+BOOST_AUTO_TEST_CASE(TimerWheelTellsWhenToAdvance)
+{
+	using clock_t = std::chrono::steady_clock;
+	auto const start = clock_t::time_point{};
+	tools::TimerWheel<size_t, clock_t> wheel(std::chrono::milliseconds(1), start);
+	BOOST_TEST(wheel.next_advance_time().is_initialized() == false);
+
+	// Продвигаем колесо только тогда, когда оно само просит: таймер истекает в срок, а тиков - единицы, а не тысяча.
+	auto const expiry = start + std::chrono::milliseconds(1000);
+	wheel.schedule(1, expiry);
+	size_t advances_count = 0;
+	boost::optional<clock_t::time_point> expired_at;
+	while (auto const next_advance_time = wheel.next_advance_time())
+	{
+		BOOST_TEST_REQUIRE((*next_advance_time <= expiry));
+		wheel.advance(*next_advance_time, [&expired_at, now = *next_advance_time](size_t) { expired_at = now; });
+		++advances_count;
+	}
+	BOOST_TEST((expired_at == expiry));
+	BOOST_TEST(advances_count < 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(PriceLevelStorage)
+
+BOOST_AUTO_TEST_CASE(PriceLevelTotalQuantity)
+{
+	PriceLevel level;
+	quantity_t expected_total = 0;
+	// Нечётное количество, чтобы задеть и векторную часть, и хвост.
+	for (size_t i = 1; i <= 37; ++i)
+	{
+		level.add(i, i, i);
+		expected_total += i;
+	}
+	BOOST_TEST(level.size() == 37);
+	BOOST_TEST(level.total_quantity() == expected_total);
+
+	BOOST_TEST(level.cancel(5) == 5);
+	BOOST_TEST(level.cancel(5) == 0);
+	BOOST_TEST(level.total_quantity() == expected_total - 5);
+	BOOST_TEST(level.size() == 36);
+}
+
+BOOST_AUTO_TEST_CASE(PriceLevelFillsInArrivalOrder)
+{
+	PriceLevel level;
+	for (size_t i = 1; i <= 10; ++i)
+		level.add(i, 10, i);
+	level.cancel(2);
+
+	std::vector<std::tuple<order_id_t, quantity_t, bool>> fills;
+	quantity_t quantity = 35;
+	level.fill(quantity, [&fills](order_id_t const &id, quantity_t filled, bool is_partial)
+	{
+		fills.emplace_back(id, filled, is_partial);
+	});
+
+	BOOST_TEST(quantity == 0);
+	// Отменённая заявка пропущена, последняя исполнена частично.
+	std::vector<std::tuple<order_id_t, quantity_t, bool>> const expected_fills{
+		std::make_tuple(order_id_t(1), quantity_t(10), false),
+		std::make_tuple(order_id_t(3), quantity_t(10), false),
+		std::make_tuple(order_id_t(4), quantity_t(10), false),
+		std::make_tuple(order_id_t(5), quantity_t(5), true)
+	};
+	BOOST_TEST((fills == expected_fills));
+	BOOST_TEST(level.size() == 6);
+	BOOST_TEST(level.total_quantity() == 55);
+
+	std::vector<order_id_t> rest;
+	level.for_each([&rest](order_id_t const &id, quantity_t, PriceLevel::timestamp_t) { rest.emplace_back(id); });
+	BOOST_TEST(rest.front() == 5);
+	BOOST_TEST(rest.size() == 6);
+}
+
+BOOST_AUTO_TEST_CASE(PriceLevelFillMoreThanAvailable)
+{
+	PriceLevel level;
+	for (size_t i = 1; i <= 100; ++i)
+		level.add(i, 1, i);
+
+	quantity_t quantity = 150;
+	level.fill(quantity);
+	BOOST_TEST(quantity == 50);
+	BOOST_TEST(level.empty());
+	BOOST_TEST(level.total_quantity() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(SnapshotVisiting)
+
+BOOST_AUTO_TEST_CASE(EmptyBookSnapshotVisiting)
+{
+	OrderBook book;
+	size_t visited = 0;
+	book.visit_snapshot([&visited](OrderView const &) { ++visited; });
+	book.visit_snapshot_levels([&visited](PriceLevelView const &) { ++visited; });
+	BOOST_TEST(visited == 0);
+}
+
+BOOST_AUTO_TEST_CASE(SnapshotOrdersVisiting, *boost::unit_test::timeout(2))
+{
+	OrderBookTestWrapper book;
+
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 5, 300));
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 4, 200));
+	BOOST_TEST_PASSPOINT();
+
+	std::map<order_id_t, std::tuple<Order::Type, price_t, quantity_t>> visited;
+	book.visit_snapshot([&visited](OrderView const &order)
+	{
+		visited.emplace(order.order_id, std::make_tuple(order.type, order.price, order.quantity));
+	});
+
+	BOOST_TEST(visited.size() == 2);
+	BOOST_TEST((visited[ask_id] == std::make_tuple(Order::Type::Ask, price_t(5), quantity_t(300))));
+	BOOST_TEST((visited[bid_id] == std::make_tuple(Order::Type::Bid, price_t(4), quantity_t(200))));
+}
+
+BOOST_AUTO_TEST_CASE(SnapshotLevelsAreAggregatedAndInAscPriceOrder, *boost::unit_test::timeout(3))
+{
+	OrderBookTestWrapper book;
+
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 300));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 1, 100));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 50));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 10, 300));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 7, 10));
+	BOOST_TEST_PASSPOINT();
+
+	std::vector<PriceLevelView> levels;
+	book.copy_snapshot_levels(std::back_inserter(levels));
+
+	BOOST_TEST(levels.size() == 4);
+	auto const expected = std::vector<std::tuple<Order::Type, price_t, quantity_t, size_t>>{
+		std::make_tuple(Order::Type::Ask, 7, 10, 1),
+		std::make_tuple(Order::Type::Ask, 10, 300, 1),
+		std::make_tuple(Order::Type::Bid, 1, 100, 1),
+		std::make_tuple(Order::Type::Bid, 5, 350, 2)
+	};
+	for (size_t i = 0; i < (std::min)(levels.size(), expected.size()); ++i)
+		BOOST_TEST((std::make_tuple(levels[i].type, levels[i].price, levels[i].quantity, levels[i].orders_count) == expected[i]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(FlatSnapshot)
+
+BOOST_AUTO_TEST_CASE(EmptyBookFlatSnapshotGetting)
+{
+	OrderBook book;
+	auto const snapshot = book.get_flat_snapshot();
+	BOOST_TEST(snapshot.GetOrders()[Order::Type::Ask].empty());
+	BOOST_TEST(snapshot.GetOrders()[Order::Type::Bid].empty());
+}
+
+BOOST_AUTO_TEST_CASE(FlatSnapshotIsSortedAndAdaptable, *boost::unit_test::timeout(3))
+{
+	OrderBookTestWrapper book;
+
+	auto const first_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 5, 300));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 1, 100));
+	auto const second_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 5, 50));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 10, 300));
+	BOOST_TEST_PASSPOINT();
+
+	auto const flat_snapshot = book.get_flat_snapshot();
+	auto const &bids = flat_snapshot.GetOrders()[Order::Type::Bid];
+	BOOST_TEST(bids.size() == 3);
+	BOOST_TEST(flat_snapshot.GetOrders()[Order::Type::Ask].size() == 1);
+	BOOST_TEST(
+		std::is_sorted(bids.begin(), bids.end(),
+			[](FlatMarketDataSnapshot::Record const &lhs, FlatMarketDataSnapshot::Record const &rhs) { return lhs.price < rhs.price; }
+		)
+	);
+	// При равной цене первой идёт заявка, поставленная раньше.
+	BOOST_TEST(from_pod(bids[1].order_id) == first_bid_id);
+	BOOST_TEST(from_pod(bids[2].order_id) == second_bid_id);
+	BOOST_TEST(bids[2].quantity == 50);
+
+	// Адаптер даёт то же, что и get_snapshot.
+	MarketDataSnapshot const adapted(flat_snapshot);
+	auto const snapshot = book.get_snapshot();
+	for (auto const type : { Order::Type::Ask, Order::Type::Bid })
+	{
+		auto const &adapted_orders = adapted.GetOrders()[type];
+		auto const &orders = snapshot->GetOrders()[type];
+		BOOST_TEST(adapted_orders.size() == orders.size());
+		BOOST_TEST(
+			std::equal(adapted_orders.begin(), adapted_orders.end(), orders.begin(),
+				[](OrderData const &lhs, OrderData const &rhs)
+				{
+					return lhs.GetPrice() == rhs.GetPrice() && lhs.GetQuantity() == rhs.GetQuantity() && lhs.GetType() == rhs.GetType();
+				}
+			)
+		);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(FlatSnapshotPartsMerging)
+{
+	std::vector<FlatMarketDataSnapshot> parts(3);
+	parts[0].add(Order::Type::Bid, 5, 1, 1);
+	parts[0].add(Order::Type::Bid, 1, 1, 2);
+	parts[1].add(Order::Type::Bid, 3, 1, 3);
+	parts[1].add(Order::Type::Bid, 5, 1, 0);
+	parts[1].add(Order::Type::Ask, 7, 1, 4);
+	// третья часть пустая
+	for (auto &part : parts)
+		part.sort();
+
+	auto const merged = FlatMarketDataSnapshot::merge(parts);
+	auto const &bids = merged.GetOrders()[Order::Type::Bid];
+	std::vector<std::pair<price_t, order_id_t>> merged_bids;
+	for (auto const &record : bids)
+		merged_bids.emplace_back(record.price, from_pod(record.order_id));
+
+	std::vector<std::pair<price_t, order_id_t>> const expected_bids{ { 1, 2 }, { 3, 3 }, { 5, 0 }, { 5, 1 } };
+	BOOST_TEST((merged_bids == expected_bids));
+	BOOST_TEST(merged.GetOrders()[Order::Type::Ask].size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(LargeBookSnapshotGetting, *boost::unit_test::timeout(60))
+{
+	// Заявок больше, чем порог параллельного построения среза. Цены Ask и Bid не пересекаются, так что ничего не сводится.
+	OrderBook book;
+	auto constexpr orders_count = 70000;
+	for (size_t i = 0; i < orders_count; ++i)
+		book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 2000 : 0) + i % 1000, 1));
+
+	// IOC исполняется в потоке сведения после всех поставленных раньше заявок, так что после него все они уже в стакане.
+	wait_for_merging(book);
+
+	auto const flat_snapshot = book.get_flat_snapshot();
+	for (auto const type : { Order::Type::Ask, Order::Type::Bid })
+	{
+		auto const &records = flat_snapshot.GetOrders()[type];
+		BOOST_TEST(records.size() == orders_count / 2);
+		BOOST_TEST(std::is_sorted(records.begin(), records.end(), &FlatMarketDataSnapshot::precedes));
+	}
+
+	auto const snapshot = book.get_snapshot();
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Ask].size() == orders_count / 2);
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Bid].size() == orders_count / 2);
+}
+
+BOOST_AUTO_TEST_CASE(OrderIdPodConversion)
+{
+	auto const big_id = (order_id_t(1) << 200) + 12345;
+	BOOST_TEST(from_pod(to_pod(big_id)) == big_id);
+	BOOST_TEST(from_pod(to_pod(7)) == 7);
+	BOOST_TEST(to_pod(7)[0] == 7u);
+	BOOST_TEST(to_pod(7)[3] == 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(SharedMemoryPublishing)
+
+std::string unique_segment_name(char const *test_name)
+{
+	return std::string("OrderBookTests_") + test_name + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+BOOST_AUTO_TEST_CASE(WriterLevelsAreReadByReader)
+{
+	auto const segment_name = unique_segment_name("Writer");
+	shared_memory_book::Writer writer(segment_name, 2);
+	shared_memory_book::Reader reader(segment_name);
+
+	shared_memory_book::View view;
+	reader.read(view);
+	BOOST_TEST(view.version == 0);
+	BOOST_TEST(view.levels[Order::Type::Ask].empty());
+	BOOST_TEST(reader.read_top_of_book().has_level[Order::Type::Bid] == false);
+
+	// Лишний третий уровень Ask не помещается в сегмент глубины 2.
+	writer.publish({ { 5, 10, 1 }, { 6, 20, 2 }, { 7, 30, 3 } }, { { 4, 40, 4 } });
+	reader.read(view);
+	BOOST_TEST(view.version == 1);
+	BOOST_TEST(view.levels[Order::Type::Ask].size() == 2);
+	BOOST_TEST(view.levels[Order::Type::Ask].back().price == 6);
+	BOOST_TEST(view.levels[Order::Type::Bid].size() == 1);
+	BOOST_TEST(view.levels[Order::Type::Bid].front().orders_count == 4);
+
+	auto const top_of_book = reader.read_top_of_book();
+	BOOST_TEST(top_of_book.version == 1);
+	BOOST_TEST(top_of_book.has_level[Order::Type::Ask]);
+	BOOST_TEST(top_of_book.level[Order::Type::Ask].price == 5);
+	BOOST_TEST(top_of_book.level[Order::Type::Bid].quantity == 40);
+}
+
+BOOST_AUTO_TEST_CASE(MissingSegmentOpeningThrows)
+{
+	BOOST_CHECK_THROW(shared_memory_book::Reader(unique_segment_name("Missing")), boost::interprocess::interprocess_exception);
+}
+
+BOOST_AUTO_TEST_CASE(BookIsPublishedBestLevelsFirst, *boost::unit_test::timeout(5))
+{
+	auto const segment_name = unique_segment_name("Book");
+	OrderBookTestWrapper book;
+	book.publish_to_shared_memory(segment_name, 2);
+	BOOST_CHECK_THROW(book.publish_to_shared_memory(segment_name, 2), std::logic_error);
+
+	book.post(std::make_unique<Order>(Order::Type::Bid, 3, 100));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 300));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 50));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 1, 10));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 9, 300));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 7, 10));
+	BOOST_TEST_PASSPOINT();
+
+	shared_memory_book::Reader reader(segment_name);
+	shared_memory_book::View view;
+	do
+	{
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+		reader.read(view);
+	} while (view.levels[Order::Type::Ask].size() != 2 || view.levels[Order::Type::Bid].size() != 2);
+
+	BOOST_TEST(view.levels[Order::Type::Ask][0].price == 7);
+	BOOST_TEST(view.levels[Order::Type::Ask][1].price == 9);
+	BOOST_TEST(view.levels[Order::Type::Bid][0].price == 5);
+	BOOST_TEST(view.levels[Order::Type::Bid][0].quantity == 350);
+	BOOST_TEST(view.levels[Order::Type::Bid][0].orders_count == 2);
+	BOOST_TEST(view.levels[Order::Type::Bid][1].price == 3);
+
+	// Неизменившийся стакан повторно не публикуется ..
+	auto const version = view.version;
+	boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+	BOOST_TEST(reader.read_top_of_book().version == version);
+	// .. как и изменение уровня хуже опубликованных.
+	book.post(std::make_unique<Order>(Order::Type::Ask, 11, 5));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 1, 5));
+	BOOST_TEST(reader.read_top_of_book().version == version);
+
+	book.post(std::make_unique<Order>(Order::Type::Ask, 9, 5));
+	reader.read(view);
+	BOOST_TEST(view.version > version);
+	BOOST_TEST(view.levels[Order::Type::Ask][1].quantity == 305);
+
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(AsyncOperations)
+
+BOOST_AUTO_TEST_CASE(AsyncOperationsWithFutures, *boost::unit_test::timeout(3))
+{
+	OrderBook book;
+
+	auto const ask_id = book.async_post(std::make_unique<Order>(Order::Type::Ask, 5, 300), boost::asio::use_future).get();
+	auto const bid_id = book.async_post(std::make_unique<Order>(Order::Type::Bid, 4, 200), boost::asio::use_future).get();
+	// Барьер: немедленное исполнение дожидается сведения поставленных раньше заявок.
+	book.async_post(std::make_unique<Order>(Order::Type::Bid, 1, 1, Order::TimeInForce::ImmediateOrCancel), boost::asio::use_future).get();
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_TEST(book.async_get_data(ask_id, boost::asio::use_future).get().GetQuantity() == 300);
+	BOOST_TEST(book.async_get_snapshot(boost::asio::use_future).get()->GetOrders()[Order::Type::Bid].size() == 1);
+
+	auto const cancelled = book.async_cancel(bid_id, boost::asio::use_future).get();
+	BOOST_TEST(cancelled.is_initialized());
+	BOOST_TEST(book.async_cancel(bid_id, boost::asio::use_future).get().is_initialized() == false);
+
+	// Исключение операции передаётся через future.
+	BOOST_CHECK_THROW(book.async_get_data(bid_id, boost::asio::use_future).get(), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(AsyncOperationsCompleteOnCallerExecutor, *boost::unit_test::timeout(3))
+{
+	OrderBook book;
+	boost::asio::io_context caller_context;
+
+	boost::thread::id completion_thread;
+	std::exception_ptr completion_error;
+	order_id_t posted_id = 0;
+	book.async_post(
+		std::make_unique<Order>(Order::Type::Ask, 5, 300),
+		boost::asio::bind_executor(caller_context, [&](std::exception_ptr error, order_id_t id)
+		{
+			completion_thread = boost::this_thread::get_id();
+			completion_error = error;
+			posted_id = id;
+		})
+	);
+
+	// run не вернёт управление, пока операция не завершится: она держит исполнитель занятым.
+	caller_context.run();
+
+	BOOST_TEST((completion_thread == boost::this_thread::get_id()));
+	BOOST_TEST(!completion_error);
+	BOOST_TEST(posted_id != 0);
+}
+
+BOOST_AUTO_TEST_CASE(AsyncImmediateOrderDoesNotHoldUpOtherOperations, *boost::unit_test::timeout(5))
+{
+	tools::async::TasksExecutor merger;
+	merger.StartTasksExecution();
+	{
+		OrderBook book(merger);
+		auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 5, 300));
+		wait_for_merging(book);
+
+		// Занимаем поток сведения: IOC будет ждать сведения, пока его не отпустят.
+		boost::promise<void> merger_released;
+		auto merger_release = merger_released.get_future().share();
+		merger.GetService().post([merger_release] { merger_release.wait(); });
+
+		auto execution = book.async_execute(std::make_unique<Order>(Order::Type::Bid, 5, 100, Order::TimeInForce::ImmediateOrCancel), boost::asio::use_future);
+		// Операция после IOC завершается, хотя IOC ещё не исполнен.
+		BOOST_TEST(book.async_get_data(ask_id, boost::asio::use_future).get().GetQuantity() == 300);
+		BOOST_TEST((execution.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout));
+
+		merger_released.set_value();
+		BOOST_TEST(execution.get().GetQuantity() == 0);
+		BOOST_TEST(book.async_get_data(ask_id, boost::asio::use_future).get().GetQuantity() == 200);
+	}
+	merger.StopTasksExecution();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(LockPolicies)
+
+using lock_policies_t = boost::mpl::list<lock_policy::SharedMutex, lock_policy::SharedSpinLock, lock_policy::NullLock>;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(OrdersMergingWithLockPolicy, LockPolicyT, lock_policies_t)
+{
+	BasicOrderBook<LockPolicyT> book;
+
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 5, 300));
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 5, 100));
+	auto const other_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 4, 50));
+	// Барьер: немедленное исполнение дожидается сведения поставленных раньше заявок.
+	wait_for_merging(book);
+	BOOST_TEST_PASSPOINT();
+
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 200);
+	BOOST_CHECK_THROW(book.get_data(bid_id), std::logic_error);
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Bid].size() == 1);
+
+	BOOST_TEST(book.cancel(other_bid_id).is_initialized());
+	BOOST_TEST(book.cancel(other_bid_id).is_initialized() == false);
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Bid].empty());
+}
+
+BOOST_AUTO_TEST_CASE(ThreadConfinedBookMergesInCallerThread)
+{
+	BasicOrderBook<lock_policy::NullLock> book;
+
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 5, 300));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 5, 100));
+	// Ждать не нужно: заявка сведена ещё до возврата из post.
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 200);
+
+	BOOST_CHECK_THROW(book.publish_to_shared_memory("OrderBookTests_ThreadConfined", 1), std::logic_error);
+	BOOST_CHECK_THROW(book.async_get_data(ask_id, boost::asio::use_future), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(SharedSpinLockExcludesWriters, *boost::unit_test::timeout(10))
+{
+	tools::SharedSpinLock lock;
+	size_t counter = 0;
+	std::atomic<size_t> readers_saw_odd{ 0 };
+
+	auto const writer = [&]
+	{
+		for (size_t i = 0; i < 100000; ++i)
+		{
+			boost::unique_lock<tools::SharedSpinLock> write_lock(lock);
+			++counter;
+			++counter;
+		}
+	};
+	auto const reader = [&]
+	{
+		for (size_t i = 0; i < 100000; ++i)
+		{
+			boost::shared_lock<tools::SharedSpinLock> read_lock(lock);
+			if (counter % 2 != 0)
+				++readers_saw_odd;
+		}
+	};
+	{
+		boost::thread_group threads;
+		threads.create_thread(writer);
+		threads.create_thread(writer);
+		threads.create_thread(reader);
+		threads.create_thread(reader);
+		threads.join_all();
+	}
+
+	BOOST_TEST(counter == 400000);
+	BOOST_TEST(readers_saw_odd == 0);
+	BOOST_TEST(lock.try_lock());
+	BOOST_TEST(lock.try_lock_shared() == false);
+	lock.unlock();
+	BOOST_TEST(lock.try_lock_shared());
+	BOOST_TEST(lock.try_lock() == false);
+	lock.unlock_shared();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(ConsolidatedBookView)
+
+BOOST_AUTO_TEST_CASE(LevelChangesAreDelivered)
+{
+	OrderBook book;
+	book.post(std::make_unique<Order>(Order::Type::Ask, 10, 5));
+	wait_for_merging(book);
+
+	std::vector<PriceLevelView> levels;
+	auto const subscription_id = book.subscribe_to_level_changes([&levels](PriceLevelView const &level) { levels.emplace_back(level); });
+	// Сначала приходят уровни, которые уже есть в стакане.
+	BOOST_TEST_REQUIRE(levels.size() == 1);
+	BOOST_TEST(levels[0].price == 10);
+	BOOST_TEST(levels[0].quantity == 5);
+
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 10, 2));
+	wait_for_merging(book);
+	BOOST_TEST_REQUIRE(levels.size() == 2);
+	BOOST_TEST(levels[1].type == Order::Type::Ask);
+	BOOST_TEST(levels[1].quantity == 3);
+	BOOST_CHECK_THROW(book.get_data(bid_id), std::logic_error);
+
+	book.unsubscribe_from_level_changes(subscription_id);
+	book.post(std::make_unique<Order>(Order::Type::Bid, 10, 3));
+	wait_for_merging(book);
+	BOOST_TEST(levels.size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(BestLevelsAreMergedAcrossVenues)
+{
+	OrderBook first_venue;
+	OrderBook second_venue;
+	first_venue.post(std::make_unique<Order>(Order::Type::Ask, 101, 10));
+	first_venue.post(std::make_unique<Order>(Order::Type::Ask, 103, 10));
+	first_venue.post(std::make_unique<Order>(Order::Type::Bid, 99, 10));
+	second_venue.post(std::make_unique<Order>(Order::Type::Ask, 101, 5));
+	second_venue.post(std::make_unique<Order>(Order::Type::Ask, 102, 5));
+	second_venue.post(std::make_unique<Order>(Order::Type::Bid, 98, 5));
+	second_venue.post(std::make_unique<Order>(Order::Type::Bid, 100, 5));
+	for (auto book : { &first_venue, &second_venue })
+		wait_for_merging(*book);
+
+	ConsolidatedBook consolidated(2);
+	consolidated.add_venue(first_venue);
+	consolidated.add_venue(second_venue);
+
+	auto const asks = consolidated.top(Order::Type::Ask);
+	BOOST_TEST_REQUIRE(asks.size() == 2);
+	BOOST_TEST(asks[0].price == 101);
+	BOOST_TEST(asks[0].quantity == 15);
+	BOOST_TEST(asks[0].orders_count == 2);
+	BOOST_TEST(asks[1].price == 102);
+
+	auto const bids = consolidated.top(Order::Type::Bid);
+	BOOST_TEST_REQUIRE(bids.size() == 2);
+	BOOST_TEST(bids[0].price == 100);
+	BOOST_TEST(bids[1].price == 99);
+}
+
+BOOST_AUTO_TEST_CASE(TopIsUpdatedOnlyByRelevantLevels)
+{
+	OrderBook first_venue;
+	OrderBook second_venue;
+	first_venue.post(std::make_unique<Order>(Order::Type::Ask, 101, 10));
+	auto const second_best_id = second_venue.post(std::make_unique<Order>(Order::Type::Ask, 102, 10));
+	for (auto book : { &first_venue, &second_venue })
+		wait_for_merging(*book);
+
+	ConsolidatedBook consolidated(2);
+	consolidated.add_venue(first_venue);
+	consolidated.add_venue(second_venue);
+	BOOST_TEST(consolidated.top(Order::Type::Ask).size() == 2);
+
+	// Уровень хуже последнего из лучших лучшие уровни не меняет.
+	auto version = consolidated.version();
+	first_venue.post(std::make_unique<Order>(Order::Type::Ask, 105, 10));
+	wait_for_merging(first_venue);
+	BOOST_TEST(consolidated.version() == version);
+
+	// Отмена уходит из лучших, и на её место встаёт следующий уровень. Об отмене сообщает поток сведения.
+	BOOST_TEST(second_venue.cancel(second_best_id).is_initialized());
+	wait_for_merging(second_venue);
+	BOOST_TEST(consolidated.version() > version);
+	auto const asks = consolidated.top(Order::Type::Ask);
+	BOOST_TEST_REQUIRE(asks.size() == 2);
+	BOOST_TEST(asks[0].price == 101);
+	BOOST_TEST(asks[1].price == 105);
+
+	version = consolidated.version();
+	second_venue.post(std::make_unique<Order>(Order::Type::Ask, 100, 1));
+	wait_for_merging(second_venue);
+	BOOST_TEST(consolidated.version() > version);
+	BOOST_TEST(consolidated.top(Order::Type::Ask)[0].price == 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(MemoryFootprint)
+
+BOOST_AUTO_TEST_CASE(MemoryUsageCountsRestingOrders)
+{
+	OrderBook book;
+	BOOST_TEST(book.memory_usage().orders_count == 0);
+
+	size_t constexpr orders_count = 1000;
+	for (size_t i = 0; i < orders_count; ++i)
+		book.post(std::make_unique<Order>(Order::Type::Ask, 100 + i % 10, 1));
+	wait_for_merging(book);
+
+	auto const usage = book.memory_usage();
+	BOOST_TEST(usage.orders_count == orders_count);
+	BOOST_TEST(usage.order_payloads == orders_count * sizeof(Order));
+	BOOST_TEST(usage.index_nodes >= orders_count * sizeof(OrderData));
+	BOOST_TEST(usage.index_buckets >= orders_count * sizeof(void*));
+	BOOST_TEST(usage.total() == usage.index_buckets + usage.index_nodes + usage.order_payloads + usage.pending_queue + usage.cold_levels);
+	BOOST_TEST(usage.bytes_per_order() > sizeof(OrderData) + sizeof(Order));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(WireFormat)
+
+BOOST_AUTO_TEST_CASE(SnapshotRoundTrip)
+{
+	OrderBook book;
+	for (size_t i = 0; i < 100; ++i)
+		book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, (i % 2 ? 200 : 100) + (i % 7) * 0.5, 1 + i * 1000));
+	wait_for_merging(book);
+	auto const snapshot = book.get_flat_snapshot();
+
+	std::vector<uint8_t> buffer(wire_format::max_encoded_size(snapshot));
+	auto const encoded_size = wire_format::encode(snapshot, 0.5, buffer.data(), buffer.size());
+	BOOST_TEST(encoded_size < 100 * sizeof(FlatMarketDataSnapshot::Record) / 8);
+
+	FlatMarketDataSnapshot decoded;
+	BOOST_TEST(wire_format::decode(buffer.data(), encoded_size, 0.5, decoded) == encoded_size);
+	for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+	{
+		auto const &expected = snapshot.GetOrders()[type];
+		auto const &actual = decoded.GetOrders()[type];
+		BOOST_TEST_REQUIRE(actual.size() == expected.size());
+		for (size_t i = 0; i < expected.size(); ++i)
+		{
+			BOOST_TEST(actual[i].price == expected[i].price);
+			BOOST_TEST(actual[i].quantity == expected[i].quantity);
+			BOOST_TEST(actual[i].order_id == expected[i].order_id);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(LevelsRoundTrip)
+{
+	std::vector<PriceLevelView> const levels{
+		{ Order::Type::Ask, 100.25, 10, 2 },
+		{ Order::Type::Ask, 101, 5, 1 },
+		{ Order::Type::Bid, 99.75, 7, 3 },
+		// Уровень ушёл из стакана.
+		{ Order::Type::Bid, 98, 0, 0 }
+	};
+	std::array<uint8_t, 64> buffer{};
+	BOOST_TEST_REQUIRE(wire_format::max_encoded_levels_size(levels.size()) > buffer.size());
+	auto const encoded_size = wire_format::encode_levels(levels.begin(), levels.end(), 0.25, buffer.data(), buffer.size());
+	BOOST_TEST(encoded_size <= 16);
+
+	std::vector<PriceLevelView> decoded;
+	wire_format::decode_levels(buffer.data(), encoded_size, 0.25, std::back_inserter(decoded));
+	BOOST_TEST_REQUIRE(decoded.size() == levels.size());
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		BOOST_TEST(decoded[i].type == levels[i].type);
+		BOOST_TEST(decoded[i].price == levels[i].price);
+		BOOST_TEST(decoded[i].quantity == levels[i].quantity);
+		BOOST_TEST(decoded[i].orders_count == levels[i].orders_count);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(MalformedInputIsRejected)
+{
+	std::vector<PriceLevelView> const levels{ { Order::Type::Ask, 100, 10, 2 }, { Order::Type::Bid, 99.3, 1, 1 } };
+	std::array<uint8_t, 64> buffer{};
+	BOOST_CHECK_THROW(wire_format::encode_levels(levels.begin(), levels.end(), 0.5, buffer.data(), buffer.size()), std::invalid_argument);
+	BOOST_CHECK_THROW(wire_format::encode_levels(levels.begin(), levels.begin() + 1, 0.5, buffer.data(), 3), std::length_error);
+
+	auto const encoded_size = wire_format::encode_levels(levels.begin(), levels.begin() + 1, 0.5, buffer.data(), buffer.size());
+	std::vector<PriceLevelView> decoded;
+	BOOST_CHECK_THROW(wire_format::decode_levels(buffer.data(), encoded_size - 1, 0.5, std::back_inserter(decoded)), std::invalid_argument);
+	FlatMarketDataSnapshot snapshot;
+	BOOST_CHECK_THROW(wire_format::decode(buffer.data(), encoded_size, 0.5, snapshot), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Tracing)
+
+BOOST_AUTO_TEST_CASE(SpansOfAllThreadsAreExported)
+{
+	auto const begin = tools::tracing::timestamp();
+	tools::tracing::record("TracingTest main", begin, tools::tracing::timestamp());
+	boost::thread([] { ORDER_BOOK_TRACE_SCOPE("unused when tracing is off"); tools::tracing::Scope scope("TracingTest worker"); }).join();
+
+	std::ostringstream trace;
+	tools::tracing::export_chrome_trace(trace);
+	auto const json = trace.str();
+	BOOST_TEST(json.find("\"traceEvents\":[") != std::string::npos);
+	BOOST_TEST(json.find("\"name\":\"TracingTest main\",\"ph\":\"X\"") != std::string::npos);
+	BOOST_TEST(json.find("\"name\":\"TracingTest worker\",\"ph\":\"X\"") != std::string::npos);
+	BOOST_TEST(json.back() == '}');
+}
+
+BOOST_AUTO_TEST_CASE(RingBufferKeepsLatestSpans)
+{
+	// Буфер велик для стека.
+	auto const buffer_holder = std::make_unique<tools::tracing::ThreadBuffer>(1);
+	auto &buffer = *buffer_holder;
+	auto const overflow = 10;
+	for (uint64_t i = 0; i < tools::tracing::ThreadBuffer::capacity + overflow; ++i)
+		buffer.record("span", i, i + 1);
+
+	size_t spans_count = 0;
+	uint64_t first_begin = 0;
+	buffer.visit([&](char const *, uint64_t begin, uint64_t) { first_begin = spans_count++ == 0 ? begin : first_begin; });
+	BOOST_TEST(spans_count == tools::tracing::ThreadBuffer::capacity);
+	BOOST_TEST(first_begin == overflow);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(CallAuction)
+
+using lock_policies_t = boost::mpl::list<lock_policy::SharedMutex, lock_policy::NullLock>;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(UncrossExecutesAtEquilibriumPrice, LockPolicyT, lock_policies_t)
+{
+	BasicOrderBook<LockPolicyT> book;
+	book.begin_auction();
+
+	auto const best_bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 101, 10));
+	auto const best_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 99, 5));
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 10));
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 100, 3));
+	// Во время аукциона IOC не исполняется.
+	BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Bid, 100, 1, Order::TimeInForce::ImmediateOrCancel)).GetQuantity() == 1);
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 10);
+	BOOST_TEST(book.get_data(bid_id).GetQuantity() == 3);
+
+	// Спрос по 99, 100, 101: 13, 13, 10. Предложение: 5, 15, 15. Наибольший объём, 13, исполняется по 100.
+	auto const auction = book.uncross();
+	BOOST_TEST_REQUIRE(auction.is_initialized());
+	BOOST_TEST(auction->price == 100);
+	BOOST_TEST(auction->volume == 13);
+
+	BOOST_CHECK_THROW(book.get_data(best_bid_id), std::logic_error);
+	BOOST_CHECK_THROW(book.get_data(best_ask_id), std::logic_error);
+	BOOST_CHECK_THROW(book.get_data(bid_id), std::logic_error);
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 2);
+
+	// После аукциона заявки снова сводятся при поступлении.
+	book.post(std::make_unique<Order>(Order::Type::Bid, 100, 2));
+	wait_for_merging(book);
+	BOOST_CHECK_THROW(book.get_data(ask_id), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(EqualPricesAreExecutedInArrivalOrder)
+{
+	OrderBook book;
+	book.begin_auction();
+	auto const first_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	auto const second_ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 102, 7));
+
+	auto const auction = book.uncross();
+	BOOST_TEST_REQUIRE(auction.is_initialized());
+	BOOST_TEST(auction->volume == 7);
+	BOOST_CHECK_THROW(book.get_data(first_ask_id), std::logic_error);
+	BOOST_TEST(book.get_data(second_ask_id).GetQuantity() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(UncrossFindsSameEquilibriumWithTickLadder)
+{
+	OrderBook default_book;
+	OrderBook ladder_book;
+	ladder_book.enable_tick_ladder(90, 110, 0.5);
+	for (auto *book : { &default_book, &ladder_book })
+	{
+		book->begin_auction();
+		for (size_t order = 0; order < 200; ++order)
+		{
+			auto const type = order % 2 ? Order::Type::Ask : Order::Type::Bid;
+			book->post(std::make_unique<Order>(type, 95 + 0.5 * (order * 7 % 21), 1 + order % 5));
+		}
+	}
+
+	auto const default_auction = default_book.uncross();
+	auto const ladder_auction = ladder_book.uncross();
+	BOOST_TEST_REQUIRE(default_auction.is_initialized());
+	BOOST_TEST_REQUIRE(ladder_auction.is_initialized());
+	BOOST_TEST(ladder_auction->price == default_auction->price);
+	BOOST_TEST(ladder_auction->volume == default_auction->volume);
+	// id заявок в обоих стаканах одни и те же, так что совпадают и оставшиеся заявки.
+	BOOST_TEST(ladder_book.state_checksum() == default_book.state_checksum());
+}
+
+BOOST_AUTO_TEST_CASE(UncrossWithoutCrossingOrders)
+{
+	OrderBook book;
+	BOOST_CHECK_THROW(book.uncross(), std::logic_error);
+
+	book.begin_auction();
+	BOOST_CHECK_THROW(book.begin_auction(), std::logic_error);
+	auto const ask_id = book.post(std::make_unique<Order>(Order::Type::Ask, 101, 5));
+	auto const bid_id = book.post(std::make_unique<Order>(Order::Type::Bid, 100, 5));
+
+	BOOST_TEST(book.uncross().is_initialized() == false);
+	BOOST_TEST(book.get_data(ask_id).GetQuantity() == 5);
+	BOOST_TEST(book.get_data(bid_id).GetQuantity() == 5);
+	BOOST_CHECK_THROW(book.uncross(), std::logic_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(TickLadderStorage)
+
+BOOST_AUTO_TEST_CASE(OccupancyBitmapFindsNearestSetBit)
+{
+	// Больше 64 слов, чтобы поиск проходил через несколько слов верхнего уровня.
+	bits::OccupancyBitmap bitmap(64 * 64 * 3);
+	BOOST_TEST(bitmap.find_next(0) == bits::npos);
+	BOOST_TEST(bitmap.find_previous(64 * 64 * 3 - 1) == bits::npos);
+
+	bitmap.set(5);
+	bitmap.set(64 * 64 + 7);
+	bitmap.set(64 * 64 * 3 - 1);
+	BOOST_TEST(bitmap.find_next(0) == 5);
+	BOOST_TEST(bitmap.find_next(5) == 5);
+	BOOST_TEST(bitmap.find_next(6) == 64 * 64 + 7);
+	BOOST_TEST(bitmap.find_next(64 * 64 + 8) == 64 * 64 * 3 - 1);
+	BOOST_TEST(bitmap.find_previous(64 * 64 * 3 - 2) == 64 * 64 + 7);
+	BOOST_TEST(bitmap.find_previous(64 * 64 + 6) == 5);
+	BOOST_TEST(bitmap.find_previous(4) == bits::npos);
+
+	bitmap.reset(64 * 64 + 7);
+	BOOST_TEST(bitmap.test(64 * 64 + 7) == false);
+	BOOST_TEST(bitmap.find_next(6) == 64 * 64 * 3 - 1);
+	BOOST_TEST(bitmap.find_previous(64 * 64 * 3 - 2) == 5);
+}
+
+BOOST_AUTO_TEST_CASE(TickLadderValidatesPrices)
+{
+	BOOST_CHECK_THROW(TickLadder(100, 99, 0.5), std::invalid_argument);
+	BOOST_CHECK_THROW(TickLadder(100, 200, 0), std::invalid_argument);
+
+	TickLadder ladder(100, 200, 0.1);
+	BOOST_TEST(ladder.ticks_count() == 1001);
+	BOOST_TEST(ladder.to_tick(100.3) == 3);
+	BOOST_TEST(ladder.to_tick(200) == 1000);
+	BOOST_CHECK_THROW(ladder.to_tick(100.05), std::invalid_argument);
+	BOOST_CHECK_THROW(ladder.to_tick(99.9), std::out_of_range);
+	BOOST_CHECK_THROW(ladder.to_tick(200.1), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(TickLadderTracksBestPrices)
+{
+	TickLadder ladder(100, 200, 0.5);
+	BOOST_TEST(!ladder.best_price(Order::Type::Bid));
+	BOOST_TEST(!ladder.best_price(Order::Type::Ask));
+
+	ladder.add(Order::Type::Bid, 120, 1, 10, 1);
+	ladder.add(Order::Type::Bid, 130.5, 2, 10, 2);
+	ladder.add(Order::Type::Ask, 150, 3, 10, 3);
+	ladder.add(Order::Type::Ask, 140, 4, 10, 4);
+	BOOST_TEST(*ladder.best_price(Order::Type::Bid) == 130.5);
+	BOOST_TEST(*ladder.best_price(Order::Type::Ask) == 140);
+
+	BOOST_TEST(ladder.cancel(Order::Type::Bid, 130.5, 2) == 10);
+	BOOST_TEST(*ladder.best_price(Order::Type::Bid) == 120);
+
+	std::vector<price_t> ask_prices;
+	ladder.for_each_level(Order::Type::Ask, [&ask_prices](price_t price, PriceLevel const &level)
+	{
+		ask_prices.push_back(price);
+		BOOST_TEST(level.total_quantity() == 10);
+	});
+	BOOST_TEST(ask_prices == (std::vector<price_t>{ 140, 150 }));
+}
+
+BOOST_AUTO_TEST_CASE(TickLadderMatchSweepsLevelsFromBestPrice)
+{
+	TickLadder ladder(100, 200, 1);
+	ladder.add(Order::Type::Ask, 103, 1, 5, 1);
+	ladder.add(Order::Type::Ask, 101, 2, 5, 2);
+	ladder.add(Order::Type::Ask, 101, 3, 5, 3);
+	ladder.add(Order::Type::Ask, 102, 4, 5, 4);
+
+	std::vector<std::tuple<price_t, order_id_t, quantity_t>> fills;
+	quantity_t quantity = 18;
+	ladder.match(Order::Type::Bid, 102, quantity, [&fills](price_t price, order_id_t const &id, quantity_t filled, bool)
+	{
+		fills.emplace_back(price, id, filled);
+	});
+	// Уровень 103 выше лимита, так что 3 остаются неисполненными.
+	BOOST_TEST(quantity == 3);
+	BOOST_TEST_REQUIRE(fills.size() == 3);
+	BOOST_TEST((fills[0] == std::make_tuple(price_t(101), order_id_t(2), quantity_t(5))));
+	BOOST_TEST((fills[1] == std::make_tuple(price_t(101), order_id_t(3), quantity_t(5))));
+	BOOST_TEST((fills[2] == std::make_tuple(price_t(102), order_id_t(4), quantity_t(5))));
+	BOOST_TEST(*ladder.best_price(Order::Type::Ask) == 103);
+
+	// Лимит за пределами диапазона пересекает все уровни.
+	ladder.add(Order::Type::Bid, 100, 5, 4, 5);
+	quantity = 10;
+	ladder.match(Order::Type::Ask, 0, quantity);
+	BOOST_TEST(quantity == 6);
+	BOOST_TEST(!ladder.best_price(Order::Type::Bid));
+}
+
+BOOST_AUTO_TEST_CASE(BookWithTickLadderKeepsSameLevelsAsDefaultBook)
+{
+	OrderBook default_book;
+	OrderBook ladder_book;
+	ladder_book.enable_tick_ladder(90, 110, 0.5);
+
+	// Сколько отмен попадёт в одно уведомление, зависит от потока сведения, так что сравниваем последнее состояние каждого уровня.
+	std::array<std::map<std::pair<Order::Type, price_t>, PriceLevelView>, 2> changes;
+	default_book.subscribe_to_level_changes([&changes](PriceLevelView const &level) { changes[0].erase({ level.type, level.price }); changes[0].emplace(std::make_pair(level.type, level.price), level); });
+	ladder_book.subscribe_to_level_changes([&changes](PriceLevelView const &level) { changes[1].erase({ level.type, level.price }); changes[1].emplace(std::make_pair(level.type, level.price), level); });
+
+
+	for (auto *book : { &default_book, &ladder_book })
+	{
+		std::vector<order_id_t> ids;
+		for (size_t order = 0; order < 200; ++order)
+		{
+			auto const type = order % 3 == 0 ? Order::Type::Ask : Order::Type::Bid;
+			// Уровни пересекаются только на 99, так что после сведения обе стороны не пусты.
+			auto const price = (type == Order::Type::Ask ? 99 : 90) + 0.5 * (order * 7 % 19);
+			ids.push_back(book->post(std::make_unique<Order>(type, price, 1 + order % 4)));
+
+		}
+		wait_for_merging(*book);
+		for (size_t order = 0; order < ids.size(); order += 5)
+			book->cancel(ids[order]);
+		wait_for_merging(*book);
+
+	}
+
+	auto const default_analytics = default_book.get_analytics();
+	auto const ladder_analytics = ladder_book.get_analytics();
+	for (auto const type : { Order::Type::Bid, Order::Type::Ask })
+	{
+		BOOST_TEST(ladder_analytics.best_price[type] == default_analytics.best_price[type]);
+		BOOST_TEST(ladder_analytics.best_quantity[type] == default_analytics.best_quantity[type]);
+		BOOST_TEST(ladder_analytics.total_quantity[type] == default_analytics.total_quantity[type]);
+	}
+	BOOST_TEST_REQUIRE(changes[1].size() == changes[0].size());
+	for (auto default_level = changes[0].cbegin(), ladder_level = changes[1].cbegin(); default_level != changes[0].cend(); ++default_level, ++ladder_level)
+	{
+		BOOST_TEST(ladder_level->second.price == default_level->second.price);
+		BOOST_TEST(ladder_level->second.quantity == default_level->second.quantity);
+		BOOST_TEST(ladder_level->second.orders_count == default_level->second.orders_count);
+	}
+
+	BOOST_TEST(ladder_book.memory_usage().index_nodes != default_book.memory_usage().index_nodes);
+}
+
+BOOST_AUTO_TEST_CASE(BookWithTickLadderPublishesExactOrderPrices, *boost::unit_test::timeout(5))
+{
+	// Цена шага 2 лестницы, 0.1 + 2 * 0.1, не равна 0.3 в double.
+	BOOST_TEST_REQUIRE(0.1 + 2 * 0.1 != 0.3);
+	auto const segment_name = SharedMemoryPublishing::unique_segment_name("TickLadder");
+	OrderBook book;
+	book.enable_tick_ladder(0.1, 10, 0.1);
+	book.publish_to_shared_memory(segment_name, 1);
+	std::vector<price_t> changed_prices;
+	book.subscribe_to_level_changes([&changed_prices](PriceLevelView const &level) { changed_prices.push_back(level.price); });
+
+	book.post(std::make_unique<Order>(Order::Type::Bid, 0.3, 10));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 0.7, 10));
+	wait_for_merging(book);
+	BOOST_TEST(book.get_analytics().best_price[Order::Type::Bid] == 0.3);
+	BOOST_TEST(book.get_analytics().best_price[Order::Type::Ask] == 0.7);
+	std::sort(changed_prices.begin(), changed_prices.end());
+	BOOST_TEST(changed_prices == (std::vector<price_t>{ 0.3, 0.7 }));
+
+
+	shared_memory_book::Reader reader(segment_name);
+	shared_memory_book::View view;
+	do
+	{
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+		reader.read(view);
+	} while (view.levels[Order::Type::Ask].empty() || view.levels[Order::Type::Bid].empty());
+	BOOST_TEST(view.levels[Order::Type::Bid][0].price == 0.3);
+	BOOST_TEST(view.levels[Order::Type::Ask][0].price == 0.7);
+
+	// Изменение худшего опубликованного уровня Bid публикуется заново.
+	book.post(std::make_unique<Order>(Order::Type::Bid, 0.3, 5));
+	do
+	{
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+		reader.read(view);
+	} while (view.levels[Order::Type::Bid][0].quantity != 15);
+	BOOST_TEST(view.levels[Order::Type::Bid][0].price == 0.3);
+}
+
+BOOST_AUTO_TEST_CASE(BookWithTickLadderAcceptsOnlyPricesOnLadder)
+{
+	OrderBook book;
+	BOOST_CHECK_THROW(book.enable_tick_ladder(100, 90, 1), std::invalid_argument);
+	book.enable_tick_ladder(90, 110, 0.5);
+	BOOST_CHECK_THROW(book.enable_tick_ladder(90, 110, 0.5), std::logic_error);
+
+	BOOST_CHECK_THROW(book.post(std::make_unique<Order>(Order::Type::Bid, 89.5, 1)), std::out_of_range);
+	BOOST_CHECK_THROW(book.post(std::make_unique<Order>(Order::Type::Bid, 100.25, 1)), std::invalid_argument);
+	std::vector<std::unique_ptr<Order>> batch;
+	batch.push_back(std::make_unique<Order>(Order::Type::Bid, 100, 1));
+	batch.push_back(std::make_unique<Order>(Order::Type::Ask, 120, 1));
+	BOOST_CHECK_THROW(book.post_batch(std::move(batch)), std::out_of_range);
+
+	auto const id = book.post(std::make_unique<Order>(Order::Type::Bid, 110, 3));
+	// Встречная заявка IOC в стакан не встаёт, так что её лимит может быть и вне лестницы.
+	BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Ask, 1, 1, Order::TimeInForce::ImmediateOrCancel)).GetQuantity() == 0);
+	BOOST_TEST(book.get_data(id).GetQuantity() == 2);
+	BOOST_TEST(book.get_analytics().best_price[Order::Type::Bid] == 110);
+
+	OrderBook non_empty_book;
+	non_empty_book.post(std::make_unique<Order>(Order::Type::Bid, 100, 1));
+	BOOST_CHECK_THROW(non_empty_book.enable_tick_ladder(90, 110, 0.5), std::logic_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(ShardedMerging)
+
+BOOST_AUTO_TEST_CASE(InstrumentsAreMergedIndependentlyOnSharedThreads)
+{
+	OrderBookShards shards(2);
+	BOOST_TEST(shards.shards_count() == 2);
+
+	std::vector<std::string> instruments;
+	for (size_t i = 0; i < 8; ++i)
+		instruments.emplace_back("instrument " + std::to_string(i));
+	for (auto const &instrument : instruments)
+	{
+		BOOST_TEST(shards.shard_of(instrument) < shards.shards_count());
+		BOOST_TEST(&shards.book(instrument) == &shards.book(instrument));
+	}
+
+	// В каждом стакане одна и та же последовательность: заявки одного инструмента сводятся только между собой.
+	std::vector<order_id_t> resting_ids;
+	for (auto const &instrument : instruments)
+	{
+		auto &book = shards.book(instrument);
+		book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+		resting_ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5)));
+		book.post(std::make_unique<Order>(Order::Type::Bid, 100, 7));
+	}
+	for (size_t i = 0; i < instruments.size(); ++i)
+	{
+		auto &book = shards.book(instruments[i]);
+		// IOC сводится после всех заявок до него, так что дожидается их сведения.
+		BOOST_TEST(book.execute(std::make_unique<Order>(Order::Type::Bid, 1, 1, Order::TimeInForce::ImmediateOrCancel)).GetQuantity() == 1);
+		BOOST_TEST(book.get_data(resting_ids[i]).GetQuantity() == 3);
+		auto const snapshot = book.get_snapshot();
+		BOOST_TEST(snapshot->GetOrders()[Order::Type::Ask].size() == 1);
+		BOOST_TEST(snapshot->GetOrders()[Order::Type::Bid].empty());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(BookReferenceStaysValidAsInstrumentsAreAdded)
+{
+	OrderBookShards shards(1);
+	auto &book = shards.book("instrument 0");
+	auto const id = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	for (size_t i = 1; i < 1000; ++i)
+		shards.book("instrument " + std::to_string(i));
+
+	BOOST_TEST(&shards.book("instrument 0") == &book);
+	BOOST_TEST(book.get_data(id).GetQuantity() == 5);
+}
+
+BOOST_AUTO_TEST_CASE(ShardsAreDestroyedWithPendingOrders)
+{
+	OrderBookShards shards(3);
+	for (size_t i = 0; i < 1000; ++i)
+		shards.book("instrument " + std::to_string(i % 10)).post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, 100 + i % 7, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(StripedIdIndex)
+
+BOOST_AUTO_TEST_CASE(StripedHashMapSpreadsKeysOverStripes)
+{
+	tools::StripedHashMap<order_id_t, int, boost::shared_mutex, 8> map;
+	for (int i = 1; i <= 100; ++i)
+		map.insert(order_id_t(i), i);
+
+	BOOST_TEST(map.contains(order_id_t(42)));
+	int value = 0;
+	BOOST_TEST(map.visit(order_id_t(42), [&value](int stored) { value = stored; }));
+	BOOST_TEST(value == 42);
+	BOOST_TEST(map.erase(order_id_t(42)));
+	BOOST_TEST(map.erase(order_id_t(42)) == false);
+	BOOST_TEST(map.contains(order_id_t(42)) == false);
+
+	size_t size = 0;
+	size_t non_empty_stripes = 0;
+	map.for_each_stripe([&](decltype(map)::map_t const &stripe)
+	{
+		size += stripe.size();
+		non_empty_stripes += stripe.empty() ? 0 : 1;
+	});
+	BOOST_TEST(size == 99);
+	BOOST_TEST(non_empty_stripes > 1);
+}
+
+BOOST_AUTO_TEST_CASE(CancelsAndLookupsRaceWithMerging)
+{
+	OrderBook book;
+	size_t const orders_count = 2000;
+	std::vector<order_id_t> ids;
+	for (size_t i = 0; i < orders_count; ++i)
+		ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Bid, 100 + i % 10, 10)));
+
+	std::atomic<size_t> cancelled_count{ 0 };
+	std::atomic<bool> is_lookup_consistent{ true };
+	{
+		std::vector<boost::scoped_thread<boost::join_if_joinable>> threads;
+		// Исполнение заявок стакана встречными IOC.
+		threads.emplace_back(boost::thread([&book]
+		{
+			for (size_t i = 0; i < 500; ++i)
+				book.execute(std::make_unique<Order>(Order::Type::Ask, 100, 15, Order::TimeInForce::ImmediateOrCancel));
+		}));
+		// Каждую заявку отменяют два потока: отменить её должен не больше чем один.
+		for (size_t thread = 0; thread < 2; ++thread)
+			threads.emplace_back(boost::thread([&book, &ids, &cancelled_count]
+			{
+				for (size_t i = 0; i < ids.size(); i += 2)
+					if (book.cancel(ids[i]).is_initialized())
+						++cancelled_count;
+			}));
+		threads.emplace_back(boost::thread([&book, &ids, &is_lookup_consistent]
+		{
+			for (auto const &id : ids)
+			{
+				try
+				{
+					auto const order = book.get_data(id);
+					if (order.GetQuantity() == 0 || order.GetQuantity() > 10 || order.order_id != id)
+						is_lookup_consistent = false;
+				}
+				catch (std::logic_error const &) {}
+			}
+		}));
+	}
+
+	BOOST_TEST(is_lookup_consistent.load());
+	BOOST_TEST(cancelled_count.load() <= orders_count / 2);
+	// Отменённые и исполненные заявки ни через get_data, ни через cancel больше не находятся.
+	for (size_t i = 0; i < orders_count; i += 2)
+	{
+		BOOST_TEST(book.cancel(ids[i]).is_initialized() == false);
+		BOOST_CHECK_THROW(book.get_data(ids[i]), std::logic_error);
+	}
+	auto const usage = book.memory_usage();
+	BOOST_TEST(usage.orders_count <= orders_count / 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Replication)
+
+namespace
+{
+	bool have_same_orders(FlatMarketDataSnapshot const &lhs, FlatMarketDataSnapshot const &rhs)
+	{
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const &lhs_orders = lhs.GetOrders()[type];
+			auto const &rhs_orders = rhs.GetOrders()[type];
+			auto const is_same = [](FlatMarketDataSnapshot::Record const &lhs, FlatMarketDataSnapshot::Record const &rhs)
+			{
+				return lhs.price == rhs.price && lhs.quantity == rhs.quantity && lhs.order_id == rhs.order_id;
+			};
+			if (lhs_orders.size() != rhs_orders.size() || std::equal(lhs_orders.begin(), lhs_orders.end(), rhs_orders.begin(), is_same) == false)
+				return false;
+		}
+		return true;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ReplicaFollowsLeaderInProcess)
+{
+	OrderBook leader;
+	auto const resting_before_subscription = leader.post(std::make_unique<Order>(Order::Type::Ask, 105, 10));
+	wait_for_merging(leader);
+
+	OrderBook replica;
+	leader.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+	BOOST_TEST(replica.state_checksum() == leader.state_checksum());
+
+	auto const partially_filled = leader.post(std::make_unique<Order>(Order::Type::Ask, 101.3, 10));
+	auto const cancelled = leader.post(std::make_unique<Order>(Order::Type::Bid, 99, 4));
+	leader.post(std::make_unique<Order>(Order::Type::Bid, 102, 6));
+	leader.post(std::make_unique<Order>(Order::Type::Bid, 98, 7, std::chrono::system_clock::now() + std::chrono::hours(1)));
+	wait_for_merging(leader);
+	leader.cancel(cancelled);
+	leader.execute(std::make_unique<Order>(Order::Type::Bid, 200, 5, Order::TimeInForce::ImmediateOrCancel));
+
+	BOOST_TEST(replica.state_checksum() == leader.state_checksum());
+	BOOST_TEST(have_same_orders(replica.get_flat_snapshot(), leader.get_flat_snapshot()));
+	BOOST_TEST(replica.get_data(resting_before_subscription).GetQuantity() == 9);
+	BOOST_CHECK_THROW(replica.get_data(partially_filled), std::logic_error);
+
+	// Заявки реплики меняет только лидер.
+	BOOST_CHECK_THROW(replica.post(std::make_unique<Order>(Order::Type::Bid, 100, 1)), std::logic_error);
+	BOOST_CHECK_THROW(replica.cancel(resting_before_subscription), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(ReplicaFollowsLeaderThroughWireFormat)
+{
+	OrderBook leader;
+	BasicOrderBook<lock_policy::NullLock> replica;
+	std::vector<uint8_t> buffer(wire_format::max_encoded_replication_event_size);
+	leader.subscribe_to_replication([&](ReplicationEvent const &event)
+	{
+		auto const size = wire_format::encode_replication_event(event, buffer.data(), buffer.size());
+		ReplicationEvent decoded;
+		BOOST_TEST(wire_format::decode_replication_event(buffer.data(), size, decoded) == size);
+		replica.apply_replication_event(decoded);
+	});
+
+	for (size_t i = 0; i < 200; ++i)
+		leader.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, 100 + 0.1 * (i % 13), 1 + i % 5));
+	wait_for_merging(leader);
+
+	BOOST_TEST(replica.state_checksum() == leader.state_checksum());
+	BOOST_TEST(have_same_orders(replica.get_flat_snapshot(), leader.get_flat_snapshot()));
+}
+
+BOOST_AUTO_TEST_CASE(DivergenceIsDetectedByChecksum)
+{
+	OrderBook leader;
+	std::vector<ReplicationEvent> events;
+	leader.subscribe_to_replication([&events](ReplicationEvent const &event)
+	{
+		if (event.kind != ReplicationEvent::Kind::IdAdvance)
+			events.push_back(event);
+	});
+	leader.post(std::make_unique<Order>(Order::Type::Ask, 101, 10));
+
+	leader.post(std::make_unique<Order>(Order::Type::Bid, 101, 3));
+	wait_for_merging(leader);
+	BOOST_TEST_REQUIRE(events.size() == 2);
+	BOOST_TEST((events[1].kind == ReplicationEvent::Kind::Fill));
+
+	OrderBook replica;
+	replica.apply_replication_event(events[0]);
+	auto corrupted = events[1];
+	corrupted.quantity = 2;
+	BOOST_CHECK_THROW(replica.apply_replication_event(corrupted), std::runtime_error);
+
+	OrderBook other_replica;
+	// Исполнение заявки, которой в реплике нет.
+	BOOST_CHECK_THROW(other_replica.apply_replication_event(events[1]), std::runtime_error);
+	// Стакан с заявками репликой не станет.
+	BOOST_CHECK_THROW(leader.apply_replication_event(events[0]), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(PromotedReplicaContinuesLeaderIds)
+{
+	OrderBook replica;
+	order_id_t last_leader_id;
+	{
+		OrderBook leader;
+		leader.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+		leader.post(std::make_unique<Order>(Order::Type::Ask, 101, 10));
+		last_leader_id = leader.post(std::make_unique<Order>(Order::Type::Ask, 102, 10));
+		wait_for_merging(leader);
+	}
+
+	replica.promote();
+	BOOST_TEST(replica.post(std::make_unique<Order>(Order::Type::Bid, 90, 1)) > last_leader_id);
+	BOOST_TEST(replica.execute(std::make_unique<Order>(Order::Type::Bid, 101, 4, Order::TimeInForce::ImmediateOrCancel)).GetQuantity() == 0);
+	BOOST_TEST(replica.get_data(last_leader_id - 1).GetQuantity() == 6);
+}
+
+BOOST_AUTO_TEST_CASE(PromotedReplicaDoesNotReissueIdsOfOrdersThatNeverRested)
+{
+	OrderBook replica;
+	order_id_t last_leader_id;
+	{
+		OrderBook leader;
+		leader.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+		leader.post(std::make_unique<Order>(Order::Type::Ask, 101, 10));
+		// Ни исполненная сразу при постановке заявка, ни IOC в стакан не встают.
+		leader.post(std::make_unique<Order>(Order::Type::Bid, 101, 4));
+		last_leader_id = leader.execute(std::make_unique<Order>(Order::Type::Bid, 90, 1, Order::TimeInForce::ImmediateOrCancel)).order_id;
+	}
+
+	replica.promote();
+	BOOST_TEST(replica.post(std::make_unique<Order>(Order::Type::Bid, 90, 1)) > last_leader_id);
+}
+
+
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(ColdTiering)
+
+namespace
+{
+	template<typename PredicateT>
+	bool wait_until(PredicateT &&predicate)
+	{
+		auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while (predicate() == false)
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+				return false;
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	// \brief Ask по 100, 101, .., Bid по 99, 98, .. - по две заявки на уровень.
+	std::vector<order_id_t> post_ladder(OrderBook &book, size_t levels_count)
+	{
+		std::vector<order_id_t> ids;
+		for (size_t level = 0; level < levels_count; ++level)
+			for (size_t order = 0; order < 2; ++order)
+			{
+				ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Ask, 100. + level, 1 + order)));
+				ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Bid, 99. - level, 1 + order)));
+			}
+		wait_for_merging(book);
+		return ids;
+	}
+
+	std::vector<PriceLevelView> levels_of(OrderBook const &book)
+	{
+		std::vector<PriceLevelView> levels;
+		book.copy_snapshot_levels(std::back_inserter(levels));
+		return levels;
+	}
+
+	bool are_same_levels(std::vector<PriceLevelView> const &lhs, std::vector<PriceLevelView> const &rhs)
+	{
+		return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](PriceLevelView const &lhs, PriceLevelView const &rhs)
+		{
+			return lhs.type == rhs.type && lhs.price == rhs.price && lhs.quantity == rhs.quantity && lhs.orders_count == rhs.orders_count;
+		});
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ColdLevelsKeepLevelsAndPriority)
+{
+	ColdLevels cold_levels;
+	cold_levels.freeze({
+		{ Order::Type::Bid, 90, 7, 3 },
+		{ Order::Type::Bid, 95, 5, 1 },
+		{ Order::Type::Bid, 90, 2, 4 },
+		{ Order::Type::Ask, 110, 9, 6 }
+	});
+	BOOST_TEST(cold_levels.size() == 4);
+	BOOST_TEST(*cold_levels.best_priority_price(Order::Type::Bid) == -95);
+	BOOST_TEST(*cold_levels.best_priority_price(Order::Type::Ask) == 110);
+	BOOST_TEST(cold_levels.level_totals(Order::Type::Bid, 90).first == 7);
+	BOOST_TEST(cold_levels.level_totals(Order::Type::Bid, 90).second == 2);
+	BOOST_TEST(cold_levels.find(order_id_t(2))->quantity == 4);
+	BOOST_TEST(cold_levels.find(order_id_t(2))->price == 90);
+	BOOST_TEST(cold_levels.find(order_id_t(8)).is_initialized() == false);
+
+	BOOST_TEST(cold_levels.cancel(order_id_t(5))->price == 95);
+	BOOST_TEST(cold_levels.find(order_id_t(5)).is_initialized() == false);
+	BOOST_TEST(cold_levels.cancel(order_id_t(5)).is_initialized() == false);
+	BOOST_TEST(cold_levels.size() == 3);
+
+	// Уровни Bid от лучшей цены к худшей, внутри уровня - по id. Отменённая заявка не размораживается.
+	auto const thawed = cold_levels.thaw(Order::Type::Bid, -90);
+	BOOST_TEST_REQUIRE(thawed.size() == 2);
+	BOOST_TEST(thawed[0].id == 2);
+	BOOST_TEST(thawed[1].id == 7);
+	BOOST_TEST(cold_levels.size() == 1);
+	BOOST_TEST(cold_levels.best_priority_price(Order::Type::Bid).is_initialized() == false);
+	BOOST_TEST(ColdLevels::can_be_frozen(order_id_t(1) << 64) == false);
+}
+
+BOOST_AUTO_TEST_CASE(FreezingAsManyOrdersAsCancelledKeepsThem)
+{
+	ColdLevels cold_levels;
+	cold_levels.freeze({ { Order::Type::Bid, 90, 1, 3 }, { Order::Type::Bid, 90, 2, 4 } });
+	cold_levels.cancel(order_id_t(1));
+	// Новая заявка одна, как и отменённая: размер стороны с отменённой тот же, но сторона должна перестроиться.
+	cold_levels.freeze({ { Order::Type::Bid, 80, 3, 5 } });
+
+	BOOST_TEST(cold_levels.size() == 2);
+	BOOST_TEST_REQUIRE(cold_levels.find(order_id_t(3)).is_initialized());
+	BOOST_TEST(cold_levels.find(order_id_t(3))->quantity == 5);
+	BOOST_TEST(cold_levels.find(order_id_t(2))->quantity == 4);
+	BOOST_TEST(cold_levels.find(order_id_t(1)).is_initialized() == false);
+}
+
+BOOST_AUTO_TEST_CASE(FarLevelsAreFrozenAndStayVisible)
+{
+	OrderBook book;
+	auto const ids = post_ladder(book, 20);
+	auto const hot_usage = book.memory_usage();
+	auto const hot_levels = levels_of(book);
+	auto const hot_snapshot = book.get_flat_snapshot();
+
+	BOOST_CHECK_THROW(book.enable_cold_tiering(-1), std::invalid_argument);
+	book.enable_cold_tiering(5, std::chrono::milliseconds(1));
+	BOOST_CHECK_THROW(book.enable_cold_tiering(5), std::logic_error);
+	BOOST_TEST_REQUIRE(wait_until([&book] { return book.memory_usage().cold_levels != 0; }));
+
+	// Хранятся заявки иначе, но видны так же.
+	auto const cold_usage = book.memory_usage();
+	BOOST_TEST(cold_usage.orders_count == hot_usage.orders_count);
+	BOOST_TEST(cold_usage.index_nodes < hot_usage.index_nodes);
+	BOOST_TEST(cold_usage.order_payloads < hot_usage.order_payloads);
+	BOOST_TEST(are_same_levels(levels_of(book), hot_levels));
+	BOOST_TEST(book.get_flat_snapshot().GetOrders()[Order::Type::Bid].size() == hot_snapshot.GetOrders()[Order::Type::Bid].size());
+	auto const snapshot = book.get_snapshot();
+	BOOST_TEST(snapshot->GetOrders()[Order::Type::Ask].size() + snapshot->GetOrders()[Order::Type::Bid].size() == ids.size());
+	size_t visited_count = 0;
+	book.visit_snapshot([&visited_count](OrderView const &) { ++visited_count; });
+	BOOST_TEST(visited_count == ids.size());
+
+	// Самый дальний Ask - 119, заморожен.
+	auto const far_ask = book.get_data(ids[ids.size() - 2]);
+	BOOST_TEST(far_ask.GetPrice() == 119);
+	BOOST_TEST(far_ask.GetQuantity() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(FrozenLevelsThawWhenCrossed)
+{
+	OrderBook book;
+	auto const ids = post_ladder(book, 20);
+	book.enable_cold_tiering(2, std::chrono::milliseconds(1));
+	BOOST_TEST_REQUIRE(wait_until([&book] { return book.memory_usage().cold_levels != 0; }));
+
+	// Bid по 110 исполняется со всеми Ask до 110 по порядку, в том числе с замороженными: 3 на каждом из 11 уровней.
+	auto const executed = book.execute(std::make_unique<Order>(Order::Type::Bid, 110, 33 + 1, Order::TimeInForce::ImmediateOrCancel));
+	BOOST_TEST(executed.GetQuantity() == 1);
+	// Внутри уровня 111 приоритет по-прежнему по времени: первой исполняется заявка, поставленная первой.
+	auto const partially = book.execute(std::make_unique<Order>(Order::Type::Bid, 111, 2, Order::TimeInForce::FillOrKill));
+	BOOST_TEST(partially.GetQuantity() == 0);
+	BOOST_CHECK_THROW(book.get_data(ids[4 * 11]), std::logic_error);
+	BOOST_TEST(book.get_data(ids[4 * 11 + 2]).GetQuantity() == 1);
+
+	auto const levels = levels_of(book);
+	auto const best_ask = std::find_if(levels.begin(), levels.end(), [](PriceLevelView const &level) { return level.type == Order::Type::Ask; });
+	BOOST_TEST_REQUIRE((best_ask != levels.end()));
+	BOOST_TEST(best_ask->price == 111);
+	BOOST_TEST(best_ask->quantity == 1);
+}
+
+BOOST_AUTO_TEST_CASE(FrozenOrdersAreCancelledAndReplicated)
+{
+	OrderBook book;
+	auto const ids = post_ladder(book, 20);
+	book.enable_cold_tiering(2, std::chrono::milliseconds(1));
+	BOOST_TEST_REQUIRE(wait_until([&book] { return book.memory_usage().cold_levels != 0; }));
+
+	std::vector<PriceLevelView> changes;
+	book.subscribe_to_level_changes([&changes](PriceLevelView const &level) { changes.emplace_back(level); });
+	OrderBook replica;
+	book.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+	BOOST_TEST(replica.state_checksum() == book.state_checksum());
+	BOOST_TEST(replica.memory_usage().orders_count == ids.size());
+
+	// Самый дальний Bid - 80, заморожен.
+	changes.clear();
+	auto const cancelled = book.cancel(ids.back());
+	BOOST_TEST_REQUIRE(cancelled.is_initialized());
+	BOOST_TEST(cancelled->GetPrice() == 80);
+	BOOST_TEST(book.cancel(ids.back()).is_initialized() == false);
+	BOOST_CHECK_THROW(book.get_data(ids.back()), std::logic_error);
+	wait_for_merging(book);
+	BOOST_TEST_REQUIRE(changes.size() == 1);
+
+	BOOST_TEST(changes[0].price == 80);
+	BOOST_TEST(changes[0].quantity == 1);
+	BOOST_TEST(changes[0].orders_count == 1);
+	BOOST_TEST(replica.state_checksum() == book.state_checksum());
+	BOOST_TEST(are_same_levels(levels_of(replica), levels_of(book)));
+}
+
+BOOST_AUTO_TEST_CASE(AuctionUncrossesFrozenLevels)
+{
+	OrderBook book;
+	post_ladder(book, 20);
+	book.enable_cold_tiering(1, std::chrono::milliseconds(1));
+	BOOST_TEST_REQUIRE(wait_until([&book] { return book.memory_usage().cold_levels != 0; }));
+
+	book.begin_auction();
+	book.post(std::make_unique<Order>(Order::Type::Bid, 119, 60));
+	auto const auction = book.uncross();
+	BOOST_TEST_REQUIRE(auction.is_initialized());
+	BOOST_TEST(auction->volume == 60);
+	BOOST_TEST(auction->price == 119);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(IncrementalAnalytics)
+
+namespace
+{
+	bool is_same_value(double lhs, double rhs)
+	{
+		return (std::isnan(lhs) && std::isnan(rhs)) || std::abs(lhs - rhs) <= 1e-9 * (std::max)(1., std::abs(rhs));
+	}
+
+	// \brief Показатели, посчитанные с нуля по срезу: то, что они заменяют.
+	BookAnalytics recompute_analytics(FlatMarketDataSnapshot const &snapshot)
+	{
+		auto const nan = std::numeric_limits<double>::quiet_NaN();
+		BookAnalytics analytics{};
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+		{
+			auto const &records = snapshot.GetOrders()[type];
+			double notional = 0;
+			for (auto const &record : records)
+			{
+				analytics.total_quantity[type] += record.quantity;
+				notional += record.price * record.quantity;
+			}
+			analytics.vwap[type] = analytics.total_quantity[type] != 0 ? notional / analytics.total_quantity[type] : nan;
+			analytics.best_price[type] = records.empty() ? nan : type == Order::Type::Ask ? records.front().price : records.back().price;
+			for (auto const &record : records)
+				if (record.price == analytics.best_price[type])
+					analytics.best_quantity[type] += record.quantity;
+		}
+		auto const ask = static_cast<double>(analytics.best_quantity[Order::Type::Ask]);
+		auto const bid = static_cast<double>(analytics.best_quantity[Order::Type::Bid]);
+		auto const total_ask = static_cast<double>(analytics.total_quantity[Order::Type::Ask]);
+		auto const total_bid = static_cast<double>(analytics.total_quantity[Order::Type::Bid]);
+		analytics.imbalance = ask + bid == 0 ? nan : (bid - ask) / (bid + ask);
+		analytics.depth_imbalance = total_ask + total_bid == 0 ? nan : (total_bid - total_ask) / (total_bid + total_ask);
+		analytics.microprice = ask == 0 || bid == 0
+			? nan
+			: (analytics.best_price[Order::Type::Bid] * ask + analytics.best_price[Order::Type::Ask] * bid) / (ask + bid);
+		return analytics;
+	}
+
+	bool are_same_analytics(BookAnalytics const &lhs, BookAnalytics const &rhs)
+	{
+		for (size_t type = 0; type < Order::Type::_EnumElementsCount; ++type)
+			if (is_same_value(lhs.best_price[type], rhs.best_price[type]) == false
+				|| lhs.best_quantity[type] != rhs.best_quantity[type]
+				|| lhs.total_quantity[type] != rhs.total_quantity[type]
+				|| is_same_value(lhs.vwap[type], rhs.vwap[type]) == false)
+				return false;
+		return is_same_value(lhs.imbalance, rhs.imbalance)
+			&& is_same_value(lhs.depth_imbalance, rhs.depth_imbalance)
+			&& is_same_value(lhs.microprice, rhs.microprice);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(SeqLockReadsWholeValues)
+{
+	struct Pair
+	{
+		uint64_t first;
+		uint64_t second;
+	};
+	tools::SeqLock<Pair> value(Pair{ 0, 0 });
+	std::atomic<bool> is_writing{ true };
+	boost::scoped_thread<boost::join_if_joinable> writer(boost::thread([&]
+	{
+		for (uint64_t i = 1; i <= 100000; ++i)
+			value.store(Pair{ i, i });
+		is_writing = false;
+	}));
+	bool is_torn = false;
+	while (is_writing)
+	{
+		auto const read = value.load();
+		is_torn |= read.first != read.second;
+	}
+	BOOST_TEST(is_torn == false);
+	BOOST_TEST(value.load().first == 100000u);
+}
+
+BOOST_AUTO_TEST_CASE(AnalyticsOfEmptyBookAreUndefined)
+{
+	OrderBook book;
+	auto const analytics = book.get_analytics();
+	BOOST_TEST(std::isnan(analytics.best_price[Order::Type::Ask]));
+	BOOST_TEST(std::isnan(analytics.vwap[Order::Type::Bid]));
+	BOOST_TEST(analytics.total_quantity[Order::Type::Bid] == 0u);
+	BOOST_TEST(std::isnan(analytics.imbalance));
+	BOOST_TEST(std::isnan(analytics.microprice));
+}
+
+BOOST_AUTO_TEST_CASE(AnalyticsFollowPostsFillsAndCancels)
+{
+	OrderBook book;
+	book.post(std::make_unique<Order>(Order::Type::Ask, 101, 3));
+	auto const far_ask = book.post(std::make_unique<Order>(Order::Type::Ask, 102, 1));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 99, 1));
+	book.post(std::make_unique<Order>(Order::Type::Bid, 98, 4));
+	wait_for_merging(book);
+
+	auto analytics = book.get_analytics();
+	BOOST_TEST(analytics.best_price[Order::Type::Ask] == 101);
+	BOOST_TEST(analytics.best_quantity[Order::Type::Ask] == 3u);
+	BOOST_TEST(analytics.best_price[Order::Type::Bid] == 99);
+	BOOST_TEST(analytics.total_quantity[Order::Type::Bid] == 5u);
+	BOOST_TEST(analytics.vwap[Order::Type::Ask] == 101.25);
+	BOOST_TEST(analytics.imbalance == -0.5);
+	BOOST_TEST(analytics.microprice == 99.5);
+	auto const version = analytics.version;
+
+	// Bid исполняется с лучшим Ask, и ни один уровень Bid не меняется.
+	book.execute(std::make_unique<Order>(Order::Type::Bid, 101, 2, Order::TimeInForce::ImmediateOrCancel));
+	book.cancel(far_ask);
+	wait_for_merging(book);
+	analytics = book.get_analytics();
+	BOOST_TEST(analytics.version > version);
+	BOOST_TEST(analytics.best_quantity[Order::Type::Ask] == 1u);
+	BOOST_TEST(analytics.total_quantity[Order::Type::Ask] == 1u);
+	BOOST_TEST(analytics.vwap[Order::Type::Ask] == 101);
+	BOOST_TEST(analytics.imbalance == 0);
+	BOOST_TEST(analytics.microprice == 100);
+	BOOST_TEST(analytics.depth_imbalance == 4. / 6);
+}
+
+BOOST_AUTO_TEST_CASE(AnalyticsMatchRecomputationFromSnapshot)
+{
+	BasicOrderBook<lock_policy::NullLock> book;
+	std::mt19937 random(42);
+	std::vector<order_id_t> ids;
+	for (size_t step = 0; step < 5000; ++step)
+	{
+		auto const type = random() % 2 ? Order::Type::Ask : Order::Type::Bid;
+		auto const price = 95 + 0.5 * (random() % 21);
+		switch (random() % 4)
+		{
+		case 0:
+			if (ids.empty() == false)
+				book.cancel(ids[random() % ids.size()]);
+			break;
+		case 1:
+			book.execute(std::make_unique<Order>(type, price, 1 + random() % 20, Order::TimeInForce::ImmediateOrCancel));
+			break;
+		default:
+			ids.emplace_back(book.post(std::make_unique<Order>(type, price, 1 + random() % 10)));
+		}
+		if (step % 100 == 0)
+			BOOST_TEST_REQUIRE(are_same_analytics(book.get_analytics(), recompute_analytics(book.get_flat_snapshot())));
+	}
+	BOOST_TEST(are_same_analytics(book.get_analytics(), recompute_analytics(book.get_flat_snapshot())));
+}
+
+BOOST_AUTO_TEST_CASE(AnalyticsAreConsistentWhileMerging)
+{
+	OrderBook book;
+	std::atomic<bool> is_posting{ true };
+	boost::scoped_thread<boost::join_if_joinable> poster(boost::thread([&]
+	{
+		// Заявки не пересекаются и все по 1, так что объём лучшего Ask - число заявок по 100.
+		for (size_t i = 0; i < 20000; ++i)
+			book.post(std::make_unique<Order>(i % 2 ? Order::Type::Ask : Order::Type::Bid, i % 2 ? 100. + i % 7 : 99. - i % 7, 1));
+		is_posting = false;
+	}));
+
+	bool is_consistent = true;
+	uint64_t last_version = 0;
+	while (is_posting)
+	{
+		auto const analytics = book.get_analytics();
+		is_consistent &= analytics.version >= last_version;
+		is_consistent &= analytics.best_quantity[Order::Type::Ask] <= analytics.total_quantity[Order::Type::Ask];
+		if (analytics.total_quantity[Order::Type::Ask] != 0)
+			is_consistent &= analytics.best_price[Order::Type::Ask] == 100 && analytics.vwap[Order::Type::Ask] >= 100;
+		last_version = analytics.version;
+	}
+	BOOST_TEST(is_consistent);
+	wait_for_merging(book);
+	BOOST_TEST(are_same_analytics(book.get_analytics(), recompute_analytics(book.get_flat_snapshot())));
+}
+
+BOOST_AUTO_TEST_CASE(AnalyticsIncludeFrozenLevels)
+{
+	OrderBook book;
+	std::vector<order_id_t> near_asks;
+	for (size_t level = 0; level < 10; ++level)
+	{
+		auto const id = book.post(std::make_unique<Order>(Order::Type::Ask, 100. + level, 1 + level));
+		if (level < 2)
+			near_asks.emplace_back(id);
+		book.post(std::make_unique<Order>(Order::Type::Bid, 90. - level, 1 + level));
+	}
+	wait_for_merging(book);
+	auto const hot_analytics = book.get_analytics();
+
+	book.enable_cold_tiering(1, std::chrono::milliseconds(1));
+	auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (book.memory_usage().cold_levels == 0 && std::chrono::steady_clock::now() < deadline)
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+	BOOST_TEST_REQUIRE(book.memory_usage().cold_levels != 0);
+	BOOST_TEST(are_same_analytics(book.get_analytics(), hot_analytics));
+
+	// Без горячих Ask лучший - замороженный уровень 102, пока заморозка его не разморозит.
+	for (auto const &id : near_asks)
+		book.cancel(id);
+	wait_for_merging(book);
+	auto const analytics = book.get_analytics();
+	BOOST_TEST(analytics.best_price[Order::Type::Ask] == 102);
+	BOOST_TEST(analytics.best_quantity[Order::Type::Ask] == 3u);
+	BOOST_TEST(are_same_analytics(analytics, recompute_analytics(book.get_flat_snapshot())));
+}
+
+BOOST_AUTO_TEST_CASE(CancelledLevelsAreNotifiedByMerger)
+{
+	OrderBook book;
+	auto const cancelled = book.post(std::make_unique<Order>(Order::Type::Ask, 101, 3));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 101, 2));
+	wait_for_merging(book);
+
+	std::vector<std::pair<PriceLevelView, boost::thread::id>> changes;
+	book.subscribe_to_level_changes([&changes](PriceLevelView const &level) { changes.emplace_back(level, boost::this_thread::get_id()); });
+	changes.clear();
+	BOOST_TEST(book.cancel(cancelled).is_initialized());
+	wait_for_merging(book);
+
+	// Отменивший поток только помечает уровень, а сообщает о нём и публикует показатели поток сведения.
+	BOOST_TEST_REQUIRE(changes.size() == 1u);
+	BOOST_TEST(changes[0].first.quantity == 2u);
+	BOOST_TEST(changes[0].first.orders_count == 1u);
+	BOOST_TEST((changes[0].second != boost::this_thread::get_id()));
+	BOOST_TEST(book.get_analytics().best_quantity[Order::Type::Ask] == 2u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(TombstoneCancels)
+
+BOOST_AUTO_TEST_CASE(CancelledOrdersAreHiddenUntilCompacted)
+{
+	OrderBook book;
+	std::vector<order_id_t> ids;
+	for (size_t i = 0; i < 1000; ++i)
+		ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Ask, 100 + i % 10, 1)));
+	wait_for_merging(book);
+	auto const nodes_before = book.memory_usage().index_nodes;
+
+	for (size_t i = 0; i < 900; ++i)
+		BOOST_TEST_REQUIRE(book.cancel(ids[i]).is_initialized());
+	BOOST_TEST(book.cancel(ids[0]).is_initialized() == false);
+	BOOST_CHECK_THROW(book.get_data(ids[0]), std::logic_error);
+	BOOST_TEST(book.get_data(ids[900]).GetQuantity() == 1u);
+	BOOST_TEST(book.memory_usage().orders_count == 100u);
+	BOOST_TEST(book.get_flat_snapshot().GetOrders()[Order::Type::Ask].size() == 100u);
+	BOOST_TEST(book.get_snapshot()->GetOrders()[Order::Type::Ask].size() == 100u);
+	size_t levels_quantity = 0;
+	book.visit_snapshot_levels([&levels_quantity](PriceLevelView const &level) { levels_quantity += level.quantity; });
+	BOOST_TEST(levels_quantity == 100u);
+	wait_for_merging(book);
+	BOOST_TEST(book.get_analytics().total_quantity[Order::Type::Ask] == 100u);
+
+	// Узлы удаляет поток сведения в фоне.
+	auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (book.memory_usage().index_nodes == nodes_before && std::chrono::steady_clock::now() < deadline)
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+	BOOST_TEST(book.memory_usage().index_nodes < nodes_before);
+	BOOST_TEST(book.memory_usage().orders_count == 100u);
+}
+
+BOOST_AUTO_TEST_CASE(MatchingSkipsCancelledOrders)
+{
+	OrderBook book;
+	OrderBook replica;
+	book.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+
+	auto const first = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 1));
+	auto const cancelled = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	auto const third = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 1));
+	book.post(std::make_unique<Order>(Order::Type::Ask, 101, 1));
+	wait_for_merging(book);
+	book.cancel(cancelled);
+
+	auto const executed = book.execute(std::make_unique<Order>(Order::Type::Bid, 100, 3, Order::TimeInForce::ImmediateOrCancel));
+	BOOST_TEST(executed.GetQuantity() == 1u);
+	BOOST_CHECK_THROW(book.get_data(first), std::logic_error);
+	BOOST_CHECK_THROW(book.get_data(third), std::logic_error);
+	BOOST_TEST(book.get_analytics().best_price[Order::Type::Ask] == 101);
+	BOOST_TEST(replica.state_checksum() == book.state_checksum());
+	BOOST_TEST(replica.memory_usage().orders_count == 1u);
+
+	// Отменённая заявка не участвует и в аукционе.
+	auto const cancelled_bid = book.post(std::make_unique<Order>(Order::Type::Bid, 102, 10));
+	wait_for_merging(book);
+	book.begin_auction();
+	book.cancel(book.post(std::make_unique<Order>(Order::Type::Bid, 101, 1)));
+	book.cancel(cancelled_bid);
+	BOOST_TEST(book.uncross().is_initialized() == false);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadConfinedBookCompactsWhenPosting)
+{
+	BasicOrderBook<lock_policy::NullLock> book;
+	std::vector<order_id_t> ids;
+	for (size_t i = 0; i < 100; ++i)
+		ids.emplace_back(book.post(std::make_unique<Order>(Order::Type::Bid, 90 + i % 5, 1)));
+	for (auto const &id : ids)
+		book.cancel(id);
+	BOOST_TEST(book.memory_usage().orders_count == 0u);
+	// Каталог уже пуст, а узлы стакана ещё не удалены.
+	auto const nodes_after_cancels = book.memory_usage().index_nodes;
+	BOOST_TEST(nodes_after_cancels >= ids.size() * sizeof(OrderData));
+
+	book.post(std::make_unique<Order>(Order::Type::Bid, 90, 1));
+	BOOST_TEST(book.memory_usage().orders_count == 1u);
+	BOOST_TEST(book.memory_usage().index_nodes < nodes_after_cancels);
+}
+
+BOOST_AUTO_TEST_CASE(CancelDoesNotWaitForBookLock, *boost::unit_test::timeout(10))
+{
+	OrderBook book;
+	auto const resting = book.post(std::make_unique<Order>(Order::Type::Ask, 100, 5));
+	wait_for_merging(book);
+
+	// Подписчик на уровни вызывается под write lock-ом стакана: держим его, пока отмена не завершится.
+	std::atomic<bool> is_armed{ false };
+	boost::promise<void> listener_entered;
+	boost::promise<void> cancel_completed;
+	auto cancel_completed_future = cancel_completed.get_future();
+	bool is_cancelled_under_book_lock = false;
+	book.subscribe_to_level_changes([&](PriceLevelView const &)
+	{
+		if (is_armed.exchange(false) == false)
+			return;
+		listener_entered.set_value();
+		is_cancelled_under_book_lock = cancel_completed_future.wait_for(boost::chrono::seconds(3)) == boost::future_status::ready;
+	});
+	is_armed = true;
+	book.post(std::make_unique<Order>(Order::Type::Ask, 101, 1));
+	listener_entered.get_future().wait();
+
+	BOOST_TEST(book.cancel(resting).is_initialized());
+	cancel_completed.set_value();
+	wait_for_merging(book);
+	BOOST_TEST(is_cancelled_under_book_lock);
+	BOOST_TEST(book.get_analytics().total_quantity[Order::Type::Ask] == 1u);
+}
+
+BOOST_AUTO_TEST_CASE(CancelsRaceWithMatching)
+{
+	OrderBook book;
+	OrderBook replica;
+	book.subscribe_to_replication([&replica](ReplicationEvent const &event) { replica.apply_replication_event(event); });
+
+	std::mutex ids_mutex;
+	std::vector<order_id_t> ids;
+	std::atomic<bool> is_posting{ true };
+	boost::scoped_thread<boost::join_if_joinable> poster(boost::thread([&]
+	{
+		for (size_t i = 0; i < 20000; ++i)
+		{
+			auto const type = i % 2 ? Order::Type::Ask : Order::Type::Bid;
+			auto const id = book.post(std::make_unique<Order>(type, 100 + (i * 7) % 5 - 2, 1 + i % 3));
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			ids.emplace_back(id);
+		}
+		is_posting = false;
+	}));
+
+	std::mt19937 random(7);
+	size_t cancelled_count = 0;
+	while (is_posting)
+	{
+		order_id_t id;
+		{
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			if (ids.empty())
+				continue;
+			id = ids[random() % ids.size()];
+		}
+		if (book.cancel(id))
+			++cancelled_count;
+	}
+	wait_for_merging(book);
+
+	BOOST_TEST(cancelled_count != 0u);
+	BOOST_TEST(replica.state_checksum() == book.state_checksum());
+	size_t snapshot_orders_count = 0;
+	book.visit_snapshot([&snapshot_orders_count](OrderView const &order)
+	{
+		BOOST_TEST(order.quantity != 0u);
+		++snapshot_orders_count;
+	});
+	BOOST_TEST(snapshot_orders_count == book.memory_usage().orders_count);
+	BOOST_TEST(snapshot_orders_count == replica.memory_usage().orders_count);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+BOOST_AUTO_TEST_SUITE(GatewaySessions)
+
+BOOST_AUTO_TEST_CASE(SessionCancelsOnlyItsOwnOrders, *boost::unit_test::timeout(5))
+{
+	using namespace gateway::protocol;
+	using protocol_t = boost::asio::local::stream_protocol;
+
+	auto const socket_path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("OrderBookTests_%%%%-%%%%.sock")).string();
+	protocol_t::endpoint const endpoint(socket_path);
+
+	// Как в шлюзе, стакан разрушается до сервиса, а клиенты - до всего остального.
+	boost::asio::io_service service;
+	OrderBook book;
+	gateway::OrderOwners owners(service, book);
+	gateway::Server<protocol_t> server(service, endpoint, book, owners);
+	boost::thread service_thread([&service] { service.run(); });
+
+	boost::asio::io_service clients_service;
+	protocol_t::socket owner(clients_service);
+	protocol_t::socket stranger(clients_service);
+	owner.connect(endpoint);
+	stranger.connect(endpoint);
+	auto const request = [](protocol_t::socket &client, Request const &request)
+	{
+		boost::asio::write(client, boost::asio::buffer(&request, sizeof(request)));
+		Response response;
+		boost::asio::read(client, boost::asio::buffer(&response, sizeof(response)));
+		return response;
+	};
+
+	auto const accepted = request(owner, make_post(1, Order::Type::Ask, 10, 100));
+	BOOST_TEST((accepted.type == ResponseType::Accepted));
+
+	// Чужую заявку не отменить: она остаётся в стакане за владельцем.
+	auto const rejected = request(stranger, make_cancel(2, accepted.order_id));
+	BOOST_TEST((rejected.type == ResponseType::Rejected));
+	BOOST_TEST(book.get_data(from_pod(accepted.order_id)).GetQuantity() == 100);
+
+	auto const cancelled = request(owner, make_cancel(3, accepted.order_id));
+	BOOST_TEST((cancelled.type == ResponseType::Cancelled));
+	BOOST_TEST(cancelled.quantity == 100);
+	BOOST_TEST(cancelled.client_tag == 3);
+
+	service.stop();
+	service_thread.join();
+	boost::filesystem::remove(socket_path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
+
 #ifdef IS_CI_BUILD
 
 BOOST_AUTO_TEST_SUITE(OrderBookOperationsDuration)